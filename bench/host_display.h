@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Буфер SSD1306 128×64 у пам'яті з методами Adafruit_GFX, які кличе renderMenu().
+// Символ малюється попіксельно в комірку 6×8, як drawChar() класичного шрифту GFX,
+// але замість гліфів — біти коду символу: вартість та сама, вигляд — ні
+class HostDisplay {
+public:
+  static const int WIDTH = 128;
+  static const int HEIGHT = 64;
+
+  int width() const { return WIDTH; }
+  int height() const { return HEIGHT; }
+  const uint8_t *buffer() const { return buf; }
+
+  void clearDisplay() { memset(buf, 0, sizeof(buf)); }
+  void setTextSize(uint8_t s) { size = s ? s : 1; }
+  void setTextColor(uint16_t c) { fg = bg = c; }
+  void setTextColor(uint16_t c, uint16_t b) { fg = c; bg = b; }
+  void setCursor(int16_t x, int16_t y) { cx = x; cy = y; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT) return;
+    uint8_t &byte = buf[x + (y / 8) * WIDTH];
+    if (color) byte |= 1 << (y & 7);
+    else byte &= ~(1 << (y & 7));
+  }
+
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+    int dx = abs(x1 - x0), dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (true) {
+      drawPixel(x0, y0, color);
+      if (x0 == x1 && y0 == y1) break;
+      int e2 = 2 * err;
+      if (e2 >= dy) { err += dy; x0 += sx; }
+      if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+  }
+
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    drawLine(x, y, x + w - 1, y, color);
+    drawLine(x, y + h - 1, x + w - 1, y + h - 1, color);
+    drawLine(x, y, x, y + h - 1, color);
+    drawLine(x + w - 1, y, x + w - 1, y + h - 1, color);
+  }
+
+  size_t print(const char *s) {
+    size_t n = 0;
+    while (*s) n += write(*s++);
+    return n;
+  }
+
+  size_t println(const char *s) { return print(s) + write('\n'); }
+
+  // Як Print::printf() ядра ESP32: форматування в буфер на стеку
+  __attribute__((format(printf, 2, 3)))
+  size_t printf(const char *fmt, ...) {
+    char text[64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    return print(text);
+  }
+
+private:
+  size_t write(char c) {
+    if (c == '\n') {
+      cx = 0;
+      cy += 8 * size;
+      return 1;
+    }
+    if (c == '\r') return 1;
+    if (cx + 6 * size > WIDTH) {
+      cx = 0;
+      cy += 8 * size;
+    }
+    for (int col = 0; col < 6; col++) {
+      uint8_t bits = col < 5 ? (uint8_t)(c * (col + 1)) : 0;
+      for (int row = 0; row < 8; row++) {
+        bool on = (bits >> row) & 1;
+        if (!on && bg == fg) continue;   // прозорий фон, як у GFX
+        uint16_t color = on ? fg : bg;
+        for (int sy = 0; sy < size; sy++) {
+          for (int sx = 0; sx < size; sx++) drawPixel(cx + col * size + sx, cy + row * size + sy, color);
+        }
+      }
+    }
+    cx += 6 * size;
+    return 1;
+  }
+
+  uint8_t buf[WIDTH * HEIGHT / 8];
+  int16_t cx = 0;
+  int16_t cy = 0;
+  uint8_t size = 1;
+  uint16_t fg = 1;
+  uint16_t bg = 1;
+};
@@ -0,0 +1,221 @@
+// Бенчмарки гарячих шляхів прошивки на хості (nanobench), для CI:
+//
+//   pio run -e bench -t exec                      # JSON у bench-native.json
+//   python scripts/bench_compare.py old.json bench-native.json
+//
+// Випадки ганяють той самий код із include/, що й прошивка: серіалізацію стану,
+// команду з WebSocket до виходів MotorBank, меню в буфер SSD1306, крок позиції
+// і блоби NVS. Флеш, I2C і регістри GPIO підмінені пам'яттю
+
+#define ANKERL_NANOBENCH_IMPLEMENTATION
+#include <nanobench.h>
+
+#include <stdio.h>
+#include <string>
+#include <ArduinoJson.h>
+
+#define TIME_SOURCE_US() benchClockUs
+static int64_t benchClockUs = 0;
+
+// Замінники ядра для include/motor_bank.h: регістри GPIO — змінні в пам'яті,
+// критична секція порожня (бенчмарк однопотоковий)
+struct HostGpioReg { uint32_t val; };
+struct HostGpio {
+  uint32_t out_w1ts;
+  uint32_t out_w1tc;
+  HostGpioReg out1_w1ts;
+  HostGpioReg out1_w1tc;
+};
+static volatile HostGpio GPIO;
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define LOW 0
+static void pinMode(uint8_t, uint8_t) {}
+static int digitalRead(uint8_t) { return 1; }
+
+#include "timebase.h"
+#include "motion.h"
+#include "motor_bank.h"
+#include "command.h"
+#include "state_json.h"
+#include "nvs_blob.h"
+#include "menu.h"
+#include "host_display.h"
+
+#define BENCH_STEP_US 4350000
+#define BENCH_OUTPUT "bench-native.json"
+
+// Як axisPins на esp32dev (src/main.cpp)
+constexpr AxisPins benchPins[AXIS_COUNT] = {
+  {14, 15, 2}, {13, 12, 4}, {5, 23, 35}, {27, 26, 34},
+};
+
+// NVS рахує CRC32 даних кожного блобу перед записом (esp_rom_crc32_le);
+// тут — та сама поліноміальна таблиця 0xEDB88320
+static uint32_t nvsCrcTable[256];
+
+static void nvsCrcInit() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    nvsCrcTable[i] = c;
+  }
+}
+
+static uint32_t nvsCrc32(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t*)data;
+  uint32_t crc = 0xffffffffu;
+  while (len--) crc = nvsCrcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+int main(int argc, char **argv) {
+  const char* outputPath = argc > 1 ? argv[1] : BENCH_OUTPUT;
+  ankerl::nanobench::Bench bench;
+  bench.title("stanok hot paths").warmup(100).minEpochIterations(2000).relative(false);
+  nvsCrcInit();
+
+  MotorBank<AXIS_COUNT, benchPins> motors;
+  motors.begin();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    motors[i].real_position = motors[i].target = 100 + i * 17;
+  }
+  motors[1].running = true;
+  motors[1].dir = 1;
+
+  char output[1536];
+  StateView view = {&motors[0], AXIS_COUNT, 0, 240, 1234, 987654321, true, "192.168.1.77",
+                    false, 0, "Idle", "v1.4.0", "v1.3.2"};
+  bench.run("state_json", [&] {
+    JsonDocument doc;
+    view.bseq++;
+    fillStateJson(doc, view);
+    ankerl::nanobench::doNotOptimizeAway(serializeJson(doc, output, sizeof(output)));
+  });
+
+  // Шлях onWsEvent(): розбір і перевірка, черга пакета, а в наступному такті
+  // loop() — applyPendingBatch() до виходів банку одним записом
+  static const char wsMessage[] =
+    "{\"type\":\"set_target\",\"data\":{\"motor\":0,\"target\":120},\"seq\":1,\"sid\":1,\"timestamp\":1700000000000}";
+  CommandLimits limits = {AXIS_COUNT, 0, 240, PRESET_COUNT, 0x05};
+  Command batch[4];
+  bench.run("ws_command", [&] {
+    JsonDocument doc;
+    Command cmd;
+    const char* reason = nullptr;
+    deserializeJson(doc, wsMessage);
+    int count = 0;
+    if (parseCommand(doc["type"], doc["data"], limits, cmd, &reason)) batch[count++] = cmd;
+
+    motors.hold();
+    for (int i = 0; i < count; i++) {
+      Motor &m = motors[batch[i].motor];
+      m.target = batch[i].value;
+      int dir = motorDirTo(m, m.target);
+      if (dir != 0) {
+        motorStart(m, dir, benchClockUs);
+      } else {
+        motorStop(m);
+      }
+      motors.write(batch[i].motor, dir);
+    }
+    motors.release();
+    ankerl::nanobench::doNotOptimizeAway(GPIO.out_w1ts);
+  });
+
+  // Усі 9 рівнів меню по черзі, з вибраним останнім пунктом там, де він довший
+  PresetTable presets;
+  memset(&presets, 0, sizeof(presets));
+  for (int i = 0; i < PRESET_COUNT; i += 2) {
+    presetFill(presets.slots[i], i, nullptr, &motors[0], 0, 240, i & 2);
+  }
+  HostDisplay display;
+  int menuIndex[9] = {3, 1, AXIS_COUNT - 1, 2, 1, 2, 0, 5, 0};
+  int menuLevel = 0;
+  bench.run("menu_render", [&] {
+    MenuView menu = {menuLevel, menuIndex, 1, menuLevel == 4, &motors[0], true, &presets};
+    renderMenu(display, menu);
+    menuLevel = (menuLevel + 1) % 9;
+    ankerl::nanobench::doNotOptimizeAway(display.buffer()[200]);
+  });
+
+  Motor scratch;
+  bench.run("position_step", [&] {
+    TimeUs now = benchClockUs += BENCH_STEP_US;
+    scratch.running = true;
+    scratch.dir = 1;
+    scratch.target = 240;
+    scratch.manual_distance = 0;
+    scratch.last_position_update = now - BENCH_STEP_US;
+    ankerl::nanobench::doNotOptimizeAway(advanceMotorPosition(scratch, now, BENCH_STEP_US));
+  });
+
+  // saveMotorPositions(): ключ і значення на вісь
+  bench.run("nvs_positions", [&] {
+    int sink = 0;
+    for (int i = 0; i < AXIS_COUNT; i++) {
+      char key[10];
+      motorPositionKey(key, sizeof(key), i);
+      sink += key[3] + motors[i].real_position;
+    }
+    ankerl::nanobench::doNotOptimizeAway(sink);
+  });
+
+  // POST /api/config: JSON через схему configFields у MachineConfig, далі блоб у NVS
+  JsonDocument configBody;
+  deserializeJson(configBody, "{\"max_mm\":240,\"ms_per_mm\":4000,\"servo_step_ms\":10,\"hostname\":\"stanok-2\"}");
+  bench.run("nvs_config", [&] {
+    MachineConfig next = configDefaults;
+    const char* error = nullptr;
+    bool ok = configFromJson(configBody.as<JsonObject>(), next, &error);
+    ankerl::nanobench::doNotOptimizeAway(ok ? nvsCrc32(&next, sizeof(next)) : 0);
+  });
+
+  // storePreset(): знімок цілей у слот і вся таблиця одним блобом
+  int presetSlot = 0;
+  bench.run("nvs_presets", [&] {
+    presetFill(presets.slots[presetSlot], presetSlot, "bench", &motors[0], 0, 240, true);
+    presetSlot = (presetSlot + 1) % PRESET_COUNT;
+    ankerl::nanobench::doNotOptimizeAway(nvsCrc32(&presets, sizeof(presets)));
+  });
+
+  // saveWear(): копія таблиці (у прошивці — під wearMux) і блоб
+  WearTable wear;
+  memset(&wear, 0, sizeof(wear));
+  wear.version = WEAR_VERSION;
+  bench.run("nvs_wear", [&] {
+    wear.axes[0].runUs += 10000;
+    WearTable copy = wear;
+    ankerl::nanobench::doNotOptimizeAway(nvsCrc32(&copy, sizeof(copy)));
+  });
+
+  // Формат для scripts/bench_compare.py, у наносекундах
+  JsonDocument result;
+  result["firmware"] = "native";
+  result["target"] = "native";
+  JsonObject cases = result["cases"].to<JsonObject>();
+  for (const ankerl::nanobench::Result &r : bench.results()) {
+    using Measure = ankerl::nanobench::Result::Measure;
+    JsonObject c = cases[r.config().mBenchmarkName].to<JsonObject>();
+    c["minNs"] = r.minimum(Measure::elapsed) * 1e9;
+    c["medianNs"] = r.median(Measure::elapsed) * 1e9;
+    c["maxNs"] = r.maximum(Measure::elapsed) * 1e9;
+    c["errorPercent"] = r.medianAbsolutePercentError(Measure::elapsed) * 100;
+  }
+
+  std::string text;
+  serializeJsonPretty(result, text);
+  FILE* f = fopen(outputPath, "w");
+  if (!f) {
+    fprintf(stderr, "cannot write %s\n", outputPath);
+    return 1;
+  }
+  fprintf(f, "%s\n", text.c_str());
+  fclose(f);
+  printf("results written to %s\n", outputPath);
+  return 0;
+}
@@ -21,6 +21,7 @@ document.addEventListener("DOMContentLoaded", function () {
 
       // Request initial state
       sendCommand("get_ip", {});
+      sendCommand("get_config", {});
     };
 
     websocket.onclose = function (event) {
@@ -53,6 +54,11 @@ document.addEventListener("DOMContentLoaded", function () {
   function updateInterface(data) {
     console.log("Updating admin interface with data:", data);
 
+    if (data.type === "config") {
+      renderConfig(data);
+      return;
+    }
+
     // Update IP address
     if (data.ip) {
       document.getElementById("ip-address").textContent = data.ip;
@@ -69,6 +75,137 @@ document.addEventListener("DOMContentLoaded", function () {
     }
   }
 
+  // Build the config form from the schema sent by the device
+  function renderConfig(data) {
+    const container = document.getElementById("config-fields");
+    container.innerHTML = "";
+
+    data.schema.forEach((field) => {
+      const row = document.createElement("div");
+      row.className = "info-row";
+
+      const label = document.createElement("label");
+      label.className = "info-label";
+      label.textContent = field.name.replace(/_/g, " ");
+
+      const input = document.createElement("input");
+      input.className = "config-input";
+      input.dataset.name = field.name;
+      if (field.type === "int") {
+        input.type = "number";
+        input.min = field.min;
+        input.max = field.max;
+      } else {
+        input.type = field.secret ? "password" : "text";
+        input.maxLength = field.maxLength;
+      }
+      const value = data.values[field.name];
+      input.value = value !== undefined ? value : "";
+      input.dataset.original = input.value;
+      if (field.secret) input.placeholder = "unchanged";
+      input.addEventListener("input", () => {
+        input.classList.toggle("changed", input.value !== input.dataset.original);
+      });
+
+      label.htmlFor = input.id = `config-${field.name}`;
+      row.appendChild(label);
+      row.appendChild(input);
+      container.appendChild(row);
+    });
+
+    if (data.values.github_repo) {
+      document.getElementById("repository").textContent = data.values.github_repo;
+    }
+    document.getElementById("config-restart-note").style.display =
+      data.restartRequired ? "block" : "none";
+  }
+
+  function saveConfig() {
+    const changes = {};
+    document.querySelectorAll(".config-input").forEach((input) => {
+      if (input.value === input.dataset.original) return;
+      changes[input.dataset.name] =
+        input.type === "number" ? parseInt(input.value, 10) : input.value;
+    });
+
+    if (Object.keys(changes).length === 0) {
+      showToast("No changes to save", "warning");
+      return;
+    }
+    // REST, not WebSocket: a rejected field comes back in the response
+    fetch("/api/config", {
+      method: "POST",
+      headers: { "Content-Type": "application/json" },
+      body: JSON.stringify(changes),
+    })
+      .then((response) => response.json())
+      .then((result) => {
+        if (result.accepted) {
+          showToast("Configuration saved", "success");
+        } else {
+          showToast(`Invalid value: ${result.field || result.error}`, "error");
+        }
+      })
+      .catch(() => showToast("Failed to save configuration", "error"));
+  }
+
+  // Usage counters per axis, for planning actuator replacement
+  function loadWear() {
+    fetch("/api/wear")
+      .then((response) => response.json())
+      .then(renderWear)
+      .catch(() => showToast("Failed to load motor usage", "error"));
+  }
+
+  function renderWear(data) {
+    const container = document.getElementById("wear-axes");
+    container.innerHTML = "";
+
+    data.axes.forEach((axis, index) => {
+      const row = document.createElement("div");
+      row.className = "info-row";
+
+      const label = document.createElement("span");
+      label.className = "info-label";
+      label.textContent = `Motor ${index + 1}`;
+
+      const stats = document.createElement("span");
+      stats.className = "info-value wear-stats";
+      stats.textContent =
+        `${(axis.distanceMm / 1000).toFixed(2)} m, ` +
+        `${(axis.runSeconds / 3600).toFixed(1)} h, ` +
+        `${axis.cycles} starts, ${axis.reversals} reversals, ` +
+        `${axis.limitHits} limit hits`;
+
+      const reset = document.createElement("button");
+      reset.className = "btn btn-secondary btn-small";
+      reset.textContent = "Reset";
+      reset.addEventListener("click", () => {
+        showConfirmation(
+          "Reset Motor Usage",
+          `Reset usage counters for motor ${index + 1}? Do this after replacing its actuator.`,
+          resetWear,
+          index
+        );
+      });
+
+      row.appendChild(label);
+      row.appendChild(stats);
+      row.appendChild(reset);
+      container.appendChild(row);
+    });
+  }
+
+  function resetWear(axis) {
+    fetch(`/api/wear?axis=${axis}`, { method: "POST" })
+      .then((response) => {
+        if (!response.ok) throw new Error(response.status);
+        showToast(`Usage counters reset for motor ${axis + 1}`, "success");
+        setTimeout(loadWear, 500);
+      })
+      .catch(() => showToast("Failed to reset usage counters", "error"));
+  }
+
   // Update OTA status
   function updateOTAStatus(data) {
     const updateProgress = document.getElementById("update-progress");
@@ -110,6 +247,11 @@ document.addEventListener("DOMContentLoaded", function () {
       document.getElementById("latest-version").textContent =
         data.latestVersion;
     }
+
+    if (data.currentVersion) {
+      document.getElementById("current-version").textContent =
+        data.currentVersion;
+    }
   }
 
   // Update connection status
@@ -293,6 +435,16 @@ document.addEventListener("DOMContentLoaded", function () {
         );
       });
 
+    // Save configuration button
+    document
+      .getElementById("save-config-button")
+      .addEventListener("click", saveConfig);
+
+    // Refresh motor usage button
+    document
+      .getElementById("refresh-wear-button")
+      .addEventListener("click", loadWear);
+
     // Emergency stop button
     document
       .getElementById("emergency-stop-button")
@@ -344,4 +496,5 @@ document.addEventListener("DOMContentLoaded", function () {
   // Initialize
   initializeEventListeners();
   connectWebSocket();
+  loadWear();
 });
\ No newline at end of file
@@ -26,6 +26,14 @@ document.addEventListener("DOMContentLoaded", function () {
   let lastUpdateTime = Date.now();
   let isSliding = {};
 
+  // Commands carry seq/sid; the ESP32 answers each with an ack.
+  // Unacked commands are resent after a reconnect (the device drops duplicates)
+  const sessionId = Math.floor(Math.random() * 0xfffffffe) + 1;
+  const RESEND_WINDOW = 5000;
+  let commandSeq = 0;
+  let pendingCommands = new Map();
+  let lastRtt = null;
+
   // Initialize sliding state for each motor
   for (let i = 0; i < 4; i++) {
     isSliding[i] = false;
@@ -44,6 +52,8 @@ document.addEventListener("DOMContentLoaded", function () {
       showToast("Connected to ESP32", "success");
       updateConnectionStatus(true);
 
+      resendPendingCommands();
+
       // Request initial state
       sendCommand("get_ip", {});
     };
@@ -67,6 +77,10 @@ document.addEventListener("DOMContentLoaded", function () {
         const data = JSON.parse(event.data);
         console.log("Received data:", data);
         lastUpdateTime = Date.now();
+        if (data.type === "ack") {
+          handleAck(data);
+          return;
+        }
         updateInterface(data);
       } catch (error) {
         console.error("Error parsing JSON:", error, "Raw data:", event.data);
@@ -220,17 +234,98 @@ document.addEventListener("DOMContentLoaded", function () {
         console.log(`Setting servo to ${state ? "ON" : "OFF"}`);
         sendCommand("set_servo", { state: state });
       });
+
+    // Save current targets as preset
+    document
+      .getElementById("preset-save-button")
+      .addEventListener("click", function () {
+        const slot = parseInt(document.getElementById("preset-slot").value);
+        const name = document.getElementById("preset-name").value.trim();
+        console.log(`Saving preset ${slot} "${name}"`);
+        sendCommand("save_preset", { slot: slot, name: name });
+        showToast("Preset saved", "success");
+      });
+  }
+
+  // Render preset list received from ESP32
+  function updatePresets(presets) {
+    const list = document.getElementById("preset-list");
+    const slotSelect = document.getElementById("preset-slot");
+    if (!list || !slotSelect) return;
+
+    const selectedSlot = slotSelect.value;
+    list.innerHTML = "";
+    slotSelect.innerHTML = "";
+
+    presets.forEach((preset) => {
+      const option = document.createElement("option");
+      option.value = preset.slot;
+      option.textContent = preset.used
+        ? `${preset.slot + 1}: ${preset.name}`
+        : `${preset.slot + 1}: <empty>`;
+      slotSelect.appendChild(option);
+
+      if (!preset.used) return;
+
+      const item = document.createElement("div");
+      item.className = "preset-item";
+
+      const info = document.createElement("div");
+      info.className = "preset-info";
+      const name = document.createElement("strong");
+      name.textContent = preset.name;
+      const details = document.createElement("p");
+      details.textContent = `${preset.targets.join(" / ")} mm, servo ${
+        preset.servo ? "ON" : "OFF"
+      }`;
+      info.appendChild(name);
+      info.appendChild(details);
+
+      const recallBtn = document.createElement("button");
+      recallBtn.className = "btn btn-set";
+      recallBtn.innerHTML = '<i class="fas fa-play"></i>';
+      recallBtn.title = "Recall";
+      recallBtn.addEventListener("click", () => {
+        console.log(`Recalling preset ${preset.slot}`);
+        sendCommand("recall_preset", { slot: preset.slot });
+      });
+
+      const deleteBtn = document.createElement("button");
+      deleteBtn.className = "btn btn-delete";
+      deleteBtn.innerHTML = '<i class="fas fa-trash-alt"></i>';
+      deleteBtn.title = "Delete";
+      deleteBtn.addEventListener("click", () => {
+        console.log(`Deleting preset ${preset.slot}`);
+        sendCommand("delete_preset", { slot: preset.slot });
+      });
+
+      item.appendChild(info);
+      item.appendChild(recallBtn);
+      item.appendChild(deleteBtn);
+      list.appendChild(item);
+    });
+
+    if (!list.children.length) {
+      list.innerHTML = '<p class="hint">No presets saved</p>';
+    }
+    if (selectedSlot !== "") {
+      slotSelect.value = selectedSlot;
+    }
   }
 
   // Send command to ESP32
   function sendCommand(type, data) {
+    const command = {
+      type: type,
+      data: data,
+      seq: ++commandSeq,
+      sid: sessionId,
+      timestamp: Date.now(),
+    };
+    pendingCommands.set(command.seq, { command: command, sentAt: performance.now() });
+
     if (websocket && websocket.readyState === WebSocket.OPEN) {
-      const command = {
-        type: type,
-        data: data,
-        timestamp: Date.now(),
-      };
-      websocket.send(JSON.stringify(command));
+      transmitCommand(command);
       console.log("Sent command:", command);
     } else {
       showToast("No connection to ESP32", "warning");
@@ -241,6 +336,44 @@ document.addEventListener("DOMContentLoaded", function () {
     }
   }
 
+  function transmitCommand(command) {
+    if (lastRtt !== null) {
+      command.rtt = lastRtt;
+      lastRtt = null;
+    }
+    websocket.send(JSON.stringify(command));
+    delete command.rtt;
+  }
+
+  // Commands sent while offline or lost in a reconnect; older ones are dropped
+  function resendPendingCommands() {
+    const now = performance.now();
+    pendingCommands.forEach((entry, seq) => {
+      if (now - entry.sentAt > RESEND_WINDOW) {
+        pendingCommands.delete(seq);
+        return;
+      }
+      console.log("Resending command:", entry.command);
+      entry.sentAt = now;
+      transmitCommand(entry.command);
+    });
+  }
+
+  function handleAck(ack) {
+    const entry = pendingCommands.get(ack.seq);
+    if (!entry) return;
+    pendingCommands.delete(ack.seq);
+
+    // Round trip is reported back with the next command for per-client percentiles
+    lastRtt = Math.round((performance.now() - entry.sentAt) * 1000) / 1000;
+    console.log(
+      `Ack ${ack.seq} ${ack.result}: rtt ${lastRtt} ms, device ${(ack.appliedUs - ack.rxUs) / 1000} ms`
+    );
+    if (ack.result === "rejected") {
+      showToast(`Command rejected: ${ack.reason || entry.command.type}`, "error");
+    }
+  }
+
   // Set motor target
   function setMotorTarget(motorId, target) {
     sendCommand("set_target", { motor: motorId, target: target });
@@ -251,10 +384,36 @@ document.addEventListener("DOMContentLoaded", function () {
     sendCommand("calibrate", { motor: motorId });
   }
 
+  // Travel range comes from the device config
+  function applyTravelLimits(minMm, maxMm) {
+    document.querySelectorAll(".target-slider").forEach((slider) => {
+      if (slider.max == maxMm && slider.min == minMm) return;
+      slider.min = minMm;
+      slider.max = maxMm;
+      const values = slider.parentElement.querySelectorAll(".slider-values span");
+      if (values.length === 3) {
+        values[0].textContent = minMm;
+        values[2].textContent = maxMm;
+      }
+    });
+  }
+
   // Update interface with data from ESP32
   function updateInterface(data) {
     console.log("Updating interface with data:", data);
 
+    if (data.type === "presets") {
+      updatePresets(data.presets);
+      return;
+    }
+    if (data.type === "config") {
+      return;
+    }
+
+    if (data.maxMm !== undefined) {
+      applyTravelLimits(data.minMm, data.maxMm);
+    }
+
     // Update IP address
     if (data.ip) {
       const ipDesktop = document.getElementById("ip-address");
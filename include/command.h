@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <ArduinoJson.h>
+
+// ==== Commands ====
+// Рухові команди в компактному вигляді: їх спільно використовують
+// WebSocket і REST, а пакет з /api/batch застосовується в одному такті loop()
+enum CommandOp : uint8_t {
+  CMD_SET_TARGET,
+  CMD_SET_ALL_TARGETS,
+  CMD_CALIBRATE,
+  CMD_CALIBRATE_ALL,
+  CMD_EMERGENCY_STOP,
+  CMD_SET_SERVO,
+  CMD_FULL_FORWARD,
+  CMD_FULL_BACKWARD,
+  CMD_ALL_FULL_FORWARD,
+  CMD_ALL_FULL_BACKWARD,
+  CMD_RECALL_PRESET,
+  CMD_COUNT
+};
+
+// Порядок має збігатися з CommandOp
+const char* const commandNames[CMD_COUNT] = {
+  "set_target", "set_all_targets", "calibrate", "calibrate_all",
+  "emergency_stop", "set_servo", "full_forward", "full_backward",
+  "all_full_forward", "all_full_backward", "recall_preset"
+};
+
+struct Command {
+  uint8_t op;
+  int8_t motor;
+  int16_t value;
+};
+
+// Межі, проти яких перевіряється команда; прошивка бере їх з config і presetTable
+struct CommandLimits {
+  int axes;
+  int minMm;
+  int maxMm;
+  int presetCount;
+  uint32_t presetsUsed;     // біт на зайнятий слот
+};
+
+static inline int commandOpFromName(const char* type) {
+  if (!type) return -1;
+  for (int i = 0; i < CMD_COUNT; i++) {
+    if (strcmp(type, commandNames[i]) == 0) return i;
+  }
+  return -1;
+}
+
+// Перевіряє команду повністю до виконання; при помилці повертає false і причину
+static inline bool parseCommand(const char* type, JsonObject data, const CommandLimits &limits,
+                                Command &cmd, const char** error) {
+  int op = commandOpFromName(type);
+  if (op < 0) {
+    *error = "unknown command";
+    return false;
+  }
+
+  cmd.op = op;
+  cmd.motor = -1;
+  cmd.value = 0;
+
+  switch (op) {
+    case CMD_SET_TARGET:
+    case CMD_CALIBRATE:
+    case CMD_FULL_FORWARD:
+    case CMD_FULL_BACKWARD: {
+      int motor = data["motor"] | -1;
+      if (motor < 0 || motor >= limits.axes) {
+        *error = "invalid motor";
+        return false;
+      }
+      cmd.motor = motor;
+      break;
+    }
+    default:
+      break;
+  }
+
+  switch (op) {
+    case CMD_SET_TARGET:
+    case CMD_SET_ALL_TARGETS: {
+      if (!data["target"].is<int>()) {
+        *error = "missing target";
+        return false;
+      }
+      int target = data["target"];
+      if (target < limits.minMm || target > limits.maxMm) {
+        *error = "target out of range";
+        return false;
+      }
+      cmd.value = target;
+      break;
+    }
+    case CMD_SET_SERVO:
+      if (!data["state"].is<bool>()) {
+        *error = "missing state";
+        return false;
+      }
+      cmd.value = data["state"].as<bool>() ? 1 : 0;
+      break;
+    case CMD_RECALL_PRESET: {
+      int slot = data["slot"] | -1;
+      if (slot < 0 || slot >= limits.presetCount || !(limits.presetsUsed & (1u << slot))) {
+        *error = "preset not found";
+        return false;
+      }
+      cmd.value = slot;
+      break;
+    }
+    default:
+      break;
+  }
+  return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "timebase.h"
+
+// На платі IRAM_ATTR приходить з Arduino.h; поза платою атрибут порожній
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// ==== Encoder ====
+#define ENCODER_STEPS_PER_DETENT 4    // переходів квадратури на одне клацання
+
+// Таблиця переходів квадратури: індекс = (попередній AB << 2) | поточний AB.
+// Неможливі переходи (обидва біти змінились) дають 0 і просто ігноруються.
+static const int8_t QUADRATURE_TABLE[16] = {
+   0, -1,  1,  0,
+   1,  0,  0, -1,
+  -1,  0,  0,  1,
+   0,  1, -1,  0
+};
+
+// Чиста функція декодування — ISR викликає її на кожному фронті,
+// тому записану послідовність AB можна прогнати через неї поза платою
+static inline int8_t IRAM_ATTR quadratureStep(uint8_t &state, uint8_t ab) {
+  int8_t step = QUADRATURE_TABLE[(state << 2) | ab];
+  state = ab;
+  return step;
+}
+
+// Переводить накопичені переходи в повні клацання. Залишок лишається
+// в residual до наступного виклику, тож жоден перехід не губиться.
+static inline int quadratureDetents(int &residual, int32_t steps) {
+  residual += steps;
+  int detents = residual / ENCODER_STEPS_PER_DETENT;
+  residual -= detents * ENCODER_STEPS_PER_DETENT;
+  return detents;
+}
+
+// Прискорення: чим коротший інтервал між клацаннями, тим більший крок
+struct EncoderAccelStep {
+  uint16_t max_interval_ms;
+  uint8_t multiplier;
+};
+
+static const EncoderAccelStep encoderAccel[] = {
+  {30, 5},
+  {80, 2},
+};
+
+static inline int encoderAccelerate(int detents, TimeUs &lastDetent, TimeUs now) {
+  TimeUs interval = now - lastDetent;
+  lastDetent = now;
+
+  int magnitude = abs(detents);
+  // Кілька клацань за одну ітерацію — це вже швидке обертання
+  if (magnitude > 1) interval /= magnitude;
+
+  for (const EncoderAccelStep &a : encoderAccel) {
+    if (interval <= msToUs(a.max_interval_ms)) {
+      return detents * a.multiplier;
+    }
+  }
+  return detents;
+}
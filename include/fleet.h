@@ -0,0 +1,319 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "timebase.h"
+#include "command.h"
+
+// ==== Fleet ====
+// Кілька верстатів однією лінією. Координатор розсилає по UDP multicast
+// маяки свого годинника і команди з моментом виконання за цим годинником;
+// ведені переводять момент у свій час, виконують разом і відповідають ACK
+// із запізненням. Усі пакети йдуть у групу, тож на одному хості можна
+// запустити кілька симуляторів (scripts/fleet_sim.py). Тут — протокол і
+// стан без мережі; сокет, ролі і задачі — у прошивці
+#define FLEET_PORT 4299
+#define FLEET_VERSION 1
+#define FLEET_BEACON_INTERVAL 500     // мс
+#define FLEET_LEAD_TIME 150           // мс між розсилкою команди і її виконанням
+#define FLEET_RESEND_INTERVAL 30      // мс між повторами команди, поки нема всіх ACK
+#define FLEET_RESEND_COUNT 3
+#define FLEET_PEER_TIMEOUT 3000       // мс без звіту — учасник вибув
+#define FLEET_MAX_PEERS 8
+#define FLEET_QUEUE_LENGTH 32
+#define FLEET_OUTBOX 8
+#define FLEET_SEEN 16                 // останні seq, щоб повтори не виконувались двічі
+#define FLEET_SYNC_WINDOW 8
+#define FLEET_DRIFT_INTERVAL 30000    // мс між опорними точками оцінки дрейфу
+
+static const uint8_t fleetGroupIp[4] = {239, 255, 42, 99};
+
+enum FleetKind : uint8_t {
+  FLEET_BEACON = 1,     // лише заголовок: timeUs — годинник координатора
+  FLEET_COMMAND,
+  FLEET_ACK,
+  FLEET_REPORT          // відповідь веденого на маяк: оцінка зсуву і дрейфу
+};
+
+struct __attribute__((packed)) FleetHeader {
+  char magic[4];        // "STFL"
+  uint8_t version;
+  uint8_t kind;
+  uint8_t group;        // лінії в одній мережі не чують одна одну
+  uint8_t reserved;
+  uint32_t unit;        // молодші 32 біти MAC відправника
+  uint32_t seq;
+  int64_t timeUs;       // годинник відправника на момент відправки
+};
+
+struct __attribute__((packed)) FleetCommandPacket {
+  FleetHeader header;
+  int64_t executeAtUs;  // за годинником координатора
+  Command cmd;
+};
+
+struct __attribute__((packed)) FleetAckPacket {
+  FleetHeader header;
+  uint32_t ackSeq;
+  int32_t lateUs;       // наскільки пізніше призначеного моменту виконано
+};
+
+struct __attribute__((packed)) FleetReportPacket {
+  FleetHeader header;
+  int64_t offsetUs;     // годинник координатора мінус власний
+  int32_t driftPpb;
+  int32_t lateUs;       // запізнення останньої команди
+};
+
+struct FleetPeer {
+  uint32_t unit;
+  uint32_t ip;
+  TimeUs lastSeen;
+  int64_t offsetUs;
+  int32_t driftPpb;
+  int32_t lateUs;
+  uint32_t lastAckSeq;
+  uint32_t acks;
+  uint32_t missed;      // команди, на які не прийшов ACK
+};
+
+struct FleetOutgoing {
+  FleetCommandPacket packet;
+  TimeUs nextSendAt;
+  uint8_t sends;        // 0 — слот вільний
+  uint8_t ackMask;      // біти peers, що підтвердили
+};
+
+struct FleetScheduled {
+  TimeUs due;           // за власним годинником
+  uint32_t seq;
+  Command cmd;
+  bool ack;             // ведений підтверджує виконання координатору
+};
+
+// Ведений: координатор, за яким іде, і вибірки зсуву його годинника
+struct FleetSync {
+  uint32_t coordinator;
+  TimeUs coordinatorSeen;
+  int64_t samples[FLEET_SYNC_WINDOW];
+  int count;
+  int index;
+  int64_t offsetUs;
+  int32_t driftPpb;
+  TimeUs driftRefAt;
+  int64_t driftRefOffset;
+};
+
+struct FleetSeen {
+  uint32_t seqs[FLEET_SEEN];
+  int index;
+};
+
+struct FleetQueue {
+  FleetScheduled items[FLEET_QUEUE_LENGTH];
+  int count;
+  uint32_t dropped;
+};
+
+static inline void fleetFillHeader(FleetHeader &h, FleetKind kind, uint8_t group, uint32_t unit,
+                                   uint32_t seq, TimeUs now) {
+  memcpy(h.magic, "STFL", 4);
+  h.version = FLEET_VERSION;
+  h.kind = kind;
+  h.group = group;
+  h.reserved = 0;
+  h.unit = unit;
+  h.seq = seq;
+  h.timeUs = now;
+}
+
+// Лише пакети своєї лінії і не власне відлуння з групи
+static inline bool fleetParseHeader(const uint8_t *data, size_t len, uint8_t group, uint32_t self,
+                                    FleetHeader &h) {
+  if (len < sizeof(FleetHeader)) return false;
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, "STFL", 4) != 0 || h.version != FLEET_VERSION) return false;
+  return h.group == group && h.unit != self;
+}
+
+// Бінарна команда з мережі проходить ті самі межі, що й parseCommand()
+static inline bool fleetCommandValid(const Command &cmd, const CommandLimits &limits) {
+  switch (cmd.op) {
+    case CMD_SET_TARGET:
+      if (cmd.motor < 0 || cmd.motor >= limits.axes) return false;
+      return cmd.value >= limits.minMm && cmd.value <= limits.maxMm;
+    case CMD_CALIBRATE:
+    case CMD_FULL_FORWARD:
+    case CMD_FULL_BACKWARD:
+      return cmd.motor >= 0 && cmd.motor < limits.axes;
+    case CMD_SET_ALL_TARGETS:
+      return cmd.value >= limits.minMm && cmd.value <= limits.maxMm;
+    case CMD_RECALL_PRESET:
+      return cmd.value >= 0 && cmd.value < limits.presetCount;
+    default:
+      return cmd.op < CMD_COUNT;
+  }
+}
+
+// Момент виконання за годинником координатора. Аварійна зупинка — без затримки
+static inline TimeUs fleetDueTime(const Command &cmd, TimeUs now) {
+  return cmd.op == CMD_EMERGENCY_STOP ? now : now + msToUs(FLEET_LEAD_TIME);
+}
+
+// ---- Ведений ----
+static inline void fleetResetSync(FleetSync &s) {
+  s.coordinator = 0;
+  s.count = 0;
+  s.index = 0;
+  s.offsetUs = 0;
+  s.driftPpb = 0;
+  s.driftRefAt = 0;
+}
+
+// Вибірка = годинник координатора мінус час прийому. Затримка мережі лише
+// зменшує її, тож найбільша у вікні найближча до справжнього зсуву
+static inline void fleetSyncSample(FleetSync &s, int64_t sample, TimeUs now) {
+  s.samples[s.index] = sample;
+  s.index = (s.index + 1) % FLEET_SYNC_WINDOW;
+  if (s.count < FLEET_SYNC_WINDOW) s.count++;
+
+  int64_t best = s.samples[0];
+  for (int i = 1; i < s.count; i++) {
+    if (s.samples[i] > best) best = s.samples[i];
+  }
+  s.offsetUs = best;
+
+  if (s.driftRefAt == 0) {
+    s.driftRefAt = now;
+    s.driftRefOffset = best;
+  } else if (intervalElapsed(s.driftRefAt, msToUs(FLEET_DRIFT_INTERVAL), now)) {
+    s.driftPpb = (int32_t)((best - s.driftRefOffset) * 1000000000LL / (now - s.driftRefAt));
+    s.driftRefAt = now;
+    s.driftRefOffset = best;
+  }
+}
+
+// Ведений іде за першим почутим координатором, доки той не замовкне.
+// false — пакет від іншого координатора, його треба відкинути
+static inline bool fleetFollow(FleetSync &s, uint32_t unit, int64_t coordinatorUs, TimeUs now) {
+  if (s.coordinator != unit) {
+    if (s.coordinator != 0 && !intervalElapsed(s.coordinatorSeen, msToUs(FLEET_PEER_TIMEOUT), now)) {
+      return false;
+    }
+    fleetResetSync(s);
+    s.coordinator = unit;
+  }
+  s.coordinatorSeen = now;
+  fleetSyncSample(s, coordinatorUs - now, now);
+  return true;
+}
+
+// Момент за годинником координатора — у власний час
+static inline TimeUs fleetLocalTime(const FleetSync &s, int64_t coordinatorUs) {
+  return coordinatorUs - s.offsetUs;
+}
+
+static inline bool fleetSeenBefore(FleetSeen &seen, uint32_t seq) {
+  for (int i = 0; i < FLEET_SEEN; i++) {
+    if (seen.seqs[i] == seq) return true;
+  }
+  seen.seqs[seen.index] = seq;
+  seen.index = (seen.index + 1) % FLEET_SEEN;
+  return false;
+}
+
+static inline void fleetEnqueue(FleetQueue &q, TimeUs due, uint32_t seq, const Command &cmd, bool ack) {
+  if (q.count >= FLEET_QUEUE_LENGTH) {
+    q.dropped++;
+    return;
+  }
+  FleetScheduled &s = q.items[q.count++];
+  s.due = due;
+  s.seq = seq;
+  s.cmd = cmd;
+  s.ack = ack;
+}
+
+// Забирає в due команди, чий час настав; решта зберігає порядок
+static inline int fleetTakeDue(FleetQueue &q, TimeUs now, FleetScheduled *due) {
+  int dueCount = 0;
+  int kept = 0;
+  for (int i = 0; i < q.count; i++) {
+    if (deadlineReached(q.items[i].due, now)) {
+      due[dueCount++] = q.items[i];
+    } else {
+      q.items[kept++] = q.items[i];
+    }
+  }
+  q.count = kept;
+  return dueCount;
+}
+
+// ---- Координатор ----
+static inline uint8_t fleetAliveMask(const FleetPeer *peers, TimeUs now) {
+  uint8_t mask = 0;
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    if (peers[i].unit != 0 && !intervalElapsed(peers[i].lastSeen, msToUs(FLEET_PEER_TIMEOUT), now)) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+// Слот учасника; новий займає порожній або той, що давно мовчить. -1 — місця нема
+static inline int fleetPeerSlot(FleetPeer *peers, uint32_t unit, TimeUs now) {
+  int spare = -1;
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    if (peers[i].unit == unit) return i;
+    bool stale = peers[i].unit == 0 ||
+                 intervalElapsed(peers[i].lastSeen, msToUs(FLEET_PEER_TIMEOUT), now);
+    if (stale && spare < 0) spare = i;
+  }
+  if (spare >= 0) {
+    memset(&peers[spare], 0, sizeof(FleetPeer));
+    peers[spare].unit = unit;
+  }
+  return spare;
+}
+
+// Звільняє слот; живі учасники без ACK отримують пропуск
+static inline void fleetRetire(FleetOutgoing &o, FleetPeer *peers, TimeUs now) {
+  uint8_t missing = fleetAliveMask(peers, now) & ~o.ackMask;
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    if (missing & (1 << i)) peers[i].missed++;
+  }
+  o.sends = 0;
+}
+
+// Нова команда займає слот за seq; попередню в ньому буде списано
+static inline void fleetPost(FleetOutgoing *outbox, FleetPeer *peers, const FleetCommandPacket &p, TimeUs now) {
+  FleetOutgoing &o = outbox[p.header.seq % FLEET_OUTBOX];
+  if (o.sends > 0) fleetRetire(o, peers, now);
+  o.packet = p;
+  o.sends = 1;
+  o.ackMask = 0;
+  o.nextSendAt = now + msToUs(FLEET_RESEND_INTERVAL);
+}
+
+static inline void fleetMarkAcked(FleetOutgoing *outbox, int slot, uint32_t ackSeq) {
+  for (int i = 0; i < FLEET_OUTBOX; i++) {
+    FleetOutgoing &o = outbox[i];
+    if (o.sends > 0 && o.packet.header.seq == ackSeq) o.ackMask |= 1 << slot;
+  }
+}
+
+// true — пакет треба надіслати ще раз. Поки не всі живі підтвердили, до
+// FLEET_RESEND_COUNT відправок; після моменту виконання плюс тайм-аут слот списується
+static inline bool fleetResendDue(FleetOutgoing &o, FleetPeer *peers, TimeUs now) {
+  if (o.sends == 0) return false;
+  uint8_t alive = fleetAliveMask(peers, now);
+  bool acked = (o.ackMask & alive) == alive;
+  if (deadlineReached(o.packet.executeAtUs + msToUs(FLEET_PEER_TIMEOUT), now)) {
+    fleetRetire(o, peers, now);
+  } else if (!acked && o.sends < FLEET_RESEND_COUNT && deadlineReached(o.nextSendAt, now)) {
+    o.sends++;
+    o.nextSendAt = now + msToUs(FLEET_RESEND_INTERVAL);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <stdint.h>
+#include "motion.h"
+#include "nvs_blob.h"
+
+// ==== Menu ====
+// Меню OLED малюється в буфер дисплея; на екран його передає display.display().
+// Display — Adafruit_SSD1306 у прошивці або полотно з тими самими методами
+// Adafruit_GFX (хостовий бенчмарк, bench/host_display.h)
+#ifndef SSD1306_WHITE
+#define SSD1306_BLACK 0
+#define SSD1306_WHITE 1
+#endif
+
+// Стан, який показує меню; прошивка збирає його з глобальних змінних
+struct MenuView {
+  int level;
+  const int *index;          // вибраний пункт на кожному рівні
+  int selectedMotor;         // -1 — усі осі
+  bool editValue;
+  const Motor *motors;
+  bool servo;
+  const PresetTable *presets;
+};
+
+template <class Display>
+static inline void renderMenu(Display &display, const MenuView &v) {
+  const int w = display.width();
+  const int h = display.height();
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(SSD1306_WHITE);
+
+  // Display header
+  display.drawRect(0, 0, w, 14, SSD1306_WHITE);
+  display.setCursor(4, 4);
+  
+  const char* headers[] = {
+    "MAIN MENU", "MOTOR CONTROL TYPE", "MOTOR SELECT", 
+    "ACTION SELECT", "DISTANCE CONTROL", "CALIBRATION", "SERVO CONTROL",
+    "PRESETS", "JOG"
+  };
+  display.print(headers[v.level]);
+
+  // Display menu items
+  display.setCursor(0, 16);
+
+  switch (v.level) {
+    case 0: {
+      const char* items[] = {"Motor Control", "Calibration", "Servo Control", "Presets"};
+      for (int i = 0; i < 4; i++) {
+        if (i == v.index[0]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+          display.printf("> %s \n", items[i]);
+          display.setTextColor(SSD1306_WHITE);
+        } else {
+          display.printf("  %s \n", items[i]);
+        }
+      }
+      break;
+    }
+      
+    case 1: {
+      const char* items[] = {"All Motors", "Single Motor", "Back"};
+      for (int i = 0; i < 3; i++) {
+        if (i == v.index[1]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+          display.printf("> %s \n", items[i]);
+          display.setTextColor(SSD1306_WHITE);
+        } else {
+          display.printf("  %s \n", items[i]);
+        }
+      }
+      break;
+    }
+      
+    case 2: {
+      // Осі + "Back"; понад 4 осі список прокручується
+      const int visible = 5;
+      int first = v.index[2] - visible + 1;
+      if (first < 0) first = 0;
+      for (int i = first; i < first + visible && i <= AXIS_COUNT; i++) {
+        const char* marker = (i == v.index[2]) ? ">" : " ";
+        if (i == v.index[2]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        }
+        if (i == AXIS_COUNT) {
+          display.printf("%s Back \n", marker);
+        } else {
+          display.printf("%s Motor %d \n", marker, i);
+        }
+        display.setTextColor(SSD1306_WHITE);
+      }
+      break;
+    }
+      
+    case 3: {
+      const char* items[] = {"Distance Control", "Forward", "Backward", "Jog", "Back"};
+      for (int i = 0; i < 5; i++) {
+        if (i == v.index[3]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+          if (i == 1) {
+            display.printf("> Forward [%s] \n", v.motors[v.selectedMotor].fullForward ? "ON" : "OFF");
+          } else if (i == 2) {
+            display.printf("> Backward [%s] \n", v.motors[v.selectedMotor].fullBackward ? "ON" : "OFF");
+          } else {
+            display.printf("> %s \n", items[i]);
+          }
+          display.setTextColor(SSD1306_WHITE);
+        } else {
+          if (i == 1) {
+            display.printf("  Forward [%s] \n", v.motors[v.selectedMotor].fullForward ? "ON" : "OFF");
+          } else if (i == 2) {
+            display.printf("  Backward [%s] \n", v.motors[v.selectedMotor].fullBackward ? "ON" : "OFF");
+          } else {
+            display.printf("  %s \n", items[i]);
+          }
+        }
+      }
+      break;
+    }
+      
+    case 4: {
+      if (v.index[4] == 0 && v.editValue) {
+        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        display.printf("> Target: [%d mm] \n", v.motors[v.selectedMotor].target);
+        display.setTextColor(SSD1306_WHITE);
+      } else if (v.index[4] == 0) {
+        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        display.printf("> Target: %d mm \n", v.motors[v.selectedMotor].target);
+        display.setTextColor(SSD1306_WHITE);
+      } else {
+        display.printf("  Target: %d mm \n", v.motors[v.selectedMotor].target);
+      }
+
+      if (v.index[4] == 1) {
+        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        display.printf("> Current: %d mm \n", v.motors[v.selectedMotor].real_position);
+        display.setTextColor(SSD1306_WHITE);
+      } else {
+        display.printf("  Current: %d mm \n", v.motors[v.selectedMotor].real_position);
+      }
+
+      if (v.index[4] == 2) {
+        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        display.println("> Confirm");
+        display.setTextColor(SSD1306_WHITE);
+      } else {
+        display.println("  Confirm");
+      }
+
+      if (v.index[4] == 3) {
+        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        display.println("> Back");
+        display.setTextColor(SSD1306_WHITE);
+      } else {
+        display.println("  Back");
+      }
+      break;
+    }
+      
+    case 5: {
+      const int visible = 5;
+      int first = v.index[5] - visible + 1;
+      if (first < 0) first = 0;
+      for (int i = first; i < first + visible && i <= AXIS_COUNT; i++) {
+        const char* marker = (i == v.index[5]) ? ">" : " ";
+        if (i == v.index[5]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        }
+        if (i == AXIS_COUNT) {
+          display.printf("%s Back \n", marker);
+        } else {
+          display.printf("%s Cal. Motor %d [%s]\n", marker, i, v.motors[i].calibrating ? "ON" : "OFF");
+        }
+        display.setTextColor(SSD1306_WHITE);
+      }
+      break;
+    }
+      
+    case 6: {
+      const char* items[] = {"Servo ON/OFF", "Back"};
+      for (int i = 0; i < 2; i++) {
+        if (i == v.index[6]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+          if (i == 0) {
+            display.printf("> %s [%s]\n", items[i], v.servo ? "ON" : "OFF");
+          } else {
+            display.printf("> %s \n", items[i]);
+          }
+          display.setTextColor(SSD1306_WHITE);
+        } else {
+          if (i == 0) {
+            display.printf("  %s [%s]\n", items[i], v.servo ? "ON" : "OFF");
+          } else {
+            display.printf("  %s \n", items[i]);
+          }
+        }
+      }
+      break;
+    }
+
+    case 7: {
+      // Слоти + "Back"; на екран вміщується 4 рядки, тому список прокручується
+      const int visible = 4;
+      int first = v.index[7] - visible + 1;
+      if (first < 0) first = 0;
+      for (int i = first; i < first + visible && i <= PRESET_COUNT; i++) {
+        const char* marker = (i == v.index[7]) ? ">" : " ";
+        if (i == v.index[7]) {
+          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+        }
+        if (i == PRESET_COUNT) {
+          display.printf("%s Back \n", marker);
+        } else if (v.presets->slots[i].used) {
+          display.printf("%s %d: %s \n", marker, i + 1, v.presets->slots[i].name);
+        } else {
+          display.printf("%s %d: <empty> \n", marker, i + 1);
+        }
+        display.setTextColor(SSD1306_WHITE);
+      }
+      break;
+    }
+
+    case 8: {
+      int m = (v.selectedMotor == -1) ? 0 : v.selectedMotor;
+      if (v.selectedMotor == -1) {
+        display.println("  Axis: All motors");
+      } else {
+        display.printf("  Axis: Motor %d \n", v.selectedMotor);
+      }
+      display.printf("  Target: %d mm \n", v.motors[m].target);
+      display.printf("  Current: %d mm \n", v.motors[m].real_position);
+      display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
+      display.println("> Press to exit");
+      display.setTextColor(SSD1306_WHITE);
+      break;
+    }
+  }
+
+  // Bottom status bar
+  bool any_running = false;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (v.motors[i].running) {
+      any_running = true;
+      break;
+    }
+  }
+  
+  display.drawLine(0, h-10, w, h-10, SSD1306_WHITE);
+  display.setCursor(4, h-8);
+  display.printf("Status: %s", any_running ? "RUNNING" : "STOPPED");
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdio.h>
+#include "timebase.h"
+
+// Кількість осей задається при збірці (-D AXIS_COUNT=6)
+#ifndef AXIS_COUNT
+#define AXIS_COUNT 4
+#endif
+
+// ==== Motor state ====
+// Позиція осі рахується за часом руху: крок у 1 мм кожні stepUs мікросекунд
+struct Motor {
+  int manual_distance = 0;
+  int real_position = 0;
+  int target = 0;
+  bool running = false;
+  TimeUs move_start_time = 0;
+  TimeUs last_position_update = 0;
+  int dir = 0;
+  bool fullForward = false;
+  bool fullBackward = false;
+  bool calibrating = false;
+};
+
+enum MotorStep : uint8_t {
+  STEP_NONE,
+  STEP_MOVED,
+  STEP_ARRIVED      // ціль досягнута, мотор треба зупинити
+};
+
+// Один крок лічильника позиції; GPIO не чіпає, зупинку робить викликач.
+// stopLeadUs — на скільки раніше зарахувати останній крок до цілі
+static inline MotorStep advanceMotorPosition(Motor &m, TimeUs now, TimeUs stepUs, TimeUs stopLeadUs = 0) {
+  if (!m.running || m.fullForward || m.fullBackward) return STEP_NONE;
+  TimeUs interval = stepUs;
+  if (!m.calibrating && ((m.dir > 0 && m.manual_distance + 1 >= m.target) ||
+                         (m.dir < 0 && m.manual_distance - 1 <= m.target))) {
+    interval -= stopLeadUs;
+  }
+  if (!intervalElapsed(m.last_position_update, interval, now)) return STEP_NONE;
+
+  // Крок від попередньої мітки, а не від поточного часу: затримки loop() не накопичуються
+  m.last_position_update += stepUs;
+
+  if (m.dir > 0) {
+    m.real_position++;
+  } else if (m.dir < 0) {
+    // Не дозволяємо позиції стати від'ємною під час калібрування
+    if (m.real_position > 0) {
+      m.real_position--;
+    }
+  }
+
+  if (m.dir > 0) {
+    m.manual_distance++;
+  } else if (m.dir < 0) {
+    m.manual_distance--;
+  }
+
+  // Перевірка досягнення цілі
+  if (!m.calibrating) {
+    if ((m.dir > 0 && m.manual_distance >= m.target) ||
+        (m.dir < 0 && m.manual_distance <= m.target)) {
+      return STEP_ARRIVED;
+    }
+  }
+  return STEP_MOVED;
+}
+
+// Напрямок до цілі: 1, -1 або 0, якщо вісь уже там
+static inline int motorDirTo(const Motor &m, int target) {
+  if (target > m.real_position) return 1;
+  if (target < m.real_position) return -1;
+  return 0;
+}
+
+// Облік пуску й зупинки осі; виходи перемикає викликач
+static inline void motorStart(Motor &m, int dir, TimeUs now) {
+  m.running = true;
+  m.dir = dir;
+  m.move_start_time = now;
+  m.last_position_update = now;
+}
+
+static inline void motorStop(Motor &m) {
+  m.running = false;
+  m.fullForward = false;
+  m.fullBackward = false;
+  m.calibrating = false;
+}
+
+// Ключ NVS позиції осі ("motors"/"pos<N>")
+static inline void motorPositionKey(char* key, size_t size, int axis) {
+  snprintf(key, size, "pos%d", axis);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "motion.h"
+
+// ==== Motor bank ====
+// Мотори разом із пінами. Маски виходів банку й кожної осі — constexpr-функції
+// від таблиці пінів; write() вибирає маски осі ще до критичної секції, а в ній
+// лише зливає їх у відкладений запис. Зміни кількох осей застосовуються одним
+// записом у GPIO.out_w1ts/out_w1tc.
+// GPIO, portMUX_TYPE, portENTER_CRITICAL і pinMode/digitalRead дає ядро Arduino;
+// хостовий бенчмарк підставляє свої до #include
+struct AxisPins {
+  uint8_t in1;
+  uint8_t in2;
+  uint8_t limit;    // кінцевик, активний LOW
+};
+
+// записом у GPIO.out_w1ts/out_w1tc
+struct GpioWrite {
+  uint32_t set = 0;         // GPIO0..31
+  uint32_t clear = 0;
+  uint32_t setHigh = 0;     // GPIO32 і вище
+  uint32_t clearHigh = 0;
+};
+
+struct AxisMasks {
+  uint32_t in1;
+  uint32_t in2;
+  uint32_t in1High;
+  uint32_t in2High;
+};
+
+template <size_t N, const AxisPins (&Pins)[N]>
+class MotorBank {
+public:
+  Motor &operator[](int i) { return axes[i]; }
+  const Motor &operator[](int i) const { return axes[i]; }
+  static constexpr size_t size() { return N; }
+
+  static constexpr uint32_t lowMask(uint8_t pin) { return pin < 32 ? 1UL << pin : 0; }
+  static constexpr uint32_t highMask(uint8_t pin) { return pin < 32 ? 0 : 1UL << (pin - 32); }
+
+  // Усі виходи банку, для одночасної зупинки
+  static constexpr uint32_t outputMask(size_t i = 0) {
+    return i == N ? 0 : lowMask(Pins[i].in1) | lowMask(Pins[i].in2) | outputMask(i + 1);
+  }
+  static constexpr uint32_t outputMaskHigh(size_t i = 0) {
+    return i == N ? 0 : highMask(Pins[i].in1) | highMask(Pins[i].in2) | outputMaskHigh(i + 1);
+  }
+
+  static constexpr AxisMasks axisMasks(size_t i) {
+    return {lowMask(Pins[i].in1), lowMask(Pins[i].in2),
+            highMask(Pins[i].in1), highMask(Pins[i].in2)};
+  }
+
+  void begin() {
+    for (size_t i = 0; i < N; i++) {
+      pinMode(Pins[i].in1, OUTPUT);
+      pinMode(Pins[i].in2, OUTPUT);
+      pinMode(Pins[i].limit, INPUT_PULLUP);
+    }
+    stopAll();
+  }
+
+  // dir > 0: IN1 = 1, IN2 = 0; dir < 0 — навпаки; 0 — обидва в 0
+  void write(int axis, int dir) {
+    const AxisMasks m = axisMasks(axis);
+    GpioWrite change;
+    change.set = dir > 0 ? m.in1 : dir < 0 ? m.in2 : 0;
+    change.setHigh = dir > 0 ? m.in1High : dir < 0 ? m.in2High : 0;
+    change.clear = (m.in1 | m.in2) & ~change.set;
+    change.clearHigh = (m.in1High | m.in2High) & ~change.setHigh;
+
+    portENTER_CRITICAL(&mux);
+    pending.set = (pending.set & ~change.clear) | change.set;
+    pending.clear = (pending.clear & ~change.set) | change.clear;
+    pending.setHigh = (pending.setHigh & ~change.clearHigh) | change.setHigh;
+    pending.clearHigh = (pending.clearHigh & ~change.setHigh) | change.clearHigh;
+    if (holdDepth == 0) apply();
+    portEXIT_CRITICAL(&mux);
+  }
+
+  // Між hold() і release() зміни накопичуються і виходять одним записом
+  void hold() {
+    portENTER_CRITICAL(&mux);
+    holdDepth++;
+    portEXIT_CRITICAL(&mux);
+  }
+
+  void release() {
+    portENTER_CRITICAL(&mux);
+    if (holdDepth > 0 && --holdDepth == 0) apply();
+    portEXIT_CRITICAL(&mux);
+  }
+
+  void stopAll() {
+    portENTER_CRITICAL(&mux);
+    pending = GpioWrite();
+    if (!simulated) {
+      GPIO.out_w1tc = outputMask();
+      if (outputMaskHigh()) GPIO.out1_w1tc.val = outputMaskHigh();
+    }
+    portEXIT_CRITICAL(&mux);
+  }
+
+  // Симуляція для відтворення сесії: виходи вимкнені й не змінюються,
+  // кінцевики беруться з simulatedLimits
+  void simulate(bool on) {
+    stopAll();
+    simulated = on;
+    simulatedLimits = 0;
+  }
+
+  void setSimulatedLimits(uint8_t mask) { simulatedLimits = mask; }
+
+  bool limitHit(int axis) const {
+    if (simulated) return simulatedLimits & (1 << axis);
+    return digitalRead(Pins[axis].limit) == LOW;
+  }
+
+private:
+  // Спершу гасимо, потім вмикаємо: при реверсі обидва входи не опиняться в 1
+  void apply() {
+    if (simulated) {
+      pending = GpioWrite();
+      return;
+    }
+    if (pending.clear) GPIO.out_w1tc = pending.clear;
+    if (pending.clearHigh) GPIO.out1_w1tc.val = pending.clearHigh;
+    if (pending.set) GPIO.out_w1ts = pending.set;
+    if (pending.setHigh) GPIO.out1_w1ts.val = pending.setHigh;
+    pending = GpioWrite();
+  }
+
+  Motor axes[N];
+  GpioWrite pending;
+  int holdDepth = 0;
+  bool simulated = false;
+  uint8_t simulatedLimits = 0;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ArduinoJson.h>
+#include "motion.h"
+
+// ==== NVS blobs ====
+// Бінарні блоби, які прошивка пише в NVS одним putBytes(): налаштування машини,
+// таблиця пресетів і напрацювання осей. Тут — лише розкладка й кодування;
+// Preferences, черги й м'ютекси лишаються в прошивці
+
+// ==== Machine config ====
+// Нові поля додаються лише в кінець структури з підвищенням CONFIG_VERSION
+#define CONFIG_VERSION 1
+#define CONFIG_TEXT_LEN 32
+#define CONFIG_REPO_LEN 64
+
+struct MachineConfig {
+  uint16_t version;
+  uint16_t size;                // sizeof(MachineConfig) версії, що записала блоб
+  int32_t minMm;
+  int32_t maxMm;
+  int32_t msPerMm;
+  int32_t encoderDebounceMs;    // мінімальний інтервал перемальовування від енкодера
+  int32_t servo1Angle;          // кут увімкненого серво 1
+  int32_t servo2Angle;          // серво 2 віддзеркалений
+  int32_t servoStepMs;          // плавність руху серво, мс на градус
+  int32_t servoPairDelayMs;     // пауза між увімкненням першого й другого серво
+  char hostname[CONFIG_TEXT_LEN];
+  char otaPassword[CONFIG_TEXT_LEN];
+  char githubRepo[CONFIG_REPO_LEN];
+};
+
+const MachineConfig configDefaults = {
+  CONFIG_VERSION, sizeof(MachineConfig),
+  0, 20, 4350,                  // 4.35 секунди на 1 мм
+  40,
+  180, 0, 15, 500,
+  "stanok", "ota123", "YuraKabacho/stanok"
+};
+
+enum ConfigFieldType : uint8_t {
+  CONFIG_INT,
+  CONFIG_TEXT                   // min — найменша довжина
+};
+
+#define CONFIG_APPLY_LIMITS 0x01      // цілі осей обрізаються до нових меж
+#define CONFIG_APPLY_RELEASES 0x02    // інше джерело релізів: кеш перевірки скидається
+#define CONFIG_APPLY_RESTART 0x04     // hostname і пароль OTA діють після перезапуску
+#define CONFIG_SECRET 0x08            // лише запис, GET не віддає
+
+struct ConfigField {
+  const char* name;
+  ConfigFieldType type;
+  uint16_t offset;
+  uint16_t size;
+  int32_t min;
+  int32_t max;
+  uint8_t flags;
+};
+
+#define CONFIG_INT_FIELD(name, member, lo, hi, flags) \
+  {name, CONFIG_INT, offsetof(MachineConfig, member), sizeof(int32_t), lo, hi, flags}
+#define CONFIG_TEXT_FIELD(name, member, minLen, flags) \
+  {name, CONFIG_TEXT, offsetof(MachineConfig, member), sizeof(MachineConfig::member), minLen, 0, flags}
+
+const ConfigField configFields[] = {
+  CONFIG_INT_FIELD("min_mm", minMm, 0, 1000, CONFIG_APPLY_LIMITS),
+  CONFIG_INT_FIELD("max_mm", maxMm, 1, 1000, CONFIG_APPLY_LIMITS),
+  CONFIG_INT_FIELD("ms_per_mm", msPerMm, 50, 60000, 0),
+  CONFIG_INT_FIELD("encoder_debounce_ms", encoderDebounceMs, 0, 1000, 0),
+  CONFIG_INT_FIELD("servo1_angle", servo1Angle, 0, 180, 0),
+  CONFIG_INT_FIELD("servo2_angle", servo2Angle, 0, 180, 0),
+  CONFIG_INT_FIELD("servo_step_ms", servoStepMs, 0, 100, 0),
+  CONFIG_INT_FIELD("servo_pair_delay_ms", servoPairDelayMs, 0, 5000, 0),
+  CONFIG_TEXT_FIELD("hostname", hostname, 1, CONFIG_APPLY_RESTART),
+  CONFIG_TEXT_FIELD("ota_password", otaPassword, 0, CONFIG_APPLY_RESTART | CONFIG_SECRET),
+  CONFIG_TEXT_FIELD("github_repo", githubRepo, 3, CONFIG_APPLY_RELEASES),
+};
+
+const int CONFIG_FIELD_COUNT = sizeof(configFields) / sizeof(configFields[0]);
+
+static inline int32_t* configInt(MachineConfig &c, const ConfigField &f) {
+  return (int32_t*)((uint8_t*)&c + f.offset);
+}
+
+static inline char* configText(MachineConfig &c, const ConfigField &f) {
+  return (char*)&c + f.offset;
+}
+
+static inline const ConfigField* findConfigField(const char* name) {
+  for (const ConfigField &f : configFields) {
+    if (strcmp(f.name, name) == 0) return &f;
+  }
+  return nullptr;
+}
+
+static inline bool configValid(MachineConfig &c, const char** error) {
+  for (const ConfigField &f : configFields) {
+    if (f.type == CONFIG_INT) {
+      int32_t v = *configInt(c, f);
+      if (v < f.min || v > f.max) {
+        *error = f.name;
+        return false;
+      }
+    } else {
+      size_t len = strnlen(configText(c, f), f.size);
+      if (len == f.size || len < (size_t)f.min) {
+        *error = f.name;
+        return false;
+      }
+    }
+  }
+  if (c.minMm >= c.maxMm) {
+    *error = "min_mm";
+    return false;
+  }
+  return true;
+}
+
+// Накладає поля з JSON на out; невідомі поля й значення поза схемою відхиляються
+static inline bool configFromJson(JsonObject in, MachineConfig &out, const char** error) {
+  for (JsonPair kv : in) {
+    const ConfigField* f = findConfigField(kv.key().c_str());
+    if (!f) {
+      *error = "unknown field";
+      return false;
+    }
+    if (f->type == CONFIG_INT) {
+      if (!kv.value().is<int32_t>()) {
+        *error = f->name;
+        return false;
+      }
+      *configInt(out, *f) = kv.value().as<int32_t>();
+    } else {
+      const char* text = kv.value().as<const char*>();
+      if (!text || strlen(text) >= f->size) {
+        *error = f->name;
+        return false;
+      }
+      strncpy(configText(out, *f), text, f->size);
+    }
+  }
+  return configValid(out, error);
+}
+
+// ==== Presets ====
+// Слот = індекс у таблиці, тому пошук пресету — O(1)
+#define PRESET_COUNT 8
+#define PRESET_NAME_LEN 16
+#define PRESET_TABLE_VERSION 1
+
+struct Preset {
+  char name[PRESET_NAME_LEN];
+  int16_t target[AXIS_COUNT];
+  uint8_t servo;
+  uint8_t used;
+};
+
+// Таблиця зберігається в NVS одним бінарним блобом
+struct PresetTable {
+  uint8_t version;
+  Preset slots[PRESET_COUNT];
+};
+
+static_assert(PRESET_COUNT <= 32, "CommandLimits.presetsUsed has one bit per slot");
+
+// Знімок поточних цілей осей і серво; без імені — "Preset N"
+static inline void presetFill(Preset &p, int slot, const char* name, const Motor* motors,
+                              int32_t minMm, int32_t maxMm, bool servo) {
+  memset(&p, 0, sizeof(p));
+  if (name && name[0]) {
+    strncpy(p.name, name, PRESET_NAME_LEN - 1);
+  } else {
+    snprintf(p.name, PRESET_NAME_LEN, "Preset %d", slot + 1);
+  }
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    int32_t target = motors[i].target;
+    p.target[i] = target < minMm ? minMm : target > maxMm ? maxMm : target;
+  }
+  p.servo = servo ? 1 : 0;
+  p.used = 1;
+}
+
+// ==== Wear counters ====
+#define WEAR_VERSION 1
+
+struct AxisWear {
+  uint64_t runUs;            // час під живленням
+  uint32_t distanceMm;       // хід за часом роботи, мм
+  uint32_t cycles;           // пуски (пуск/зупинка)
+  uint32_t reversals;        // зміни напрямку між пусками
+  uint32_t limitHits;        // спрацювання кінцевика при калібруванні
+  int8_t lastDir;
+};
+
+struct WearTable {
+  uint8_t version;
+  AxisWear axes[AXIS_COUNT];
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "timebase.h"
+#include "command.h"
+
+// ==== Session trace ====
+// Кодування і читання подій сліду сесії. Заголовок сліду (стан машини на
+// початку) описує прошивка; тут — лише потік подій після нього:
+// varint dt (мкс від попередньої події) + тип + дані
+#define SESSION_TICK_US 10000          // такт loop() — delay(10)
+
+enum SessionEventType : uint8_t {
+  SESSION_COMMAND = 1,    // op, motor, value — як Command
+  SESSION_ENCODER,        // zigzag-varint клацань
+  SESSION_BUTTON,         // 0 — натиснута (LOW), 1 — відпущена
+  SESSION_LIMITS,         // маска натиснутих кінцевиків
+  SESSION_END             // на кожну вісь int32 real_position, int32 manual_distance
+};
+
+#define SESSION_COMMAND_SIZE 4
+
+static inline size_t sessionPutVarint(uint8_t *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+static inline bool sessionGetVarint(const uint8_t *buf, size_t len, size_t &pos, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64 && pos < len; shift += 7) {
+    uint8_t b = buf[pos++];
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+// Подія цілком; out має вміщати 10 + 1 + len байтів
+static inline size_t sessionPutEvent(uint8_t *out, TimeUs dt, SessionEventType type, const void *data, size_t len) {
+  size_t n = sessionPutVarint(out, (uint64_t)dt);
+  out[n++] = type;
+  memcpy(out + n, data, len);
+  return n + len;
+}
+
+static inline void sessionPackCommand(const Command &cmd, uint8_t *data) {
+  data[0] = cmd.op;
+  data[1] = (uint8_t)cmd.motor;
+  data[2] = (uint8_t)(cmd.value & 0xff);
+  data[3] = (uint8_t)((uint16_t)cmd.value >> 8);
+}
+
+static inline size_t sessionPackDetents(int detents, uint8_t *data) {
+  uint32_t zigzag = ((uint32_t)detents << 1) ^ (uint32_t)(detents >> 31);
+  return sessionPutVarint(data, zigzag);
+}
+
+// Курсор відтворення: час і тип наступної події, її дані починаються з pos
+struct SessionCursor {
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  int axes;                 // розмір даних SESSION_END
+  TimeUs lastEventUs;
+  TimeUs nextEventUs;
+  uint8_t type;
+  bool corrupt;
+};
+
+struct SessionEvent {
+  uint8_t type;
+  Command cmd;
+  int detents;
+  uint8_t level;            // кнопка або маска кінцевиків
+  const uint8_t *end;       // SESSION_END: int32 real_position, int32 manual_distance на вісь
+};
+
+// Читає час і тип наступної події
+static inline bool sessionPeek(SessionCursor &c) {
+  uint64_t dt;
+  if (!sessionGetVarint(c.buf, c.len, c.pos, dt) || c.pos >= c.len) return false;
+  c.nextEventUs = c.lastEventUs + (TimeUs)dt;
+  c.type = c.buf[c.pos++];
+  return true;
+}
+
+static inline bool sessionCursorBegin(SessionCursor &c, const uint8_t *buf, size_t len, size_t pos,
+                                      int axes, TimeUs startUs) {
+  c = SessionCursor();
+  c.buf = buf;
+  c.len = len;
+  c.pos = pos;
+  c.axes = axes;
+  c.lastEventUs = startUs;
+  return sessionPeek(c);
+}
+
+// Такт відтворення: через SESSION_TICK_US після попереднього або в момент події
+static inline TimeUs sessionNextTickUs(const SessionCursor &c, TimeUs lastTickUs) {
+  TimeUs tick = lastTickUs + SESSION_TICK_US;
+  return c.nextEventUs < tick ? c.nextEventUs : tick;
+}
+
+// Бере наступну подію з міткою at. false — таких більше немає або слід
+// пошкоджений (тоді c.corrupt); після SESSION_END курсор далі не читає
+static inline bool sessionTakeEvent(SessionCursor &c, TimeUs at, SessionEvent &e) {
+  if (c.corrupt || c.nextEventUs != at) return false;
+  size_t p = c.pos;
+  uint64_t v;
+  bool ok = false;
+
+  e = SessionEvent();
+  e.type = c.type;
+  switch (c.type) {
+    case SESSION_COMMAND:
+      if (p + SESSION_COMMAND_SIZE > c.len || c.buf[p] >= CMD_COUNT) break;
+      e.cmd.op = c.buf[p];
+      e.cmd.motor = (int8_t)c.buf[p + 1];
+      e.cmd.value = (int16_t)(c.buf[p + 2] | (c.buf[p + 3] << 8));
+      p += SESSION_COMMAND_SIZE;
+      ok = true;
+      break;
+    case SESSION_ENCODER:
+      if (!sessionGetVarint(c.buf, c.len, p, v)) break;
+      e.detents = (int32_t)((uint32_t)(v >> 1) ^ -(uint32_t)(v & 1));
+      ok = true;
+      break;
+    case SESSION_BUTTON:
+    case SESSION_LIMITS:
+      if (p + 1 > c.len) break;
+      e.level = c.buf[p++];
+      ok = true;
+      break;
+    case SESSION_END:
+      if (p + (size_t)c.axes * 8 > c.len) break;
+      e.end = c.buf + p;
+      c.nextEventUs = INT64_MAX;
+      return true;
+  }
+  if (!ok) {
+    c.corrupt = true;
+    return false;
+  }
+  c.pos = p;
+  c.lastEventUs = c.nextEventUs;
+  // Наступна подія читається одразу; обрив сліду — теж пошкодження
+  if (!sessionPeek(c)) c.corrupt = true;
+  return true;
+}
+
+static inline int32_t sessionEndPosition(const SessionEvent &e, int axis) {
+  int32_t position;
+  memcpy(&position, e.end + axis * 8, 4);
+  return position;
+}
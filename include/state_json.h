@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdio.h>
+#include <ArduinoJson.h>
+#include "motion.h"
+
+// ==== State JSON ====
+// Знімок стану для розсилки; прошивка заповнює його з глобальних змінних
+struct StateView {
+  const Motor* motors;
+  int axes;
+  int minMm;
+  int maxMm;
+  uint32_t bseq;
+  TimeUs sentUs;
+  bool servo;
+  const char* ip;
+  bool updateInProgress;
+  int updateProgress;
+  const char* updateStatus;
+  const char* latestVersion;
+  const char* currentVersion;
+};
+
+static inline void fillStateJson(JsonDocument &doc, const StateView &s) {
+  bool anyRunning = false;
+  for (int i = 0; i < s.axes; i++) {
+    const Motor &m = s.motors[i];
+    char motorKey[10];
+    snprintf(motorKey, sizeof(motorKey), "motor%d", i);
+
+    JsonObject motorData = doc[motorKey].to<JsonObject>();
+    motorData["position"] = m.real_position;
+    motorData["target"] = m.target;
+    motorData["running"] = m.running;
+    motorData["calibrating"] = m.calibrating;
+    motorData["fullForward"] = m.fullForward;
+    motorData["fullBackward"] = m.fullBackward;
+    anyRunning = anyRunning || m.running;
+  }
+
+  doc["axisCount"] = s.axes;
+  doc["minMm"] = s.minMm;
+  doc["maxMm"] = s.maxMm;
+  doc["bseq"] = s.bseq;
+  doc["sentUs"] = s.sentUs;
+  doc["servoState"] = s.servo;
+  doc["ip"] = s.ip;
+  doc["updateInProgress"] = s.updateInProgress;
+  doc["updateProgress"] = s.updateProgress;
+  doc["updateStatus"] = s.updateStatus;
+  doc["latestVersion"] = s.latestVersion;
+  doc["currentVersion"] = s.currentVersion;
+  doc["globalStatus"] = anyRunning ? "RUNNING" : "STOPPED";
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// ==== Time ====
+// Єдине джерело часу — 64-бітні мікросекунди від старту (esp_timer).
+// Лічильник не переповнюється за життя плати; дедлайни все одно порівнюються
+// через знакову різницю, тож лишаються коректними при будь-якому зсуві
+// відліку. Для збірки поза платою (test/) джерело підміняється через
+// TIME_SOURCE_US до включення цього файлу
+typedef int64_t TimeUs;
+
+#ifndef TIME_SOURCE_US
+#include <esp_timer.h>
+#define TIME_SOURCE_US() esp_timer_get_time()
+#endif
+
+static inline TimeUs nowUs() { return TIME_SOURCE_US(); }
+static inline TimeUs msToUs(int64_t ms) { return ms * 1000; }
+
+// Мілісекунди для 32-бітних полів записів (журнал, телеметрія, /api/boot)
+static inline uint32_t uptimeMs() { return (uint32_t)(nowUs() / 1000); }
+
+static inline bool deadlineReached(TimeUs deadline, TimeUs now = nowUs()) {
+  return (int64_t)((uint64_t)now - (uint64_t)deadline) >= 0;
+}
+
+static inline bool intervalElapsed(TimeUs since, TimeUs interval, TimeUs now = nowUs()) {
+  return deadlineReached(since + interval, now);
+}
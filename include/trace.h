@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// ==== Trace ====
+// Кільцевий буфер подій begin/end для Chrome Trace (chrome://tracing, Perfetto).
+// Запис без блокувань: атомарний інкремент індексу і 12 байтів у слот.
+// Лічильник тактів, задачу і ядро підставляє прошивка; тут — кільце і експорт
+#define TRACE_CAPACITY 512            // степінь двійки
+#define TRACE_SYNC_INTERVAL 1000      // мітка раз на секунду, щоб розгорнути 32-бітний ccount
+
+enum TraceId : uint8_t {
+  TRACE_START_MOTOR,
+  TRACE_STOP_MOTOR,
+  TRACE_SAVE_POSITIONS,
+  TRACE_DRAW_MENU,
+  TRACE_WS_EVENT,
+  TRACE_SYNC,
+  TRACE_ID_COUNT
+};
+
+static const char* const traceNames[TRACE_ID_COUNT] = {
+  "startMotor", "stopMotor", "saveMotorPositions", "drawMenu", "onWsEvent", "sync"
+};
+
+static const char* const traceCategories[TRACE_ID_COUNT] = {
+  "motion", "motion", "persistence", "display", "network", "trace"
+};
+
+struct TraceEvent {
+  uint32_t cycles;
+  uint32_t task;       // TaskHandle_t як tid
+  uint8_t id;
+  char phase;          // 'B', 'E' або 'i'
+  uint8_t core;
+  uint8_t arg;
+};
+
+static inline void traceStore(TraceEvent *ring, volatile uint32_t &head, uint32_t cycles, uint32_t task,
+                              uint8_t id, char phase, uint8_t core, uint8_t arg) {
+  uint32_t slot = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED) & (TRACE_CAPACITY - 1);
+  TraceEvent &e = ring[slot];
+  e.cycles = cycles;
+  e.task = task;
+  e.id = id;
+  e.phase = phase;
+  e.core = core;
+  e.arg = arg;
+}
+
+// Стан потокової серіалізації для chunked-відповіді: подія за подією,
+// рядок, що не влазить у буфер, дописується в наступному виклику
+struct TraceExport {
+  const TraceEvent *ring;
+  uint32_t next;
+  uint32_t end;
+  uint32_t lastCycles;
+  int64_t cycles;      // час від першої події в тактах
+  uint32_t cpuMhz;
+  bool started;
+  bool opened;
+  bool closed;
+  char line[160];
+  size_t lineLen;
+  size_t linePos;
+};
+
+// Останні TRACE_CAPACITY подій з head записаних
+static inline void traceExportBegin(TraceExport &ex, const TraceEvent *ring, uint32_t head, uint32_t cpuMhz) {
+  memset(&ex, 0, sizeof(ex));
+  ex.ring = ring;
+  ex.end = head;
+  ex.next = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+  ex.cpuMhz = cpuMhz;
+}
+
+// Формує наступний рядок JSON; false — подій більше немає
+static inline bool traceNextLine(TraceExport &ex) {
+  if (!ex.opened) {
+    ex.opened = true;
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line),
+      "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"stanok\"}}");
+    return true;
+  }
+
+  while (ex.next < ex.end) {
+    const TraceEvent &e = ex.ring[ex.next & (TRACE_CAPACITY - 1)];
+    // Знакова різниця: події з різних ядер можуть трохи перемішатися.
+    // Між сусідніми подіями має бути менше 2^31 тактів — звідси мітки TRACE_SYNC
+    if (ex.started) ex.cycles += (int32_t)(e.cycles - ex.lastCycles);
+    ex.started = true;
+    ex.lastCycles = e.cycles;
+    ex.next++;
+    if (e.id == TRACE_SYNC || e.id >= TRACE_ID_COUNT) continue;
+
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line),
+      ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,%s\"args\":{\"core\":%u,\"arg\":%u}}",
+      traceNames[e.id], traceCategories[e.id], e.phase, (double)ex.cycles / ex.cpuMhz,
+      (unsigned)e.task, e.phase == 'i' ? "\"s\":\"t\"," : "", e.core, e.arg);
+    return true;
+  }
+
+  if (!ex.closed) {
+    ex.closed = true;
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line), "\n]}\n");
+    return true;
+  }
+  return false;
+}
+
+static inline size_t traceFill(TraceExport &ex, uint8_t *buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (ex.linePos == ex.lineLen) {
+      ex.linePos = ex.lineLen = 0;
+      if (!traceNextLine(ex)) break;
+    }
+    size_t part = ex.lineLen - ex.linePos;
+    if (part > maxLen - written) part = maxLen - written;
+    memcpy(buffer + written, ex.line + ex.linePos, part);
+    ex.linePos += part;
+    written += part;
+  }
+  return written;
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Порівнює два прогони хостового бенчмарку (pio run -e bench -t exec) між
+# версіями прошивки.
+#
+#   python scripts/bench_compare.py bench-v1.2.0.json bench-v1.3.0.json
+#
+# Порівнює медіани в наносекундах і завершується з кодом 1, якщо якийсь
+# випадок повільніший за поріг (--threshold, у відсотках).
+
+import argparse
+import json
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two native benchmark runs")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed slowdown, %%")
+    args = parser.parse_args()
+
+    with open(args.old) as f:
+        old = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    # Старі прогони з /api/bench на платі рахувалися в тактах
+    for run in (old, new):
+        if run.get("target") != "native":
+            raise SystemExit("not a native benchmark run: %s" % run.get("firmware"))
+
+    key = "medianNs"
+    print("%-16s %12s %12s %8s" % ("case", old.get("firmware") or "old", new.get("firmware") or "new", "change"))
+    regressed = False
+    for name, case in new.get("cases", {}).items():
+        before = old.get("cases", {}).get(name)
+        if not before:
+            print("%-16s %12s %12d %8s" % (name, "-", case[key], "new"))
+            continue
+        change = (case[key] - before[key]) * 100.0 / max(before[key], 1)
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressed = True
+        print("%-16s %12d %12d %+7.1f%%%s" % (name, before[key], case[key], change, flag))
+
+    sys.exit(1 if regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
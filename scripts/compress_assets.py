@@ -0,0 +1,74 @@
+# PlatformIO pre-script: готує образ LittleFS зі стиснених файлів з data/.
+#
+# Кожен файл пакується в <name>.gz (без імені та часу в заголовку, тож
+# вихід детермінований). Посилання на CSS/JS у HTML отримують ?v=<crc32>,
+# щоб прошивка могла віддавати їх з Cache-Control: immutable.
+# Прошивка бере ETag з CRC32 у трейлері gzip.
+
+Import("env")
+
+import gzip
+import os
+import re
+import shutil
+import zlib
+
+SOURCE_DIR = os.path.join(env.subst("$PROJECT_DIR"), "data")
+OUTPUT_DIR = env.subst("$PROJECT_DATA_DIR")
+
+ASSET_REF = re.compile(r'(href|src)="/([\w.-]+\.(?:css|js))"')
+
+
+def crc_of(path):
+    with open(path, "rb") as f:
+        return zlib.crc32(f.read()) & 0xFFFFFFFF
+
+
+def versioned_html(content, versions):
+    def replace(match):
+        name = match.group(2)
+        if name not in versions:
+            return match.group(0)
+        return '%s="/%s?v=%08x"' % (match.group(1), name, versions[name])
+
+    return ASSET_REF.sub(replace, content)
+
+
+def write_gzip(path, data):
+    with open(path, "wb") as raw:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=raw, compresslevel=9, mtime=0) as gz:
+            gz.write(data)
+
+
+def compress_assets():
+    if os.path.abspath(OUTPUT_DIR) == os.path.abspath(SOURCE_DIR):
+        print("compress_assets: data_dir must differ from data/, skipping")
+        return
+
+    if os.path.isdir(OUTPUT_DIR):
+        shutil.rmtree(OUTPUT_DIR)
+    os.makedirs(OUTPUT_DIR)
+
+    names = sorted(
+        n for n in os.listdir(SOURCE_DIR) if os.path.isfile(os.path.join(SOURCE_DIR, n))
+    )
+    versions = {
+        n: crc_of(os.path.join(SOURCE_DIR, n)) for n in names if n.endswith((".css", ".js"))
+    }
+
+    total_in = total_out = 0
+    for name in names:
+        with open(os.path.join(SOURCE_DIR, name), "rb") as f:
+            data = f.read()
+        if name.endswith(".html"):
+            data = versioned_html(data.decode("utf-8"), versions).encode("utf-8")
+
+        target = os.path.join(OUTPUT_DIR, name + ".gz")
+        write_gzip(target, data)
+        total_in += len(data)
+        total_out += os.path.getsize(target)
+
+    print("compress_assets: %d files, %d -> %d bytes" % (len(names), total_in, total_out))
+
+
+compress_assets()
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+# Імітація лінії верстатів для перевірки протоколу fleet без заліза.
+#
+# Ведені з власним зсувом і дрейфом годинника (до реального верстата-
+# координатора або до --coordinator у сусідньому терміналі):
+#
+#   python scripts/fleet_sim.py follow --count 4 --group 0
+#
+# Координатор, що шле маяки і команду set_all_targets кожні 2 с:
+#
+#   python scripts/fleet_sim.py coordinate --group 0 --target 120
+#
+# Ведені друкують, наскільки пізно виконали команду відносно спільного
+# моменту; координатор — ACK і звіти про синхронізацію.
+
+import argparse
+import random
+import socket
+import struct
+import threading
+import time
+
+GROUP_IP = "239.255.42.99"
+PORT = 4299
+VERSION = 1
+MAGIC = b"STFL"
+
+BEACON, COMMAND, ACK, REPORT = 1, 2, 3, 4
+HEADER = struct.Struct("<4sBBBBIIq")
+COMMAND_BODY = struct.Struct("<qBbh")
+ACK_BODY = struct.Struct("<Ii")
+REPORT_BODY = struct.Struct("<qii")
+
+# Порядок має збігатися з CommandOp у include/command.h
+COMMAND_NAMES = [
+    "set_target", "set_all_targets", "calibrate", "calibrate_all",
+    "emergency_stop", "set_servo", "full_forward", "full_backward",
+    "all_full_forward", "all_full_backward", "recall_preset",
+]
+LEAD_TIME_US = 150000
+SYNC_WINDOW = 8
+
+
+def open_socket(interface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", PORT))
+    membership = socket.inet_aton(GROUP_IP) + socket.inet_aton(interface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(interface))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    return sock
+
+
+def header(kind, group, unit, seq, now_us):
+    return HEADER.pack(MAGIC, VERSION, kind, group, 0, unit, seq, now_us)
+
+
+def parse(data, group):
+    if len(data) < HEADER.size:
+        return None
+    magic, version, kind, pkt_group, _, unit, seq, time_us = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or pkt_group != group:
+        return None
+    return kind, unit, seq, time_us, data[HEADER.size:]
+
+
+class Follower:
+    """Ведений з годинником local = real * (1 + drift) + offset."""
+
+    def __init__(self, sock, group, offset_us, drift_ppm, jitter_us):
+        self.sock = sock
+        self.group = group
+        self.unit = random.getrandbits(32) or 1
+        self.seq = random.getrandbits(32)
+        self.start = time.monotonic()
+        self.offset_us = offset_us
+        self.drift = drift_ppm * 1e-6
+        self.jitter_us = jitter_us
+        self.coordinator = 0
+        self.samples = []
+        self.sync_offset = 0
+        self.seen = set()
+        self.queue = []
+        self.last_late = 0
+        self.lock = threading.Lock()
+
+    def now_us(self):
+        real = (time.monotonic() - self.start) * 1e6
+        return int(real * (1 + self.drift) + self.offset_us)
+
+    def send(self, payload):
+        self.sock.sendto(payload, (GROUP_IP, PORT))
+
+    def on_packet(self, data):
+        packet = parse(data, self.group)
+        if not packet:
+            return
+        kind, unit, seq, time_us, body = packet
+        if unit == self.unit or kind not in (BEACON, COMMAND):
+            return
+
+        with self.lock:
+            if self.coordinator != unit:
+                self.coordinator = unit
+                self.samples = []
+            self.samples = (self.samples + [time_us - self.now_us()])[-SYNC_WINDOW:]
+            self.sync_offset = max(self.samples)
+
+            if kind == COMMAND and len(body) >= COMMAND_BODY.size and seq not in self.seen:
+                self.seen.add(seq)
+                execute_at, op, motor, value = COMMAND_BODY.unpack_from(body)
+                self.queue.append((execute_at - self.sync_offset, seq, op, motor, value))
+            elif kind == BEACON:
+                self.send(header(REPORT, self.group, self.unit, seq, self.now_us()) +
+                          REPORT_BODY.pack(self.sync_offset, 0, self.last_late))
+
+    def service(self):
+        with self.lock:
+            now = self.now_us()
+            due = [item for item in self.queue if item[0] <= now]
+            self.queue = [item for item in self.queue if item[0] > now]
+        for at, seq, op, motor, value in due:
+            # Імітуємо затримку loop() верстата
+            time.sleep(random.uniform(0, self.jitter_us) / 1e6)
+            late = self.now_us() - at
+            self.last_late = late
+            name = COMMAND_NAMES[op] if op < len(COMMAND_NAMES) else "op%d" % op
+            print("%08x %s motor=%d value=%d late=%+d us" % (self.unit, name, motor, value, late))
+            self.send(header(ACK, self.group, self.unit, seq, self.now_us()) + ACK_BODY.pack(seq, late))
+
+
+def follow(args):
+    followers = []
+    for _ in range(args.count):
+        sock = open_socket(args.interface)
+        sock.settimeout(0.001)
+        follower = Follower(sock, args.group, random.randint(-5000000, 5000000),
+                            random.uniform(-args.drift, args.drift), args.jitter)
+        print("follower %08x offset %+d us drift %+.1f ppm" %
+              (follower.unit, follower.offset_us, follower.drift * 1e6))
+        followers.append(follower)
+
+    while True:
+        for follower in followers:
+            try:
+                data, _ = follower.sock.recvfrom(512)
+                follower.on_packet(data)
+            except socket.timeout:
+                pass
+            follower.service()
+
+
+def coordinate(args):
+    sock = open_socket(args.interface)
+    sock.settimeout(0.01)
+    unit = random.getrandbits(32) or 1
+    seq = random.getrandbits(32)
+    start = time.monotonic()
+    now_us = lambda: int((time.monotonic() - start) * 1e6)
+    op = COMMAND_NAMES.index(args.command)
+    next_beacon = next_command = 0
+
+    while True:
+        now = now_us()
+        if now >= next_beacon:
+            seq = (seq + 1) & 0xFFFFFFFF
+            sock.sendto(header(BEACON, args.group, unit, seq, now), (GROUP_IP, PORT))
+            next_beacon = now + 500000
+        if now >= next_command:
+            seq = (seq + 1) & 0xFFFFFFFF
+            body = COMMAND_BODY.pack(now + LEAD_TIME_US, op, args.motor, args.target)
+            sock.sendto(header(COMMAND, args.group, unit, seq, now) + body, (GROUP_IP, PORT))
+            print("command seq %d %s at +%d us" % (seq, args.command, LEAD_TIME_US))
+            next_command = now + int(args.period * 1e6)
+
+        try:
+            data, addr = sock.recvfrom(512)
+        except socket.timeout:
+            continue
+        packet = parse(data, args.group)
+        if not packet or packet[1] == unit:
+            continue
+        kind, peer, _, _, body = packet
+        if kind == ACK and len(body) >= ACK_BODY.size:
+            ack_seq, late = ACK_BODY.unpack_from(body)
+            print("ack %08x (%s) seq %d late %+d us" % (peer, addr[0], ack_seq, late))
+        elif kind == REPORT and len(body) >= REPORT_BODY.size:
+            offset, drift, late = REPORT_BODY.unpack_from(body)
+            print("report %08x offset %+d us drift %+d ppb late %+d us" % (peer, offset, drift, late))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate a fleet of stanok units")
+    parser.add_argument("--group", type=int, default=0, help="fleet group id")
+    parser.add_argument("--interface", default="0.0.0.0", help="local interface address for multicast")
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    f = sub.add_parser("follow", help="run simulated followers")
+    f.add_argument("--count", type=int, default=3)
+    f.add_argument("--drift", type=float, default=50.0, help="max clock drift, ppm")
+    f.add_argument("--jitter", type=int, default=2000, help="max execution jitter, us")
+
+    c = sub.add_parser("coordinate", help="run a simulated coordinator")
+    c.add_argument("--command", default="set_all_targets", choices=COMMAND_NAMES)
+    c.add_argument("--motor", type=int, default=-1)
+    c.add_argument("--target", type=int, default=100)
+    c.add_argument("--period", type=float, default=2.0, help="seconds between commands")
+
+    args = parser.parse_args()
+    if args.mode == "follow":
+        follow(args)
+    else:
+        coordinate(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+# Готує асети релізу для OTA з firmware.bin:
+#
+#   firmware.bin               повний образ
+#   firmware.bin.gz            той самий образ у gzip (прошивка розпаковує на льоту)
+#   firmware.bin.sha256        SHA-256 образу; перевіряється для будь-якого з форматів
+#   firmware-from-<tag>.delta  дельта "STDL" від попереднього релізу (у gzip)
+#
+# Кожна дельта одразу перевіряється: її застосовують до бази на хості
+# і порівнюють з новим образом.
+#
+# Для перевірки на хості асети можна віддати локальним HTTP-сервером,
+# що імітує GitHub releases/latest і підтримує Range:
+#
+#   python scripts/make_ota_assets.py .pio/build/esp32dev/firmware.bin -o release \
+#       --tag v1.3.0 --base old/firmware.bin --base-tag v1.2.0 --serve 8000
+#
+# і на пристрої: {"type":"set_update_url","data":{"url":"http://<host>:8000/releases/latest"}}
+
+import argparse
+import gzip
+import hashlib
+import http.server
+import json
+import os
+import shutil
+import struct
+
+FIRMWARE_NAME = "firmware.bin"
+DELTA_MAGIC = b"STDL"
+BLOCK = 32          # мінімальна довжина копії; коротші збіги йдуть вставкою
+
+
+def write_gzip(path, data):
+    with open(path, "wb") as raw:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=raw, compresslevel=9, mtime=0) as gz:
+            gz.write(data)
+
+
+def make_delta(base, target):
+    index = {}
+    for offset in range(0, len(base) - BLOCK + 1, BLOCK):
+        index.setdefault(base[offset:offset + BLOCK], offset)
+
+    ops = []
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            ops.append(b"I" + struct.pack("<I", len(literal)) + bytes(literal))
+            literal.clear()
+
+    pos = 0
+    while pos < len(target):
+        offset = index.get(target[pos:pos + BLOCK]) if pos + BLOCK <= len(target) else None
+        if offset is None:
+            literal.append(target[pos])
+            pos += 1
+            continue
+
+        # Розширюємо збіг назад (за рахунок вставки) і вперед
+        while literal and offset > 0 and base[offset - 1] == literal[-1]:
+            literal.pop()
+            offset -= 1
+            pos -= 1
+        length = 0
+        while pos + length < len(target) and offset + length < len(base):
+            step = min(256, len(target) - pos - length, len(base) - offset - length)
+            if base[offset + length:offset + length + step] == target[pos + length:pos + length + step]:
+                length += step
+            elif base[offset + length] == target[pos + length]:
+                length += 1
+            else:
+                break
+
+        flush_literal()
+        ops.append(b"C" + struct.pack("<II", offset, length))
+        pos += length
+
+    flush_literal()
+    header = DELTA_MAGIC + struct.pack("<I", len(base)) + hashlib.sha256(base).digest()
+    header += struct.pack("<I", len(target))
+    return header + b"".join(ops)
+
+
+def apply_delta(base, delta):
+    if delta[:4] != DELTA_MAGIC:
+        raise ValueError("not a delta")
+    base_size, = struct.unpack_from("<I", delta, 4)
+    if base_size != len(base) or delta[8:40] != hashlib.sha256(base).digest():
+        raise ValueError("delta base mismatch")
+    target_size, = struct.unpack_from("<I", delta, 40)
+
+    out = bytearray()
+    pos = 44
+    while pos < len(delta):
+        op = delta[pos:pos + 1]
+        if op == b"C":
+            offset, length = struct.unpack_from("<II", delta, pos + 1)
+            if offset + length > len(base):
+                raise ValueError("copy out of range")
+            out += base[offset:offset + length]
+            pos += 9
+        elif op == b"I":
+            length, = struct.unpack_from("<I", delta, pos + 1)
+            out += delta[pos + 5:pos + 5 + length]
+            pos += 5 + length
+        else:
+            raise ValueError("bad opcode at %d" % pos)
+
+    if len(out) != target_size:
+        raise ValueError("size mismatch")
+    return bytes(out)
+
+
+def build_assets(args):
+    with open(args.firmware, "rb") as f:
+        image = f.read()
+    if image[:1] != b"\xe9":
+        raise SystemExit("%s is not an ESP32 app image" % args.firmware)
+
+    os.makedirs(args.output, exist_ok=True)
+    shutil.copyfile(args.firmware, os.path.join(args.output, FIRMWARE_NAME))
+    write_gzip(os.path.join(args.output, FIRMWARE_NAME + ".gz"), image)
+    with open(os.path.join(args.output, FIRMWARE_NAME + ".sha256"), "w") as f:
+        f.write("%s  %s\n" % (hashlib.sha256(image).hexdigest(), FIRMWARE_NAME))
+
+    sizes = {"full": len(image), "gzip": os.path.getsize(os.path.join(args.output, FIRMWARE_NAME + ".gz"))}
+
+    for base_path, base_tag in zip(args.base, args.base_tag):
+        with open(base_path, "rb") as f:
+            base = f.read()
+        delta = make_delta(base, image)
+        if apply_delta(base, delta) != image:
+            raise SystemExit("delta from %s does not reproduce the image" % base_tag)
+        name = "firmware-from-%s.delta" % base_tag
+        write_gzip(os.path.join(args.output, name), delta)
+        sizes[name] = os.path.getsize(os.path.join(args.output, name))
+
+    for name, size in sizes.items():
+        print("%-32s %8d bytes" % (name, size))
+
+
+class ReleaseHandler(http.server.SimpleHTTPRequestHandler):
+    """Віддає асети з Range та JSON у форматі GitHub releases/latest."""
+
+    tag = ""
+
+    def do_GET(self):
+        if self.path.rstrip("/") == "/releases/latest":
+            return self.send_release()
+
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            return self.send_error(404)
+        with open(path, "rb") as f:
+            data = f.read()
+
+        start, status = 0, 200
+        requested = self.headers.get("Range", "")
+        if requested.startswith("bytes="):
+            start = int(requested[6:].split("-")[0])
+            status = 206
+        self.send_response(status)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(data) - start))
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(data) - 1, len(data)))
+        self.end_headers()
+        self.wfile.write(data[start:])
+
+    def send_release(self):
+        host = self.headers.get("Host")
+        assets = [
+            {"name": name, "browser_download_url": "http://%s/%s" % (host, name)}
+            for name in sorted(os.listdir(self.directory))
+        ]
+        body = json.dumps({"tag_name": self.tag, "assets": assets}).encode("utf-8")
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("ETag", '"%s"' % hashlib.sha1(body).hexdigest())
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def serve(args):
+    handler = lambda *a, **kw: ReleaseHandler(*a, directory=args.output, **kw)
+    ReleaseHandler.tag = args.tag
+    with http.server.ThreadingHTTPServer(("", args.serve), handler) as httpd:
+        print("Serving %s on port %d, release URL: /releases/latest" % (args.output, args.serve))
+        httpd.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build OTA release assets")
+    parser.add_argument("firmware", help="new firmware.bin")
+    parser.add_argument("-o", "--output", default="release", help="output directory")
+    parser.add_argument("--tag", default="", help="release tag reported by --serve")
+    parser.add_argument("--base", action="append", default=[], help="previous firmware.bin")
+    parser.add_argument("--base-tag", action="append", default=[], help="tag of the matching --base")
+    parser.add_argument("--serve", type=int, metavar="PORT", help="serve assets after building")
+    args = parser.parse_args()
+
+    if len(args.base) != len(args.base_tag):
+        parser.error("every --base needs a --base-tag")
+
+    build_assets(args)
+    if args.serve:
+        serve(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Запис, перегляд і відтворення сесій керування (GET/POST /api/session*).
+#
+#   python scripts/session_tool.py record stanok.local        # старт запису
+#   python scripts/session_tool.py stop stanok.local -o s.bin # стоп і завантаження
+#   python scripts/session_tool.py show s.bin                 # хронологія подій
+#   python scripts/session_tool.py replay stanok.local s.bin --speed 0
+#
+# replay завантажує слід на пристрій, проганяє його з вимкненими виходами
+# (--speed 0 — якнайшвидше) і порівнює підсумкові позиції з записаними.
+# Код виходу 1, якщо відтворення розійшлося із записом.
+
+import argparse
+import json
+import struct
+import sys
+import time
+import urllib.error
+import urllib.request
+
+MAGIC = b"STRC"
+VERSION = 2
+PRESET_COUNT = 8
+PRESET_NAME_LEN = 16
+
+# Порядок має збігатися з CommandOp у src/main.cpp
+COMMAND_NAMES = [
+    "set_target", "set_all_targets", "calibrate", "calibrate_all",
+    "emergency_stop", "set_servo", "full_forward", "full_backward",
+    "all_full_forward", "all_full_backward", "recall_preset",
+]
+COMMAND, ENCODER, BUTTON, LIMITS, END = 1, 2, 3, 4, 5
+
+HEAD = struct.Struct("<4sBBHIqqqqq9hBbBBBB")
+AXIS = struct.Struct("<iiiIbBII")
+AXIS_FLAGS = ["running", "fullForward", "fullBackward", "calibrating"]
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode(data):
+    if len(data) < HEAD.size or data[:4] != MAGIC:
+        raise SystemExit("not a session trace")
+    (magic, version, axes, size, ms_per_mm, start_us, _, _, _, _, *rest) = HEAD.unpack_from(data)
+    if version != VERSION:
+        raise SystemExit("unsupported trace version %d" % version)
+    menu_level, selected_motor = rest[9], rest[10]
+
+    pos = HEAD.size
+    header = {"axes": axes, "msPerMm": ms_per_mm, "menuLevel": menu_level,
+              "selectedMotor": selected_motor, "limits": rest[13], "axisState": []}
+    for i in range(axes):
+        manual, real, target, phase, direction, flags, lead_fwd, lead_back = AXIS.unpack_from(data, pos)
+        pos += AXIS.size
+        header["axisState"].append({
+            "real": real, "manual": manual, "target": target, "dir": direction,
+            "stopLeadUs": [lead_fwd, lead_back],
+            "flags": [name for bit, name in enumerate(AXIS_FLAGS) if flags & (1 << bit)],
+        })
+    # PresetTable: версія, байт вирівнювання, слоти
+    if size != pos + 2 + PRESET_COUNT * (PRESET_NAME_LEN + axes * 2 + 2):
+        raise SystemExit("header size mismatch: trace %d bytes" % size)
+
+    events = []
+    pos = size
+    t = 0
+    while pos < len(data):
+        dt, pos = varint(data, pos)
+        t += dt
+        kind = data[pos]
+        pos += 1
+        if kind == COMMAND:
+            op, motor, value = struct.unpack_from("<Bbh", data, pos)
+            pos += 4
+            name = COMMAND_NAMES[op] if op < len(COMMAND_NAMES) else "op%d" % op
+            events.append((t, "command", "%s motor=%d value=%d" % (name, motor, value)))
+        elif kind == ENCODER:
+            z, pos = varint(data, pos)
+            events.append((t, "encoder", "%+d" % ((z >> 1) ^ -(z & 1))))
+        elif kind == BUTTON:
+            events.append((t, "button", "released" if data[pos] else "pressed"))
+            pos += 1
+        elif kind == LIMITS:
+            events.append((t, "limits", "0b{:0{}b}".format(data[pos], axes)))
+            pos += 1
+        elif kind == END:
+            final = [struct.unpack_from("<ii", data, pos + i * 8) for i in range(axes)]
+            events.append((t, "end", "positions %s" % [real for real, _ in final]))
+            break
+        else:
+            raise SystemExit("corrupt trace at byte %d" % pos)
+    return header, events
+
+
+def show(args):
+    with open(args.file, "rb") as f:
+        header, events = decode(f.read())
+    print("axes %d, %d ms/mm, menu level %d" % (header["axes"], header["msPerMm"], header["menuLevel"]))
+    for i, axis in enumerate(header["axisState"]):
+        print("  axis %d: pos %d target %d stop lead %d/%d us %s" % (
+            i, axis["real"], axis["target"], axis["stopLeadUs"][0], axis["stopLeadUs"][1], " ".join(axis["flags"])))
+    for t, kind, text in events:
+        print("%10.3f s  %-8s %s" % (t / 1e6, kind, text))
+    if not events or events[-1][1] != "end":
+        print("warning: trace has no END record")
+
+
+def api(host, path, method="GET", data=None, timeout=5):
+    request = urllib.request.Request("http://%s%s" % (host, path), data=data, method=method)
+    if data is not None:
+        request.add_header("Content-Type", "application/octet-stream")
+    with urllib.request.urlopen(request, timeout=timeout) as response:
+        return response.read()
+
+
+def status(host):
+    return json.loads(api(host, "/api/session"))
+
+
+def wait_mode(host, mode, timeout):
+    deadline = time.time() + timeout
+    while True:
+        state = status(host)
+        if state["mode"] == mode:
+            return state
+        if time.time() > deadline:
+            raise SystemExit("device still %s" % state["mode"])
+        time.sleep(0.3)
+
+
+def record(args):
+    api(args.host, "/api/session?action=record", "POST", b"")
+    wait_mode(args.host, "recording", 5)
+    print("recording; stop with: session_tool.py stop %s -o FILE" % args.host)
+
+
+def stop(args):
+    api(args.host, "/api/session?action=stop", "POST", b"")
+    state = wait_mode(args.host, "idle", 5)
+    data = api(args.host, "/api/session.bin", timeout=15)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print("saved %d bytes to %s%s" % (len(data), args.output, " (truncated)" if state["truncated"] else ""))
+
+
+def replay(args):
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+        decode(data)
+        try:
+            api(args.host, "/api/session.bin", "POST", data, timeout=15)
+        except urllib.error.HTTPError as e:
+            raise SystemExit("upload rejected: %s" % e.read().decode())
+
+    api(args.host, "/api/session?action=replay&speed=%g" % args.speed, "POST", b"")
+    time.sleep(0.3)
+    state = wait_mode(args.host, "idle", args.timeout)
+    result = state.get("replay")
+    if not result:
+        raise SystemExit("no replay result")
+    print(json.dumps(result, indent=2))
+    if "error" in result:
+        sys.exit(2)
+    sys.exit(0 if result["match"] else 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Record, inspect and replay control sessions")
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    r = sub.add_parser("record", help="start recording on a device")
+    r.add_argument("host")
+
+    s = sub.add_parser("stop", help="stop recording and download the trace")
+    s.add_argument("host")
+    s.add_argument("-o", "--output", default="session.bin")
+
+    v = sub.add_parser("show", help="print a trace as a timeline")
+    v.add_argument("file")
+
+    p = sub.add_parser("replay", help="replay a trace on a device and compare positions")
+    p.add_argument("host")
+    p.add_argument("file", nargs="?", help="trace to upload; default is the one on the device")
+    p.add_argument("--speed", type=float, default=0, help="time scale, 0 = as fast as possible")
+    p.add_argument("--timeout", type=float, default=600.0)
+
+    args = parser.parse_args()
+    {"record": record, "stop": stop, "show": show, "replay": replay}[args.mode](args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Перетворює GET /api/telemetry.bin у CSV.
+#
+#   curl -o telemetry.bin http://stanok.local/api/telemetry.bin
+#   python scripts/telemetry_decode.py telemetry.bin > telemetry.csv
+#
+# Формат: "STTL", версія, кількість осей, u16 розмір блоку; далі блоки
+# з заголовком <u32 seq, u32 startMs, u16 used, u16 intervalMs> і даними.
+# Дані блоку: ключовий кадр (на вісь zigzag-varint позиція + байт прапорців,
+# потім байт серво), далі записи: varint dt у тактах, varint-маска змінених
+# осей (біт <кількість осей> — серво), для кожної зміненої осі zigzag-varint
+# дельта + прапорці.
+
+import struct
+import sys
+
+MODES = ["idle", "target", "full_forward", "full_backward", "calibrating"]
+DIRS = [0, 1, -1, 0]
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode(data):
+    if data[:4] != b"STTL":
+        raise SystemExit("not a telemetry dump")
+    version, axes, _block_size = struct.unpack_from("<BBH", data, 4)
+    if version != 1:
+        raise SystemExit("unsupported version %d" % version)
+
+    pos = 8
+    last_seq = None
+    while pos + 12 <= len(data):
+        seq, start_ms, used, interval = struct.unpack_from("<IIHH", data, pos)
+        pos += 12
+        body = data[pos:pos + used]
+        pos += used
+        if last_seq is not None and seq != last_seq + 1:
+            print("# gap: blocks %d..%d lost" % (last_seq + 1, seq - 1), file=sys.stderr)
+        last_seq = seq
+
+        p = 0
+        position = []
+        flags = []
+        for _ in range(axes):
+            value, p = read_varint(body, p)
+            position.append(unzigzag(value))
+            flags.append(body[p])
+            p += 1
+        servo = body[p]
+        p += 1
+        tick = 0
+        yield start_ms, position, flags, servo
+
+        while p < len(body):
+            dt, p = read_varint(body, p)
+            tick += dt
+            mask, p = read_varint(body, p)
+            for axis in range(axes):
+                if mask & (1 << axis):
+                    delta, p = read_varint(body, p)
+                    position[axis] += unzigzag(delta)
+                    flags[axis] = body[p]
+                    p += 1
+            if mask & (1 << axes):
+                servo = body[p]
+                p += 1
+            yield start_ms + tick * interval, position, flags, servo
+
+
+def main():
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    axes = data[5] if len(data) > 5 else 4
+    columns = ["time_ms"]
+    for axis in range(axes):
+        columns += ["m%d_pos" % axis, "m%d_dir" % axis, "m%d_mode" % axis, "m%d_limit" % axis]
+    print(",".join(columns + ["servo"]))
+
+    for time_ms, position, flags, servo in decode(data):
+        row = [str(time_ms)]
+        for axis, value in enumerate(position):
+            f = flags[axis]
+            row += [str(value), str(DIRS[f & 3]), MODES[(f >> 2) & 7] if (f >> 2) & 7 < len(MODES) else "?",
+                    "1" if f & 0x20 else "0"]
+        print(",".join(row + [str(servo)]))
+
+
+if __name__ == "__main__":
+    main()
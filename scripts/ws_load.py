@@ -0,0 +1,339 @@
+#!/usr/bin/env python3
+# Навантажувальний тест WebSocket: N синтетичних клієнтів на справжньому
+# пристрої, кількість клієнтів зростає ступенями.
+#
+# Працює лише проти прошитої плати в мережі: хостової збірки вебсервера
+# немає, тож ні pio test, ні [env:native] цей шлях не покривають. Порядок:
+#
+#   1. Прошити плату (pio run -t upload, pio run -t uploadfs) і дочекатися,
+#      поки вона з'явиться в мережі: curl http://stanok.local/metrics
+#   2. Закрити вкладки з вебінтерфейсом — вони теж WebSocket-клієнти
+#      і спотворюють розкид розсилок.
+#   3. Запустити ступені і за бажанням зберегти результат:
+#
+#   python scripts/ws_load.py stanok.local --clients 1,2,5,8 --duration 30
+#   python scripts/ws_load.py 192.168.1.50 --clients 8 --rate 5 --json load.json
+#
+#   4. Порівняти рядки між ступенями: ack p99 і fan-out spread мають рости
+#      приблизно лінійно, dropped/missing acks/reconnects — лишатися нулем.
+#      dropped (device) > 0 означає, що черга якогось клієнта була повна;
+#      rejected — команди, які прошивка відхилила (зокрема "queue full",
+#      коли пакет команд для loop() переповнений).
+#
+# З --motion осі справді рухаються: лише на верстаті без заготовки.
+#
+# Кожен клієнт поводиться як вкладка script.js: команди з seq/sid, get_ip
+# кожні 15 с. Для кожного ступеня звіт містить:
+#   - розкид доставки однієї розсилки стану між клієнтами (bseq однаковий);
+#   - затримку команда → ack (p50/p90/p99/max);
+#   - пропущені розсилки (розриви bseq) і розриви з'єднань;
+#   - мінімум вільної купи та приріст лічильників ws_* з /metrics.
+#
+# Без --motion команди не рухають осі: get_ip, get_presets і set_target поза
+# діапазоном (відхиляється після повного розбору). З --motion додаються
+# set_target у межах --span мм від поточної цілі.
+#
+# Лише стандартна бібліотека Python 3.8+.
+
+import argparse
+import asyncio
+import base64
+import json
+import os
+import random
+import re
+import struct
+import time
+import urllib.request
+
+PING_INTERVAL = 15.0
+
+
+class WebSocket:
+    """Мінімальний клієнт RFC 6455: лише текстові кадри, ping/pong і close."""
+
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+
+    @classmethod
+    async def connect(cls, host, port, path="/ws"):
+        reader, writer = await asyncio.open_connection(host, port)
+        key = base64.b64encode(os.urandom(16)).decode()
+        writer.write((
+            "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (path, host, key)
+        ).encode())
+        status = await reader.readline()
+        if b" 101 " not in status:
+            raise ConnectionError("handshake failed: %r" % status)
+        while (await reader.readline()) not in (b"\r\n", b""):
+            pass
+        return cls(reader, writer)
+
+    def _frame(self, opcode, payload):
+        mask = os.urandom(4)
+        header = bytes([0x80 | opcode])
+        n = len(payload)
+        if n < 126:
+            header += bytes([0x80 | n])
+        elif n < 65536:
+            header += bytes([0x80 | 126]) + struct.pack(">H", n)
+        else:
+            header += bytes([0x80 | 127]) + struct.pack(">Q", n)
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        self.writer.write(header + mask + masked)
+
+    async def send(self, text):
+        self._frame(0x1, text.encode())
+        await self.writer.drain()
+
+    async def recv(self):
+        message = b""
+        while True:
+            b0, b1 = await self.reader.readexactly(2)
+            n = b1 & 0x7F
+            if n == 126:
+                n, = struct.unpack(">H", await self.reader.readexactly(2))
+            elif n == 127:
+                n, = struct.unpack(">Q", await self.reader.readexactly(8))
+            payload = await self.reader.readexactly(n)
+            opcode = b0 & 0x0F
+            if opcode == 0x8:
+                raise ConnectionError("closed by server")
+            if opcode == 0x9:
+                self._frame(0xA, payload)
+                continue
+            if opcode in (0x0, 0x1, 0x2):
+                message += payload
+                if b0 & 0x80:
+                    return message.decode("utf-8", "replace")
+
+    def close(self):
+        self.writer.close()
+
+
+def percentiles(samples):
+    if not samples:
+        return [0, 0, 0, 0]
+    s = sorted(samples)
+    pick = lambda p: s[(len(s) - 1) * p // 100]
+    return [pick(50), pick(90), pick(99), s[-1]]
+
+
+class Step:
+    """Зведення одного ступеня навантаження."""
+
+    def __init__(self):
+        self.broadcasts = {}      # bseq -> [час прийому в кожного клієнта]
+        self.ack_ms = []
+        self.rejected = 0
+        self.missing_acks = 0
+        self.gaps = 0
+        self.disconnects = 0
+        self.sent = 0
+
+
+class Client:
+    def __init__(self, index, args, step, stop):
+        self.index = index
+        self.args = args
+        self.step = step
+        self.stop = stop
+        self.sid = random.randint(1, 0xFFFFFFFE)
+        self.seq = 0
+        self.pending = {}
+        self.last_bseq = None
+        self.targets = {}
+        self.axes = 4
+
+    def next_command(self):
+        roll = random.random()
+        if self.args.motion and self.targets and roll < 0.6:
+            motor = random.randrange(self.axes)
+            target = self.targets.get(motor, 0) + random.randint(-self.args.span, self.args.span)
+            return "set_target", {"motor": motor, "target": max(0, target)}
+        if roll < 0.3:
+            return "get_presets", {}
+        if roll < 0.5:
+            return "get_ip", {}
+        # Повний розбір і відмова без руху
+        return "set_target", {"motor": random.randrange(self.axes), "target": -1}
+
+    async def send(self, ws, kind, data):
+        self.seq += 1
+        self.pending[self.seq] = time.perf_counter()
+        self.step.sent += 1
+        await ws.send(json.dumps({"type": kind, "data": data, "seq": self.seq,
+                                  "sid": self.sid, "timestamp": int(time.time() * 1000)}))
+
+    def on_message(self, text, now):
+        try:
+            data = json.loads(text)
+        except ValueError:
+            return
+        if data.get("type") == "ack":
+            sent = self.pending.pop(data.get("seq"), None)
+            if sent is not None:
+                self.step.ack_ms.append((now - sent) * 1000)
+            if data.get("result") == "rejected" and self.args.motion:
+                self.step.rejected += 1
+            return
+        bseq = data.get("bseq")
+        if bseq is None:
+            return
+        self.axes = data.get("axisCount", self.axes)
+        for i in range(self.axes):
+            motor = data.get("motor%d" % i)
+            if motor:
+                self.targets[i] = motor.get("target", 0)
+        self.step.broadcasts.setdefault(bseq, []).append(now)
+        if self.last_bseq is not None and bseq > self.last_bseq + 1:
+            self.step.gaps += bseq - self.last_bseq - 1
+        self.last_bseq = bseq
+
+    async def run(self):
+        while not self.stop.is_set():
+            try:
+                ws = await WebSocket.connect(self.args.host, self.args.port)
+            except (OSError, ConnectionError):
+                self.step.disconnects += 1
+                await asyncio.sleep(1)
+                continue
+            self.last_bseq = None
+            reader = asyncio.ensure_future(self.read(ws))
+            try:
+                await self.send(ws, "get_ip", {})
+                next_ping = time.perf_counter() + PING_INTERVAL
+                while not self.stop.is_set() and not reader.done():
+                    delay = random.expovariate(self.args.rate) if self.args.rate > 0 else PING_INTERVAL
+                    try:
+                        await asyncio.wait_for(self.stop.wait(), timeout=delay)
+                    except asyncio.TimeoutError:
+                        pass
+                    if self.stop.is_set() or reader.done():
+                        break
+                    if time.perf_counter() >= next_ping:
+                        await self.send(ws, "get_ip", {})
+                        next_ping = time.perf_counter() + PING_INTERVAL
+                    elif self.args.rate > 0:
+                        await self.send(ws, *self.next_command())
+            except (OSError, ConnectionError):
+                pass
+            if reader.done() and not self.stop.is_set():
+                self.step.disconnects += 1
+            reader.cancel()
+            ws.close()
+
+        self.step.missing_acks += len(self.pending)
+
+    async def read(self, ws):
+        try:
+            while True:
+                text = await ws.recv()
+                self.on_message(text, time.perf_counter())
+        except (OSError, ConnectionError, asyncio.IncompleteReadError):
+            pass
+
+
+def fetch_metrics(args):
+    try:
+        with urllib.request.urlopen("http://%s:%d/metrics" % (args.host, args.http_port), timeout=3) as r:
+            text = r.read().decode()
+    except OSError:
+        return {}
+    values = {}
+    for line in text.splitlines():
+        m = re.match(r"^(stanok_(?:heap|ws)_\w+) (\S+)$", line)
+        if m:
+            values[m.group(1)] = float(m.group(2))
+    return values
+
+
+async def sample_heap(args, stop, lows):
+    loop = asyncio.get_event_loop()
+    while not stop.is_set():
+        metrics = await loop.run_in_executor(None, fetch_metrics, args)
+        if "stanok_heap_free_bytes" in metrics:
+            lows.append(metrics["stanok_heap_free_bytes"])
+        try:
+            await asyncio.wait_for(stop.wait(), timeout=1.0)
+        except asyncio.TimeoutError:
+            pass
+
+
+async def run_step(args, count):
+    step = Step()
+    stop = asyncio.Event()
+    loop = asyncio.get_event_loop()
+    before = await loop.run_in_executor(None, fetch_metrics, args)
+    heap = []
+
+    clients = [Client(i, args, step, stop) for i in range(count)]
+    tasks = [asyncio.ensure_future(c.run()) for c in clients]
+    tasks.append(asyncio.ensure_future(sample_heap(args, stop, heap)))
+    await asyncio.sleep(args.duration)
+    stop.set()
+    await asyncio.gather(*tasks)
+    after = await loop.run_in_executor(None, fetch_metrics, args)
+
+    spreads = [(max(t) - min(t)) * 1000 for t in step.broadcasts.values() if len(t) == count and count > 1]
+    delta = lambda key: after.get(key, 0) - before.get(key, 0)
+    return {
+        "clients": count,
+        "commands": step.sent,
+        "ackMs": percentiles(step.ack_ms),
+        "missingAcks": step.missing_acks,
+        "broadcasts": len(step.broadcasts),
+        "fanoutSpreadMs": percentiles(spreads),
+        "droppedFrames": step.gaps,
+        "disconnects": step.disconnects,
+        "rejected": step.rejected,
+        "heapFreeMin": min(heap) if heap else None,
+        "heapMinFreeEver": after.get("stanok_heap_min_free_bytes"),
+        "deviceBroadcastsDropped": delta("stanok_ws_broadcasts_dropped_total"),
+        "deviceFramesQueued": delta("stanok_ws_frames_queued_total"),
+    }
+
+
+def print_row(r):
+    fmt = lambda v: "%.1f" % v
+    print("%3d clients  ack p50/p90/p99/max %s ms  fan-out spread p50/p99 %s/%s ms  "
+          "dropped %d (device %d)  missing acks %d  reconnects %d  heap min %s" % (
+              r["clients"], "/".join(fmt(v) for v in r["ackMs"]),
+              fmt(r["fanoutSpreadMs"][0]), fmt(r["fanoutSpreadMs"][2]),
+              r["droppedFrames"], r["deviceBroadcastsDropped"], r["missingAcks"], r["disconnects"],
+              "%d" % r["heapFreeMin"] if r["heapFreeMin"] is not None else "?"))
+
+
+async def main_async(args):
+    results = []
+    for count in args.clients:
+        result = await run_step(args, count)
+        print_row(result)
+        results.append(result)
+        await asyncio.sleep(args.pause)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Multi-client WebSocket load test")
+    parser.add_argument("host", help="device address, e.g. stanok.local")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--http-port", type=int, default=80, help="port serving /metrics")
+    parser.add_argument("--clients", default="1,2,5,8",
+                        type=lambda s: [int(x) for x in s.split(",")], help="client counts per step")
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds per step")
+    parser.add_argument("--pause", type=float, default=3.0, help="seconds between steps")
+    parser.add_argument("--rate", type=float, default=0.5, help="commands per second per client")
+    parser.add_argument("--motion", action="store_true", help="include small set_target moves")
+    parser.add_argument("--span", type=int, default=5, help="max move for --motion, mm")
+    parser.add_argument("--json", help="write results to file")
+    args = parser.parse_args()
+    asyncio.get_event_loop().run_until_complete(main_async(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -11,6 +11,8 @@
 #include <ArduinoOTA.h>
 
 #include <LittleFS.h>
+#include <AsyncUDP.h>
+#include <PubSubClient.h>
 
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
@@ -19,6 +21,107 @@
 // ==== OTA Update Includes ====
 #include <HTTPClient.h>
 #include <Update.h>
+#include <mbedtls/sha256.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#if CONFIG_IDF_TARGET_ESP32S3
+#include <esp32s3/rom/miniz.h>
+#include <esp32s3/rom/crc.h>
+#else
+#include <esp32/rom/miniz.h>
+#include <esp32/rom/crc.h>
+#endif
+
+#include <soc/gpio_struct.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <esp_freertos_hooks.h>
+#include <driver/gpio.h>
+
+#include "timebase.h"
+#include "motion.h"
+#include "motor_bank.h"
+#include "encoder.h"
+#include "command.h"
+#include "nvs_blob.h"
+#include "menu.h"
+#include "state_json.h"
+#include "session_trace.h"
+#include "fleet.h"
+#include "trace.h"
+
+// ==== Fixed-capacity strings ====
+// Рядок із буфером усередині об'єкта: статус OTA, версії та URL живуть
+// у статичній пам'яті й не фрагментують купу. Задовгий вміст обрізається
+template <size_t N>
+class FixedString {
+public:
+  FixedString() { clear(); }
+  FixedString(const char* s) { assign(s); }
+
+  FixedString &operator=(const char* s) { assign(s); return *this; }
+  FixedString &operator=(const String &s) { assign(s.c_str()); return *this; }
+  template <size_t M>
+  FixedString &operator=(const FixedString<M> &s) { assign(s.c_str()); return *this; }
+
+  void clear() {
+    len = 0;
+    cut = false;
+    buf[0] = '\0';
+  }
+
+  void assign(const char* s) {
+    clear();
+    append(s);
+  }
+
+  void append(const char* s) {
+    if (!s) return;
+    size_t n = strlen(s);
+    if (len + n > N) {
+      n = N - len;
+      cut = true;
+    }
+    memcpy(buf + len, s, n);
+    len += n;
+    buf[len] = '\0';
+  }
+
+  __attribute__((format(printf, 2, 3)))
+  void format(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, N + 1, fmt, args);
+    va_end(args);
+    len = n < 0 ? 0 : min((size_t)n, N);
+    cut = n > (int)N;
+    buf[len] = '\0';
+  }
+
+  const char* c_str() const { return buf; }
+  size_t length() const { return len; }
+  bool isEmpty() const { return len == 0; }
+  bool truncated() const { return cut; }
+  static constexpr size_t capacity() { return N; }
+
+  bool operator==(const char* s) const { return strcmp(buf, s ? s : "") == 0; }
+  template <size_t M>
+  bool operator==(const FixedString<M> &s) const { return strcmp(buf, s.c_str()) == 0; }
+
+private:
+  char buf[N + 1];
+  size_t len;
+  bool cut;
+};
+
+// ==== Time ====
+// nowUs(), дедлайни та інтервали — у include/timebase.h.
+// Годинник керування (енкодер, меню, рух). Під час відтворення сесії він
+// віртуальний, а мережа й задачі далі живуть за nowUs()
+bool controlClockVirtual = false;
+TimeUs controlClockUs = 0;
+
+static inline TimeUs controlNowUs() { return controlClockVirtual ? controlClockUs : nowUs(); }
 
 // ==== OLED ====
 #define SCREEN_WIDTH 128
@@ -26,30 +129,115 @@
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
 
 // ==== Pin Definitions ====
+// Кількість осей задається при збірці (-D AXIS_COUNT=6, типово 4 — include/motion.h).
+// На esp32dev вільних GPIO вистачає лише на 4 осі; 6 і 8 — на ESP32-S3-DevKitC-1
+// без octal PSRAM ([env:esp32s3-6axis], [env:esp32s3-8axis]), де GPIO35..37 вільні
+
+#if AXIS_COUNT == 4 && CONFIG_IDF_TARGET_ESP32
 const int encoderPins[] = {25, 33, 32}; // CLK, DT, SW
-const int motorPins[4][2] = {
-  {14, 15}, // M1: IN1, IN2
-  {13, 12}, // M2: IN1, IN2
-  {5, 23},  // M3: IN1, IN2
-  {27, 26}  // M4: IN1, IN2
-};
-const int limitPins[] = {2, 4, 35, 34};
 const int servoPins[] = {18, 19};
+const int i2cPins[] = {21, 22};         // SDA, SCL
+
+constexpr AxisPins axisPins[AXIS_COUNT] = {
+  {14, 15, 2},   // M1: IN1, IN2, кінцевик
+  {13, 12, 4},   // M2
+  {5, 23, 35},   // M3
+  {27, 26, 34},  // M4
+};
+#elif (AXIS_COUNT == 6 || AXIS_COUNT == 8) && CONFIG_IDF_TARGET_ESP32S3
+// Спільна розводка: 6-осьова плата — це 8-осьова без M7 і M8.
+// GPIO19/20 (USB) вільні, бо консоль іде через UART-міст; GPIO3 — лише вхід кінцевика
+const int encoderPins[] = {4, 5, 6};    // CLK, DT, SW
+const int servoPins[] = {7, 15};
+const int i2cPins[] = {8, 9};           // SDA, SCL
+
+constexpr AxisPins axisPins[AXIS_COUNT] = {
+  {10, 11, 1},   // M1: IN1, IN2, кінцевик
+  {12, 13, 2},   // M2
+  {14, 16, 35},  // M3
+  {17, 18, 36},  // M4
+  {21, 38, 37},  // M5
+  {39, 40, 19},  // M6
+#if AXIS_COUNT == 8
+  {41, 42, 20},  // M7
+  {47, 48, 3},   // M8
+#endif
+};
+#else
+#error "No axis pin table for this AXIS_COUNT on this target"
+#endif
+static_assert(AXIS_COUNT >= 1 && AXIS_COUNT <= 8, "menus and telemetry records are sized for up to 8 axes");
 
 // ==== Parameters ====
-const int max_mm = 20;
-const int min_mm = 0;
-const int ms_per_mm = 4.35 * 1000; // 4.35 секунди на 20 мм
-#define ENCODER_DEBOUNCE 40
+#define BUTTON_DEBOUNCE 300           // мс між натисканнями кнопки енкодера
+#define POSITION_SAVE_INTERVAL 5000   // мс між збереженнями позицій під час руху
+
+// ==== Machine config ====
+// Налаштування машини — один бінарний блоб у NVS ("config"/"blob"); розкладка
+// і схема configFields — у include/nvs_blob.h. Гарячий шлях читає поля config
+// напряму; зміни з HTTP і WebSocket перевіряються за схемою і застосовуються
+// в loop() без перезапуску
+#define CONFIG_MAX_BODY 1024
+
+MachineConfig config = configDefaults;
+
+// Зміни з задач вебсервера чекають тут на configService() у loop()
+MachineConfig configPending;
+volatile bool configPendingValid = false;
+bool configRestartRequired = false;
+portMUX_TYPE configMux = portMUX_INITIALIZER_UNLOCKED;
 
 // ==== OTA Update Settings ====
-const char* GITHUB_REPO = "YuraKabacho/stanok";
 const char* FIRMWARE_FILENAME = "firmware.bin";
+const char* FIRMWARE_DIGEST_SUFFIX = ".sha256";   // асет з SHA-256 прошивки: firmware.bin.sha256
+const char* FIRMWARE_GZIP_SUFFIX = ".gz";         // стиснений образ: firmware.bin.gz
+const char* FIRMWARE_DELTA_PREFIX = "firmware-from-";  // дельта від релізу: firmware-from-<tag>.delta
+const char* FIRMWARE_DELTA_SUFFIX = ".delta";
+// Тег релізу цієї збірки (-D FIRMWARE_VERSION=\"v1.2.3\"); без нього
+// береться тег, встановлений останнім OTA
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION ""
+#endif
+#define OTA_CHUNK_SIZE 4096
+#define OTA_BUFFER_COUNT 2
+#define OTA_MAX_RETRIES 5
+#define OTA_HTTP_TIMEOUT 5000
+#define OTA_PROGRESS_STEP 5             // розсилати прогрес не частіше ніж кожні 5%...
+#define OTA_PROGRESS_INTERVAL 1000      // ...або раз на секунду
+#define OTA_COPY_CHUNK 512              // блок читання поточного розділу для дельти
+#define OTA_URL_LEN 255
+#define OTA_STATUS_LEN 63
+#define OTA_VERSION_LEN 31
+#define OTA_ETAG_LEN 95
+#define OTA_DIGEST_LEN 64               // SHA-256 у hex
 bool updateInProgress = false;
 int updateProgress = 0;
-String updateStatus = "";
-unsigned long lastUpdateCheck = 0;
-String latestVersion = "";
+FixedString<OTA_STATUS_LEN> updateStatus;
+TimeUs lastUpdateCheck = 0;
+FixedString<OTA_VERSION_LEN> latestVersion;
+FixedString<OTA_VERSION_LEN> runningVersion;
+
+// Перевірка оновлень працює у власній задачі; відповідь кешується за ETag,
+// щоб повторні перевірки отримували 304 без тіла
+volatile bool updateCheckRunning = false;
+FixedString<OTA_URL_LEN> updateReleaseUrl;      // порожньо = GitHub releases/latest
+FixedString<OTA_ETAG_LEN> cachedReleaseEtag;
+FixedString<OTA_VERSION_LEN> cachedReleaseTag;
+FixedString<OTA_URL_LEN> cachedFirmwareUrl;
+FixedString<OTA_URL_LEN> cachedDigestUrl;
+FixedString<OTA_URL_LEN> cachedFallbackUrl;     // повний образ, якщо дельта не підійде
+
+// Параметри для задачі OTA
+struct OtaRequest {
+  FixedString<OTA_URL_LEN> firmwareUrl;
+  FixedString<OTA_URL_LEN> fallbackUrl;      // повний образ на випадок, коли дельта не від поточної прошивки
+  FixedString<OTA_URL_LEN> digestUrl;        // файл з опублікованим SHA-256 образу
+  FixedString<OTA_DIGEST_LEN> expectedDigest;  // або сам дайджест у hex
+  FixedString<OTA_VERSION_LEN> version;      // тег релізу, що встановлюється
+};
+
+// OTA-задача одна, тож запит живе в єдиному статичному слоті
+OtaRequest otaRequest;
 
 // ==== Global Variables ====
 Servo myServo1, myServo2;
@@ -59,52 +247,801 @@ int servo2Angle = 0;   // поточний кут серво 2
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
-// Motor structure
-struct Motor {
-  int manual_distance = 0;
-  int real_position = 0;
-  int target = 0;
-  bool running = false;
-  unsigned long move_start_time = 0;
-  unsigned long last_position_update = 0;
-  int dir = 0;
-  bool fullForward = false;
-  bool fullBackward = false;
-  bool calibrating = false;
+// ==== Motor bank ====
+// MotorBank (include/motor_bank.h): мотори разом із пінами, зміни кількох осей —
+// одним записом у GPIO
+MotorBank<AXIS_COUNT, axisPins> motors;
+Preferences preferences;           // для збереження позицій моторів
+TimeUs lastSaveTime = 0;            // для періодичного збереження
+
+// ==== Presets ====
+// Таблиця (include/nvs_blob.h) зберігається в NVS одним бінарним блобом
+PresetTable presetTable;
+
+// Таблицю змінює лише loop(); запис і видалення з задачі вебсервера
+// чекають тут на presetService()
+#define PRESET_OP_QUEUE 4
+
+struct PresetOp {
+  int8_t slot;
+  bool store;                      // false — видалити
+  char name[PRESET_NAME_LEN];
 };
 
-Motor motors[4];
-Preferences preferences;           // для збереження позицій моторів
-unsigned long lastSaveTime = 0;     // для періодичного збереження
+PresetOp presetOps[PRESET_OP_QUEUE];
+int presetOpCount = 0;
+portMUX_TYPE presetMux = portMUX_INITIALIZER_UNLOCKED;
 
 // Menu variables
 int menu_level = 0;
-int menu_index[7] = {0};
+int menu_index[9] = {0};
 int selected_motor = 0;
 int selected_action = 0;
 bool edit_value = false;
 
 // Encoder variables
-volatile int8_t encoder_delta = 0;
-unsigned long lastEncoderUpdate = 0;
-unsigned long lastDebounce = 0;
+// ISR лише накопичує переходи квадратури; loop() забирає їх цілими клацаннями
+volatile int32_t encoder_steps = 0;
+portMUX_TYPE encoderMux = portMUX_INITIALIZER_UNLOCKED;
+int encoder_residual = 0;            // переходи, що ще не склали повне клацання
+TimeUs lastDetentTime = 0;
+bool encoderRedrawPending = false;
+TimeUs lastEncoderUpdate = 0;
+TimeUs lastDebounce = 0;
 bool btnPressed = false;
 
-// Display timer
-unsigned long displayStartTime = 0;
-bool showIP = true;
+// Display timer: підказка з hostname поверх меню, зникає сама або від вводу
+#define HOSTNAME_OVERLAY_TIME 10000
+TimeUs displayStartTime = 0;
+bool showIP = false;
 
 // WiFi Manager instance
 WiFiManager wm;
+const char* WIFI_AP_NAME = "ESP32";
+const char* WIFI_AP_PASSWORD = "12345678";
+
+// ==== Staged boot ====
+// Мітки часу етапів старту (мс від скидання, 0 — етап ще не пройдено)
+enum BootStage : uint8_t {
+  BOOT_HARDWARE,   // піни, OLED, енкодер
+  BOOT_STORAGE,    // LittleFS і NVS: позиції, пресети, налаштування
+  BOOT_UI,         // меню на екрані, керування доступне
+  BOOT_WIFI,       // перше підключення до Wi-Fi
+  BOOT_NETWORK,    // веб-сервер і ArduinoOTA запущені
+  BOOT_STAGE_COUNT
+};
+
+const char* const bootStageNames[BOOT_STAGE_COUNT] = {
+  "hardware", "storage", "ui", "wifi", "network"
+};
+
+uint32_t bootStageMs[BOOT_STAGE_COUNT] = {0};
+
+enum NetworkState : uint8_t {
+  NET_CONNECTING,  // чекаємо збережену мережу після старту
+  NET_PORTAL,      // працює портал налаштування WiFiManager
+  NET_ONLINE,
+  NET_OFFLINE      // зв'язок втрачено, перепідключення з паузою
+};
+
+const char* const networkStateNames[] = {"connecting", "portal", "online", "offline"};
+
+#define WIFI_CONNECT_TIMEOUT 20000   // скільки чекати збережену мережу до запуску порталу
+#define WIFI_RECONNECT_MIN 1000
+#define WIFI_RECONNECT_MAX 60000
+
+NetworkState networkState = NET_CONNECTING;
+TimeUs networkStateSince = 0;
+TimeUs nextReconnectAt = 0;
+uint32_t reconnectDelay = WIFI_RECONNECT_MIN;
+uint32_t wifiReconnects = 0;
+bool networkServicesStarted = false;
+
+// ==== Commands ====
+// CommandOp, Command і перевірка команд — у include/command.h
+#define BATCH_MAX_COMMANDS 32
+#define BATCH_MAX_BODY 4096
+
+Command pendingBatch[BATCH_MAX_COMMANDS];
+int pendingBatchCount = 0;
+portMUX_TYPE batchMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Поки true, sendState()/drawMenu() лише позначають, що потрібне оновлення
+bool deferUpdates = false;
+bool statePending = false;
+bool menuPending = false;
+
+// ==== JSON arenas ====
+// JsonDocument бере пам'ять зі статичних арен замість купи. Арена
+// закріплюється за задачею, доки в ній живе хоч один документ, тож
+// вкладені документи (sendState() з обробника WebSocket) ідуть у ту саму.
+// Коли вільної арени чи місця нема, документ іде в купу — це рахується
+#define JSON_ARENA_SIZE 6144
+#define JSON_ARENA_COUNT 3          // loop, async_tcp і фонова задача OTA
+#define JSON_MESSAGE_MAX 1536       // буфер серіалізації вихідних повідомлень
+
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t size) override;
+  void reset();
+
+  TaskHandle_t owner = NULL;
+  uint8_t depth = 0;
+  uint32_t highWater = 0;
+
+private:
+  // Блоки лежать стеком; звільнений блок повертається, коли все над ним теж вільне
+  struct Block {
+    uint32_t size;    // старший біт — блок звільнено
+    uint32_t prev;    // зсув попереднього блоку
+  };
+  static const uint32_t NO_BLOCK = 0xFFFFFFFF;
+  static const uint32_t FREED = 0x80000000;
+
+  bool owns(void* ptr) const { return ptr >= buffer && ptr < buffer + JSON_ARENA_SIZE; }
+  Block* block(uint32_t offset) { return (Block*)(buffer + offset); }
+
+  alignas(8) uint8_t buffer[JSON_ARENA_SIZE];
+  uint32_t top = 0;
+  uint32_t last = NO_BLOCK;
+};
+
+class HeapJsonAllocator : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override { return malloc(size); }
+  void deallocate(void* ptr) override { free(ptr); }
+  void* reallocate(void* ptr, size_t size) override { return realloc(ptr, size); }
+};
+
+JsonArena jsonArenas[JSON_ARENA_COUNT];
+HeapJsonAllocator heapJsonAllocator;
+portMUX_TYPE jsonArenaMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t jsonArenaOverflows = 0;
+
+// Оголошується перед JsonDocument, щоб пережити його:
+//   JsonArenaScope arena;
+//   JsonDocument doc(arena.allocator());
+class JsonArenaScope {
+public:
+  JsonArenaScope();
+  ~JsonArenaScope();
+  ArduinoJson::Allocator* allocator();
+
+private:
+  JsonArena* arena;
+};
+
+// Останній розісланий стан для GET /api/state
+char stateSnapshot[JSON_MESSAGE_MAX];
+size_t stateSnapshotLen = 0;
+SemaphoreHandle_t stateSnapshotMutex = NULL;
+
+// ==== Metrics ====
+// Лічильники тактів CPU і гістограми тривалості для основних ділянок.
+// Запис — кілька десятків тактів, тож усе лишається увімкненим постійно.
+enum MetricId : uint8_t {
+  METRIC_LOOP,
+  METRIC_SEND_STATE,
+  METRIC_MENU_RENDER,
+  METRIC_MENU_FLUSH,     // передача буфера OLED по I2C
+  METRIC_NVS_SAVE,
+  METRIC_WS_COMMAND,
+  METRIC_WS_FANOUT,      // постановка кадру в черги всіх клієнтів
+  METRIC_COUNT
+};
+
+const char* const metricNames[METRIC_COUNT] = {
+  "loop", "send_state", "menu_render", "menu_flush", "nvs_save", "ws_command", "ws_fanout"
+};
+
+// Верхні межі кошиків гістограми, мкс
+const uint32_t metricBucketsUs[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+#define METRIC_BUCKET_COUNT (sizeof(metricBucketsUs) / sizeof(metricBucketsUs[0]))
+
+struct CycleMetric {
+  uint64_t cycles;
+  uint64_t micros;
+  uint32_t count;
+  uint32_t maxCycles;
+  uint32_t buckets[METRIC_BUCKET_COUNT + 1];   // останній — понад усі межі (+Inf)
+};
+
+CycleMetric metrics[METRIC_COUNT];
+portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t metricsCpuMhz = 240;   // для переведення тактів у мкс, оновлюється в setup()
+
+// Вільна купа на початку робочого режиму і її мінімум відтоді: різниця —
+// найбільше, що сталий режим узяв із купи (в ідеалі близько нуля)
+#define HEAP_SAMPLE_INTERVAL 1000
+uint32_t heapSteadyBaseline = 0;
+uint32_t heapSteadyLow = 0;
+uint32_t heapLargestBlockLow = 0;
+TimeUs lastHeapSample = 0;
+
+// Розсилки WebSocket: кадри в черги клієнтів і розсилки, коли чиясь черга
+// була повна (такий клієнт кадр втратить). Номер розсилки стану (bseq)
+// дозволяє клієнту помітити пропуск; навантажувальний тест на платі: scripts/ws_load.py
+uint32_t wsBroadcasts = 0;
+uint32_t wsFramesQueued = 0;
+uint32_t wsBroadcastsDropped = 0;
+uint32_t stateBroadcastSeq = 0;
+
+// Викликається з loop() і з задачі AsyncTCP, тому під спінлоком
+void metricRecord(MetricId id, uint32_t cycles) {
+  uint32_t us = cycles / metricsCpuMhz;
+  size_t bucket = 0;
+  while (bucket < METRIC_BUCKET_COUNT && us > metricBucketsUs[bucket]) bucket++;
+
+  portENTER_CRITICAL(&metricsMux);
+  CycleMetric &m = metrics[id];
+  m.cycles += cycles;
+  m.micros += us;
+  m.count++;
+  if (cycles > m.maxCycles) m.maxCycles = cycles;
+  m.buckets[bucket]++;
+  portEXIT_CRITICAL(&metricsMux);
+}
+
+// Замір до кінця області видимості
+struct MetricScope {
+  MetricId id;
+  uint32_t start;
+  explicit MetricScope(MetricId metric) : id(metric), start(ESP.getCycleCount()) {}
+  ~MetricScope() { metricRecord(id, ESP.getCycleCount() - start); }
+};
+
+// Час CPU по задачах, вибіркою: хук тіку FreeRTOS (1 кГц на кожному ядрі)
+// рахує задачу, яку перервав. configGENERATE_RUN_TIME_STATS задає sdkconfig
+// зібраного ядра Arduino, а -D у build_flags FreeRTOS не перебудовує (і зламав би
+// розкладку TaskStatus_t), тому точні лічильники є не в кожній збірці, а ці — завжди.
+// Дескриптор видаленої задачі може дістатися новій — тоді такти йдуть під старе ім'я
+#define CPU_SAMPLE_TASKS 16
+
+struct CpuSampleSlot {
+  TaskHandle_t task;
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t ticks[portNUM_PROCESSORS];
+};
+
+CpuSampleSlot cpuSamples[CPU_SAMPLE_TASKS];
+uint32_t cpuSampleTotal[portNUM_PROCESSORS];
+uint32_t cpuSampleOverflow = 0;        // такти задач, що не вмістилися в таблицю
+portMUX_TYPE cpuSampleMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Викликається з переривання тіку, тож лише IRAM: без strncpy і логів
+void IRAM_ATTR cpuSampleTick() {
+  int core = xPortGetCoreID();
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL_ISR(&cpuSampleMux);
+  cpuSampleTotal[core]++;
+  int i = 0;
+  while (i < CPU_SAMPLE_TASKS && cpuSamples[i].task && cpuSamples[i].task != task) i++;
+  if (i == CPU_SAMPLE_TASKS) {
+    cpuSampleOverflow++;
+  } else {
+    CpuSampleSlot &slot = cpuSamples[i];
+    if (!slot.task) {
+      const char* name = pcTaskGetName(task);
+      for (int c = 0; c < configMAX_TASK_NAME_LEN - 1 && name[c]; c++) slot.name[c] = name[c];
+      slot.task = task;
+    }
+    slot.ticks[core]++;
+  }
+  portEXIT_CRITICAL_ISR(&cpuSampleMux);
+}
+
+// ==== Trace ====
+// Кільце подій і експорт у Chrome Trace — у include/trace.h
+TraceEvent traceRing[TRACE_CAPACITY];
+volatile uint32_t traceHead = 0;       // загальна кількість записаних подій
+volatile bool traceArmed = false;
+TimeUs traceStopAt = 0;                // 0 — без автозупинки
+TimeUs traceLastSync = 0;
+
+inline void traceRecord(uint8_t id, char phase, uint8_t arg) {
+  if (!traceArmed) return;
+  traceStore(traceRing, traceHead, ESP.getCycleCount(), (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle(),
+             id, phase, xPortGetCoreID(), arg);
+}
+
+struct TraceScope {
+  uint8_t id;
+  uint8_t arg;
+  TraceScope(TraceId traceId, int value = 0) : id(traceId), arg(value) { traceRecord(id, 'B', arg); }
+  ~TraceScope() { traceRecord(id, 'E', arg); }
+};
+
+// ==== Telemetry ====
+// Кільце блоків фіксованого розміру. Кожен блок починається ключовим кадром
+// (повний стан), далі лише зміни: varint-інтервал у тактах вибірки, varint-маска
+// змінених осей (біт AXIS_COUNT — серво) і zigzag-varint дельта позиції. У простої записів немає,
+// тож 32 КБ вистачає на години. Декодер: scripts/telemetry_decode.py
+#define TELEMETRY_BLOCK_SIZE 512
+#define TELEMETRY_BLOCK_COUNT 64
+#define TELEMETRY_MAX_RECORD (8u + AXIS_COUNT * 6u)  // dt + маска + осі по 6 байтів + серво
+#define TELEMETRY_SERVO_BIT (1 << AXIS_COUNT)
+#define TELEMETRY_MAX_RATE 100         // Гц — частота такту loop()
+#define TELEMETRY_DEFAULT_INTERVAL 50  // мс
+#define TELEMETRY_EXPORT_MARGIN 2      // найстаріші блоки можуть перезаписатися під час віддачі
+
+// Біти прапорців осі
+#define TELEMETRY_DIR_MASK 0x03        // 0 стоїть, 1 вперед, 2 назад
+#define TELEMETRY_MODE_SHIFT 2         // 0 idle, 1 до цілі, 2 full fwd, 3 full back, 4 калібрування
+#define TELEMETRY_LIMIT_BIT 0x20       // кінцевик натиснутий
+
+struct TelemetryBlockHeader {
+  uint32_t seq;          // 0 — блок ще не використовувався
+  uint32_t startMs;
+  uint16_t used;         // байтів у data
+  uint16_t intervalMs;
+};
+
+struct TelemetryBlock {
+  TelemetryBlockHeader header;
+  uint8_t data[TELEMETRY_BLOCK_SIZE - sizeof(TelemetryBlockHeader)];
+};
+
+struct TelemetrySample {
+  int32_t position[AXIS_COUNT];
+  uint8_t flags[AXIS_COUNT];
+  uint8_t servo;
+};
+
+TelemetryBlock telemetryRing[TELEMETRY_BLOCK_COUNT];
+volatile uint32_t telemetrySeq = 0;    // номер поточного блоку
+uint16_t telemetryIntervalMs = TELEMETRY_DEFAULT_INTERVAL;
+bool telemetryReopen = true;           // наступна вибірка відкриває новий блок
+TimeUs telemetryLastSample = 0;
+uint32_t telemetryTick = 0;
+uint32_t telemetryLastRecordTick = 0;
+TelemetrySample telemetryLast;
+
+// ==== Event journal ====
+// Журнал подій на LittleFS: записи по 16 байтів з CRC, сегменти-файли
+// /log/<перший seq>, найстаріші видаляються понад бюджет. logEvent() лише
+// кладе запис у чергу без очікування; пише на flash окрема задача.
+#define LOG_DIR "/log"
+#define LOG_SEGMENT_RECORDS 512       // 8 КБ на сегмент
+#define LOG_SEGMENT_COUNT 8           // бюджет 64 КБ
+#define LOG_QUEUE_LENGTH 64
+#define LOG_BATCH_MAX 16
+#define LOG_QUERY_MAX 1000
+#define LOG_EXPORT_READS_MAX 32       // спроб читання за один виклик chunk-колбека
+
+enum LogEventType : uint8_t {
+  LOG_BOOT,               // value = причина скидання
+  LOG_MOTOR_START,        // value = напрямок
+  LOG_MOTOR_STOP,         // value = позиція
+  LOG_CALIBRATION_START,
+  LOG_CALIBRATION_DONE,
+  LOG_OTA_START,
+  LOG_OTA_DONE,
+  LOG_OTA_FAILED,
+  LOG_WIFI_UP,
+  LOG_WIFI_DOWN,
+  LOG_WIFI_PORTAL,
+  LOG_WS_CONNECT,         // value = id клієнта
+  LOG_WS_DISCONNECT,
+  LOG_EVENT_TYPE_COUNT
+};
+
+const char* const logEventNames[LOG_EVENT_TYPE_COUNT] = {
+  "boot", "motor_start", "motor_stop", "calibration_start", "calibration_done",
+  "ota_start", "ota_done", "ota_failed", "wifi_up", "wifi_down", "wifi_portal",
+  "ws_connect", "ws_disconnect"
+};
+
+struct LogRecord {
+  uint32_t seq;
+  uint32_t ms;
+  uint8_t type;
+  int8_t motor;           // -1 — не стосується осі
+  int16_t value;
+  uint32_t crc;           // CRC32 перших 12 байтів; недописаний запис не пройде перевірку
+};
+
+QueueHandle_t logQueue = NULL;
+uint32_t logNextSeq = 1;
+uint32_t logDropped = 0;              // записи, що не влізли в чергу
+uint32_t logSegments[LOG_SEGMENT_COUNT + 1];   // перші seq сегментів, за зростанням
+int logSegmentCount = 0;
+portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==== Fleet ====
+// Кілька верстатів однією лінією по UDP multicast. Протокол, синхронізація
+// годинника і черги — у include/fleet.h; тут сокет, роль і стан
+enum FleetRole : uint8_t {
+  FLEET_OFF,
+  FLEET_COORDINATOR,
+  FLEET_FOLLOWER,
+  FLEET_ROLE_COUNT
+};
+
+const char* const fleetRoleNames[FLEET_ROLE_COUNT] = {"off", "coordinator", "follower"};
+
+AsyncUDP fleetUdp;
+bool fleetListening = false;
+FleetRole fleetRole = FLEET_OFF;
+uint8_t fleetGroup = 0;
+uint32_t fleetUnit = 0;
+uint32_t fleetNextSeq = 0;
+TimeUs fleetLastBeacon = 0;
+portMUX_TYPE fleetMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Координатор
+FleetPeer fleetPeers[FLEET_MAX_PEERS];
+FleetOutgoing fleetOutbox[FLEET_OUTBOX];
+
+// Ведений: зсув годинника координатора і команди, що чекають свого моменту
+FleetSync fleetSync;
+int32_t fleetLastLateUs = 0;
+FleetSeen fleetSeen;
+FleetQueue fleetQueue;
+
+// ==== MQTT ====
+// Необов'язковий міст для моніторингу цеху. Окрема задача тримає з'єднання,
+// loop() лише знімає стан раз на такт. Теми (prefix за замовчуванням "stanok"):
+//   <prefix>/status        online/offline (retained, LWT)
+//   <prefix>/axis/<n>      стан осі в JSON (retained, лише при зміні)
+//   <prefix>/servo         on/off (retained)
+//   <prefix>/event         події журналу; поки немає зв'язку — буфер на MQTT_EVENT_BUFFER
+//   <prefix>/cmd           команди як у WebSocket: {"type":"set_target","data":{...}}
+// Перевірка з Mosquitto: mosquitto_sub -v -t 'stanok/#'
+#define MQTT_HOST_LEN 63
+#define MQTT_PREFIX_LEN 31
+#define MQTT_TOPIC_LEN (MQTT_PREFIX_LEN + 16)
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_BUFFER_SIZE 512
+#define MQTT_KEEPALIVE 15             // с
+#define MQTT_SOCKET_TIMEOUT 3         // с; блокує лише задачу MQTT
+#define MQTT_RECONNECT_MIN 1000
+#define MQTT_RECONNECT_MAX 60000
+#define MQTT_POLL_INTERVAL 50         // мс між обслуговуванням клієнта без змін стану
+#define MQTT_EVENT_BUFFER 32
+#define MQTT_INBOX_LENGTH 8
+
+struct MqttState {
+  TelemetrySample sample;             // позиції й прапорці, як у телеметрії
+  int32_t target[AXIS_COUNT];
+};
+
+struct MqttEvent {
+  uint32_t ms;
+  uint8_t type;
+  int8_t motor;
+  int16_t value;
+};
+
+FixedString<MQTT_HOST_LEN> mqttHost;  // порожній — міст вимкнено
+uint16_t mqttPort = MQTT_DEFAULT_PORT;
+FixedString<MQTT_PREFIX_LEN> mqttPrefix;
+bool mqttReconfigure = false;         // задача перепідключиться з новими налаштуваннями
+
+WiFiClient mqttNet;
+PubSubClient mqttClient(mqttNet);
+TaskHandle_t mqttTaskHandle = NULL;
+volatile bool mqttConnected = false;
+uint32_t mqttReconnects = 0;
+uint32_t mqttPublished = 0;
+uint32_t mqttRejected = 0;            // команди, що не пройшли parseCommand()
+portMUX_TYPE mqttMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Знімок з loop(); задача порівнює його з уже опублікованим
+MqttState mqttLatest;
+bool mqttLatestValid = false;
+MqttState mqttSent;
+uint32_t mqttSentMask = 0;            // осі (і біт AXIS_COUNT — серво), що вже на брокері
+
+// Події: найстаріші витісняються, поки брокер недоступний
+MqttEvent mqttEvents[MQTT_EVENT_BUFFER];
+uint32_t mqttEventHead = 0;           // наступний запис
+uint32_t mqttEventTail = 0;           // наступний для відправки
+uint32_t mqttEventsDropped = 0;
+
+// Команди з брокера виконуються в loop(), як пакет /api/batch
+Command mqttInbox[MQTT_INBOX_LENGTH];
+int mqttInboxCount = 0;
+
+// ==== Command acks ====
+// Повідомлення WebSocket з полями seq і sid (сесія сторінки) отримують
+// особисту відповідь {"type":"ack"} з часами прийому, розбору і застосування
+// (мкс від старту). Повтор того самого seq після перепідключення не виконується
+// вдруге, а отримує первинний результат.
+#define WS_SESSION_COUNT 8
+#define WS_DEDUP_WINDOW 16
+#define WS_LATENCY_SAMPLES 64
+#define WS_SESSION_TIMEOUT 600000      // мс; далі слот сесії можна віддати іншій
+
+enum AckResult : uint8_t {
+  ACK_OK,
+  ACK_SCHEDULED,        // координатор лінії: виконається в appliedUs
+  ACK_REJECTED,
+  ACK_UNKNOWN,
+  ACK_RESULT_COUNT
+};
+
+const char* const ackResultNames[ACK_RESULT_COUNT] = {"ok", "scheduled", "rejected", "unknown"};
+
+struct LatencyRing {
+  uint32_t samples[WS_LATENCY_SAMPLES];
+  uint8_t count;
+  uint8_t index;
+};
+
+struct WsSession {
+  uint32_t sid;                        // 0 — слот вільний
+  uint32_t clientId;
+  TimeUs lastSeen;
+  uint32_t seqs[WS_DEDUP_WINDOW];      // 0 — порожньо, клієнт рахує з 1
+  uint8_t results[WS_DEDUP_WINDOW];
+  uint8_t seqIndex;
+  uint32_t commands;
+  uint32_t duplicates;
+  LatencyRing deviceUs;                // прийом → застосування на пристрої
+  LatencyRing rttUs;                   // повний цикл, який повідомляє клієнт
+};
+
+struct CommandAck {
+  WsSession *session;
+  uint32_t seq;
+  int64_t clientTime;                  // timestamp клієнта, повертається як є
+  TimeUs rxUs;
+  TimeUs dispatchUs;
+  TimeUs appliedUs;
+  AckResult result;
+  const char* reason;
+  bool duplicate;
+};
+
+// Сесії змінюються лише з задачі async_tcp (WebSocket і /api/clients)
+WsSession wsSessions[WS_SESSION_COUNT];
+
+// ==== Stop model ====
+// Позиція рахується за часом, тож вісь гасне лише на тому такті loop(), що
+// помітив останній крок, а механіка ще докочується. Модель на вісь і напрямок:
+// lagUs — затримка від розрахункового моменту зупинки до гасіння виходу
+// (міряється на кожній зупинці), coastUs — докочування, яке видно лише на
+// кінцевику: під час калібрування лічена позиція порівнюється з нулем.
+// Останній крок до цілі зараховується і гаситься раніше на lagUs + coastUs
+#define MOTION_MODEL_VERSION 1
+#define MOTION_LAG_WEIGHT 8             // EMA затримки, 1/8 на зупинку
+#define MOTION_COAST_GAIN 0.25f         // крок NLMS для докочування
+#define MOTION_LEAD_MAX_DIV 2           // не раніше ніж за пів кроку
+
+enum MotionDir { MOTION_FORWARD, MOTION_BACKWARD, MOTION_DIRS };
+const char* const motionDirNames[MOTION_DIRS] = {"forward", "backward"};
+
+struct MotionAxisModel {
+  int32_t lagUs[MOTION_DIRS];
+  int32_t coastUs[MOTION_DIRS];
+  uint32_t stops[MOTION_DIRS];     // зупинок на цілі
+  uint32_t samples;                // калібрувань, з яких навчено coastUs
+  int32_t lastResidualUs;          // лічена позиція на кінцевику, мкс ходу
+};
+
+struct MotionModelBlob {
+  uint8_t version;
+  MotionAxisModel axes[AXIS_COUNT];
+};
+
+// Хід з останнього калібрування; лише з чистих зупинок можна вчити coastUs
+struct MotionTrack {
+  uint16_t sinceHome[MOTION_DIRS];
+  bool clean;                      // усі рухи завершились на цілі
+  bool moving;                     // рух почався і ще не завершився на цілі
+};
+
+MotionAxisModel motionModel[AXIS_COUNT];
+MotionTrack motionTrack[AXIS_COUNT];
+portMUX_TYPE motionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==== Session record ====
+// Запис усіх вхідних подій у компактний бінарний слід і детерміноване
+// відтворення на самій платі: виходи вимкнені, кінцевики й кнопка — зі сліду,
+// controlTick() іде за віртуальним годинником з будь-якою швидкістю.
+// Формат: SessionHeader (стан на початку), далі події varint-dt (мкс) + тип +
+// дані, в кінці SESSION_END з підсумковими позиціями. Інструмент: scripts/session_tool.py
+// Кодування подій і курсор відтворення — у include/session_trace.h
+#define SESSION_BUFFER_SIZE 16384
+#define SESSION_VERSION 2
+#define SESSION_REPLAY_BUDGET 500      // тактів за один прохід loop() на максимальній швидкості
+#define SESSION_END_RESERVE (11 + AXIS_COUNT * 8)   // varint dt + тип + позиції
+#define SESSION_MENU_LEVELS 9
+
+enum SessionMode : uint8_t {
+  SESSION_IDLE,
+  SESSION_RECORDING,
+  SESSION_REPLAYING,
+  SESSION_MODE_COUNT
+};
+
+const char* const sessionModeNames[SESSION_MODE_COUNT] = {"idle", "recording", "replaying"};
+
+// Прапорці осі в заголовку
+#define SESSION_AXIS_RUNNING 0x01
+#define SESSION_AXIS_FULL_FORWARD 0x02
+#define SESSION_AXIS_FULL_BACKWARD 0x04
+#define SESSION_AXIS_CALIBRATING 0x08
+
+// Прапорці загального стану
+#define SESSION_EDIT_VALUE 0x01
+#define SESSION_BUTTON_HELD 0x02
+#define SESSION_SERVO_ON 0x04
+#define SESSION_BUTTON_LOW 0x08       // рівень кнопки в момент старту запису
+#define SESSION_REDRAW_PENDING 0x10
+#define SESSION_OVERLAY 0x20          // показана підказка з hostname
+
+struct SessionAxis {
+  int32_t manualDistance;
+  int32_t realPosition;
+  int32_t target;
+  uint32_t stepPhaseUs;     // скільки мкс минуло від останнього кроку позиції
+  int8_t dir;
+  uint8_t flags;
+  uint32_t stopLeadUs[MOTION_DIRS];  // модель зупинки заморожена на час запису
+} __attribute__((packed));
+
+struct SessionHeader {
+  char magic[4];            // "STRC"
+  uint8_t version;
+  uint8_t axisCount;
+  uint16_t size;            // sizeof(SessionHeader)
+  uint32_t msPerMm;         // відтворення вимагає тих самих констант руху
+  int64_t startUs;
+  int64_t lastDetentUs;
+  int64_t lastDebounceUs;
+  int64_t lastEncoderUpdateUs;
+  int64_t displayStartUs;
+  int16_t menuIndex[SESSION_MENU_LEVELS];
+  uint8_t menuLevel;
+  int8_t selectedMotor;
+  uint8_t selectedAction;
+  uint8_t flags;
+  uint8_t limits;
+  uint8_t reserved;
+  SessionAxis axes[AXIS_COUNT];
+  PresetTable presets;      // recall_preset відтворюється з тими самими слотами
+} __attribute__((packed));
+
+uint8_t sessionBuffer[SESSION_BUFFER_SIZE];
+size_t sessionLength = 0;
+bool sessionTruncated = false;
+volatile SessionMode sessionMode = SESSION_IDLE;
+volatile bool sessionStopRequested = false;   // буфер заповнився під час запису
+TimeUs sessionLastEventUs = 0;
+bool sessionLastButton = HIGH;
+uint8_t sessionLastLimits = 0;
+portMUX_TYPE sessionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Відтворення
+struct SessionReplay {
+  SessionCursor cursor;     // віртуальний час і тип наступної події
+  TimeUs lastTickUs;
+  TimeUs startUs;
+  TimeUs realStartUs;
+  float speed;              // 0 — якнайшвидше
+  bool button;
+  bool injecting;           // applyCommand() від відтворення, а не ззовні
+};
+
+struct SessionResult {
+  bool valid;
+  bool match;
+  int32_t expected[AXIS_COUNT];
+  int32_t actual[AXIS_COUNT];
+  uint32_t events;
+  uint32_t ticks;
+  uint32_t virtualMs;
+  uint32_t wallMs;
+  const char* error;
+};
+
+// Запити з HTTP виконуються в loop(), де живе стан машини
+enum SessionRequest : uint8_t {
+  SESSION_REQ_NONE,
+  SESSION_REQ_RECORD,
+  SESSION_REQ_STOP,
+  SESSION_REQ_REPLAY
+};
+
+volatile SessionRequest sessionRequest = SESSION_REQ_NONE;
+float sessionRequestSpeed = 1.0f;
+
+SessionReplay sessionReplay;
+SessionResult sessionResult;
+
+// Справжній стан машини, відкладений на час відтворення
+struct SessionSaved {
+  Motor axes[AXIS_COUNT];
+  MotionAxisModel motion[AXIS_COUNT];
+  MotionTrack track[AXIS_COUNT];
+  PresetTable presets;
+  int menuIndex[SESSION_MENU_LEVELS];
+  int menuLevel;
+  int selectedMotor;
+  int selectedAction;
+  bool editValue;
+  bool servo;
+  bool btnPressed;
+  bool redrawPending;
+  bool overlay;
+  TimeUs lastDetent;
+  TimeUs lastDebounce;
+  TimeUs lastEncoderUpdate;
+  TimeUs displayStart;
+};
+
+SessionSaved sessionSaved;
+
+// ==== Wear counters ====
+// Напрацювання осей для планування заміни приводів. Такт руху лише додає в
+// RAM; у NVS пишемо всю таблицю одним блобом, рідко і лише коли осі стоять
+#define WEAR_SAVE_INTERVAL 600000      // мс між записами в NVS
+
+WearTable wearTable;                 // розкладка блобу — у include/nvs_blob.h
+TimeUs wearTravelUs[AXIS_COUNT];     // частка міліметра, що ще не зарахована
+TimeUs wearLastTick = 0;
+TimeUs wearSavedAt = 0;
+bool wearDirty = false;
+volatile uint32_t wearResetMask = 0; // осі, які треба обнулити (з задачі вебсервера)
+portMUX_TYPE wearMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==== Power ====
+// Коли осі стоять і з машиною ніхто не працює, loop() знижує частоту CPU,
+// вмикає modem-sleep і чекає на подію замість delay(10). Енкодер, кнопка
+// й команди з мережі будять його одразу. Без мережі — light-sleep
+#define POWER_IDLE_AFTER 30000         // мс без активності до переходу в idle
+#define POWER_IDLE_POLL 100            // найдовше очікування події в idle, мс
+#define POWER_IDLE_MHZ 80              // APB лишається 80 МГц, UART і таймери не змінюються
+#define POWER_SLEEP_MAX 1000           // найдовший один light-sleep, мс
+#define POWER_CONNECT_GUARD 15000      // після спроби підключення Wi-Fi не спимо, мс
+
+enum PowerState : uint8_t {
+  POWER_ACTIVE,
+  POWER_IDLE,       // знижена частота, modem-sleep, очікування події
+  POWER_SLEEP,      // light-sleep між спробами підключення до Wi-Fi
+  POWER_STATE_COUNT
+};
+
+const char* const powerStateNames[POWER_STATE_COUNT] = {"active", "idle", "sleep"};
+
+volatile PowerState powerState = POWER_ACTIVE;
+TaskHandle_t loopTaskHandle = NULL;
+uint32_t powerActiveMhz = 240;
+TimeUs powerLastActivity = 0;
+TimeUs powerStateSince = 0;
+TimeUs powerStateUs[POWER_STATE_COUNT] = {0};
+volatile TimeUs powerWakeAt = 0;       // момент події, що розбудила; 0 — немає
+uint32_t powerWakeups = 0;
+uint32_t powerWakeLatencyUs = 0;       // подія → повна частота CPU
+uint32_t powerWakeLatencyMaxUs = 0;
+uint32_t powerSleeps = 0;
+
+// ==== Static assets ====
+// Таблиця файлів LittleFS будується при старті; ETag — це CRC32 вмісту
+#define STATIC_ASSET_MAX 16
+
+struct StaticAsset {
+  char url[32];        // "/style.css"; для .html також доступний без розширення
+  const char* mime;
+  char etag[20];
+};
+
+StaticAsset staticAssets[STATIC_ASSET_MAX];
+int staticAssetCount = 0;
 
 // Function prototypes
 void setServoState(bool state);
 void moveServoSmooth(Servo &servo, int &currentAngle, int targetAngle, int stepDelay = 15);
 void setMotorTarget(int motor, int target);
 void drawMenu();
+void renderMenu();
 void drawHostnameDisplay();
 void drawOTAProgress();
 void sendState();
+void wsBroadcast(const char* data, size_t len);
 void toggleCalibration(int motor);
 void startMotor(int motor, int dir);
 void stopMotor(int motor);
@@ -115,27 +1052,107 @@ void toggleAllFullForward();
 void toggleAllFullBackward();
 void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
 void IRAM_ATTR readEncoder();
+int takeEncoderDetents();
+int encoderAcceleration(int detents);
+void handleEncoderDetents(int detents);
+void moveAllToTargets(const int targets[AXIS_COUNT]);
 void setupI2C();
 void setupOTA();
 void handleWebServer();
-String checkForUpdate();
-bool performUpdate(String firmwareUrl);
+void beginNetwork();
+void serviceNetwork();
+void logEvent(LogEventType type, int motor = -1, int value = 0);
+void setTelemetryRate(int hz);
+void loadFleetSettings();
+void setFleetRole(FleetRole role, uint8_t group);
+void startFleet();
+TimeUs fleetBroadcast(const Command *cmds, int count);
+void fleetService();
+void handleFleetRequest(AsyncWebServerRequest *request);
+void loadMqttSettings();
+void setMqttSettings(const char* host, uint16_t port, const char* prefix);
+void startMqtt();
+void mqttCapture();
+void telemetryCapture(TelemetrySample &s);
+void mqttQueueEvent(LogEventType type, int motor, int value);
+void mqttService();
+bool commandAckBegin(AsyncWebSocketClient *client, JsonDocument &doc, CommandAck &ack, TimeUs rxUs);
+void commandAckFinish(AsyncWebSocketClient *client, CommandAck &ack);
+void handleClientsRequest(AsyncWebServerRequest *request);
+TimeUs motionLeadUs(int axis, int dir);
+void motionMoveStarted(int axis);
+void motionStopped(int axis);
+void motionArrived(int axis, int dir, TimeUs cutAt);
+void motionHomed(int axis, TimeUs now);
+void loadMotionModel();
+void saveMotionModel();
+void handleMotionModel(AsyncWebServerRequest *request);
+void loadWear();
+void saveWear();
+void wearTick();
+void wearMotorStarted(int axis, int dir);
+void wearLimitHit(int axis);
+void wearService();
+void handleWearRequest(AsyncWebServerRequest *request);
+void controlTick(int detents, bool btnState);
+void sessionRecordCommand(const Command &cmd);
+void sessionRecordInputs(int detents, bool btnState);
+void sessionService();
+void powerWake();
+void IRAM_ATTR powerWakeFromISR();
+void powerService();
+void handleSessionStatus(AsyncWebServerRequest *request);
+void traceStart(unsigned long durationMs);
+void traceStop();
+void traceTick();
+bool checkForUpdate();
+const char* releaseUrl();
+void loadUpdateSettings();
+void setUpdateReleaseUrl(const char* url);
+void startUpdateCheck();
+bool performUpdate(const OtaRequest &request, const char* url, bool &deltaRejected);
+void startOta(const OtaRequest &request);
+void otaTask(void *param);
 void sendUpdateStatus();
 void loadMotorPositions();
 void saveMotorPositions();
+void loadPresets();
+void loadConfig();
+bool requestConfigChange(JsonObject in, const char** error);
+void sendConfig();
+void configService();
+void handleConfigRequest(AsyncWebServerRequest *request);
+void handleConfigUpdate(AsyncWebServerRequest *request, const char* body);
+void savePresets();
+bool storePreset(int slot, const char* name);
+bool deletePreset(int slot);
+bool requestPresetChange(int slot, bool store, const char* name);
+void presetService();
+bool recallPreset(int slot);
+void sendPresets();
+bool parseCommand(const char* type, JsonObject data, Command &cmd, const char** error);
+void applyCommand(const Command &cmd);
+void applyPendingBatch();
+void flushDeferredUpdates();
+size_t buildStateJson(char* output, size_t size);
+void sampleHeap(bool restart = false);
+bool queuePendingBatch(const Command* batch, int count);
+void handleBatchRequest(AsyncWebServerRequest *request, const char* body);
+void scanStaticAssets();
+const StaticAsset* findStaticAsset(const String &url);
 
 // ==== I2C ====
 void setupI2C() {
-  Wire.begin(21, 22); // SDA, SCL
+  Wire.begin(i2cPins[0], i2cPins[1]);
   Wire.setClock(400000);
 }
 
 // ==== Preferences: збереження та завантаження позицій моторів ====
 void loadMotorPositions() {
   preferences.begin("motors", false);
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < AXIS_COUNT; i++) {
     char key[10];
-    sprintf(key, "pos%d", i);
+    motorPositionKey(key, sizeof(key), i);
     motors[i].real_position = preferences.getInt(key, 0);
     motors[i].target = motors[i].real_position; // за замовчуванням ціль = поточній позиції
   }
@@ -144,838 +1161,4827 @@ void loadMotorPositions() {
 }
 
 void saveMotorPositions() {
+  if (sessionMode == SESSION_REPLAYING) return;  // позиції симульовані
+  MetricScope metric(METRIC_NVS_SAVE);
+  TraceScope trace(TRACE_SAVE_POSITIONS);
   preferences.begin("motors", false);
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < AXIS_COUNT; i++) {
     char key[10];
-    sprintf(key, "pos%d", i);
+    motorPositionKey(key, sizeof(key), i);
     preferences.putInt(key, motors[i].real_position);
   }
   preferences.end();
-  lastSaveTime = millis();
+  lastSaveTime = nowUs();
   Serial.println("Motor positions saved to preferences");
 }
 
-// ==== OTA Update Functions ====
-String checkForUpdate() {
-  if (WiFi.status() != WL_CONNECTED) {
-    return "";
+// ==== Presets: збереження, видалення та виклик ====
+void loadPresets() {
+  memset(&presetTable, 0, sizeof(presetTable));
+  preferences.begin("presets", true);
+  size_t len = preferences.getBytesLength("table");
+  if (len == sizeof(presetTable)) {
+    preferences.getBytes("table", &presetTable, sizeof(presetTable));
   }
-  
-  HTTPClient http;
-  String url = "https://api.github.com/repos/" + String(GITHUB_REPO) + "/releases/latest";
-  
-  http.begin(url);
-  http.setUserAgent("ESP32-OTA");
-  
-  int httpCode = http.GET();
-  
-  if (httpCode == HTTP_CODE_OK) {
-    String payload = http.getString();
-    http.end();
-    
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, payload);
-    
-    if (error) {
-      return "";
-    }
-    
-    String latestVer = doc["tag_name"].as<String>();
-    latestVersion = latestVer;
-    
-    JsonArray assets = doc["assets"].as<JsonArray>();
-    for (JsonObject asset : assets) {
-      String name = asset["name"].as<String>();
-      if (name == FIRMWARE_FILENAME) {
-        String downloadUrl = asset["browser_download_url"].as<String>();
-        return downloadUrl;
-      }
-    }
+  preferences.end();
+
+  if (presetTable.version != PRESET_TABLE_VERSION) {
+    memset(&presetTable, 0, sizeof(presetTable));
+    presetTable.version = PRESET_TABLE_VERSION;
   }
-  
-  http.end();
-  return "";
+  Serial.println("Presets loaded from preferences");
 }
 
-bool performUpdate(String firmwareUrl) {
-  if (WiFi.status() != WL_CONNECTED) {
-    updateStatus = "WiFi not connected";
-    return false;
+// Викликається з обробника WebSocket (задача async_tcp): окремий екземпляр,
+// бо глобальний preferences використовує loop()
+void savePresets() {
+  MetricScope metric(METRIC_NVS_SAVE);
+  Preferences presetPrefs;
+  presetPrefs.begin("presets", false);
+  presetPrefs.putBytes("table", &presetTable, sizeof(presetTable));
+  presetPrefs.end();
+  Serial.println("Presets saved to preferences");
+}
+
+// Запам'ятовує поточні цілі всіх моторів і стан серво у слот
+bool storePreset(int slot, const char* name) {
+  if (slot < 0 || slot >= PRESET_COUNT || sessionMode == SESSION_REPLAYING) return false;
+
+  Preset &p = presetTable.slots[slot];
+  presetFill(p, slot, name, &motors[0], config.minMm, config.maxMm, servoState);
+
+  savePresets();
+  Serial.printf("Preset %d \"%s\" stored\n", slot, p.name);
+  sendPresets();
+  return true;
+}
+
+bool deletePreset(int slot) {
+  if (slot < 0 || slot >= PRESET_COUNT || sessionMode == SESSION_REPLAYING) return false;
+  memset(&presetTable.slots[slot], 0, sizeof(Preset));
+  savePresets();
+  sendPresets();
+  return true;
+}
+
+// Викликається з задачі вебсервера; false, якщо слот неправильний або черга повна
+bool requestPresetChange(int slot, bool store, const char* name) {
+  if (slot < 0 || slot >= PRESET_COUNT) return false;
+
+  PresetOp op;
+  memset(&op, 0, sizeof(op));
+  op.slot = slot;
+  op.store = store;
+  if (name) strncpy(op.name, name, PRESET_NAME_LEN - 1);
+
+  bool queued = false;
+  portENTER_CRITICAL(&presetMux);
+  if (presetOpCount < PRESET_OP_QUEUE) {
+    presetOps[presetOpCount++] = op;
+    queued = true;
   }
-  
-  HTTPClient http;
-  
-  http.begin(firmwareUrl);
-  http.setUserAgent("ESP32-OTA");
-  
-  int httpCode = http.GET();
-  
-  if (httpCode == HTTP_CODE_OK) {
-    int contentLength = http.getSize();
-    
-    if (contentLength > 0) {
-      if (contentLength > (ESP.getFreeSketchSpace() - 0x1000)) {
-        updateStatus = "Not enough space";
-        http.end();
-        return false;
-      }
-      
-      if (!Update.begin(contentLength)) {
-        updateStatus = "Update begin failed: " + String(Update.getError());
-        http.end();
-        return false;
-      }
-      
-      WiFiClient *stream = http.getStreamPtr();
-      uint8_t buffer[1024];
-      size_t totalRead = 0;
-      
-      while (http.connected() && totalRead < contentLength) {
-        size_t read = stream->readBytes(buffer, min(sizeof(buffer), contentLength - totalRead));
-        if (read > 0) {
-          Update.write(buffer, read);
-          totalRead += read;
-          
-          updateProgress = (totalRead * 100) / contentLength;
-          sendUpdateStatus();
-          
-          if (millis() - lastEncoderUpdate > 500) {
-            drawOTAProgress();
-            lastEncoderUpdate = millis();
-          }
-        }
-      }
-      
-      if (Update.end()) {
-        updateStatus = "Update complete! Restarting...";
-        updateProgress = 100;
-        sendUpdateStatus();
-        http.end();
-        
-        delay(2000);
-        ESP.restart();
-        return true;
-      } else {
-        updateStatus = "Update failed: " + String(Update.getError());
-        http.end();
-        return false;
-      }
+  portEXIT_CRITICAL(&presetMux);
+  if (queued) powerWake();
+  return queued;
+}
+
+void presetService() {
+  if (presetOpCount == 0 || sessionMode == SESSION_REPLAYING) return;
+
+  PresetOp ops[PRESET_OP_QUEUE];
+  int count;
+  portENTER_CRITICAL(&presetMux);
+  count = presetOpCount;
+  memcpy(ops, presetOps, count * sizeof(PresetOp));
+  presetOpCount = 0;
+  portEXIT_CRITICAL(&presetMux);
+
+  for (int i = 0; i < count; i++) {
+    if (ops[i].store) {
+      storePreset(ops[i].slot, ops[i].name);
+    } else {
+      deletePreset(ops[i].slot);
     }
-  } else {
-    updateStatus = "HTTP error: " + String(httpCode);
-    http.end();
-    return false;
   }
-  
-  http.end();
-  return false;
 }
 
-// Функція для задачі OTA (отримує String* через параметр)
-void otaTask(void *param) {
-  String* urlPtr = (String*)param;
-  performUpdate(*urlPtr);
-  delete urlPtr;
-  updateInProgress = false;
-  vTaskDelete(NULL);
+// Виклик пресету: всі мотори стартують в одному проході, без
+// проміжних перемальовувань та розсилок стану між ними
+bool recallPreset(int slot) {
+  if (slot < 0 || slot >= PRESET_COUNT) return false;
+  const Preset &p = presetTable.slots[slot];
+  if (!p.used) return false;
+
+  Serial.printf("Recalling preset %d \"%s\"\n", slot, p.name);
+
+  int targets[AXIS_COUNT];
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    targets[i] = p.target[i];
+  }
+  moveAllToTargets(targets);
+
+  if ((p.servo != 0) != servoState) {
+    setServoState(p.servo != 0);
+  }
+  return true;
 }
 
-void drawOTAProgress() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(0, 0);
-  display.println("OTA UPDATE");
-  display.println("==========");
-  
-  display.setCursor(0, 20);
-  display.println(updateStatus);
-  
-  int barWidth = SCREEN_WIDTH - 4;
-  int barHeight = 10;
-  int barX = 2;
-  int barY = SCREEN_HEIGHT - barHeight - 10;
-  
-  display.drawRect(barX, barY, barWidth, barHeight, SSD1306_WHITE);
-  
-  int progressWidth = (updateProgress * (barWidth - 2)) / 100;
-  display.fillRect(barX + 1, barY + 1, progressWidth, barHeight - 2, SSD1306_WHITE);
-  
-  display.setCursor(SCREEN_WIDTH/2 - 10, barY - 12);
-  display.printf("%d%%", updateProgress);
-  
-  display.display();
-}
-
-void sendUpdateStatus() {
-  JsonDocument doc;
-  doc["type"] = "update_status";
-  doc["status"] = updateStatus;
-  doc["progress"] = updateProgress;
-  doc["inProgress"] = updateInProgress;
-  doc["latestVersion"] = latestVersion;
-  
-  String output;
-  serializeJson(doc, output);
-  ws.textAll(output);
-}
+void sendPresets() {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  doc["type"] = "presets";
+  JsonArray list = doc["presets"].to<JsonArray>();
 
-// ==== Плавний рух серво ====
-void moveServoSmooth(Servo &servo, int &currentAngle, int targetAngle, int stepDelay) {
-  if (!servo.attached()) return;
-  int step = (targetAngle > currentAngle) ? 1 : -1;
-  while (currentAngle != targetAngle) {
-    currentAngle += step;
-    servo.write(currentAngle);
-    delay(stepDelay);
-  }
-}
+  for (int i = 0; i < PRESET_COUNT; i++) {
+    const Preset &p = presetTable.slots[i];
+    JsonObject item = list.add<JsonObject>();
+    item["slot"] = i;
+    item["used"] = p.used != 0;
+    if (!p.used) continue;
 
-// ==== Servo Control Function ====
-void setServoState(bool state) {
-  servoState = state;
-  if (servoState) {
-    // Вмикаємо: спочатку перший серво
-    if (!myServo1.attached()) {
-      myServo1.attach(servoPins[0], 500, 2400);
+    item["name"] = p.name;
+    item["servo"] = p.servo != 0;
+    JsonArray targets = item["targets"].to<JsonArray>();
+    for (int m = 0; m < AXIS_COUNT; m++) {
+      targets.add(p.target[m]);
     }
-    moveServoSmooth(myServo1, servo1Angle, 180, 15); // повільно до 180
+  }
 
-    delay(500); // затримка 500 мс між увімкненням
+  char output[JSON_MESSAGE_MAX];
+  size_t len = serializeJson(doc, output, sizeof(output));
+  wsBroadcast(output, len);
+}
 
-    // Другий серво (віддзеркалений) – крутимо в протилежний бік (0 градусів)
-    if (!myServo2.attached()) {
-      myServo2.attach(servoPins[1], 500, 2400);
+// ==== Machine config: NVS і гаряче застосування ====
+void loadConfig() {
+  config = configDefaults;
+  preferences.begin("config", true);
+  size_t len = preferences.getBytesLength("blob");
+  // Блоб старішої версії коротший: відсутні поля лишаються за замовчуванням
+  if (len >= offsetof(MachineConfig, minMm) && len <= sizeof(MachineConfig)) {
+    MachineConfig stored = configDefaults;
+    preferences.getBytes("blob", &stored, len);
+    const char* error = nullptr;
+    if (stored.version > CONFIG_VERSION || stored.size != len) {
+      Serial.printf("Config blob v%u (%u bytes) ignored\n", stored.version, (unsigned)len);
+    } else if (!configValid(stored, &error)) {
+      Serial.printf("Config field %s out of range, using defaults\n", error);
+    } else {
+      stored.version = CONFIG_VERSION;
+      stored.size = sizeof(MachineConfig);
+      config = stored;
     }
-    moveServoSmooth(myServo2, servo2Angle, 0, 15);   // повільно до 0
-  } else {
-    // Вимикаємо одночасно – просто детачимо
-    myServo1.detach();
-    myServo2.detach();
   }
-  sendState();
+  preferences.end();
+  Serial.printf("Config: %d..%d mm, %d ms/mm, host %s\n", config.minMm, config.maxMm, config.msPerMm, config.hostname);
 }
 
-// ==== OLED Display ====
-void drawHostnameDisplay() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(0, 0);
-  display.println("Hostname:");
-  display.println("");
-  
-  display.setTextSize(2);
-  display.println(WiFi.getHostname());
-  display.setTextSize(1);
-  display.println("");
-  display.println("stanok.local");
-  display.display();
+void saveConfig() {
+  preferences.begin("config", false);
+  preferences.putBytes("blob", &config, sizeof(config));
+  preferences.end();
 }
 
-void drawMenu() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-
-  // Display header
-  display.drawRect(0, 0, SCREEN_WIDTH, 14, SSD1306_WHITE);
-  display.setCursor(4, 4);
-  
-  const char* headers[] = {
-    "MAIN MENU", "MOTOR CONTROL TYPE", "MOTOR SELECT", 
-    "ACTION SELECT", "DISTANCE CONTROL", "CALIBRATION", "SERVO CONTROL"
-  };
-  display.print(headers[menu_level]);
-
-  // Display menu items
-  display.setCursor(0, 16);
-
-  switch (menu_level) {
-    case 0: {
-      const char* items[] = {"Motor Control", "Calibration", "Servo Control"};
-      for (int i = 0; i < 3; i++) {
-        if (i == menu_index[0]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          display.printf("> %s \n", items[i]);
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          display.printf("  %s \n", items[i]);
-        }
-      }
-      break;
-    }
-      
-    case 1: {
-      const char* items[] = {"All Motors", "Single Motor", "Back"};
-      for (int i = 0; i < 3; i++) {
-        if (i == menu_index[1]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          display.printf("> %s \n", items[i]);
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          display.printf("  %s \n", items[i]);
-        }
-      }
-      break;
-    }
-      
-    case 2: {
-      const char* items[] = {"Motor 0", "Motor 1", "Motor 2", "Motor 3", "Back"};
-      for (int i = 0; i < 5; i++) {
-        if (i == menu_index[2]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          display.printf("> %s \n", items[i]);
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          display.printf("  %s \n", items[i]);
-        }
-      }
-      break;
-    }
-      
-    case 3: {
-      const char* items[] = {"Distance Control", "Forward", "Backward", "Back"};
-      for (int i = 0; i < 4; i++) {
-        if (i == menu_index[3]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          if (i == 1) {
-            display.printf("> Forward [%s] \n", motors[selected_motor].fullForward ? "ON" : "OFF");
-          } else if (i == 2) {
-            display.printf("> Backward [%s] \n", motors[selected_motor].fullBackward ? "ON" : "OFF");
-          } else {
-            display.printf("> %s \n", items[i]);
-          }
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          if (i == 1) {
-            display.printf("  Forward [%s] \n", motors[selected_motor].fullForward ? "ON" : "OFF");
-          } else if (i == 2) {
-            display.printf("  Backward [%s] \n", motors[selected_motor].fullBackward ? "ON" : "OFF");
-          } else {
-            display.printf("  %s \n", items[i]);
-          }
-        }
-      }
-      break;
-    }
-      
-    case 4: {
-      if (menu_index[4] == 0 && edit_value) {
-        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-        display.printf("> Target: [%d mm] \n", motors[selected_motor].target);
-        display.setTextColor(SSD1306_WHITE);
-      } else if (menu_index[4] == 0) {
-        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-        display.printf("> Target: %d mm \n", motors[selected_motor].target);
-        display.setTextColor(SSD1306_WHITE);
-      } else {
-        display.printf("  Target: %d mm \n", motors[selected_motor].target);
-      }
+// Перевіряє зміни й ставить їх у чергу для loop(); викликається з будь-якої задачі
+bool requestConfigChange(JsonObject in, const char** error) {
+  MachineConfig next;
+  portENTER_CRITICAL(&configMux);
+  next = configPendingValid ? configPending : config;
+  portEXIT_CRITICAL(&configMux);
 
-      if (menu_index[4] == 1) {
-        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-        display.printf("> Current: %d mm \n", motors[selected_motor].real_position);
-        display.setTextColor(SSD1306_WHITE);
-      } else {
-        display.printf("  Current: %d mm \n", motors[selected_motor].real_position);
-      }
+  if (!configFromJson(in, next, error)) return false;
 
-      if (menu_index[4] == 2) {
-        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-        display.println("> Confirm");
-        display.setTextColor(SSD1306_WHITE);
-      } else {
-        display.println("  Confirm");
-      }
+  portENTER_CRITICAL(&configMux);
+  configPending = next;
+  configPendingValid = true;
+  portEXIT_CRITICAL(&configMux);
+  powerWake();
+  return true;
+}
 
-      if (menu_index[4] == 3) {
-        display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-        display.println("> Back");
-        display.setTextColor(SSD1306_WHITE);
-      } else {
-        display.println("  Back");
-      }
-      break;
-    }
-      
-    case 5: {
-      const char* items[] = {"Cal. Motor 0", "Cal. Motor 1", "Cal. Motor 2", "Cal. Motor 3", "Back"};
-      for (int i = 0; i < 5; i++) {
-        if (i == menu_index[5]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          if (i < 4) {
-            display.printf("> %s [%s]\n", items[i], motors[i].calibrating ? "ON" : "OFF");
-          } else {
-            display.printf("> %s \n", items[i]);
-          }
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          if (i < 4) {
-            display.printf("  %s [%s]\n", items[i], motors[i].calibrating ? "ON" : "OFF");
-          } else {
-            display.printf("  %s \n", items[i]);
-          }
-        }
-      }
-      break;
-    }
-      
-    case 6: {
-      const char* items[] = {"Servo ON/OFF", "Back"};
-      for (int i = 0; i < 2; i++) {
-        if (i == menu_index[6]) {
-          display.setTextColor(SSD1306_BLACK, SSD1306_WHITE);
-          if (i == 0) {
-            display.printf("> %s [%s]\n", items[i], servoState ? "ON" : "OFF");
-          } else {
-            display.printf("> %s \n", items[i]);
-          }
-          display.setTextColor(SSD1306_WHITE);
-        } else {
-          if (i == 0) {
-            display.printf("  %s [%s]\n", items[i], servoState ? "ON" : "OFF");
-          } else {
-            display.printf("  %s \n", items[i]);
-          }
-        }
-      }
-      break;
+void buildConfigJson(JsonObject out) {
+  out["version"] = CONFIG_VERSION;
+  out["restartRequired"] = configRestartRequired;
+  JsonObject values = out["values"].to<JsonObject>();
+  JsonArray schema = out["schema"].to<JsonArray>();
+  for (const ConfigField &f : configFields) {
+    JsonObject item = schema.add<JsonObject>();
+    item["name"] = f.name;
+    item["type"] = f.type == CONFIG_INT ? "int" : "text";
+    if (f.type == CONFIG_INT) {
+      item["min"] = f.min;
+      item["max"] = f.max;
+      values[f.name] = *configInt(config, f);
+    } else {
+      item["minLength"] = f.min;
+      item["maxLength"] = f.size - 1;
+      if (!(f.flags & CONFIG_SECRET)) values[f.name] = (const char*)configText(config, f);
     }
+    if (f.flags & CONFIG_APPLY_RESTART) item["restart"] = true;
+    if (f.flags & CONFIG_SECRET) item["secret"] = true;
   }
+}
 
-  // Bottom status bar
-  bool any_running = false;
-  for (int i = 0; i < 4; i++) {
-    if (motors[i].running) {
-      any_running = true;
-      break;
-    }
-  }
-  
-  display.drawLine(0, SCREEN_HEIGHT-10, SCREEN_WIDTH, SCREEN_HEIGHT-10, SSD1306_WHITE);
-  display.setCursor(4, SCREEN_HEIGHT-8);
-  display.printf("Status: %s", any_running ? "RUNNING" : "STOPPED");
+void sendConfig() {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  doc["type"] = "config";
+  buildConfigJson(doc.as<JsonObject>());
 
-  display.display();
+  char output[JSON_MESSAGE_MAX];
+  size_t len = serializeJson(doc, output, sizeof(output));
+  wsBroadcast(output, len);
 }
 
-// ==== Encoder ====
-void IRAM_ATTR readEncoder() {
-  static uint8_t lastState = 0;
-  static unsigned long lastInterruptTime = 0;
-  unsigned long interruptTime = millis();
-  
-  if (interruptTime - lastInterruptTime < 5) return;
-  lastInterruptTime = interruptTime;
-  
-  uint8_t state = (digitalRead(encoderPins[0]) << 1) | digitalRead(encoderPins[1]);
-  uint8_t transition = (lastState << 2) | state;
+// Викликається з loop(): нові значення діють з наступного такту керування
+void configService() {
+  if (!configPendingValid || sessionMode == SESSION_REPLAYING) return;
 
-  if (transition == 0b1101 || transition == 0b0100 || transition == 0b0010 || transition == 0b1011) encoder_delta++;
-  if (transition == 0b1110 || transition == 0b0111 || transition == 0b0001 || transition == 0b1000) encoder_delta--;
+  MachineConfig next;
+  portENTER_CRITICAL(&configMux);
+  next = configPending;
+  configPendingValid = false;
+  portEXIT_CRITICAL(&configMux);
 
-  lastState = state;
-}
+  uint8_t changed = 0;
+  bool any = false;
+  for (const ConfigField &f : configFields) {
+    if (memcmp((uint8_t*)&config + f.offset, (uint8_t*)&next + f.offset, f.size) != 0) {
+      changed |= f.flags;
+      any = true;
+    }
+  }
+  if (!any) return;
 
-// ==== Motor Control ====
-void startMotor(int motor, int dir) {
-  if (motor < 0 || motor > 3) return;
-  
-  motors[motor].running = true;
-  motors[motor].dir = dir;
-  motors[motor].move_start_time = millis();
-  motors[motor].last_position_update = millis();
-  
-  digitalWrite(motorPins[motor][0], dir > 0 ? HIGH : LOW);
-  digitalWrite(motorPins[motor][1], dir < 0 ? HIGH : LOW);
-  
-  Serial.printf("Motor %d started, direction: %d\n", motor, dir);
-}
+  portENTER_CRITICAL(&configMux);
+  config = next;
+  portEXIT_CRITICAL(&configMux);
+  saveConfig();
+  Serial.println("Config updated");
 
-void stopMotor(int motor) {
-  if (motor < 0 || motor > 3) return;
-  
-  motors[motor].running = false;
-  motors[motor].fullForward = false;
-  motors[motor].fullBackward = false;
-  motors[motor].calibrating = false;
-  
-  digitalWrite(motorPins[motor][0], LOW);
-  digitalWrite(motorPins[motor][1], LOW);
-  
-  // Зберігаємо позицію після зупинки
-  saveMotorPositions();
-  
-  Serial.printf("Motor %d stopped\n", motor);
-  
+  if (changed & CONFIG_APPLY_LIMITS) {
+    for (int i = 0; i < AXIS_COUNT; i++) {
+      motors[i].target = constrain(motors[i].target, config.minMm, config.maxMm);
+    }
+  }
+  if (changed & CONFIG_APPLY_RELEASES) {
+    cachedReleaseEtag = "";
+    Preferences otaPrefs;
+    otaPrefs.begin("ota", false);
+    otaPrefs.remove("etag");
+    otaPrefs.end();
+  }
+  if (changed & CONFIG_APPLY_RESTART) {
+    configRestartRequired = true;
+  }
+
+  sendConfig();
   sendState();
   drawMenu();
 }
 
-void stopAllMotors() {
-  for (int i = 0; i < 4; i++) {
-    stopMotor(i);
-  }
+void handleConfigRequest(AsyncWebServerRequest *request) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  buildConfigJson(doc.to<JsonObject>());
+
+  char output[JSON_MESSAGE_MAX];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
 }
 
-void toggleFullForward(int motor) {
-  if (motors[motor].fullForward) {
-    stopMotor(motor);
-  } else {
-    motors[motor].calibrating = false;
-    motors[motor].fullBackward = false;
-    motors[motor].fullForward = true;
-    startMotor(motor, 1);
+void handleConfigUpdate(AsyncWebServerRequest *request, const char* body) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  if (deserializeJson(doc, body) || !doc.is<JsonObject>()) {
+    request->send(400, "application/json", "{\"error\":\"invalid JSON\"}");
+    return;
   }
-  sendState();
-  drawMenu();
+  const char* error = nullptr;
+  if (!requestConfigChange(doc.as<JsonObject>(), &error)) {
+    char output[96];
+    snprintf(output, sizeof(output), "{\"error\":\"invalid value\",\"field\":\"%s\"}", error);
+    request->send(422, "application/json", output);
+    return;
+  }
+  request->send(202, "application/json", "{\"accepted\":true}");
 }
 
-void toggleFullBackward(int motor) {
-  if (motors[motor].fullBackward) {
-    stopMotor(motor);
+// ==== OTA Update Functions ====
+void loadUpdateSettings() {
+  preferences.begin("ota", true);
+  updateReleaseUrl = preferences.getString("release_url", "");
+  cachedReleaseEtag = preferences.getString("etag", "");
+  cachedReleaseTag = preferences.getString("tag", "");
+  cachedFirmwareUrl = preferences.getString("fw_url", "");
+  cachedDigestUrl = preferences.getString("sha_url", "");
+  cachedFallbackUrl = preferences.getString("full_url", "");
+  if (strlen(FIRMWARE_VERSION) > 0) {
+    runningVersion = FIRMWARE_VERSION;
   } else {
-    motors[motor].calibrating = false;
-    motors[motor].fullForward = false;
-    motors[motor].fullBackward = true;
-    startMotor(motor, -1);
+    runningVersion = preferences.getString("installed", "");
   }
-  sendState();
-  drawMenu();
+  preferences.end();
+  latestVersion = cachedReleaseTag;
 }
 
-void toggleAllFullForward() {
-  bool allRunning = true;
-  for (int i = 0; i < 4; i++) {
-    if (!motors[i].fullForward) allRunning = false;
+const char* releaseUrl() {
+  if (updateReleaseUrl.length() > 0) return updateReleaseUrl.c_str();
+
+  // Репозиторій береться з конфігурації, тож його зміна діє з наступної перевірки
+  static FixedString<OTA_URL_LEN> githubUrl;
+  githubUrl.format("https://api.github.com/repos/%s/releases/latest", config.githubRepo);
+  return githubUrl.c_str();
+}
+
+// Дозволяє підмінити джерело релізів, напр. локальним HTTP-сервером для тестів
+void setUpdateReleaseUrl(const char* url) {
+  updateReleaseUrl = url ? url : "";
+  cachedReleaseEtag = "";
+
+  Preferences otaPrefs;
+  otaPrefs.begin("ota", false);
+  otaPrefs.putString("release_url", updateReleaseUrl.c_str());
+  otaPrefs.remove("etag");
+  otaPrefs.end();
+  Serial.printf("Release URL set to %s\n", releaseUrl());
+}
+
+// true — знайдено образ; посилання лишаються в cachedFirmwareUrl/cachedFallbackUrl
+bool checkForUpdate() {
+  if (WiFi.status() != WL_CONNECTED) {
+    return false;
   }
   
-  for (int i = 0; i < 4; i++) {
-    if (allRunning) {
-      stopMotor(i);
-    } else {
-      motors[i].calibrating = false;
-      motors[i].fullBackward = false;
-      motors[i].fullForward = true;
-      startMotor(i, 1);
-    }
+  HTTPClient http;
+  http.begin(releaseUrl());
+  http.setUserAgent("ESP32-OTA");
+  // HTTP/1.0 — без chunked-кодування, тож тіло можна розбирати прямо з потоку
+  http.useHTTP10(true);
+
+  const char* headerKeys[] = {"ETag"};
+  http.collectHeaders(headerKeys, 1);
+  if (cachedReleaseEtag.length() > 0) {
+    http.addHeader("If-None-Match", cachedReleaseEtag.c_str());
   }
-  sendState();
-}
+  
+  int httpCode = http.GET();
 
-void toggleAllFullBackward() {
-  bool allRunning = true;
-  for (int i = 0; i < 4; i++) {
-    if (!motors[i].fullBackward) allRunning = false;
+  if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+    http.end();
+    Serial.println("Release info not modified, using cached result");
+    latestVersion = cachedReleaseTag;
+    return !cachedFirmwareUrl.isEmpty();
   }
   
-  for (int i = 0; i < 4; i++) {
-    if (allRunning) {
-      stopMotor(i);
-    } else {
-      motors[i].calibrating = false;
-      motors[i].fullForward = false;
-      motors[i].fullBackward = true;
-      startMotor(i, -1);
-    }
+  if (httpCode != HTTP_CODE_OK) {
+    Serial.printf("Release check failed, HTTP %d\n", httpCode);
+    http.end();
+    return false;
   }
-  sendState();
-}
 
-void toggleCalibration(int motor) {
-  if (motors[motor].calibrating) {
-    stopMotor(motor);
-  } else {
-    motors[motor].fullForward = false;
-    motors[motor].fullBackward = false;
-    motors[motor].calibrating = true;
-    startMotor(motor, -1);
+  // Фільтр відкидає все, крім тегу та назв/посилань асетів
+  JsonArenaScope arena;
+  JsonDocument filter(arena.allocator());
+  filter["tag_name"] = true;
+  filter["assets"][0]["name"] = true;
+  filter["assets"][0]["browser_download_url"] = true;
+
+  JsonDocument doc(arena.allocator());
+  DeserializationError error = deserializeJson(doc, http.getStream(), DeserializationOption::Filter(filter));
+  FixedString<OTA_ETAG_LEN> etag;
+  etag = http.header("ETag");
+  http.end();
+    
+  if (error) {
+    Serial.printf("Release JSON parse failed: %s\n", error.c_str());
+    return false;
   }
-  sendState();
-  drawMenu();
+    
+  latestVersion = doc["tag_name"] | "";
+
+  // Посилання вказують у doc, який живе до кінця функції
+  const char* imageUrl = "";
+  const char* gzipUrl = "";
+  const char* deltaUrl = "";
+  const char* digestUrl = "";
+  FixedString<64> gzipName;
+  FixedString<64> digestName;
+  FixedString<64> deltaName;
+  gzipName.format("%s%s", FIRMWARE_FILENAME, FIRMWARE_GZIP_SUFFIX);
+  digestName.format("%s%s", FIRMWARE_FILENAME, FIRMWARE_DIGEST_SUFFIX);
+  if (!runningVersion.isEmpty()) {
+    deltaName.format("%s%s%s", FIRMWARE_DELTA_PREFIX, runningVersion.c_str(), FIRMWARE_DELTA_SUFFIX);
+  }
+  JsonArray assets = doc["assets"].as<JsonArray>();
+  for (JsonObject asset : assets) {
+    const char* name = asset["name"] | "";
+    const char* url = asset["browser_download_url"] | "";
+    if (strcmp(name, FIRMWARE_FILENAME) == 0) {
+      imageUrl = url;
+    } else if (gzipName == name) {
+      gzipUrl = url;
+    } else if (digestName == name) {
+      digestUrl = url;
+    } else if (!deltaName.isEmpty() && deltaName == name) {
+      deltaUrl = url;
+    }
+  }
+
+  // Найменше завантаження: дельта, далі стиснений образ, далі повний
+  const char* fullUrl = *gzipUrl ? gzipUrl : imageUrl;
+  const char* downloadUrl = *deltaUrl ? deltaUrl : fullUrl;
+
+  cachedReleaseEtag = etag;
+  cachedReleaseTag = latestVersion;
+  cachedFirmwareUrl = downloadUrl;
+  cachedDigestUrl = digestUrl;
+  cachedFallbackUrl = *deltaUrl ? fullUrl : "";
+
+  // Окремий екземпляр: глобальний preferences використовує loop()
+  Preferences otaPrefs;
+  otaPrefs.begin("ota", false);
+  otaPrefs.putString("etag", cachedReleaseEtag.c_str());
+  otaPrefs.putString("tag", cachedReleaseTag.c_str());
+  otaPrefs.putString("fw_url", cachedFirmwareUrl.c_str());
+  otaPrefs.putString("sha_url", cachedDigestUrl.c_str());
+  otaPrefs.putString("full_url", cachedFallbackUrl.c_str());
+  otaPrefs.end();
+
+  return *downloadUrl != '\0';
 }
 
-// WebSocket event handler
-void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
-  switch(type) {
-    case WS_EVT_CONNECT:
-      Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
-      sendState();
-      break;
-      
-    case WS_EVT_DISCONNECT:
-      Serial.printf("WebSocket client #%u disconnected\n", client->id());
-      break;
-      
-    case WS_EVT_DATA: {
-      AwsFrameInfo *info = (AwsFrameInfo*)arg;
-      if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-        data[len] = 0;
-        
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, data);
-        
-        if (error) {
-          Serial.print(F("deserializeJson() failed: "));
-          Serial.println(error.f_str());
-          return;
-        }
-        
-        const char* commandType = doc["type"];
-        JsonObject dataObj = doc["data"];
-        
-        if (strcmp(commandType, "set_target") == 0) {
-          int motor = dataObj["motor"];
-          int target = dataObj["target"];
-          setMotorTarget(motor, target);
+// Задача перевірки: мережевий запит не блокує обробник WebSocket
+void updateCheckTask(void *param) {
+  bool found = checkForUpdate();
+  if (found && !runningVersion.isEmpty() && latestVersion == runningVersion) {
+    updateStatus = "Already up to date";
+    sendUpdateStatus();
+  } else if (found) {
+    updateStatus = "Update found! Starting...";
+    OtaRequest request;
+    request.firmwareUrl = cachedFirmwareUrl;
+    request.fallbackUrl = cachedFallbackUrl;
+    request.digestUrl = cachedDigestUrl;
+    request.version = latestVersion;
+    startOta(request);
+  } else {
+    updateStatus = "No update available";
+    sendUpdateStatus();
+  }
+
+  updateCheckRunning = false;
+  vTaskDelete(NULL);
+}
+
+void startUpdateCheck() {
+  if (updateCheckRunning || updateInProgress) return;
+  updateCheckRunning = true;
+  lastUpdateCheck = nowUs();
+
+  updateStatus = "Checking for updates...";
+  sendUpdateStatus();
+
+  if (xTaskCreate(updateCheckTask, "Update Check", 8192, NULL, 1, NULL) != pdPASS) {
+    updateCheckRunning = false;
+    updateStatus = "Update check failed to start";
+    sendUpdateStatus();
+  }
+}
+
+// ==== OTA image decoder ====
+// Завантаження може бути повним образом, gzip-архівом або дельтою "STDL"
+// від поточної прошивки (у т.ч. стисненою gzip). Формат визначається за
+// першими байтами, тож назва асету не важлива.
+//
+// Дельта: заголовок (magic "STDL", u32 розмір бази, SHA-256 бази,
+// u32 розмір результату), далі команди:
+//   'C' u32 offset, u32 len — копія з поточного розділу
+//   'I' u32 len, байти      — вставка
+// Усі числа little-endian. Генератор: scripts/make_ota_assets.py
+#define DELTA_MAGIC "STDL"
+#define DELTA_HEADER_SIZE 44
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+enum OtaFormat : uint8_t {
+  OTA_FORMAT_UNKNOWN,
+  OTA_FORMAT_RAW,
+  OTA_FORMAT_DELTA
+};
+
+// Порядок станів збігається з порядком полів заголовка gzip
+enum GzipState : uint8_t {
+  GZ_HEADER,
+  GZ_EXTRA_LEN,
+  GZ_EXTRA,
+  GZ_NAME,
+  GZ_COMMENT,
+  GZ_HCRC,
+  GZ_BODY,
+  GZ_TRAILER,
+  GZ_DONE
+};
+
+enum DeltaState : uint8_t {
+  DELTA_HEADER,
+  DELTA_OP,
+  DELTA_INSERT
+};
+
+struct OtaDecoder {
+  size_t downloadSize;
+  bool started;
+
+  // Шар gzip
+  bool gzip;
+  GzipState gzState;
+  uint8_t gzFlags;
+  uint8_t gzField[10];          // заголовок або трейлер
+  uint32_t gzCount;
+  uint32_t gzSkip;
+  uint32_t gzCrc;
+  uint32_t gzSize;
+  tinfl_decompressor *inflator;
+  uint8_t *window;              // словник 32 КБ, він же вихідний буфер
+  size_t windowPos;
+
+  // Образ або дельта
+  OtaFormat format;
+  DeltaState deltaState;
+  uint8_t field[DELTA_HEADER_SIZE];  // magic, заголовок дельти або команда
+  size_t fieldLen;
+  uint32_t baseSize;
+  uint32_t targetSize;
+  uint32_t insertLeft;
+  const esp_partition_t *base;
+  uint8_t copyBuffer[OTA_COPY_CHUNK];
+
+  size_t imageSize;             // UPDATE_SIZE_UNKNOWN для gzip з повним образом
+  size_t written;
+  mbedtls_sha256_context sha;   // SHA-256 образу, що пишеться у flash
+  const char *error;
+  bool deltaRejected;           // дельта зроблена не від поточної прошивки
+};
+
+uint32_t readLe32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool otaFail(OtaDecoder &dec, const char *error) {
+  if (!dec.error) dec.error = error;
+  return false;
+}
+
+void otaDecoderInit(OtaDecoder &dec, size_t downloadSize) {
+  memset(&dec, 0, sizeof(dec));
+  dec.downloadSize = downloadSize;
+  dec.imageSize = UPDATE_SIZE_UNKNOWN;
+  mbedtls_sha256_init(&dec.sha);
+  mbedtls_sha256_starts(&dec.sha, 0);
+}
+
+void otaDecoderFree(OtaDecoder &dec) {
+  free(dec.inflator);
+  free(dec.window);
+  dec.inflator = nullptr;
+  dec.window = nullptr;
+  mbedtls_sha256_free(&dec.sha);
+}
+
+bool otaBeginImage(OtaDecoder &dec, size_t size) {
+  if (size != UPDATE_SIZE_UNKNOWN && size > ESP.getFreeSketchSpace() - 0x1000) {
+    return otaFail(dec, "Not enough space");
+  }
+  if (!Update.begin(size)) {
+    return otaFail(dec, "Update begin failed");
+  }
+  dec.imageSize = size;
+  return true;
+}
+
+bool otaWriteImage(OtaDecoder &dec, const uint8_t *data, size_t len) {
+  if (len == 0) return true;
+  if (dec.imageSize != UPDATE_SIZE_UNKNOWN && dec.written + len > dec.imageSize) {
+    return otaFail(dec, "Image larger than declared");
+  }
+  mbedtls_sha256_update(&dec.sha, data, len);
+  if (Update.write((uint8_t*)data, len) != len) {
+    return otaFail(dec, "Flash write failed");
+  }
+  dec.written += len;
+  return true;
+}
+
+// Перевіряє, що дельта зроблена саме від прошивки в поточному розділі
+bool deltaStart(OtaDecoder &dec) {
+  dec.baseSize = readLe32(dec.field + 4);
+  dec.targetSize = readLe32(dec.field + 40);
+  dec.base = esp_ota_get_running_partition();
+  if (!dec.base || dec.baseSize > dec.base->size) {
+    dec.deltaRejected = true;
+    return otaFail(dec, "Delta base mismatch");
+  }
+
+  mbedtls_sha256_context baseSha;
+  mbedtls_sha256_init(&baseSha);
+  mbedtls_sha256_starts(&baseSha, 0);
+  bool readOk = true;
+  for (uint32_t offset = 0; offset < dec.baseSize && readOk; offset += OTA_COPY_CHUNK) {
+    size_t len = min((uint32_t)OTA_COPY_CHUNK, dec.baseSize - offset);
+    readOk = esp_partition_read(dec.base, offset, dec.copyBuffer, len) == ESP_OK;
+    mbedtls_sha256_update(&baseSha, dec.copyBuffer, len);
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&baseSha, digest);
+  mbedtls_sha256_free(&baseSha);
+
+  if (!readOk) {
+    return otaFail(dec, "Running partition read failed");
+  }
+  if (memcmp(digest, dec.field + 8, sizeof(digest)) != 0) {
+    dec.deltaRejected = true;
+    return otaFail(dec, "Delta base mismatch");
+  }
+  return otaBeginImage(dec, dec.targetSize);
+}
+
+bool deltaCopy(OtaDecoder &dec, uint32_t offset, uint32_t len) {
+  if (offset > dec.baseSize || len > dec.baseSize - offset) {
+    return otaFail(dec, "Delta copy out of range");
+  }
+  while (len > 0) {
+    size_t part = min((uint32_t)OTA_COPY_CHUNK, len);
+    if (esp_partition_read(dec.base, offset, dec.copyBuffer, part) != ESP_OK) {
+      return otaFail(dec, "Running partition read failed");
+    }
+    if (!otaWriteImage(dec, dec.copyBuffer, part)) return false;
+    offset += part;
+    len -= part;
+  }
+  return true;
+}
+
+bool deltaFeed(OtaDecoder &dec, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    switch (dec.deltaState) {
+      case DELTA_HEADER: {
+        size_t take = min(len, DELTA_HEADER_SIZE - dec.fieldLen);
+        memcpy(dec.field + dec.fieldLen, data, take);
+        dec.fieldLen += take;
+        data += take;
+        len -= take;
+        if (dec.fieldLen == DELTA_HEADER_SIZE) {
+          if (!deltaStart(dec)) return false;
+          dec.fieldLen = 0;
+          dec.deltaState = DELTA_OP;
         }
-        else if (strcmp(commandType, "calibrate") == 0) {
-          int motor = dataObj["motor"];
-          toggleCalibration(motor);
+        break;
+      }
+
+      case DELTA_OP: {
+        dec.field[dec.fieldLen++] = *data++;
+        len--;
+        uint8_t op = dec.field[0];
+        if (op != 'C' && op != 'I') {
+          return otaFail(dec, "Bad delta opcode");
         }
-        else if (strcmp(commandType, "set_all_targets") == 0) {
-          int target = dataObj["target"];
-          for (int i = 0; i < 4; i++) {
-            setMotorTarget(i, target);
-          }
+        size_t need = (op == 'C') ? 9 : 5;
+        if (dec.fieldLen < need) break;
+
+        dec.fieldLen = 0;
+        if (op == 'C') {
+          if (!deltaCopy(dec, readLe32(dec.field + 1), readLe32(dec.field + 5))) return false;
+        } else {
+          dec.insertLeft = readLe32(dec.field + 1);
+          if (dec.insertLeft > 0) dec.deltaState = DELTA_INSERT;
         }
-        else if (strcmp(commandType, "calibrate_all") == 0) {
-          for (int i = 0; i < 4; i++) {
-            toggleCalibration(i);
+        break;
+      }
+
+      case DELTA_INSERT: {
+        size_t take = min(len, (size_t)dec.insertLeft);
+        if (!otaWriteImage(dec, data, take)) return false;
+        data += take;
+        len -= take;
+        dec.insertLeft -= take;
+        if (dec.insertLeft == 0) dec.deltaState = DELTA_OP;
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// Розпакований потік: повний образ або дельта
+bool imageFeed(OtaDecoder &dec, const uint8_t *data, size_t len) {
+  if (dec.format == OTA_FORMAT_UNKNOWN) {
+    while (len > 0 && dec.fieldLen < 4) {
+      dec.field[dec.fieldLen++] = *data++;
+      len--;
+    }
+    if (dec.fieldLen < 4) return true;
+
+    if (memcmp(dec.field, DELTA_MAGIC, 4) == 0) {
+      dec.format = OTA_FORMAT_DELTA;
+      dec.deltaState = DELTA_HEADER;
+    } else {
+      dec.format = OTA_FORMAT_RAW;
+      if (!otaBeginImage(dec, dec.gzip ? UPDATE_SIZE_UNKNOWN : dec.downloadSize)) return false;
+      if (!otaWriteImage(dec, dec.field, 4)) return false;
+      dec.fieldLen = 0;
+    }
+  }
+
+  if (dec.format == OTA_FORMAT_RAW) {
+    return otaWriteImage(dec, data, len);
+  }
+  return deltaFeed(dec, data, len);
+}
+
+void gzipEnter(OtaDecoder &dec, GzipState state) {
+  dec.gzState = state;
+  dec.gzCount = 0;
+  dec.gzSkip = (state == GZ_HCRC) ? 2 : 0;
+}
+
+// Наступне необов'язкове поле заголовка після поточного
+GzipState gzipNextField(uint8_t flags, GzipState current) {
+  if (current < GZ_EXTRA_LEN && (flags & GZIP_FLAG_EXTRA)) return GZ_EXTRA_LEN;
+  if (current < GZ_NAME && (flags & GZIP_FLAG_NAME)) return GZ_NAME;
+  if (current < GZ_COMMENT && (flags & GZIP_FLAG_COMMENT)) return GZ_COMMENT;
+  if (current < GZ_HCRC && (flags & GZIP_FLAG_HCRC)) return GZ_HCRC;
+  return GZ_BODY;
+}
+
+// Розпаковує deflate у кільцевий словник і одразу віддає вихід далі
+bool gzipInflate(OtaDecoder &dec, const uint8_t *&data, size_t &len) {
+  tinfl_status status;
+  do {
+    size_t inBytes = len;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - dec.windowPos;
+    status = tinfl_decompress(dec.inflator, data, &inBytes, dec.window,
+                              dec.window + dec.windowPos, &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+    data += inBytes;
+    len -= inBytes;
+
+    if (outBytes > 0) {
+      uint8_t *out = dec.window + dec.windowPos;
+      dec.gzCrc = crc32_le(dec.gzCrc, out, outBytes);
+      dec.gzSize += outBytes;
+      if (!imageFeed(dec, out, outBytes)) return false;
+      dec.windowPos = (dec.windowPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    if (status < TINFL_STATUS_DONE) {
+      return otaFail(dec, "Corrupt gzip stream");
+    }
+    if (status == TINFL_STATUS_DONE) {
+      gzipEnter(dec, GZ_TRAILER);
+      return true;
+    }
+  } while (len > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT);
+  return true;
+}
+
+bool gzipFeed(OtaDecoder &dec, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    switch (dec.gzState) {
+      case GZ_HEADER:
+        dec.gzField[dec.gzCount++] = *data++;
+        len--;
+        if (dec.gzCount == 10) {
+          if (dec.gzField[2] != 8) {
+            return otaFail(dec, "Unsupported gzip method");
           }
+          dec.gzFlags = dec.gzField[3];
+          gzipEnter(dec, gzipNextField(dec.gzFlags, GZ_HEADER));
         }
-        else if (strcmp(commandType, "emergency_stop") == 0) {
-          stopAllMotors();
-        }
-        else if (strcmp(commandType, "set_servo") == 0) {
-          bool state = dataObj["state"];
-          setServoState(state);
-        }
-        else if (strcmp(commandType, "full_forward") == 0) {
-          int motor = dataObj["motor"];
-          toggleFullForward(motor);
-        }
-        else if (strcmp(commandType, "full_backward") == 0) {
-          int motor = dataObj["motor"];
-          toggleFullBackward(motor);
-        }
-        else if (strcmp(commandType, "all_full_forward") == 0) {
-          toggleAllFullForward();
-        }
-        else if (strcmp(commandType, "all_full_backward") == 0) {
-          toggleAllFullBackward();
-        }
-        else if (strcmp(commandType, "get_ip") == 0) {
-          sendState();
-        }
-        else if (strcmp(commandType, "check_update") == 0) {
-          String firmwareUrl = checkForUpdate();
-          if (firmwareUrl != "") {
-            updateStatus = "Update found! Starting...";
-            updateInProgress = true;
-            sendUpdateStatus();
-            
-            // Передаємо URL через копію в купі
-            String* urlPtr = new String(firmwareUrl);
-            xTaskCreate(otaTask, "OTA Task", 8192, urlPtr, 1, NULL);
-          } else {
-            updateStatus = "No update available";
-            sendUpdateStatus();
-          }
+        break;
+
+      case GZ_EXTRA_LEN:
+        dec.gzSkip |= (uint32_t)(*data++) << (8 * dec.gzCount++);
+        len--;
+        if (dec.gzCount == 2) {
+          uint32_t skip = dec.gzSkip;
+          gzipEnter(dec, GZ_EXTRA);
+          dec.gzSkip = skip;
         }
-        else if (strcmp(commandType, "perform_update") == 0) {
-          String firmwareUrl = dataObj["url"].as<String>();
-          if (firmwareUrl != "") {
-            updateStatus = "Starting update...";
-            updateInProgress = true;
-            sendUpdateStatus();
-            
-            String* urlPtr = new String(firmwareUrl);
-            xTaskCreate(otaTask, "OTA Task", 8192, urlPtr, 1, NULL);
+        break;
+
+      case GZ_EXTRA:
+      case GZ_HCRC: {
+        size_t take = min(len, (size_t)dec.gzSkip);
+        data += take;
+        len -= take;
+        dec.gzSkip -= take;
+        if (dec.gzSkip == 0) gzipEnter(dec, gzipNextField(dec.gzFlags, dec.gzState));
+        break;
+      }
+
+      case GZ_NAME:
+      case GZ_COMMENT:
+        len--;
+        if (*data++ == 0) gzipEnter(dec, gzipNextField(dec.gzFlags, dec.gzState));
+        break;
+
+      case GZ_BODY:
+        if (!gzipInflate(dec, data, len)) return false;
+        break;
+
+      case GZ_TRAILER:
+        dec.gzField[dec.gzCount++] = *data++;
+        len--;
+        if (dec.gzCount == 8) {
+          if (readLe32(dec.gzField) != dec.gzCrc || readLe32(dec.gzField + 4) != dec.gzSize) {
+            return otaFail(dec, "gzip CRC mismatch");
           }
+          dec.gzState = GZ_DONE;
         }
-        else if (strcmp(commandType, "restart") == 0) {
-          ESP.restart();
-        }
-        else if (strcmp(commandType, "reset_wifi") == 0) {
-          wm.resetSettings();
-          ESP.restart();
-        }
+        break;
+
+      case GZ_DONE:
+        return true;
+    }
+  }
+  return true;
+}
+
+bool otaDecode(OtaDecoder &dec, const uint8_t *data, size_t len) {
+  if (!dec.started) {
+    dec.started = true;
+    if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+      dec.gzip = true;
+      dec.inflator = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+      dec.window = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+      if (!dec.inflator || !dec.window) {
+        return otaFail(dec, "Not enough memory for gzip");
+      }
+      tinfl_init(dec.inflator);
+    }
+  }
+  return dec.gzip ? gzipFeed(dec, data, len) : imageFeed(dec, data, len);
+}
+
+// Після останнього блоку: потік має бути повним на кожному шарі
+bool otaDecoderFinish(OtaDecoder &dec) {
+  if (dec.gzip && dec.gzState != GZ_DONE) {
+    return otaFail(dec, "Truncated gzip stream");
+  }
+  if (dec.format == OTA_FORMAT_UNKNOWN) {
+    return otaFail(dec, "Image too short");
+  }
+  if (dec.format == OTA_FORMAT_DELTA &&
+      (dec.deltaState != DELTA_OP || dec.fieldLen != 0 || dec.written != dec.targetSize)) {
+    return otaFail(dec, "Truncated delta");
+  }
+  return true;
+}
+
+// ==== OTA download pipeline ====
+// Мережа читає в один буфер, поки задача-записувач декодує інший у flash
+struct OtaChunk {
+  uint8_t index;
+  uint16_t len;            // 0 — кінець потоку
+};
+
+struct OtaPipeline {
+  QueueHandle_t freeQueue;   // індекси вільних буферів
+  QueueHandle_t fullQueue;   // заповнені OtaChunk для запису
+  SemaphoreHandle_t done;
+  volatile bool failed;
+  OtaDecoder decoder;
+};
+
+static uint8_t otaBuffers[OTA_BUFFER_COUNT][OTA_CHUNK_SIZE];
+
+void otaWriterTask(void *param) {
+  OtaPipeline *pipeline = (OtaPipeline*)param;
+  OtaChunk chunk;
+
+  while (xQueueReceive(pipeline->fullQueue, &chunk, portMAX_DELAY) == pdTRUE) {
+    if (chunk.len == 0) break;
+    if (!pipeline->failed && !otaDecode(pipeline->decoder, otaBuffers[chunk.index], chunk.len)) {
+      pipeline->failed = true;
+    }
+    xQueueSend(pipeline->freeQueue, &chunk.index, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(pipeline->done);
+  vTaskDelete(NULL);
+}
+
+// 64 hex-символи на початку тексту (формат sha256sum теж підходить)
+bool parseHexDigest(const char* text, uint8_t digest[32]) {
+  while (*text == ' ' || *text == '\n' || *text == '\r' || *text == '\t') text++;
+  for (int i = 0; i < 32; i++) {
+    uint8_t value = 0;
+    for (int j = 0; j < 2; j++) {
+      char c = text[i * 2 + j];
+      value <<= 4;
+      if (c >= '0' && c <= '9') value |= c - '0';
+      else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+      else return false;
+    }
+    digest[i] = value;
+  }
+  return true;
+}
+
+bool fetchExpectedDigest(const OtaRequest &request, uint8_t digest[32]) {
+  if (request.expectedDigest.length() > 0) {
+    return parseHexDigest(request.expectedDigest.c_str(), digest);
+  }
+  if (request.digestUrl.length() == 0) {
+    return false;
+  }
+
+  HTTPClient http;
+  http.begin(request.digestUrl.c_str());
+  http.setUserAgent("ESP32-OTA");
+  http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+  http.setTimeout(OTA_HTTP_TIMEOUT);
+
+  bool ok = false;
+  if (http.GET() == HTTP_CODE_OK) {
+    String text = http.getString();
+    ok = parseHexDigest(text.c_str(), digest);
+  }
+  http.end();
+  return ok;
+}
+
+// offset > 0 — дозавантаження з HTTP Range після обриву
+bool openFirmwareStream(HTTPClient &http, const char* url, size_t offset) {
+  http.begin(url);
+  http.setUserAgent("ESP32-OTA");
+  http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+  http.setTimeout(OTA_HTTP_TIMEOUT);
+
+  if (offset > 0) {
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%u-", (unsigned)offset);
+    http.addHeader("Range", range);
+  }
+
+  int httpCode = http.GET();
+  int expected = offset > 0 ? HTTP_CODE_PARTIAL_CONTENT : HTTP_CODE_OK;
+  if (httpCode != expected) {
+    updateStatus.format("HTTP error: %d", httpCode);
+    http.end();
+    return false;
+  }
+  return true;
+}
+
+// Розсилка прогресу: не частіше ніж кожні OTA_PROGRESS_STEP відсотків
+// або OTA_PROGRESS_INTERVAL мс, замість повідомлення на кожен блок
+void reportOtaProgress(size_t received, size_t total) {
+  static int lastSentProgress = 0;
+  static TimeUs lastSentTime = 0;
+  static TimeUs lastDrawTime = 0;
+
+  int progress = (received * 100) / total;
+  if (received == 0) {
+    lastSentProgress = 0;
+    lastSentTime = nowUs();
+  }
+  if (progress == updateProgress) return;
+  updateProgress = progress;
+
+  if (progress - lastSentProgress >= OTA_PROGRESS_STEP ||
+      intervalElapsed(lastSentTime, msToUs(OTA_PROGRESS_INTERVAL)) ||
+      progress == 100) {
+    lastSentProgress = progress;
+    lastSentTime = nowUs();
+    sendUpdateStatus();
+  }
+
+  if (intervalElapsed(lastDrawTime, msToUs(500))) {
+    drawOTAProgress();
+    lastDrawTime = nowUs();
+  }
+}
+
+// Читає завантаження в буфери конвеєра і при обриві з'єднання
+// продовжує з місця зупинки
+bool downloadFirmware(HTTPClient &http, const char* url, size_t total, OtaPipeline &pipeline) {
+  WiFiClient *stream = http.getStreamPtr();
+  size_t received = 0;
+  int retries = 0;
+
+  reportOtaProgress(0, total);
+
+  while (received < total) {
+    uint8_t index;
+    xQueueReceive(pipeline.freeQueue, &index, portMAX_DELAY);
+    if (pipeline.failed) {
+      return false;
+    }
+
+    size_t want = min((size_t)OTA_CHUNK_SIZE, total - received);
+    size_t fill = 0;
+    while (fill < want) {
+      size_t read = stream ? stream->readBytes(otaBuffers[index] + fill, want - fill) : 0;
+      if (read > 0) {
+        fill += read;
+        continue;
+      }
+
+      if (++retries > OTA_MAX_RETRIES) {
+        updateStatus = "Download failed after retries";
+        return false;
+      }
+      Serial.printf("OTA stream stalled at %u bytes, resuming (%d/%d)\n",
+                    (unsigned)(received + fill), retries, OTA_MAX_RETRIES);
+      http.end();
+      vTaskDelay(pdMS_TO_TICKS(retries * 1000));
+      stream = openFirmwareStream(http, url, received + fill) ? http.getStreamPtr() : nullptr;
+    }
+
+    received += fill;
+
+    OtaChunk chunk = {index, (uint16_t)fill};
+    xQueueSend(pipeline.fullQueue, &chunk, portMAX_DELAY);
+    reportOtaProgress(received, total);
+  }
+  return true;
+}
+
+bool performUpdate(const OtaRequest &request, const char* url, bool &deltaRejected) {
+  deltaRejected = false;
+  if (WiFi.status() != WL_CONNECTED) {
+    updateStatus = "WiFi not connected";
+    return false;
+  }
+
+  uint8_t expectedDigest[32];
+  bool haveDigest = fetchExpectedDigest(request, expectedDigest);
+  if (!haveDigest) {
+    Serial.println("No published SHA-256, image will not be verified");
+  }
+
+  HTTPClient http;
+  if (!openFirmwareStream(http, url, 0)) {
+    return false;
+  }
+
+  int contentLength = http.getSize();
+  if (contentLength <= 0) {
+    updateStatus = "Unknown firmware size";
+    http.end();
+    return false;
+  }
+
+  // Update.begin() викликає декодер, коли стане відомий розмір образу
+  OtaPipeline pipeline;
+  pipeline.freeQueue = xQueueCreate(OTA_BUFFER_COUNT, sizeof(uint8_t));
+  pipeline.fullQueue = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(OtaChunk));
+  pipeline.done = xSemaphoreCreateBinary();
+  pipeline.failed = false;
+  otaDecoderInit(pipeline.decoder, contentLength);
+  for (uint8_t i = 0; i < OTA_BUFFER_COUNT; i++) {
+    xQueueSend(pipeline.freeQueue, &i, 0);
+  }
+  xTaskCreate(otaWriterTask, "OTA Writer", 4096, &pipeline, 2, NULL);
+
+  updateStatus = "Downloading...";
+  bool downloaded = downloadFirmware(http, url, contentLength, pipeline);
+  http.end();
+
+  // Дочікуємось, поки записувач допише все з черги
+  OtaChunk endChunk = {0, 0};
+  xQueueSend(pipeline.fullQueue, &endChunk, portMAX_DELAY);
+  xSemaphoreTake(pipeline.done, portMAX_DELAY);
+  vQueueDelete(pipeline.freeQueue);
+  vQueueDelete(pipeline.fullQueue);
+  vSemaphoreDelete(pipeline.done);
+
+  OtaDecoder &decoder = pipeline.decoder;
+  if (downloaded && !pipeline.failed && !otaDecoderFinish(decoder)) {
+    pipeline.failed = true;
+  }
+
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&decoder.sha, digest);
+  bool sizeUnknown = decoder.imageSize == UPDATE_SIZE_UNKNOWN;
+  deltaRejected = decoder.deltaRejected;
+  const char* decodeError = decoder.error;
+  otaDecoderFree(decoder);
+
+  if (pipeline.failed) {
+    const char* reason = decodeError ? decodeError : "Update failed";
+    if (Update.hasError()) {
+      updateStatus.format("%s: %u", reason, (unsigned)Update.getError());
+    } else {
+      updateStatus = reason;
+    }
+  }
+  if (!downloaded || pipeline.failed) {
+    Update.abort();
+    return false;
+  }
+
+  if (haveDigest && memcmp(digest, expectedDigest, sizeof(digest)) != 0) {
+    updateStatus = "SHA-256 mismatch, update rejected";
+    Update.abort();
+    return false;
+  }
+
+  // Для gzip розмір образу наперед невідомий — завершуємо за фактом
+  if (Update.end(sizeUnknown)) {
+    // Тег потрібен, щоб наступна перевірка знайшла дельту від цієї версії
+    Preferences otaPrefs;
+    otaPrefs.begin("ota", false);
+    if (request.version.length() > 0) {
+      otaPrefs.putString("installed", request.version.c_str());
+    } else {
+      otaPrefs.remove("installed");
+    }
+    otaPrefs.remove("etag");
+    otaPrefs.end();
+    logEvent(LOG_OTA_DONE);
+
+    updateStatus = haveDigest ? "Update verified! Restarting..." : "Update complete! Restarting...";
+    updateProgress = 100;
+    sendUpdateStatus();
+
+    delay(2000);
+    ESP.restart();
+    return true;
+  }
+
+  updateStatus.format("Update failed: %u", (unsigned)Update.getError());
+  return false;
+}
+
+// Функція для задачі OTA (запит бере зі слота otaRequest)
+void otaTask(void *param) {
+  const OtaRequest &request = otaRequest;
+  bool deltaRejected = false;
+  bool ok = performUpdate(request, request.firmwareUrl.c_str(), deltaRejected);
+
+  // Дельта від іншої прошивки (напр. після прошивки по USB) — качаємо повний образ
+  if (!ok && deltaRejected && request.fallbackUrl.length() > 0) {
+    Serial.println("Delta does not match running firmware, downloading full image");
+    updateStatus = "Delta rejected, downloading full image...";
+    updateProgress = 0;
+    sendUpdateStatus();
+    ok = performUpdate(request, request.fallbackUrl.c_str(), deltaRejected);
+  }
+
+  updateInProgress = false;
+  if (!ok) {
+    logEvent(LOG_OTA_FAILED);
+    sendUpdateStatus();
+  }
+  vTaskDelete(NULL);
+}
+
+void startOta(const OtaRequest &request) {
+  // Слот зайнятий, доки працює попереднє оновлення
+  if (updateInProgress) return;
+  otaRequest = request;
+  updateInProgress = true;
+  updateProgress = 0;
+  sendUpdateStatus();
+  logEvent(LOG_OTA_START);
+
+  xTaskCreate(otaTask, "OTA Task", 8192, NULL, 1, NULL);
+}
+
+
+void drawOTAProgress() {
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(SSD1306_WHITE);
+  
+  display.setCursor(0, 0);
+  display.println("OTA UPDATE");
+  display.println("==========");
+  
+  display.setCursor(0, 20);
+  display.println(updateStatus.c_str());
+  
+  int barWidth = SCREEN_WIDTH - 4;
+  int barHeight = 10;
+  int barX = 2;
+  int barY = SCREEN_HEIGHT - barHeight - 10;
+  
+  display.drawRect(barX, barY, barWidth, barHeight, SSD1306_WHITE);
+  
+  int progressWidth = (updateProgress * (barWidth - 2)) / 100;
+  display.fillRect(barX + 1, barY + 1, progressWidth, barHeight - 2, SSD1306_WHITE);
+  
+  display.setCursor(SCREEN_WIDTH/2 - 10, barY - 12);
+  display.printf("%d%%", updateProgress);
+  
+  display.display();
+}
+
+void sendUpdateStatus() {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  doc["type"] = "update_status";
+  doc["status"] = updateStatus.c_str();
+  doc["progress"] = updateProgress;
+  doc["inProgress"] = updateInProgress;
+  doc["latestVersion"] = latestVersion.c_str();
+  doc["currentVersion"] = runningVersion.c_str();
+  
+  char output[JSON_MESSAGE_MAX];
+  size_t len = serializeJson(doc, output, sizeof(output));
+  wsBroadcast(output, len);
+}
+
+// ==== Плавний рух серво ====
+void moveServoSmooth(Servo &servo, int &currentAngle, int targetAngle, int stepDelay) {
+  if (!servo.attached()) return;
+  int step = (targetAngle > currentAngle) ? 1 : -1;
+  while (currentAngle != targetAngle) {
+    currentAngle += step;
+    servo.write(currentAngle);
+    delay(stepDelay);
+  }
+}
+
+// ==== Servo Control Function ====
+void setServoState(bool state) {
+  servoState = state;
+  // Відтворення сесії змінює лише стан, серво не рухаються
+  if (sessionMode == SESSION_REPLAYING) {
+    sendState();
+    return;
+  }
+  if (servoState) {
+    // Вмикаємо: спочатку перший серво
+    if (!myServo1.attached()) {
+      myServo1.attach(servoPins[0], 500, 2400);
+    }
+    moveServoSmooth(myServo1, servo1Angle, config.servo1Angle, config.servoStepMs); // повільно
+
+    delay(config.servoPairDelayMs); // затримка між увімкненням
+
+    // Другий серво (віддзеркалений) – крутимо в протилежний бік
+    if (!myServo2.attached()) {
+      myServo2.attach(servoPins[1], 500, 2400);
+    }
+    moveServoSmooth(myServo2, servo2Angle, config.servo2Angle, config.servoStepMs);
+  } else {
+    // Вимикаємо одночасно – просто детачимо
+    myServo1.detach();
+    myServo2.detach();
+  }
+  sendState();
+}
+
+// ==== OLED Display ====
+void drawHostnameDisplay() {
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(SSD1306_WHITE);
+  
+  display.setCursor(0, 0);
+  if (networkState == NET_PORTAL) {
+    display.println("WiFi setup AP:");
+    display.println("");
+    display.setTextSize(2);
+    display.println(WIFI_AP_NAME);
+    display.setTextSize(1);
+    display.println("");
+    display.println("192.168.4.1");
+    display.display();
+    return;
+  }
+
+  display.println("Hostname:");
+  display.println("");
+  
+  display.setTextSize(2);
+  display.println(WiFi.getHostname());
+  display.setTextSize(1);
+  display.println("");
+  display.printf("%s.local\n", config.hostname);
+  display.display();
+}
+
+void drawMenu() {
+  if (deferUpdates || sessionMode == SESSION_REPLAYING) {
+    menuPending = true;
+    return;
+  }
+  // Меню перемалюється, коли закриється підказка з hostname
+  if (showIP) return;
+  TraceScope trace(TRACE_DRAW_MENU, menu_level);
+  uint32_t renderStart = ESP.getCycleCount();
+  renderMenu();
+
+  uint32_t flushStart = ESP.getCycleCount();
+  metricRecord(METRIC_MENU_RENDER, flushStart - renderStart);
+  display.display();
+  metricRecord(METRIC_MENU_FLUSH, ESP.getCycleCount() - flushStart);
+}
+
+// Малює меню в буфер дисплея; на екран його передає display.display()
+void renderMenu() {
+  MenuView view = {menu_level, menu_index, selected_motor, edit_value, &motors[0], servoState, &presetTable};
+  renderMenu(display, view);
+}
+
+// ==== Encoder ====
+// Декодування квадратури і прискорення — у include/encoder.h
+
+// digitalRead() лежить у flash і недоступний з ISR під час запису в NVS,
+// тому читаємо регістри GPIO напряму
+static inline uint8_t IRAM_ATTR readPinFast(int pin) {
+  if (pin < 32) return (GPIO.in >> pin) & 1;
+  return (GPIO.in1.val >> (pin - 32)) & 1;
+}
+
+void IRAM_ATTR readEncoder() {
+  static uint8_t lastState = 0;
+
+  uint8_t ab = (readPinFast(encoderPins[0]) << 1) | readPinFast(encoderPins[1]);
+  int8_t step = quadratureStep(lastState, ab);
+  if (step == 0) return;
+
+  portENTER_CRITICAL_ISR(&encoderMux);
+  encoder_steps += step;
+  portEXIT_CRITICAL_ISR(&encoderMux);
+  powerWakeFromISR();
+}
+
+// Забирає накопичені переходи і повертає кількість повних клацань.
+// Залишок зберігається до наступного виклику, тож жоден перехід не губиться.
+int takeEncoderDetents() {
+  portENTER_CRITICAL(&encoderMux);
+  int32_t steps = encoder_steps;
+  encoder_steps = 0;
+  portEXIT_CRITICAL(&encoderMux);
+
+  return quadratureDetents(encoder_residual, steps);
+}
+
+int encoderAcceleration(int detents) {
+  return encoderAccelerate(detents, lastDetentTime, controlNowUs());
+}
+
+void handleEncoderDetents(int detents) {
+  int accelerated = encoderAcceleration(detents);
+
+  if (menu_level == 4 && edit_value) {
+    motors[selected_motor].target += accelerated;
+    motors[selected_motor].target = constrain(motors[selected_motor].target, config.minMm, config.maxMm);
+  } else if (menu_level == 8) {
+    // Jog: енкодер напряму веде вісь, ціль застосовується одразу
+    if (selected_motor == -1) {
+      int targets[AXIS_COUNT];
+      for (int i = 0; i < AXIS_COUNT; i++) {
+        targets[i] = constrain(motors[i].target + accelerated, config.minMm, config.maxMm);
+      }
+      moveAllToTargets(targets);
+    } else {
+      int target = constrain(motors[selected_motor].target + accelerated, config.minMm, config.maxMm);
+      if (target != motors[selected_motor].target) {
+        setMotorTarget(selected_motor, target);
+      }
+    }
+  } else {
+    // У меню кожне клацання — рівно один пункт, без прискорення
+    menu_index[menu_level] += detents;
+
+    int max_indices[] = {3, 2, AXIS_COUNT, 4, 3, AXIS_COUNT, 1, PRESET_COUNT, 0};
+    menu_index[menu_level] = constrain(menu_index[menu_level], 0, max_indices[menu_level]);
+  }
+}
+
+// ==== Stop model: вимірювання і компенсація ====
+void loadMotionModel() {
+  MotionModelBlob blob;
+  memset(&blob, 0, sizeof(blob));
+  preferences.begin("motion", true);
+  if (preferences.getBytesLength("model") == sizeof(blob)) {
+    preferences.getBytes("model", &blob, sizeof(blob));
+  }
+  preferences.end();
+
+  if (blob.version != MOTION_MODEL_VERSION) {
+    memset(&blob, 0, sizeof(blob));
+  }
+  memcpy(motionModel, blob.axes, sizeof(motionModel));
+  // Позиція з NVS могла застаріти: coastUs вчимо лише після першого калібрування
+  memset(motionTrack, 0, sizeof(motionTrack));
+}
+
+void saveMotionModel() {
+  if (sessionMode != SESSION_IDLE) return;
+  MetricScope metric(METRIC_NVS_SAVE);
+  MotionModelBlob blob;
+  blob.version = MOTION_MODEL_VERSION;
+  portENTER_CRITICAL(&motionMux);
+  memcpy(blob.axes, motionModel, sizeof(motionModel));
+  portEXIT_CRITICAL(&motionMux);
+
+  preferences.begin("motion", false);
+  preferences.putBytes("model", &blob, sizeof(blob));
+  preferences.end();
+}
+
+// На скільки раніше зарахувати й погасити останній крок до цілі
+TimeUs motionLeadUs(int axis, int dir) {
+  int d = dir > 0 ? MOTION_FORWARD : MOTION_BACKWARD;
+  const MotionAxisModel &m = motionModel[axis];
+  TimeUs lead = (TimeUs)m.lagUs[d] + m.coastUs[d];
+  return constrain(lead, (TimeUs)0, msToUs(config.msPerMm) / MOTION_LEAD_MAX_DIV);
+}
+
+// Новий рух поверх незавершеного губить частку кроку — з такої історії не вчимося
+void motionMoveStarted(int axis) {
+  MotionTrack &t = motionTrack[axis];
+  if (t.moving) t.clean = false;
+  t.moving = true;
+}
+
+// Зупинка не на цілі: аварійна, повний хід, скасування
+void motionStopped(int axis) {
+  MotionTrack &t = motionTrack[axis];
+  if (t.moving) t.clean = false;
+  t.moving = false;
+}
+
+// Вісь дійшла до цілі; cutAt — розрахунковий момент гасіння виходу
+void motionArrived(int axis, int dir, TimeUs cutAt) {
+  int d = dir > 0 ? MOTION_FORWARD : MOTION_BACKWARD;
+  MotionTrack &t = motionTrack[axis];
+  t.moving = false;
+  if (t.sinceHome[d] < UINT16_MAX) t.sinceHome[d]++;
+  // Під час запису й відтворення модель заморожена, інакше відтворення розійдеться
+  if (sessionMode != SESSION_IDLE) return;
+
+  int32_t lag = (int32_t)constrain(controlNowUs() - cutAt, (TimeUs)0, msToUs(config.msPerMm));
+  portENTER_CRITICAL(&motionMux);
+  MotionAxisModel &m = motionModel[axis];
+  m.lagUs[d] = m.stops[d] == 0 ? lag : m.lagUs[d] + (lag - m.lagUs[d]) / MOTION_LAG_WEIGHT;
+  m.stops[d]++;
+  portEXIT_CRITICAL(&motionMux);
+}
+
+// Кінцевик — єдине місце, де відома справжня позиція (нуль). Залишок ліченої
+// позиції в мкс ходу e = -nF·(cF - ĉF) + nB·(cB - ĉB), де n — зупинки на цілі
+// з попереднього калібрування; ĉ підтягуємо кроком NLMS
+void motionHomed(int axis, TimeUs now) {
+  MotionTrack &t = motionTrack[axis];
+  const Motor &motor = motors[axis];
+  TimeUs stepUs = msToUs(config.msPerMm);
+  int stops = t.sinceHome[MOTION_FORWARD] + t.sinceHome[MOTION_BACKWARD];
+  bool learned = false;
+
+  if (sessionMode == SESSION_IDLE) {
+    TimeUs residual = (TimeUs)motor.manual_distance * stepUs - (now - motor.last_position_update);
+    MotionAxisModel next = motionModel[axis];
+    next.lastResidualUs = (int32_t)constrain(residual, (TimeUs)INT32_MIN, (TimeUs)INT32_MAX);
+
+    // Більше ніж пів кроку на зупинку — проковзування чи ручне втручання, а не докочування
+    if (t.clean && stops > 0 && llabs(residual) <= stops * stepUs / 2) {
+      float phi[MOTION_DIRS] = {-(float)t.sinceHome[MOTION_FORWARD], (float)t.sinceHome[MOTION_BACKWARD]};
+      float norm = phi[0] * phi[0] + phi[1] * phi[1];
+      for (int d = 0; d < MOTION_DIRS; d++) {
+        TimeUs coast = next.coastUs[d] + lroundf(MOTION_COAST_GAIN * phi[d] * (float)residual / norm);
+        next.coastUs[d] = (int32_t)constrain(coast, -stepUs / 2, stepUs / 2);
+      }
+      next.samples++;
+      learned = true;
+    }
+
+    portENTER_CRITICAL(&motionMux);
+    motionModel[axis] = next;
+    portEXIT_CRITICAL(&motionMux);
+  }
+
+  t.sinceHome[MOTION_FORWARD] = 0;
+  t.sinceHome[MOTION_BACKWARD] = 0;
+  t.clean = true;
+  t.moving = false;
+  if (learned) saveMotionModel();
+}
+
+void handleMotionModel(AsyncWebServerRequest *request) {
+  MotionAxisModel model[AXIS_COUNT];
+  portENTER_CRITICAL(&motionMux);
+  memcpy(model, motionModel, sizeof(model));
+  portEXIT_CRITICAL(&motionMux);
+
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  doc["stepUs"] = msToUs(config.msPerMm);
+  JsonArray axes = doc["axes"].to<JsonArray>();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    JsonObject axis = axes.add<JsonObject>();
+    for (int d = 0; d < MOTION_DIRS; d++) {
+      JsonObject dir = axis[motionDirNames[d]].to<JsonObject>();
+      dir["lagUs"] = model[i].lagUs[d];
+      dir["coastUs"] = model[i].coastUs[d];
+      dir["leadUs"] = motionLeadUs(i, d == MOTION_FORWARD ? 1 : -1);
+      dir["stops"] = model[i].stops[d];
+      dir["sinceHome"] = motionTrack[i].sinceHome[d];
+    }
+    axis["samples"] = model[i].samples;
+    axis["lastResidualUs"] = model[i].lastResidualUs;
+    axis["clean"] = motionTrack[i].clean;
+  }
+
+  char output[JSON_MESSAGE_MAX];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
+}
+
+// ==== Motor Control ====
+void startMotor(int motor, int dir) {
+  if (motor < 0 || motor >= AXIS_COUNT) return;
+  TraceScope trace(TRACE_START_MOTOR, motor);
+  logEvent(LOG_MOTOR_START, motor, dir);
+  
+  motionMoveStarted(motor);
+  wearMotorStarted(motor, dir);
+  motorStart(motors[motor], dir, controlNowUs());
+  motors.write(motor, dir);
+  
+  Serial.printf("Motor %d started, direction: %d\n", motor, dir);
+}
+
+void stopMotor(int motor) {
+  if (motor < 0 || motor >= AXIS_COUNT) return;
+  TraceScope trace(TRACE_STOP_MOTOR, motor);
+  if (motors[motor].running) {
+    logEvent(LOG_MOTOR_STOP, motor, motors[motor].real_position);
+  }
+  motionStopped(motor);
+  
+  motorStop(motors[motor]);
+  motors.write(motor, 0);
+  
+  // Зберігаємо позицію після зупинки
+  saveMotorPositions();
+  
+  Serial.printf("Motor %d stopped\n", motor);
+  
+  sendState();
+  drawMenu();
+}
+
+void stopAllMotors() {
+  // Виходи гасимо одним записом ще до збережень у NVS у stopMotor()
+  motors.stopAll();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    stopMotor(i);
+  }
+}
+
+void toggleFullForward(int motor) {
+  if (motors[motor].fullForward) {
+    stopMotor(motor);
+  } else {
+    motors[motor].calibrating = false;
+    motors[motor].fullBackward = false;
+    motors[motor].fullForward = true;
+    startMotor(motor, 1);
+  }
+  sendState();
+  drawMenu();
+}
+
+void toggleFullBackward(int motor) {
+  if (motors[motor].fullBackward) {
+    stopMotor(motor);
+  } else {
+    motors[motor].calibrating = false;
+    motors[motor].fullForward = false;
+    motors[motor].fullBackward = true;
+    startMotor(motor, -1);
+  }
+  sendState();
+  drawMenu();
+}
+
+void toggleAllFullForward() {
+  bool allRunning = true;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!motors[i].fullForward) allRunning = false;
+  }
+  
+  motors.hold();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (allRunning) {
+      stopMotor(i);
+    } else {
+      motors[i].calibrating = false;
+      motors[i].fullBackward = false;
+      motors[i].fullForward = true;
+      startMotor(i, 1);
+    }
+  }
+  motors.release();
+  sendState();
+}
+
+void toggleAllFullBackward() {
+  bool allRunning = true;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!motors[i].fullBackward) allRunning = false;
+  }
+  
+  motors.hold();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (allRunning) {
+      stopMotor(i);
+    } else {
+      motors[i].calibrating = false;
+      motors[i].fullForward = false;
+      motors[i].fullBackward = true;
+      startMotor(i, -1);
+    }
+  }
+  motors.release();
+  sendState();
+}
+
+void toggleCalibration(int motor) {
+  if (motors[motor].calibrating) {
+    stopMotor(motor);
+  } else {
+    motors[motor].fullForward = false;
+    motors[motor].fullBackward = false;
+    motors[motor].calibrating = true;
+    logEvent(LOG_CALIBRATION_START, motor);
+    startMotor(motor, -1);
+  }
+  sendState();
+  drawMenu();
+}
+
+// ==== Command parsing and dispatch ====
+bool parseCommand(const char* type, JsonObject data, Command &cmd, const char** error) {
+  CommandLimits limits = {AXIS_COUNT, config.minMm, config.maxMm, PRESET_COUNT, 0};
+  for (int i = 0; i < PRESET_COUNT; i++) {
+    if (presetTable.slots[i].used) limits.presetsUsed |= 1u << i;
+  }
+  return parseCommand(type, data, limits, cmd, error);
+}
+
+void applyCommand(const Command &cmd) {
+  powerWake();  // команда могла прийти з задачі вебсервера, поки loop() чекає
+  // Під час відтворення сесії осі належать сліду: зовнішні команди ігноруються
+  if (sessionMode == SESSION_REPLAYING && !sessionReplay.injecting) return;
+  if (sessionMode == SESSION_RECORDING) sessionRecordCommand(cmd);
+
+  switch (cmd.op) {
+    case CMD_SET_TARGET:
+      setMotorTarget(cmd.motor, cmd.value);
+      break;
+    case CMD_SET_ALL_TARGETS: {
+      int targets[AXIS_COUNT];
+      for (int i = 0; i < AXIS_COUNT; i++) {
+        targets[i] = cmd.value;
+      }
+      moveAllToTargets(targets);
+      break;
+    }
+    case CMD_CALIBRATE:
+      toggleCalibration(cmd.motor);
+      break;
+    case CMD_CALIBRATE_ALL:
+      for (int i = 0; i < AXIS_COUNT; i++) {
+        toggleCalibration(i);
+      }
+      break;
+    case CMD_EMERGENCY_STOP:
+      stopAllMotors();
+      break;
+    case CMD_SET_SERVO:
+      setServoState(cmd.value != 0);
+      break;
+    case CMD_FULL_FORWARD:
+      toggleFullForward(cmd.motor);
+      break;
+    case CMD_FULL_BACKWARD:
+      toggleFullBackward(cmd.motor);
+      break;
+    case CMD_ALL_FULL_FORWARD:
+      toggleAllFullForward();
+      break;
+    case CMD_ALL_FULL_BACKWARD:
+      toggleAllFullBackward();
+      break;
+    case CMD_RECALL_PRESET:
+      recallPreset(cmd.value);
+      break;
+  }
+}
+
+// Викликається з loop(): весь пакет виконується в одному такті,
+// а стан розсилається і екран перемальовується лише один раз
+void applyPendingBatch() {
+  Command batch[BATCH_MAX_COMMANDS];
+  int count;
+
+  portENTER_CRITICAL(&batchMux);
+  count = pendingBatchCount;
+  memcpy(batch, pendingBatch, count * sizeof(Command));
+  pendingBatchCount = 0;
+  portEXIT_CRITICAL(&batchMux);
+
+  if (count == 0) return;
+
+  if (fleetRole == FLEET_COORDINATOR) {
+    fleetBroadcast(batch, count);  // виконається разом з лінією з fleetService()
+    return;
+  }
+
+  Serial.printf("Applying batch of %d commands\n", count);
+  deferUpdates = true;
+  motors.hold();
+  for (int i = 0; i < count; i++) {
+    applyCommand(batch[i]);
+  }
+  motors.release();
+  deferUpdates = false;
+  flushDeferredUpdates();
+}
+
+void flushDeferredUpdates() {
+  if (menuPending) {
+    menuPending = false;
+    drawMenu();
+  }
+  if (statePending) {
+    statePending = false;
+    sendState();
+  }
+}
+
+// Передає команди з задачі вебсервера в loop(). Дописує в чергу лише
+// цілий пакет; false, якщо він не вміщується поруч із ще не виконаними
+bool queuePendingBatch(const Command* batch, int count) {
+  bool queued = false;
+  portENTER_CRITICAL(&batchMux);
+  if (pendingBatchCount + count <= BATCH_MAX_COMMANDS) {
+    memcpy(pendingBatch + pendingBatchCount, batch, count * sizeof(Command));
+    pendingBatchCount += count;
+    queued = true;
+  }
+  portEXIT_CRITICAL(&batchMux);
+  if (queued) powerWake();
+  return queued;
+}
+
+void handleBatchRequest(AsyncWebServerRequest *request, const char* body) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  DeserializationError error = deserializeJson(doc, body);
+  if (error) {
+    request->send(400, "application/json", "{\"error\":\"invalid JSON\"}");
+    return;
+  }
+
+  // Приймаємо як голий масив, так і {"commands": [...]}
+  JsonArray list = doc.is<JsonArray>() ? doc.as<JsonArray>() : doc["commands"].as<JsonArray>();
+  if (list.isNull() || list.size() == 0) {
+    request->send(400, "application/json", "{\"error\":\"no commands\"}");
+    return;
+  }
+  if (list.size() > BATCH_MAX_COMMANDS) {
+    request->send(413, "application/json", "{\"error\":\"too many commands\"}");
+    return;
+  }
+
+  Command batch[BATCH_MAX_COMMANDS];
+  int count = 0;
+  for (JsonVariant item : list) {
+    const char* type = item["type"];
+    const char* reason = nullptr;
+    if (!parseCommand(type, item["data"], batch[count], &reason)) {
+      char response[96];
+      snprintf(response, sizeof(response), "{\"error\":\"%s\",\"index\":%d}", reason, count);
+      request->send(422, "application/json", response);
+      return;
+    }
+    count++;
+  }
+
+  if (!queuePendingBatch(batch, count)) {
+    request->send(409, "application/json", "{\"error\":\"batch queue full\"}");
+    return;
+  }
+
+  char response[48];
+  snprintf(response, sizeof(response), "{\"accepted\":%d}", count);
+  request->send(202, "application/json", response);
+}
+
+// WebSocket event handler
+void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  TraceScope trace(TRACE_WS_EVENT, type);
+  switch(type) {
+    case WS_EVT_CONNECT:
+      Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+      logEvent(LOG_WS_CONNECT, -1, client->id() & 0x7fff);
+      sendState();
+      sendPresets();
+      break;
+      
+    case WS_EVT_DISCONNECT:
+      Serial.printf("WebSocket client #%u disconnected\n", client->id());
+      logEvent(LOG_WS_DISCONNECT, -1, client->id() & 0x7fff);
+      break;
+      
+    case WS_EVT_DATA: {
+      MetricScope metric(METRIC_WS_COMMAND);
+      TimeUs rxUs = nowUs();
+      AwsFrameInfo *info = (AwsFrameInfo*)arg;
+      if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+        data[len] = 0;
+        
+        JsonArenaScope arena;
+        JsonDocument doc(arena.allocator());
+        DeserializationError error = deserializeJson(doc, data);
+        
+        if (error) {
+          Serial.print(F("deserializeJson() failed: "));
+          Serial.println(error.f_str());
+          return;
+        }
+        
+        const char* commandType = doc["type"];
+        JsonObject dataObj = doc["data"];
+        if (!commandType) return;
+
+        // Повтор уже виконаної команди лише отримує первинний результат
+        CommandAck ack;
+        bool acked = commandAckBegin(client, doc, ack, rxUs);
+        if (acked && ack.duplicate) {
+          commandAckFinish(client, ack);
+          return;
+        }
+        ack.dispatchUs = nowUs();
+        
+        if (commandOpFromName(commandType) >= 0) {
+          Command cmd;
+          const char* reason = nullptr;
+          if (parseCommand(commandType, dataObj, cmd, &reason)) {
+            if (sessionMode == SESSION_REPLAYING) {
+              ack.result = ACK_REJECTED;
+              ack.reason = "session replay";
+            } else if (fleetRole == FLEET_COORDINATOR) {
+              ack.appliedUs = fleetBroadcast(&cmd, 1);
+              ack.result = ACK_SCHEDULED;
+            } else if (!queuePendingBatch(&cmd, 1)) {
+              // Виконує loop() у наступному такті, як /api/batch і MQTT
+              ack.result = ACK_REJECTED;
+              ack.reason = "queue full";
+            }
+          } else {
+            Serial.printf("Rejected %s: %s\n", commandType, reason);
+            ack.result = ACK_REJECTED;
+            ack.reason = reason;
+          }
+        }
+        else if (strcmp(commandType, "get_ip") == 0) {
+          sendState();
+        }
+        else if (strcmp(commandType, "save_preset") == 0) {
+          int slot = dataObj["slot"] | -1;
+          const char* name = dataObj["name"] | "";
+          if (!requestPresetChange(slot, true, name)) {
+            ack.result = ACK_REJECTED;
+            ack.reason = "invalid preset";
+          }
+        }
+        else if (strcmp(commandType, "delete_preset") == 0) {
+          int slot = dataObj["slot"] | -1;
+          if (!requestPresetChange(slot, false, nullptr)) {
+            ack.result = ACK_REJECTED;
+            ack.reason = "invalid preset";
+          }
+        }
+        else if (strcmp(commandType, "get_presets") == 0) {
+          sendPresets();
+        }
+        else if (strcmp(commandType, "get_config") == 0) {
+          sendConfig();
+        }
+        else if (strcmp(commandType, "set_config") == 0) {
+          const char* field = nullptr;
+          if (!requestConfigChange(dataObj, &field)) {
+            Serial.printf("Rejected set_config: %s\n", field);
+            ack.result = ACK_REJECTED;
+            ack.reason = "invalid config";
+          }
+        }
+        else if (strcmp(commandType, "check_update") == 0) {
+          startUpdateCheck();
+        }
+        else if (strcmp(commandType, "set_update_url") == 0) {
+          setUpdateReleaseUrl(dataObj["url"] | "");
+        }
+        else if (strcmp(commandType, "perform_update") == 0) {
+          const char* firmwareUrl = dataObj["url"] | "";
+          if (*firmwareUrl && !updateInProgress) {
+            OtaRequest request;
+            request.firmwareUrl = firmwareUrl;
+            request.fallbackUrl = dataObj["fallback_url"] | "";
+            request.digestUrl = dataObj["sha256_url"] | "";
+            request.expectedDigest = dataObj["sha256"] | "";
+            request.version = dataObj["version"] | "";
+            updateStatus = "Starting update...";
+            startOta(request);
+          }
+        }
+        else if (strcmp(commandType, "set_telemetry_rate") == 0) {
+          setTelemetryRate(dataObj["hz"] | 1000 / TELEMETRY_DEFAULT_INTERVAL);
+        }
+        else if (strcmp(commandType, "set_fleet") == 0) {
+          const char* role = dataObj["role"] | "";
+          for (int i = 0; i < FLEET_ROLE_COUNT; i++) {
+            if (strcmp(role, fleetRoleNames[i]) == 0) {
+              setFleetRole((FleetRole)i, dataObj["group"] | 0);
+              break;
+            }
+          }
+        }
+        else if (strcmp(commandType, "set_mqtt") == 0) {
+          setMqttSettings(dataObj["host"] | "", dataObj["port"] | MQTT_DEFAULT_PORT, dataObj["prefix"] | "");
+        }
+        else if (strcmp(commandType, "trace_start") == 0) {
+          traceStart(dataObj["duration"] | 0UL);
+        }
+        else if (strcmp(commandType, "trace_stop") == 0) {
+          traceStop();
+        }
+        else if (strcmp(commandType, "restart") == 0) {
+          saveWear();
+          ESP.restart();
+        }
+        else if (strcmp(commandType, "reset_wifi") == 0) {
+          wm.resetSettings();
+          ESP.restart();
+        }
+        else {
+          ack.result = ACK_UNKNOWN;
+        }
+
+        if (acked) {
+          if (ack.appliedUs == 0) ack.appliedUs = nowUs();
+          commandAckFinish(client, ack);
+        }
+      }
+      break;
+    }
+      
+    case WS_EVT_ERROR:
+      Serial.printf("WebSocket error\n");
+      break;
+  }
+}
+
+void wsBroadcast(const char* data, size_t len) {
+  MetricScope metric(METRIC_WS_FANOUT);
+  uint32_t clients = ws.count();
+  bool full = !ws.availableForWriteAll();
+  ws.textAll(data, len);
+
+  wsBroadcasts++;
+  wsFramesQueued += clients;
+  if (full) wsBroadcastsDropped++;
+}
+
+// Send state to all WebSocket clients
+void sendState() {
+  if (deferUpdates || sessionMode == SESSION_REPLAYING) {
+    statePending = true;
+    return;
+  }
+  MetricScope metric(METRIC_SEND_STATE);
+  stateBroadcastSeq++;
+
+  char output[JSON_MESSAGE_MAX];
+  size_t len = buildStateJson(output, sizeof(output));
+
+  if (stateSnapshotMutex && xSemaphoreTake(stateSnapshotMutex, portMAX_DELAY) == pdTRUE) {
+    memcpy(stateSnapshot, output, len + 1);
+    stateSnapshotLen = len;
+    xSemaphoreGive(stateSnapshotMutex);
+  }
+
+  wsBroadcast(output, len);
+}
+
+size_t buildStateJson(char* output, size_t size) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  String ip = WiFi.localIP().toString();
+
+  StateView view = {
+    &motors[0], AXIS_COUNT, config.minMm, config.maxMm, stateBroadcastSeq, nowUs(),
+    servoState, ip.c_str(), updateInProgress, updateProgress,
+    updateStatus.c_str(), latestVersion.c_str(), runningVersion.c_str()
+  };
+  fillStateJson(doc, view);
+  return serializeJson(doc, output, size);
+}
+
+// Скоординований рух: спершу виставляємо всі цілі, потім стартуємо
+// всі осі в одному проході з однією розсилкою стану наприкінці
+void moveAllToTargets(const int targets[AXIS_COUNT]) {
+  int dirs[AXIS_COUNT];
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    motors[i].target = constrain(targets[i], config.minMm, config.maxMm);
+    motors[i].calibrating = false;
+    motors[i].fullForward = false;
+    motors[i].fullBackward = false;
+    dirs[i] = motorDirTo(motors[i], motors[i].target);
+  }
+
+  bool stopped = false;
+  motors.hold();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (dirs[i] != 0) {
+      startMotor(i, dirs[i]);
+    } else if (motors[i].running) {
+      stopMotor(i);
+      stopped = true;
+    }
+  }
+  motors.release();
+
+  if (!stopped) {
+    sendState();
+    drawMenu();
+  }
+}
+
+void setMotorTarget(int motor, int target) {
+  if (motor < 0 || motor >= AXIS_COUNT) return;
+  
+  motors[motor].target = target;
+  Serial.printf("Setting motor %d target to %d, current position: %d\n", 
+                motor, target, motors[motor].real_position);
+  
+  motors[motor].running = true;
+  
+  int dir = motorDirTo(motors[motor], target);
+  if (dir != 0) {
+    startMotor(motor, dir);
+  } else {
+    stopMotor(motor);
+  }
+  
+  drawMenu();
+  sendState();
+}
+
+void setupOTA() {
+  ArduinoOTA.setHostname(config.hostname);
+  ArduinoOTA.setPassword(config.otaPassword);
+
+  ArduinoOTA
+    .onStart([]() {
+      String type;
+      if (ArduinoOTA.getCommand() == U_FLASH)
+        type = "sketch";
+      else
+        type = "filesystem";
+
+      Serial.println("Start updating " + type);
+      stopAllMotors();
+      
+      display.clearDisplay();
+      display.setTextSize(1);
+      display.setTextColor(SSD1306_WHITE);
+      display.setCursor(0, 0);
+      display.println("OTA UPDATE");
+      display.println("Updating " + type);
+      display.display();
+    })
+    .onEnd([]() {
+      Serial.println("\nEnd");
+      display.clearDisplay();
+      display.setTextSize(1);
+      display.setTextColor(SSD1306_WHITE);
+      display.setCursor(0, 0);
+      display.println("Update Complete!");
+      display.println("Rebooting...");
+      display.display();
+    })
+    .onProgress([](unsigned int progress, unsigned int total) {
+      Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+      
+      display.clearDisplay();
+      display.setTextSize(1);
+      display.setTextColor(SSD1306_WHITE);
+      display.setCursor(0, 0);
+      display.println("OTA UPDATE");
+      display.printf("Progress: %u%%", (progress / (total / 100)));
+      display.display();
+    })
+    .onError([](ota_error_t error) {
+      Serial.printf("Error[%u]: ", error);
+      if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
+      else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
+      else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
+      else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
+      else if (error == OTA_END_ERROR) Serial.println("End Failed");
+      
+      display.clearDisplay();
+      display.setTextSize(1);
+      display.setTextColor(SSD1306_WHITE);
+      display.setCursor(0, 0);
+      display.println("OTA ERROR!");
+      display.printf("Error: %u", error);
+      display.display();
+    });
+
+  ArduinoOTA.begin();
+  Serial.println("OTA Ready");
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
+}
+
+// ==== Fleet coordination ====
+void loadFleetSettings() {
+  fleetUnit = (uint32_t)ESP.getEfuseMac();
+  fleetNextSeq = esp_random();    // після перезапуску seq не збігаються зі старими
+
+  preferences.begin("fleet", true);
+  uint8_t role = preferences.getUChar("role", FLEET_OFF);
+  fleetGroup = preferences.getUChar("group", 0);
+  preferences.end();
+  fleetRole = role < FLEET_ROLE_COUNT ? (FleetRole)role : FLEET_OFF;
+}
+
+void setFleetRole(FleetRole role, uint8_t group) {
+  portENTER_CRITICAL(&fleetMux);
+  fleetRole = role;
+  fleetGroup = group;
+  fleetResetSync(fleetSync);
+  memset(fleetPeers, 0, sizeof(fleetPeers));
+  memset(fleetOutbox, 0, sizeof(fleetOutbox));
+  fleetQueue.count = 0;
+  portEXIT_CRITICAL(&fleetMux);
+
+  // Окремий екземпляр: глобальний preferences використовує loop()
+  Preferences fleetPrefs;
+  fleetPrefs.begin("fleet", false);
+  fleetPrefs.putUChar("role", role);
+  fleetPrefs.putUChar("group", group);
+  fleetPrefs.end();
+
+  Serial.printf("Fleet role: %s, group %u\n", fleetRoleNames[role], group);
+  startFleet();
+}
+
+void fleetFillHeader(FleetHeader &h, FleetKind kind, uint32_t seq) {
+  fleetFillHeader(h, kind, fleetGroup, fleetUnit, seq, nowUs());
+}
+
+void fleetSend(const void *data, size_t len) {
+  if (!fleetListening) return;
+  IPAddress group(fleetGroupIp[0], fleetGroupIp[1], fleetGroupIp[2], fleetGroupIp[3]);
+  fleetUdp.writeTo((const uint8_t*)data, len, group, FLEET_PORT);
+}
+
+// Ведений іде за першим почутим координатором, доки той не замовкне
+void fleetFollowerPacket(AsyncUDPPacket &packet, const FleetHeader &h, TimeUs now) {
+  if (h.kind != FLEET_BEACON && h.kind != FLEET_COMMAND) return;
+
+  FleetReportPacket report;
+  bool sendReport = false;
+  // Зайнятість слотів пресетів перевіряє recallPreset() уже в loop()
+  CommandLimits limits = {AXIS_COUNT, config.minMm, config.maxMm, PRESET_COUNT, 0};
+
+  portENTER_CRITICAL(&fleetMux);
+  if (!fleetFollow(fleetSync, h.unit, h.timeUs, now)) {
+    portEXIT_CRITICAL(&fleetMux);
+    return;
+  }
+
+  if (h.kind == FLEET_COMMAND && packet.length() >= sizeof(FleetCommandPacket)) {
+    FleetCommandPacket p;
+    memcpy(&p, packet.data(), sizeof(p));
+    if (fleetCommandValid(p.cmd, limits) && !fleetSeenBefore(fleetSeen, h.seq)) {
+      fleetEnqueue(fleetQueue, fleetLocalTime(fleetSync, p.executeAtUs), h.seq, p.cmd, true);
+    }
+  } else if (h.kind == FLEET_BEACON) {
+    fleetFillHeader(report.header, FLEET_REPORT, h.seq);
+    report.offsetUs = fleetSync.offsetUs;
+    report.driftPpb = fleetSync.driftPpb;
+    report.lateUs = fleetLastLateUs;
+    sendReport = true;
+  }
+  portEXIT_CRITICAL(&fleetMux);
+
+  if (sendReport) fleetSend(&report, sizeof(report));
+}
+
+void fleetCoordinatorPacket(AsyncUDPPacket &packet, const FleetHeader &h, TimeUs now) {
+  bool isAck = h.kind == FLEET_ACK && packet.length() >= sizeof(FleetAckPacket);
+  bool isReport = h.kind == FLEET_REPORT && packet.length() >= sizeof(FleetReportPacket);
+  if (!isAck && !isReport) return;
+  uint32_t ip = packet.remoteIP();
+
+  portENTER_CRITICAL(&fleetMux);
+  int slot = fleetPeerSlot(fleetPeers, h.unit, now);
+  if (slot >= 0) {
+    FleetPeer &peer = fleetPeers[slot];
+    peer.ip = ip;
+    peer.lastSeen = now;
+    if (isReport) {
+      FleetReportPacket p;
+      memcpy(&p, packet.data(), sizeof(p));
+      peer.offsetUs = p.offsetUs;
+      peer.driftPpb = p.driftPpb;
+      peer.lateUs = p.lateUs;
+    } else {
+      FleetAckPacket p;
+      memcpy(&p, packet.data(), sizeof(p));
+      peer.lastAckSeq = p.ackSeq;
+      peer.lateUs = p.lateUs;
+      peer.acks++;
+      fleetMarkAcked(fleetOutbox, slot, p.ackSeq);
+    }
+  }
+  portEXIT_CRITICAL(&fleetMux);
+}
+
+void fleetOnPacket(AsyncUDPPacket &packet) {
+  FleetHeader h;
+  if (!fleetParseHeader(packet.data(), packet.length(), fleetGroup, fleetUnit, h)) return;
+
+  TimeUs now = nowUs();
+  if (fleetRole == FLEET_FOLLOWER) {
+    fleetFollowerPacket(packet, h, now);
+    if (fleetQueue.count > 0) powerWake();
+  } else if (fleetRole == FLEET_COORDINATOR) {
+    fleetCoordinatorPacket(packet, h, now);
+  }
+}
+
+// Після зміни ролі чи перепідключення Wi-Fi група приєднується заново
+void startFleet() {
+  if (fleetListening) {
+    fleetListening = false;
+    fleetUdp.close();
+  }
+  if (fleetRole == FLEET_OFF || WiFi.status() != WL_CONNECTED) return;
+
+  IPAddress group(fleetGroupIp[0], fleetGroupIp[1], fleetGroupIp[2], fleetGroupIp[3]);
+  if (!fleetUdp.listenMulticast(group, FLEET_PORT)) {
+    Serial.println("Fleet multicast listen failed");
+    return;
+  }
+  fleetUdp.onPacket(fleetOnPacket);
+  fleetListening = true;
+  Serial.printf("Fleet %s on %s:%d, unit %08x\n", fleetRoleNames[fleetRole],
+                group.toString().c_str(), FLEET_PORT, (unsigned)fleetUnit);
+}
+
+// Координатор: команди з WebSocket і /api/batch ідуть усій лінії, а сам
+// він виконує їх у той самий момент. Аварійна зупинка — без затримки.
+// Повертає момент виконання останньої команди
+TimeUs fleetBroadcast(const Command *cmds, int count) {
+  TimeUs now = nowUs();
+  TimeUs due = now;
+  for (int i = 0; i < count; i++) {
+    due = fleetDueTime(cmds[i], now);
+    FleetCommandPacket p;
+
+    portENTER_CRITICAL(&fleetMux);
+    uint32_t seq = fleetNextSeq++;
+    fleetFillHeader(p.header, FLEET_COMMAND, seq);
+    p.executeAtUs = due;
+    p.cmd = cmds[i];
+    fleetPost(fleetOutbox, fleetPeers, p, now);
+    fleetEnqueue(fleetQueue, due, seq, cmds[i], false);
+    portEXIT_CRITICAL(&fleetMux);
+
+    fleetSend(&p, sizeof(p));
+  }
+  return due;
+}
+
+// З loop(): маяки, повтори без ACK і виконання команд, чий час настав
+void fleetService() {
+  if (fleetRole == FLEET_OFF) return;
+  TimeUs now = nowUs();
+
+  if (fleetRole == FLEET_COORDINATOR) {
+    if (intervalElapsed(fleetLastBeacon, msToUs(FLEET_BEACON_INTERVAL), now)) {
+      fleetLastBeacon = now;
+      FleetHeader beacon;
+      portENTER_CRITICAL(&fleetMux);
+      fleetFillHeader(beacon, FLEET_BEACON, fleetNextSeq++);
+      portEXIT_CRITICAL(&fleetMux);
+      fleetSend(&beacon, sizeof(beacon));
+    }
+
+    for (FleetOutgoing &o : fleetOutbox) {
+      FleetCommandPacket resend;
+      bool send = false;
+
+      portENTER_CRITICAL(&fleetMux);
+      send = fleetResendDue(o, fleetPeers, now);
+      if (send) resend = o.packet;
+      portEXIT_CRITICAL(&fleetMux);
+
+      if (send) fleetSend(&resend, sizeof(resend));
+    }
+  }
+
+  // Команди з однаковим моментом застосовуються в одному такті, як пакет /api/batch
+  FleetScheduled due[FLEET_QUEUE_LENGTH];
+  portENTER_CRITICAL(&fleetMux);
+  int dueCount = fleetTakeDue(fleetQueue, now, due);
+  portEXIT_CRITICAL(&fleetMux);
+
+  if (dueCount == 0) return;
+
+  deferUpdates = true;
+  motors.hold();
+  for (int i = 0; i < dueCount; i++) {
+    applyCommand(due[i].cmd);
+  }
+  motors.release();
+  deferUpdates = false;
+
+  for (int i = 0; i < dueCount; i++) {
+    if (!due[i].ack) continue;
+    FleetAckPacket ack;
+    fleetFillHeader(ack.header, FLEET_ACK, due[i].seq);
+    ack.ackSeq = due[i].seq;
+    ack.lateUs = (int32_t)(now - due[i].due);
+    fleetLastLateUs = ack.lateUs;
+    fleetSend(&ack, sizeof(ack));
+  }
+  flushDeferredUpdates();
+}
+
+void handleFleetRequest(AsyncWebServerRequest *request) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  TimeUs now = nowUs();
+
+  portENTER_CRITICAL(&fleetMux);
+  FleetPeer peers[FLEET_MAX_PEERS];
+  memcpy(peers, fleetPeers, sizeof(peers));
+  uint8_t alive = fleetAliveMask(fleetPeers, now);
+  uint32_t coordinator = fleetSync.coordinator;
+  TimeUs coordinatorSeen = fleetSync.coordinatorSeen;
+  int64_t offsetUs = fleetSync.offsetUs;
+  int32_t driftPpb = fleetSync.driftPpb;
+  int32_t lateUs = fleetLastLateUs;
+  int queued = fleetQueue.count;
+  portEXIT_CRITICAL(&fleetMux);
+
+  char unit[9];
+  snprintf(unit, sizeof(unit), "%08x", (unsigned)fleetUnit);
+  doc["role"] = fleetRoleNames[fleetRole];
+  doc["group"] = fleetGroup;
+  doc["unit"] = unit;
+  doc["listening"] = fleetListening;
+  doc["queued"] = queued;
+  doc["dropped"] = fleetQueue.dropped;
+
+  if (fleetRole == FLEET_FOLLOWER) {
+    char id[9];
+    snprintf(id, sizeof(id), "%08x", (unsigned)coordinator);
+    JsonObject sync = doc["coordinator"].to<JsonObject>();
+    sync["unit"] = coordinator ? id : nullptr;
+    sync["ageMs"] = coordinator ? (now - coordinatorSeen) / 1000 : -1;
+    sync["offsetUs"] = offsetUs;
+    sync["driftPpb"] = driftPpb;
+    sync["lastLateUs"] = lateUs;
+  }
+
+  JsonArray list = doc["followers"].to<JsonArray>();
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    if (!(alive & (1 << i))) continue;
+    const FleetPeer &p = peers[i];
+    char id[9];
+    snprintf(id, sizeof(id), "%08x", (unsigned)p.unit);
+    JsonObject item = list.add<JsonObject>();
+    item["unit"] = id;
+    item["ip"] = IPAddress(p.ip).toString();
+    item["ageMs"] = (now - p.lastSeen) / 1000;
+    item["offsetUs"] = p.offsetUs;
+    item["driftPpb"] = p.driftPpb;
+    item["lateUs"] = p.lateUs;
+    item["lastAckSeq"] = p.lastAckSeq;
+    item["acks"] = p.acks;
+    item["missed"] = p.missed;
+  }
+
+  char output[JSON_MESSAGE_MAX];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
+}
+
+// ==== MQTT bridge ====
+void loadMqttSettings() {
+  preferences.begin("mqtt", true);
+  mqttHost = preferences.getString("host", "");
+  mqttPort = preferences.getUShort("port", MQTT_DEFAULT_PORT);
+  mqttPrefix = preferences.getString("prefix", "stanok");
+  preferences.end();
+  if (mqttPrefix.isEmpty()) mqttPrefix = "stanok";
+}
+
+void setMqttSettings(const char* host, uint16_t port, const char* prefix) {
+  portENTER_CRITICAL(&mqttMux);
+  mqttHost = host ? host : "";
+  mqttPort = port ? port : MQTT_DEFAULT_PORT;
+  mqttPrefix = prefix && *prefix ? prefix : "stanok";
+  mqttReconfigure = true;
+  portEXIT_CRITICAL(&mqttMux);
+
+  // Окремий екземпляр: глобальний preferences використовує loop()
+  Preferences mqttPrefs;
+  mqttPrefs.begin("mqtt", false);
+  mqttPrefs.putString("host", mqttHost.c_str());
+  mqttPrefs.putUShort("port", mqttPort);
+  mqttPrefs.putString("prefix", mqttPrefix.c_str());
+  mqttPrefs.end();
+
+  Serial.printf("MQTT broker set to %s:%u\n", mqttHost.isEmpty() ? "(off)" : mqttHost.c_str(), mqttPort);
+  startMqtt();
+  if (mqttTaskHandle) xTaskNotifyGive(mqttTaskHandle);
+}
+
+// Викликається з loop() після telemetrySample(): лише порівняння і копія,
+// публікує задача MQTT
+void mqttCapture() {
+  if (!mqttTaskHandle) return;
+
+  MqttState s;
+  telemetryCapture(s.sample);
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    s.target[i] = motors[i].target;
+  }
+  if (mqttLatestValid && memcmp(&s, &mqttLatest, sizeof(s)) == 0) return;
+
+  portENTER_CRITICAL(&mqttMux);
+  mqttLatest = s;
+  mqttLatestValid = true;
+  portEXIT_CRITICAL(&mqttMux);
+  xTaskNotifyGive(mqttTaskHandle);
+}
+
+// З logEvent(); поки брокер недоступний, найстаріші події витісняються
+void mqttQueueEvent(LogEventType type, int motor, int value) {
+  if (!mqttTaskHandle) return;
+  portENTER_CRITICAL(&mqttMux);
+  MqttEvent &e = mqttEvents[mqttEventHead % MQTT_EVENT_BUFFER];
+  e.ms = uptimeMs();
+  e.type = type;
+  e.motor = motor;
+  e.value = constrain(value, INT16_MIN, INT16_MAX);
+  mqttEventHead++;
+  if (mqttEventHead - mqttEventTail > MQTT_EVENT_BUFFER) {
+    mqttEventTail = mqttEventHead - MQTT_EVENT_BUFFER;
+    mqttEventsDropped++;
+  }
+  portEXIT_CRITICAL(&mqttMux);
+}
+
+// Далі — лише з задачі MQTT
+FixedString<MQTT_HOST_LEN> mqttActiveHost;   // PubSubClient тримає вказівник на рядок
+FixedString<MQTT_PREFIX_LEN> mqttActivePrefix;
+
+void mqttTopic(char* topic, size_t size, const char* suffix) {
+  snprintf(topic, size, "%s/%s", mqttActivePrefix.c_str(), suffix);
+}
+
+void mqttOnMessage(char* topic, uint8_t* payload, unsigned int length) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  Command cmd;
+  const char* reason = "bad json";
+  const char* type = nullptr;
+  bool ok = false;
+
+  if (!deserializeJson(doc, payload, length)) {
+    type = doc["type"];
+    reason = "unknown command";
+    ok = type && parseCommand(type, doc["data"], cmd, &reason);
+  }
+  if (ok) {
+    portENTER_CRITICAL(&mqttMux);
+    if (mqttInboxCount < MQTT_INBOX_LENGTH) {
+      mqttInbox[mqttInboxCount++] = cmd;
+    } else {
+      ok = false;
+      reason = "inbox full";
+    }
+    portEXIT_CRITICAL(&mqttMux);
+    if (ok) powerWake();
+  }
+  if (!ok) {
+    mqttRejected++;
+    Serial.printf("MQTT rejected %s: %s\n", type ? type : "?", reason);
+  }
+}
+
+bool mqttConnect() {
+  uint16_t port;
+  portENTER_CRITICAL(&mqttMux);
+  mqttActiveHost = mqttHost;
+  mqttActivePrefix = mqttPrefix;
+  port = mqttPort;
+  portEXIT_CRITICAL(&mqttMux);
+  if (mqttActiveHost.isEmpty()) return false;
+
+  char clientId[24];
+  snprintf(clientId, sizeof(clientId), "stanok-%08x", (unsigned)ESP.getEfuseMac());
+  char statusTopic[MQTT_TOPIC_LEN];
+  mqttTopic(statusTopic, sizeof(statusTopic), "status");
+
+  mqttClient.setServer(mqttActiveHost.c_str(), port);
+  if (!mqttClient.connect(clientId, nullptr, nullptr, statusTopic, 0, true, "offline")) {
+    Serial.printf("MQTT connect to %s:%u failed, state %d\n", mqttActiveHost.c_str(), port, mqttClient.state());
+    return false;
+  }
+
+  char cmdTopic[MQTT_TOPIC_LEN];
+  mqttTopic(cmdTopic, sizeof(cmdTopic), "cmd");
+  mqttClient.publish(statusTopic, "online", true);
+  mqttClient.subscribe(cmdTopic);
+  Serial.printf("MQTT connected to %s:%u as %s\n", mqttActiveHost.c_str(), port, clientId);
+  return true;
+}
+
+const char* const mqttModeNames[] = {"idle", "target", "forward", "backward", "calibrating"};
+
+// Лише змінені осі; після перепідключення mqttSentMask = 0, тож усе публікується заново
+void mqttPublishState() {
+  MqttState s;
+  portENTER_CRITICAL(&mqttMux);
+  bool valid = mqttLatestValid;
+  s = mqttLatest;
+  portEXIT_CRITICAL(&mqttMux);
+  if (!valid) return;
+
+  char topic[MQTT_TOPIC_LEN];
+  char payload[128];
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    bool sent = mqttSentMask & (1 << i);
+    if (sent && s.sample.position[i] == mqttSent.sample.position[i] &&
+        s.sample.flags[i] == mqttSent.sample.flags[i] && s.target[i] == mqttSent.target[i]) {
+      continue;
+    }
+    uint8_t flags = s.sample.flags[i];
+    uint8_t mode = flags >> TELEMETRY_MODE_SHIFT & 0x07;
+    uint8_t dir = flags & TELEMETRY_DIR_MASK;
+    snprintf(topic, sizeof(topic), "%s/axis/%d", mqttActivePrefix.c_str(), i);
+    snprintf(payload, sizeof(payload),
+             "{\"position\":%d,\"target\":%d,\"dir\":%d,\"mode\":\"%s\",\"limit\":%s}",
+             (int)s.sample.position[i], (int)s.target[i], dir == 2 ? -1 : dir,
+             mode < 5 ? mqttModeNames[mode] : "idle", flags & TELEMETRY_LIMIT_BIT ? "true" : "false");
+    if (!mqttClient.publish(topic, payload, true)) return;
+    mqttSent.sample.position[i] = s.sample.position[i];
+    mqttSent.sample.flags[i] = flags;
+    mqttSent.target[i] = s.target[i];
+    mqttSentMask |= 1 << i;
+    mqttPublished++;
+  }
+
+  uint32_t servoBit = 1 << AXIS_COUNT;
+  if (!(mqttSentMask & servoBit) || s.sample.servo != mqttSent.sample.servo) {
+    mqttTopic(topic, sizeof(topic), "servo");
+    if (!mqttClient.publish(topic, s.sample.servo ? "on" : "off", true)) return;
+    mqttSent.sample.servo = s.sample.servo;
+    mqttSentMask |= servoBit;
+    mqttPublished++;
+  }
+}
+
+void mqttPublishEvents() {
+  char topic[MQTT_TOPIC_LEN];
+  mqttTopic(topic, sizeof(topic), "event");
+
+  for (int n = 0; n < MQTT_EVENT_BUFFER; n++) {
+    portENTER_CRITICAL(&mqttMux);
+    uint32_t index = mqttEventTail;
+    bool pending = index != mqttEventHead;
+    MqttEvent e = mqttEvents[index % MQTT_EVENT_BUFFER];
+    portEXIT_CRITICAL(&mqttMux);
+    if (!pending) return;
+
+    char payload[96];
+    snprintf(payload, sizeof(payload), "{\"ms\":%u,\"event\":\"%s\",\"motor\":%d,\"value\":%d}",
+             (unsigned)e.ms, e.type < LOG_EVENT_TYPE_COUNT ? logEventNames[e.type] : "unknown",
+             e.motor, e.value);
+    if (!mqttClient.publish(topic, payload, false)) return;
+    mqttPublished++;
+
+    portENTER_CRITICAL(&mqttMux);
+    if (mqttEventTail == index) mqttEventTail++;   // інакше запис уже витіснено
+    portEXIT_CRITICAL(&mqttMux);
+  }
+}
+
+// Підключення може блокувати до MQTT_SOCKET_TIMEOUT — тому окрема задача,
+// а не loop(). Повтори з подвоєнням паузи, як у Wi-Fi
+void mqttTask(void *param) {
+  uint32_t backoff = MQTT_RECONNECT_MIN;
+  TimeUs nextAttempt = 0;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_POLL_INTERVAL));
+
+    if (mqttReconfigure) {
+      mqttReconfigure = false;
+      if (mqttClient.connected()) {
+        char statusTopic[MQTT_TOPIC_LEN];
+        mqttTopic(statusTopic, sizeof(statusTopic), "status");
+        mqttClient.publish(statusTopic, "offline", true);
+        mqttClient.disconnect();
+      }
+      backoff = MQTT_RECONNECT_MIN;
+      nextAttempt = 0;
+    }
+
+    if (!mqttClient.connected()) {
+      if (mqttConnected) {
+        mqttConnected = false;
+        Serial.println("MQTT connection lost");
+        nextAttempt = nowUs() + msToUs(backoff);
+      }
+      if (WiFi.status() != WL_CONNECTED || !deadlineReached(nextAttempt)) continue;
+
+      if (!mqttConnect()) {
+        nextAttempt = nowUs() + msToUs(backoff);
+        backoff = min(backoff * 2, (uint32_t)MQTT_RECONNECT_MAX);
+        continue;
+      }
+      mqttReconnects++;
+      mqttConnected = true;
+      mqttSentMask = 0;
+      backoff = MQTT_RECONNECT_MIN;
+    }
+
+    mqttClient.loop();
+    mqttPublishState();
+    mqttPublishEvents();
+  }
+}
+
+// Задача створюється, лише коли брокер задано; далі живе до перезапуску
+void startMqtt() {
+  if (mqttTaskHandle || mqttHost.isEmpty()) return;
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+  mqttClient.setKeepAlive(MQTT_KEEPALIVE);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+  mqttClient.setCallback(mqttOnMessage);
+  xTaskCreate(mqttTask, "MQTT", 6144, NULL, 1, &mqttTaskHandle);
+}
+
+// Викликається з loop(): команди з брокера, як і /api/batch, — в одному такті
+void mqttService() {
+  Command inbox[MQTT_INBOX_LENGTH];
+  int count;
+
+  portENTER_CRITICAL(&mqttMux);
+  count = mqttInboxCount;
+  memcpy(inbox, mqttInbox, count * sizeof(Command));
+  mqttInboxCount = 0;
+  portEXIT_CRITICAL(&mqttMux);
+
+  if (count == 0) return;
+
+  if (fleetRole == FLEET_COORDINATOR) {
+    fleetBroadcast(inbox, count);
+    return;
+  }
+
+  deferUpdates = true;
+  motors.hold();
+  for (int i = 0; i < count; i++) {
+    applyCommand(inbox[i]);
+  }
+  motors.release();
+  deferUpdates = false;
+  flushDeferredUpdates();
+}
+
+// ==== Command acknowledgements ====
+WsSession* wsSessionFor(uint32_t sid, uint32_t clientId, TimeUs now) {
+  WsSession *spare = nullptr;
+  for (WsSession &s : wsSessions) {
+    if (s.sid == sid) {
+      s.clientId = clientId;   // після перепідключення id клієнта новий
+      s.lastSeen = now;
+      return &s;
+    }
+    if (!spare && (s.sid == 0 || intervalElapsed(s.lastSeen, msToUs(WS_SESSION_TIMEOUT), now))) {
+      spare = &s;
+    }
+  }
+  // Усі слоти зайняті — витісняємо найдовше неактивну сесію
+  if (!spare) {
+    spare = &wsSessions[0];
+    for (WsSession &s : wsSessions) {
+      if (s.lastSeen < spare->lastSeen) spare = &s;
+    }
+  }
+  memset(spare, 0, sizeof(WsSession));
+  spare->sid = sid;
+  spare->clientId = clientId;
+  spare->lastSeen = now;
+  return spare;
+}
+
+void latencyAdd(LatencyRing &ring, uint32_t us) {
+  ring.samples[ring.index] = us;
+  ring.index = (ring.index + 1) % WS_LATENCY_SAMPLES;
+  if (ring.count < WS_LATENCY_SAMPLES) ring.count++;
+}
+
+// p50, p90, p99 і максимум останніх вибірок
+void latencyPercentiles(const LatencyRing &ring, uint32_t out[4]) {
+  uint32_t sorted[WS_LATENCY_SAMPLES];
+  int n = ring.count;
+  for (int i = 0; i < n; i++) {
+    uint32_t v = ring.samples[i];
+    int j = i;
+    for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+    sorted[j] = v;
+  }
+  if (n == 0) {
+    out[0] = out[1] = out[2] = out[3] = 0;
+    return;
+  }
+  out[0] = sorted[(n - 1) * 50 / 100];
+  out[1] = sorted[(n - 1) * 90 / 100];
+  out[2] = sorted[(n - 1) * 99 / 100];
+  out[3] = sorted[n - 1];
+}
+
+// false — повідомлення без seq/sid, підтвердження не потрібне
+bool commandAckBegin(AsyncWebSocketClient *client, JsonDocument &doc, CommandAck &ack, TimeUs rxUs) {
+  uint32_t seq = doc["seq"] | 0u;
+  uint32_t sid = doc["sid"] | 0u;
+  if (seq == 0 || sid == 0) return false;
+
+  ack.session = wsSessionFor(sid, client->id(), rxUs);
+  ack.seq = seq;
+  ack.clientTime = doc["timestamp"] | (int64_t)0;
+  ack.rxUs = rxUs;
+  ack.dispatchUs = 0;
+  ack.appliedUs = 0;
+  ack.result = ACK_OK;
+  ack.reason = nullptr;
+  ack.duplicate = false;
+
+  // Клієнт повідомляє повний цикл попередньої команди, мс
+  float rttMs = doc["rtt"] | 0.0f;
+  if (rttMs > 0) latencyAdd(ack.session->rttUs, (uint32_t)(rttMs * 1000));
+
+  WsSession &s = *ack.session;
+  for (int i = 0; i < WS_DEDUP_WINDOW; i++) {
+    if (s.seqs[i] == seq) {
+      ack.duplicate = true;
+      ack.result = (AckResult)s.results[i];
+      ack.dispatchUs = ack.appliedUs = rxUs;
+      s.duplicates++;
+      break;
+    }
+  }
+  return true;
+}
+
+void commandAckFinish(AsyncWebSocketClient *client, CommandAck &ack) {
+  WsSession &s = *ack.session;
+  if (!ack.duplicate) {
+    s.seqs[s.seqIndex] = ack.seq;
+    s.results[s.seqIndex] = ack.result;
+    s.seqIndex = (s.seqIndex + 1) % WS_DEDUP_WINDOW;
+    s.commands++;
+    if (ack.result == ACK_OK) latencyAdd(s.deviceUs, (uint32_t)(ack.appliedUs - ack.rxUs));
+  }
+
+  char reason[48] = "";
+  if (ack.reason) snprintf(reason, sizeof(reason), ",\"reason\":\"%s\"", ack.reason);
+  char output[224];
+  snprintf(output, sizeof(output),
+           "{\"type\":\"ack\",\"seq\":%u,\"timestamp\":%lld,\"result\":\"%s\",\"duplicate\":%s,"
+           "\"rxUs\":%lld,\"dispatchUs\":%lld,\"appliedUs\":%lld%s}",
+           (unsigned)ack.seq, (long long)ack.clientTime, ackResultNames[ack.result],
+           ack.duplicate ? "true" : "false", (long long)ack.rxUs, (long long)ack.dispatchUs,
+           (long long)ack.appliedUs, reason);
+  client->text(output);
+}
+
+// GET /api/clients: сесії сторінок і перцентилі затримок, мкс
+void handleClientsRequest(AsyncWebServerRequest *request) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  TimeUs now = nowUs();
+  static const char* const keys[4] = {"p50", "p90", "p99", "max"};
+
+  JsonArray list = doc["clients"].to<JsonArray>();
+  for (const WsSession &s : wsSessions) {
+    if (s.sid == 0) continue;
+    char sid[9];
+    snprintf(sid, sizeof(sid), "%08x", (unsigned)s.sid);
+    JsonObject item = list.add<JsonObject>();
+    item["sid"] = sid;
+    item["client"] = s.clientId;
+    item["ageMs"] = (now - s.lastSeen) / 1000;
+    item["commands"] = s.commands;
+    item["duplicates"] = s.duplicates;
+
+    uint32_t p[4];
+    latencyPercentiles(s.deviceUs, p);
+    JsonObject device = item["deviceUs"].to<JsonObject>();
+    for (int i = 0; i < 4; i++) device[keys[i]] = p[i];
+    latencyPercentiles(s.rttUs, p);
+    JsonObject rtt = item["rttUs"].to<JsonObject>();
+    for (int i = 0; i < 4; i++) rtt[keys[i]] = p[i];
+  }
+
+  char output[JSON_MESSAGE_MAX * 2];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
+}
+
+// ==== Event journal ====
+void logEvent(LogEventType type, int motor, int value) {
+  if (sessionMode == SESSION_REPLAYING) return;
+  mqttQueueEvent(type, motor, value);
+  if (!logQueue) return;
+  LogRecord record = {};
+  record.ms = uptimeMs();
+  record.type = type;
+  record.motor = motor;
+  record.value = constrain(value, INT16_MIN, INT16_MAX);
+  if (xQueueSend(logQueue, &record, 0) != pdTRUE) {
+    logDropped++;
+  }
+}
+
+uint32_t logRecordCrc(const LogRecord &record) {
+  return crc32_le(0, (const uint8_t*)&record, offsetof(LogRecord, crc));
+}
+
+void logSegmentPath(char *path, size_t len, uint32_t firstSeq) {
+  snprintf(path, len, LOG_DIR "/%08x", (unsigned)firstSeq);
+}
+
+// Останній цілий запис сегмента; 0 — жодного
+uint32_t logLastValidSeq(uint32_t firstSeq) {
+  char path[24];
+  logSegmentPath(path, sizeof(path), firstSeq);
+  File file = LittleFS.open(path, "r");
+  if (!file) return 0;
+
+  uint32_t lastSeq = 0;
+  LogRecord record;
+  while (file.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+    if (record.crc != logRecordCrc(record) || record.seq != firstSeq + (file.position() / sizeof(record)) - 1) break;
+    lastSeq = record.seq;
+  }
+  file.close();
+  return lastSeq;
+}
+
+// Після старту завжди починаємо новий сегмент: хвіст попереднього
+// міг бути недописаний при вимкненні живлення
+void loadEventLog() {
+  LittleFS.mkdir(LOG_DIR);
+  logSegmentCount = 0;
+
+  File dir = LittleFS.open(LOG_DIR);
+  if (dir && dir.isDirectory()) {
+    File file = dir.openNextFile();
+    while (file) {
+      const char* name = strrchr(file.name(), '/');
+      name = name ? name + 1 : file.name();
+      uint32_t firstSeq = strtoul(name, nullptr, 16);
+      file.close();
+
+      if (firstSeq > 0) {
+        // Вставка з сортуванням; зайві найстаріші відкидаються
+        int pos = logSegmentCount;
+        while (pos > 0 && logSegments[pos - 1] > firstSeq) {
+          logSegments[pos] = logSegments[pos - 1];
+          pos--;
+        }
+        logSegments[pos] = firstSeq;
+        if (logSegmentCount < LOG_SEGMENT_COUNT) {
+          logSegmentCount++;
+        } else {
+          char path[24];
+          logSegmentPath(path, sizeof(path), logSegments[0]);
+          LittleFS.remove(path);
+          memmove(logSegments, logSegments + 1, LOG_SEGMENT_COUNT * sizeof(uint32_t));
+        }
+      }
+      file = dir.openNextFile();
+    }
+  }
+
+  if (logSegmentCount > 0) {
+    uint32_t newest = logSegments[logSegmentCount - 1];
+    uint32_t lastSeq = logLastValidSeq(newest);
+    logNextSeq = lastSeq ? lastSeq + 1 : newest + LOG_SEGMENT_RECORDS;
+  }
+  Serial.printf("Event log: %d segments, next seq %u\n", logSegmentCount, (unsigned)logNextSeq);
+}
+
+// Відкриває новий сегмент і видаляє найстаріший понад бюджет
+File logOpenSegment() {
+  char path[24];
+  if (logSegmentCount >= LOG_SEGMENT_COUNT) {
+    logSegmentPath(path, sizeof(path), logSegments[0]);
+    LittleFS.remove(path);
+    portENTER_CRITICAL(&logMux);
+    memmove(logSegments, logSegments + 1, (logSegmentCount - 1) * sizeof(uint32_t));
+    logSegmentCount--;
+    portEXIT_CRITICAL(&logMux);
+  }
+
+  logSegmentPath(path, sizeof(path), logNextSeq);
+  File file = LittleFS.open(path, "w");
+  if (file) {
+    portENTER_CRITICAL(&logMux);
+    logSegments[logSegmentCount++] = logNextSeq;
+    portEXIT_CRITICAL(&logMux);
+  }
+  return file;
+}
+
+// Задача журналу: збирає пакет із черги, дописує його одним write()
+// і робить flush, тож після збою губиться щонайбільше один пакет
+void eventLogTask(void *param) {
+  File segment = logOpenSegment();
+  uint32_t segmentRecords = 0;
+  LogRecord batch[LOG_BATCH_MAX];
+
+  while (true) {
+    int count = 0;
+    if (xQueueReceive(logQueue, &batch[count], portMAX_DELAY) != pdTRUE) continue;
+    count++;
+    while (count < LOG_BATCH_MAX && xQueueReceive(logQueue, &batch[count], 0) == pdTRUE) {
+      count++;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (!segment || segmentRecords >= LOG_SEGMENT_RECORDS) {
+        if (segment) segment.close();
+        segment = logOpenSegment();
+        segmentRecords = 0;
+      }
+      if (!segment) break;
+
+      batch[i].seq = logNextSeq++;
+      batch[i].crc = logRecordCrc(batch[i]);
+      segment.write((const uint8_t*)&batch[i], sizeof(LogRecord));
+      segmentRecords++;
+    }
+    if (segment) segment.flush();
+  }
+}
+
+void startEventLog() {
+  loadEventLog();
+  logQueue = xQueueCreate(LOG_QUEUE_LENGTH, sizeof(LogRecord));
+  xTaskCreate(eventLogTask, "Event Log", 4096, NULL, 1, NULL);
+  logEvent(LOG_BOOT, -1, (int)esp_reset_reason());
+}
+
+// Читання діапазону для GET /api/log: JSON-рядки, сегмент за сегментом
+struct LogExport {
+  uint32_t seq;
+  uint32_t remaining;
+  File file;               // сегмент, що читається зараз
+  uint32_t fileFirst;
+  uint32_t fileEnd;        // перший seq наступного сегмента
+  bool opened;
+  bool closed;
+  bool first;
+  char line[128];
+  size_t lineLen;
+  size_t linePos;
+};
+
+enum LogRead {
+  LOG_READ_OK,
+  LOG_READ_BAD,            // пошкоджений запис — далі в сегменті можуть бути цілі
+  LOG_READ_GAP             // до кінця сегмента записів немає, продовжуємо з ex.fileEnd
+};
+
+// Сегмент тримається відкритим, тож послідовне читання обходиться без seek
+LogRead logReadRecord(LogExport &ex, uint32_t seq, LogRecord &record) {
+  if (!ex.file || seq < ex.fileFirst || seq >= ex.fileEnd) {
+    if (ex.file) ex.file.close();
+    ex.fileFirst = 0;
+    ex.fileEnd = UINT32_MAX;
+    portENTER_CRITICAL(&logMux);
+    for (int i = logSegmentCount - 1; i >= 0; i--) {
+      if (logSegments[i] <= seq) {
+        ex.fileFirst = logSegments[i];
+        break;
+      }
+      ex.fileEnd = logSegments[i];
+    }
+    portEXIT_CRITICAL(&logMux);
+    if (ex.fileFirst == 0) return LOG_READ_GAP;   // seq між сегментами
+
+    char path[24];
+    logSegmentPath(path, sizeof(path), ex.fileFirst);
+    ex.file = LittleFS.open(path, "r");
+    if (!ex.file) return LOG_READ_GAP;
+  }
+
+  size_t offset = (seq - ex.fileFirst) * sizeof(LogRecord);
+  if (ex.file.position() != offset && !ex.file.seek(offset)) return LOG_READ_GAP;
+  if (ex.file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) return LOG_READ_GAP;
+  return record.crc == logRecordCrc(record) && record.seq == seq ? LOG_READ_OK : LOG_READ_BAD;
+}
+
+// false — рядків більше немає або вичерпано reads; різницю видно з ex.closed
+bool logNextLine(LogExport &ex, uint32_t &reads) {
+  if (!ex.opened) {
+    ex.opened = true;
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line), "[");
+    return true;
+  }
+
+  while (ex.remaining > 0 && ex.seq < logNextSeq) {
+    if (reads == 0) return false;
+    reads--;
+    LogRecord record;
+    LogRead result = logReadRecord(ex, ex.seq, record);
+    if (result == LOG_READ_GAP) {
+      // Решта сегмента відсутня (недописаний чи після відновлення) — одразу до наступного
+      ex.seq = max(ex.fileEnd, ex.seq + 1);
+      if (ex.file) ex.file.close();
+      continue;
+    }
+    ex.seq++;
+    if (result == LOG_READ_BAD) continue;
+    ex.remaining--;
+
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line),
+      "%s\n{\"seq\":%u,\"ms\":%u,\"type\":\"%s\",\"motor\":%d,\"value\":%d}",
+      ex.first ? "" : ",", (unsigned)record.seq, (unsigned)record.ms,
+      record.type < LOG_EVENT_TYPE_COUNT ? logEventNames[record.type] : "unknown",
+      record.motor, record.value);
+    ex.first = false;
+    return true;
+  }
+
+  if (!ex.closed) {
+    ex.closed = true;
+    if (ex.file) ex.file.close();
+    ex.lineLen = snprintf(ex.line, sizeof(ex.line), "\n]\n");
+    return true;
+  }
+  return false;
+}
+
+// Колбек виконується в задачі async_tcp, тож роботу за виклик обмежено
+size_t logFill(LogExport &ex, uint8_t *buffer, size_t maxLen) {
+  size_t written = 0;
+  uint32_t reads = LOG_EXPORT_READS_MAX;
+  while (written < maxLen) {
+    if (ex.linePos == ex.lineLen) {
+      ex.linePos = ex.lineLen = 0;
+      if (!logNextLine(ex, reads)) break;
+    }
+    size_t part = min(maxLen - written, ex.lineLen - ex.linePos);
+    memcpy(buffer + written, ex.line + ex.linePos, part);
+    ex.linePos += part;
+    written += part;
+  }
+  // Бюджет пішов на пропуски, а 0 завершив би відповідь: пробіл допустимий у JSON
+  if (written == 0 && !ex.closed && maxLen > 0) {
+    buffer[0] = ' ';
+    written = 1;
+  }
+  return written;
+}
+
+// GET /api/log?from=<seq>&count=<n>; без from — найстаріший збережений запис
+void handleLogRequest(AsyncWebServerRequest *request) {
+  LogExport ex;
+  ex.seq = 0;
+  ex.remaining = 0;
+  ex.fileFirst = 0;
+  ex.fileEnd = 0;
+  ex.opened = false;
+  ex.closed = false;
+  ex.first = true;
+  ex.lineLen = 0;
+  ex.linePos = 0;
+
+  portENTER_CRITICAL(&logMux);
+  uint32_t oldest = logSegmentCount > 0 ? logSegments[0] : logNextSeq;
+  portEXIT_CRITICAL(&logMux);
+
+  ex.seq = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), nullptr, 10) : oldest;
+  if (ex.seq < oldest) ex.seq = oldest;
+  ex.remaining = request->hasParam("count") ? request->getParam("count")->value().toInt() : 100;
+  ex.remaining = min(ex.remaining, (uint32_t)LOG_QUERY_MAX);
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+    [ex](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return logFill(ex, buffer, maxLen);
+    });
+  response->addHeader("X-Log-Next-Seq", String(logNextSeq));
+  response->addHeader("X-Log-Dropped", String(logDropped));
+  request->send(response);
+}
+
+// ==== Telemetry recorder ====
+uint8_t* putVarint(uint8_t *p, uint32_t value) {
+  while (value >= 0x80) {
+    *p++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *p++ = value;
+  return p;
+}
+
+uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+uint8_t telemetryFlags(int i) {
+  const Motor &m = motors[i];
+  uint8_t dir = !m.running ? 0 : (m.dir > 0 ? 1 : (m.dir < 0 ? 2 : 0));
+  uint8_t mode = 0;
+  if (m.calibrating) mode = 4;
+  else if (m.fullForward) mode = 2;
+  else if (m.fullBackward) mode = 3;
+  else if (m.running) mode = 1;
+
+  uint8_t flags = dir | (mode << TELEMETRY_MODE_SHIFT);
+  if (motors.limitHit(i)) flags |= TELEMETRY_LIMIT_BIT;
+  return flags;
+}
+
+void telemetryCapture(TelemetrySample &s) {
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    s.position[i] = motors[i].real_position;
+    s.flags[i] = telemetryFlags(i);
+  }
+  s.servo = servoState ? 1 : 0;
+}
+
+// Новий блок з ключовим кадром поверх найстарішого
+void telemetryOpenBlock(const TelemetrySample &s) {
+  uint32_t seq = telemetrySeq + 1;
+  TelemetryBlock &block = telemetryRing[seq % TELEMETRY_BLOCK_COUNT];
+
+  block.header.seq = 0;    // поки заповнюється, експорт його пропускає
+  block.header.startMs = uptimeMs();
+  block.header.intervalMs = telemetryIntervalMs;
+
+  uint8_t *p = block.data;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    p = putVarint(p, zigzag(s.position[i]));
+    *p++ = s.flags[i];
+  }
+  *p++ = s.servo;
+  block.header.used = p - block.data;
+  block.header.seq = seq;
+
+  telemetrySeq = seq;
+  telemetryLastRecordTick = telemetryTick;
+  telemetryLast = s;
+  telemetryReopen = false;
+}
+
+// Викликається з loop() після оновлення позицій
+void telemetrySample() {
+  if (!intervalElapsed(telemetryLastSample, msToUs(telemetryIntervalMs))) return;
+  telemetryLastSample = nowUs();
+  telemetryTick++;
+
+  TelemetrySample s;
+  telemetryCapture(s);
+  if (telemetryReopen) {
+    telemetryOpenBlock(s);
+    return;
+  }
+
+  uint32_t mask = 0;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (s.position[i] != telemetryLast.position[i] || s.flags[i] != telemetryLast.flags[i]) {
+      mask |= 1 << i;
+    }
+  }
+  if (s.servo != telemetryLast.servo) mask |= TELEMETRY_SERVO_BIT;
+  if (mask == 0) return;
+
+  TelemetryBlock &block = telemetryRing[telemetrySeq % TELEMETRY_BLOCK_COUNT];
+  if (block.header.used + TELEMETRY_MAX_RECORD > sizeof(block.data)) {
+    telemetryOpenBlock(s);
+    return;
+  }
+
+  uint8_t *p = block.data + block.header.used;
+  p = putVarint(p, telemetryTick - telemetryLastRecordTick);
+  p = putVarint(p, mask);
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!(mask & (1 << i))) continue;
+    p = putVarint(p, zigzag(s.position[i] - telemetryLast.position[i]));
+    *p++ = s.flags[i];
+  }
+  if (mask & TELEMETRY_SERVO_BIT) *p++ = s.servo;
+  block.header.used = p - block.data;
+
+  telemetryLastRecordTick = telemetryTick;
+  telemetryLast = s;
+}
+
+void setTelemetryRate(int hz) {
+  hz = constrain(hz, 1, TELEMETRY_MAX_RATE);
+  telemetryIntervalMs = 1000 / hz;
+  telemetryReopen = true;   // інтервал записаний у заголовку блоку
+  Serial.printf("Telemetry interval %u ms\n", telemetryIntervalMs);
+}
+
+// Віддача: файловий заголовок "STTL", далі блоки (заголовок + used байтів)
+// від найстарішого. Дані копіюються з кільця прямо в буфер TCP.
+struct TelemetryExport {
+  uint32_t seq;
+  uint32_t endSeq;
+  TelemetryBlockHeader header;   // знімок заголовка поточного блоку
+  size_t offset;                 // позиція в заголовку + даних блоку
+  uint8_t fileHeader[8];
+  size_t fileHeaderPos;
+};
+
+size_t telemetryFill(TelemetryExport &ex, uint8_t *buffer, size_t maxLen) {
+  size_t written = 0;
+
+  if (ex.fileHeaderPos < sizeof(ex.fileHeader)) {
+    size_t part = min(maxLen, sizeof(ex.fileHeader) - ex.fileHeaderPos);
+    memcpy(buffer, ex.fileHeader + ex.fileHeaderPos, part);
+    ex.fileHeaderPos += part;
+    written += part;
+  }
+
+  while (written < maxLen && ex.seq <= ex.endSeq) {
+    const TelemetryBlock &block = telemetryRing[ex.seq % TELEMETRY_BLOCK_COUNT];
+    if (ex.offset == 0) {
+      ex.header = block.header;
+      if (ex.header.seq != ex.seq) {
+        ex.seq++;       // блок уже перезаписаний або ще не готовий
+        continue;
+      }
+    }
+
+    size_t blockLen = sizeof(ex.header) + ex.header.used;
+    size_t part = min(maxLen - written, blockLen - ex.offset);
+    if (ex.offset < sizeof(ex.header)) {
+      part = min(part, sizeof(ex.header) - ex.offset);
+      memcpy(buffer + written, (const uint8_t*)&ex.header + ex.offset, part);
+    } else {
+      memcpy(buffer + written, block.data + (ex.offset - sizeof(ex.header)), part);
+    }
+    ex.offset += part;
+    written += part;
+
+    if (ex.offset == blockLen) {
+      ex.offset = 0;
+      ex.seq++;
+    }
+  }
+  return written;
+}
+
+// GET /api/telemetry.bin
+void handleTelemetryRequest(AsyncWebServerRequest *request) {
+  TelemetryExport ex = {};
+  ex.endSeq = telemetrySeq;
+  ex.seq = ex.endSeq >= TELEMETRY_BLOCK_COUNT ? ex.endSeq - TELEMETRY_BLOCK_COUNT + 1 + TELEMETRY_EXPORT_MARGIN : 1;
+  memcpy(ex.fileHeader, "STTL", 4);
+  ex.fileHeader[4] = 1;    // версія формату
+  ex.fileHeader[5] = AXIS_COUNT;    // кількість осей
+  ex.fileHeader[6] = TELEMETRY_BLOCK_SIZE & 0xff;
+  ex.fileHeader[7] = TELEMETRY_BLOCK_SIZE >> 8;
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/octet-stream",
+    [ex](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return telemetryFill(ex, buffer, maxLen);
+    });
+  response->addHeader("Content-Disposition", "attachment; filename=\"telemetry.bin\"");
+  request->send(response);
+}
+
+// ==== Trace capture ====
+void traceStart(unsigned long durationMs) {
+  traceArmed = false;
+  traceHead = 0;
+  traceLastSync = nowUs();
+  traceStopAt = durationMs > 0 ? nowUs() + msToUs(durationMs) : 0;
+  traceArmed = true;
+  traceRecord(TRACE_SYNC, 'i', 0);
+  Serial.printf("Trace armed%s\n", durationMs > 0 ? " with auto stop" : "");
+}
+
+void traceStop() {
+  if (!traceArmed) return;
+  traceArmed = false;
+  traceStopAt = 0;
+  Serial.printf("Trace stopped, %u events\n", (unsigned)min((uint32_t)traceHead, (uint32_t)TRACE_CAPACITY));
+}
+
+// З loop(): мітки синхронізації та автозупинка
+void traceTick() {
+  if (!traceArmed) return;
+  if (traceStopAt != 0 && deadlineReached(traceStopAt)) {
+    traceStop();
+    return;
+  }
+  if (intervalElapsed(traceLastSync, msToUs(TRACE_SYNC_INTERVAL))) {
+    traceLastSync = nowUs();
+    traceRecord(TRACE_SYNC, 'i', 0);
+  }
+}
+
+// GET /trace.json: запис зупиняється, буфер віддається частинами
+void handleTraceRequest(AsyncWebServerRequest *request) {
+  traceStop();
+
+  TraceExport ex;
+  traceExportBegin(ex, traceRing, traceHead, metricsCpuMhz);
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+    [ex](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return traceFill(ex, buffer, maxLen);
+    });
+  response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+  request->send(response);
+}
+
+// ==== JSON arena allocator ====
+static inline uint32_t arenaAlign(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+void* JsonArena::allocate(size_t size) {
+  uint32_t need = sizeof(Block) + arenaAlign(size);
+  if (top + need > JSON_ARENA_SIZE) {
+    __atomic_fetch_add(&jsonArenaOverflows, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+  }
+
+  Block* b = block(top);
+  b->size = arenaAlign(size);
+  b->prev = last;
+  last = top;
+  top += need;
+  if (top > highWater) highWater = top;
+  return b + 1;
+}
+
+void JsonArena::deallocate(void* ptr) {
+  if (!ptr) return;
+  if (!owns(ptr)) {
+    free(ptr);
+    return;
+  }
+
+  ((Block*)ptr - 1)->size |= FREED;
+  while (last != NO_BLOCK && (block(last)->size & FREED)) {
+    top = last;
+    last = block(last)->prev;
+  }
+}
+
+void* JsonArena::reallocate(void* ptr, size_t size) {
+  if (!ptr) return allocate(size);
+  if (!owns(ptr)) return realloc(ptr, size);
+
+  Block* b = (Block*)ptr - 1;
+  uint32_t offset = (uint8_t*)b - buffer;
+
+  // Верхній блок росте і стискається на місці (рядки під час розбору, shrinkToFit)
+  if (offset == last && offset + sizeof(Block) + arenaAlign(size) <= JSON_ARENA_SIZE) {
+    b->size = arenaAlign(size);
+    top = offset + sizeof(Block) + b->size;
+    if (top > highWater) highWater = top;
+    return ptr;
+  }
+  if (size <= b->size) return ptr;
+
+  void* moved = allocate(size);
+  if (!moved) return nullptr;
+  memcpy(moved, ptr, b->size);
+  deallocate(ptr);
+  return moved;
+}
+
+void JsonArena::reset() {
+  top = 0;
+  last = NO_BLOCK;
+}
+
+JsonArenaScope::JsonArenaScope() : arena(nullptr) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&jsonArenaMux);
+  for (int i = 0; i < JSON_ARENA_COUNT && !arena; i++) {
+    if (jsonArenas[i].owner == self) arena = &jsonArenas[i];
+  }
+  for (int i = 0; i < JSON_ARENA_COUNT && !arena; i++) {
+    if (jsonArenas[i].owner == NULL) {
+      arena = &jsonArenas[i];
+      arena->owner = self;
+    }
+  }
+  if (arena) arena->depth++;
+  portEXIT_CRITICAL(&jsonArenaMux);
+
+  if (!arena) {
+    __atomic_fetch_add(&jsonArenaOverflows, 1, __ATOMIC_RELAXED);
+  }
+}
+
+JsonArenaScope::~JsonArenaScope() {
+  if (!arena) return;
+  portENTER_CRITICAL(&jsonArenaMux);
+  if (--arena->depth == 0) {
+    arena->reset();
+    arena->owner = NULL;
+  }
+  portEXIT_CRITICAL(&jsonArenaMux);
+}
+
+ArduinoJson::Allocator* JsonArenaScope::allocator() {
+  if (arena) return arena;
+  return &heapJsonAllocator;
+}
+
+// Раз на секунду з loop(); restart — почати відлік сталого режиму заново
+void sampleHeap(bool restart) {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t largest = ESP.getMaxAllocHeap();
+  if (restart || heapSteadyBaseline == 0) {
+    heapSteadyBaseline = freeHeap;
+    heapSteadyLow = freeHeap;
+    heapLargestBlockLow = largest;
+    return;
+  }
+  if (freeHeap < heapSteadyLow) heapSteadyLow = freeHeap;
+  if (largest < heapLargestBlockLow) heapLargestBlockLow = largest;
+}
+
+// ==== Session record and replay ====
+uint8_t sessionReadLimits() {
+  uint8_t mask = 0;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (motors.limitHit(i)) mask |= 1 << i;
+  }
+  return mask;
+}
+
+// Подія з міткою часу at; END завжди має місце в резерві
+bool sessionAppend(SessionEventType type, const void *data, size_t len, TimeUs at) {
+  bool ok = false;
+  portENTER_CRITICAL(&sessionMux);
+  if (sessionMode == SESSION_RECORDING && (!sessionTruncated || type == SESSION_END)) {
+    size_t reserve = type == SESSION_END ? 0 : SESSION_END_RESERVE;
+    if (sessionLength + 10 + 1 + len + reserve <= SESSION_BUFFER_SIZE) {
+      // Команди з задачі вебсервера можуть на мікросекунди випередити такт loop()
+      TimeUs dt = at > sessionLastEventUs ? at - sessionLastEventUs : 0;
+      sessionLastEventUs += dt;
+      sessionLength += sessionPutEvent(sessionBuffer + sessionLength, dt, type, data, len);
+      ok = true;
+    } else {
+      sessionTruncated = true;
+      sessionStopRequested = true;
+    }
+  }
+  portEXIT_CRITICAL(&sessionMux);
+  return ok;
+}
+
+void sessionRecordCommand(const Command &cmd) {
+  uint8_t data[SESSION_COMMAND_SIZE];
+  sessionPackCommand(cmd, data);
+  sessionAppend(SESSION_COMMAND, data, sizeof(data), nowUs());
+}
+
+// Викликається з loop() перед controlTick(): лише зміни входів
+void sessionRecordInputs(int detents, bool btnState) {
+  if (sessionMode != SESSION_RECORDING) return;
+  TimeUs now = nowUs();
+
+  if (detents != 0) {
+    uint8_t data[10];
+    sessionAppend(SESSION_ENCODER, data, sessionPackDetents(detents, data), now);
+  }
+  if (btnState != sessionLastButton) {
+    sessionLastButton = btnState;
+    uint8_t level = btnState;
+    sessionAppend(SESSION_BUTTON, &level, 1, now);
+  }
+  uint8_t limits = sessionReadLimits();
+  if (limits != sessionLastLimits) {
+    sessionLastLimits = limits;
+    sessionAppend(SESSION_LIMITS, &limits, 1, now);
+  }
+}
+
+void sessionStartRecording() {
+  TimeUs now = nowUs();
+  SessionHeader h = {};
+  memcpy(h.magic, "STRC", 4);
+  h.version = SESSION_VERSION;
+  h.axisCount = AXIS_COUNT;
+  h.size = sizeof(SessionHeader);
+  h.msPerMm = config.msPerMm;
+  h.startUs = now;
+  h.lastDetentUs = lastDetentTime;
+  h.lastDebounceUs = lastDebounce;
+  h.lastEncoderUpdateUs = lastEncoderUpdate;
+  h.displayStartUs = displayStartTime;
+  for (int i = 0; i < SESSION_MENU_LEVELS; i++) {
+    h.menuIndex[i] = menu_index[i];
+  }
+  h.menuLevel = menu_level;
+  h.selectedMotor = selected_motor;
+  h.selectedAction = selected_action;
+  bool button = digitalRead(encoderPins[2]);
+  h.flags = (edit_value ? SESSION_EDIT_VALUE : 0) | (btnPressed ? SESSION_BUTTON_HELD : 0) |
+            (servoState ? SESSION_SERVO_ON : 0) | (button == LOW ? SESSION_BUTTON_LOW : 0) |
+            (encoderRedrawPending ? SESSION_REDRAW_PENDING : 0) | (showIP ? SESSION_OVERLAY : 0);
+  h.limits = sessionReadLimits();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    const Motor &m = motors[i];
+    SessionAxis &a = h.axes[i];
+    a.manualDistance = m.manual_distance;
+    a.realPosition = m.real_position;
+    a.target = m.target;
+    a.stepPhaseUs = m.running ? (uint32_t)(now - m.last_position_update) : 0;
+    a.dir = m.dir;
+    a.stopLeadUs[MOTION_FORWARD] = motionLeadUs(i, 1);
+    a.stopLeadUs[MOTION_BACKWARD] = motionLeadUs(i, -1);
+    a.flags = (m.running ? SESSION_AXIS_RUNNING : 0) | (m.fullForward ? SESSION_AXIS_FULL_FORWARD : 0) |
+              (m.fullBackward ? SESSION_AXIS_FULL_BACKWARD : 0) | (m.calibrating ? SESSION_AXIS_CALIBRATING : 0);
+  }
+  h.presets = presetTable;
+
+  portENTER_CRITICAL(&sessionMux);
+  memcpy(sessionBuffer, &h, sizeof(h));
+  sessionLength = sizeof(h);
+  sessionTruncated = false;
+  sessionStopRequested = false;
+  sessionLastEventUs = now;
+  sessionLastButton = button;
+  sessionLastLimits = h.limits;
+  sessionMode = SESSION_RECORDING;
+  portEXIT_CRITICAL(&sessionMux);
+
+  sessionResult = SessionResult();
+  Serial.println("Session recording started");
+}
+
+// Підсумкові позиції — еталон для порівняння після відтворення
+void sessionStopRecording() {
+  uint8_t data[AXIS_COUNT * 8];
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    int32_t values[2] = {motors[i].real_position, motors[i].manual_distance};
+    memcpy(data + i * 8, values, 8);
+  }
+  sessionAppend(SESSION_END, data, sizeof(data), nowUs());
+  sessionMode = SESSION_IDLE;
+  sessionStopRequested = false;
+  Serial.printf("Session recording stopped: %u bytes%s\n", (unsigned)sessionLength,
+                sessionTruncated ? " (buffer full)" : "");
+}
+
+bool sessionHeaderValid(const char **error) {
+  const SessionHeader *h = (const SessionHeader*)sessionBuffer;
+  if (sessionLength < sizeof(SessionHeader) || memcmp(h->magic, "STRC", 4) != 0 || h->version != SESSION_VERSION) {
+    *error = "not a session trace";
+  } else if (h->size != sizeof(SessionHeader) || h->axisCount != AXIS_COUNT) {
+    *error = "axis count mismatch";
+  } else if (h->msPerMm != (uint32_t)config.msPerMm) {
+    *error = "motion constants differ";
+  } else {
+    return true;
+  }
+  return false;
+}
+
+void sessionFinishReplay(const char *error) {
+  SessionResult &r = sessionResult;
+  r.valid = error == nullptr;
+  r.error = error;
+  r.match = r.valid;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    r.actual[i] = motors[i].real_position;
+    if (r.valid && r.actual[i] != r.expected[i]) r.match = false;
+  }
+  r.virtualMs = (uint32_t)((sessionReplay.lastTickUs - sessionReplay.startUs) / 1000);
+  r.wallMs = (uint32_t)((nowUs() - sessionReplay.realStartUs) / 1000);
+
+  // Повертаємо справжній стан машини
+  const SessionSaved &s = sessionSaved;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    motors[i] = s.axes[i];
+  }
+  portENTER_CRITICAL(&motionMux);
+  memcpy(motionModel, s.motion, sizeof(motionModel));
+  portEXIT_CRITICAL(&motionMux);
+  memcpy(motionTrack, s.track, sizeof(motionTrack));
+  presetTable = s.presets;
+  memcpy(menu_index, s.menuIndex, sizeof(s.menuIndex));
+  menu_level = s.menuLevel;
+  selected_motor = s.selectedMotor;
+  selected_action = s.selectedAction;
+  edit_value = s.editValue;
+  servoState = s.servo;
+  btnPressed = s.btnPressed;
+  encoderRedrawPending = s.redrawPending;
+  showIP = s.overlay;
+  lastDetentTime = s.lastDetent;
+  lastDebounce = s.lastDebounce;
+  lastEncoderUpdate = s.lastEncoderUpdate;
+  displayStartTime = s.displayStart;
+
+  motors.simulate(false);
+  controlClockVirtual = false;
+  sessionMode = SESSION_IDLE;
+  statePending = false;
+  menuPending = false;
+  drawMenu();
+  sendState();
+
+  if (error) {
+    Serial.printf("Session replay failed: %s\n", error);
+  } else {
+    Serial.printf("Session replay %s: %lu events, %lu ticks, %lu ms virtual in %lu ms\n",
+                  r.match ? "matched" : "DIVERGED", (unsigned long)r.events, (unsigned long)r.ticks,
+                  (unsigned long)r.virtualMs, (unsigned long)r.wallMs);
+  }
+}
+
+void sessionStartReplay(float speed) {
+  sessionResult = SessionResult();
+  const char *error = nullptr;
+  if (!sessionHeaderValid(&error)) {
+    sessionResult.error = error;
+    return;
+  }
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (motors[i].running) {
+      sessionResult.error = "motors running";
+      return;
+    }
+  }
+
+  SessionSaved &s = sessionSaved;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    s.axes[i] = motors[i];
+  }
+  memcpy(s.motion, motionModel, sizeof(s.motion));
+  memcpy(s.track, motionTrack, sizeof(s.track));
+  s.presets = presetTable;
+  memcpy(s.menuIndex, menu_index, sizeof(s.menuIndex));
+  s.menuLevel = menu_level;
+  s.selectedMotor = selected_motor;
+  s.selectedAction = selected_action;
+  s.editValue = edit_value;
+  s.servo = servoState;
+  s.btnPressed = btnPressed;
+  s.redrawPending = encoderRedrawPending;
+  s.overlay = showIP;
+  s.lastDetent = lastDetentTime;
+  s.lastDebounce = lastDebounce;
+  s.lastEncoderUpdate = lastEncoderUpdate;
+  s.displayStart = displayStartTime;
+
+  // Стан на початку запису
+  SessionHeader h;
+  memcpy(&h, sessionBuffer, sizeof(h));
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    const SessionAxis &a = h.axes[i];
+    Motor &m = motors[i];
+    m = Motor();
+    m.manual_distance = a.manualDistance;
+    m.real_position = a.realPosition;
+    m.target = a.target;
+    m.dir = a.dir;
+    m.running = a.flags & SESSION_AXIS_RUNNING;
+    m.fullForward = a.flags & SESSION_AXIS_FULL_FORWARD;
+    m.fullBackward = a.flags & SESSION_AXIS_FULL_BACKWARD;
+    m.calibrating = a.flags & SESSION_AXIS_CALIBRATING;
+    m.last_position_update = h.startUs - a.stepPhaseUs;
+    m.move_start_time = m.last_position_update;
+    // Випередження зупинки — як під час запису
+    for (int d = 0; d < MOTION_DIRS; d++) {
+      motionModel[i].lagUs[d] = a.stopLeadUs[d];
+      motionModel[i].coastUs[d] = 0;
+    }
+    motionTrack[i].moving = m.running;
+  }
+  presetTable = h.presets;
+  for (int i = 0; i < SESSION_MENU_LEVELS; i++) {
+    menu_index[i] = h.menuIndex[i];
+  }
+  menu_level = h.menuLevel;
+  selected_motor = h.selectedMotor;
+  selected_action = h.selectedAction;
+  edit_value = h.flags & SESSION_EDIT_VALUE;
+  btnPressed = h.flags & SESSION_BUTTON_HELD;
+  servoState = h.flags & SESSION_SERVO_ON;
+  encoderRedrawPending = h.flags & SESSION_REDRAW_PENDING;
+  showIP = h.flags & SESSION_OVERLAY;
+  lastDetentTime = h.lastDetentUs;
+  lastDebounce = h.lastDebounceUs;
+  lastEncoderUpdate = h.lastEncoderUpdateUs;
+  displayStartTime = h.displayStartUs;
+
+  sessionReplay = SessionReplay();
+  sessionReplay.startUs = h.startUs;
+  sessionReplay.lastTickUs = h.startUs;
+  sessionReplay.realStartUs = nowUs();
+  sessionReplay.speed = speed;
+  sessionReplay.button = (h.flags & SESSION_BUTTON_LOW) ? LOW : HIGH;
+
+  motors.simulate(true);
+  motors.setSimulatedLimits(h.limits);
+  controlClockVirtual = true;
+  controlClockUs = h.startUs;
+  sessionMode = SESSION_REPLAYING;
+  Serial.printf("Session replay started, speed %.2f\n", speed);
+
+  if (!sessionCursorBegin(sessionReplay.cursor, sessionBuffer, sessionLength, sizeof(SessionHeader),
+                          AXIS_COUNT, h.startUs)) {
+    sessionFinishReplay("empty trace");
+  }
+}
+
+// Застосовує подію сліду до машини у віртуальний момент такту
+void sessionReplayApply(const SessionEvent &e, int &detents) {
+  switch (e.type) {
+    case SESSION_COMMAND:
+      sessionReplay.injecting = true;
+      applyCommand(e.cmd);
+      sessionReplay.injecting = false;
+      break;
+    case SESSION_ENCODER:
+      detents += e.detents;
+      break;
+    case SESSION_BUTTON:
+      sessionReplay.button = e.level ? HIGH : LOW;
+      break;
+    case SESSION_LIMITS:
+      motors.setSimulatedLimits(e.level);
+      break;
+    case SESSION_END:
+      for (int i = 0; i < AXIS_COUNT; i++) {
+        sessionResult.expected[i] = sessionEndPosition(e, i);
+      }
+      return;
+  }
+  sessionResult.events++;
+}
+
+// Крок відтворення з loop(): такти через SESSION_TICK_US і в моменти подій,
+// не далі, ніж дозволяє швидкість (0 — без обмеження, до SESSION_REPLAY_BUDGET тактів)
+void sessionReplayStep() {
+  SessionReplay &r = sessionReplay;
+  TimeUs limit = INT64_MAX;
+  if (r.speed > 0) {
+    limit = r.startUs + (TimeUs)((nowUs() - r.realStartUs) * r.speed);
+  }
+
+  for (int budget = SESSION_REPLAY_BUDGET; budget > 0; budget--) {
+    TimeUs at = sessionNextTickUs(r.cursor, r.lastTickUs);
+    if (at > limit) return;
+    controlClockUs = at;
+
+    // Усі події з однаковою міткою — як входи одного такту loop()
+    int detents = 0;
+    bool ended = false;
+    SessionEvent e;
+    while (!ended && sessionTakeEvent(r.cursor, at, e)) {
+      sessionReplayApply(e, detents);
+      ended = e.type == SESSION_END;
+    }
+    if (r.cursor.corrupt) {
+      sessionFinishReplay("corrupt trace");
+      return;
+    }
+    if (ended) {
+      sessionFinishReplay(nullptr);
+      return;
+    }
+
+    controlTick(detents, r.button);
+    r.lastTickUs = at;
+    sessionResult.ticks++;
+  }
+}
+
+void sessionService() {
+  SessionRequest request = sessionRequest;
+  sessionRequest = SESSION_REQ_NONE;
+
+  if (sessionStopRequested && sessionMode == SESSION_RECORDING) {
+    sessionStopRecording();
+  }
+
+  switch (request) {
+    case SESSION_REQ_RECORD:
+      if (sessionMode == SESSION_IDLE) sessionStartRecording();
+      break;
+    case SESSION_REQ_STOP:
+      if (sessionMode == SESSION_RECORDING) {
+        sessionStopRecording();
+      } else if (sessionMode == SESSION_REPLAYING) {
+        sessionFinishReplay("stopped");
+      }
+      break;
+    case SESSION_REQ_REPLAY:
+      if (sessionMode == SESSION_IDLE) sessionStartReplay(sessionRequestSpeed);
+      break;
+    default:
+      break;
+  }
+
+  if (sessionMode == SESSION_REPLAYING) {
+    sessionReplayStep();
+  }
+}
+
+void handleSessionStatus(AsyncWebServerRequest *request) {
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  doc["mode"] = sessionModeNames[sessionMode];
+  doc["bytes"] = sessionLength;
+  doc["capacity"] = SESSION_BUFFER_SIZE;
+  doc["truncated"] = sessionTruncated;
+
+  const SessionResult &r = sessionResult;
+  if (r.valid || r.error) {
+    JsonObject replay = doc["replay"].to<JsonObject>();
+    if (r.error) replay["error"] = r.error;
+    replay["match"] = r.match;
+    replay["events"] = r.events;
+    replay["ticks"] = r.ticks;
+    replay["virtualMs"] = r.virtualMs;
+    replay["wallMs"] = r.wallMs;
+    JsonArray expected = replay["expected"].to<JsonArray>();
+    JsonArray actual = replay["actual"].to<JsonArray>();
+    for (int i = 0; i < AXIS_COUNT; i++) {
+      expected.add(r.expected[i]);
+      actual.add(r.actual[i]);
+    }
+  }
+
+  char output[JSON_MESSAGE_MAX];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
+}
+
+// ==== Wear counters ====
+void loadWear() {
+  memset(&wearTable, 0, sizeof(wearTable));
+  preferences.begin("wear", true);
+  if (preferences.getBytesLength("axes") == sizeof(wearTable)) {
+    preferences.getBytes("axes", &wearTable, sizeof(wearTable));
+  }
+  preferences.end();
+
+  if (wearTable.version != WEAR_VERSION) {
+    memset(&wearTable, 0, sizeof(wearTable));
+    wearTable.version = WEAR_VERSION;
+  }
+  wearSavedAt = nowUs();
+}
+
+// Викликається і з задачі вебсервера перед перезапуском — тому локальний Preferences
+void saveWear() {
+  MetricScope metric(METRIC_NVS_SAVE);
+  WearTable copy;
+  portENTER_CRITICAL(&wearMux);
+  copy = wearTable;
+  wearDirty = false;
+  portEXIT_CRITICAL(&wearMux);
+
+  Preferences prefs;
+  prefs.begin("wear", false);
+  prefs.putBytes("axes", &copy, sizeof(copy));
+  prefs.end();
+  wearSavedAt = nowUs();
+}
+
+// Такт руху: лише додавання. Хід рахуємо з часу роботи, тож повні ходи й
+// калібрування, де лічильник позиції не ведеться, теж враховані
+void wearTick() {
+  TimeUs now = nowUs();
+  TimeUs last = wearLastTick;
+  wearLastTick = now;
+  if (sessionMode == SESSION_REPLAYING || last == 0) return;
+
+  TimeUs stepUs = msToUs(config.msPerMm);
+  portENTER_CRITICAL(&wearMux);
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!motors[i].running) continue;
+    // Вісь могла стартувати між тактами, а такт у простої буває довгим
+    TimeUs dt = now - max(last, motors[i].move_start_time);
+    AxisWear &w = wearTable.axes[i];
+    w.runUs += dt;
+    wearTravelUs[i] += dt;
+    while (wearTravelUs[i] >= stepUs) {
+      wearTravelUs[i] -= stepUs;
+      w.distanceMm++;
+    }
+    wearDirty = true;
+  }
+  portEXIT_CRITICAL(&wearMux);
+}
+
+void wearMotorStarted(int axis, int dir) {
+  if (sessionMode == SESSION_REPLAYING || dir == 0) return;
+  portENTER_CRITICAL(&wearMux);
+  AxisWear &w = wearTable.axes[axis];
+  w.cycles++;
+  if (w.lastDir != 0 && w.lastDir != dir) w.reversals++;
+  w.lastDir = dir;
+  wearDirty = true;
+  portEXIT_CRITICAL(&wearMux);
+}
+
+void wearLimitHit(int axis) {
+  if (sessionMode == SESSION_REPLAYING) return;
+  portENTER_CRITICAL(&wearMux);
+  wearTable.axes[axis].limitHits++;
+  wearDirty = true;
+  portEXIT_CRITICAL(&wearMux);
+}
+
+void wearService() {
+  if (wearResetMask) {
+    portENTER_CRITICAL(&wearMux);
+    uint32_t mask = wearResetMask;
+    wearResetMask = 0;
+    for (int i = 0; i < AXIS_COUNT; i++) {
+      if (mask & (1u << i)) {
+        memset(&wearTable.axes[i], 0, sizeof(AxisWear));
+        wearTravelUs[i] = 0;
+      }
+    }
+    portEXIT_CRITICAL(&wearMux);
+    // Скидання після заміни приводу зберігаємо одразу
+    saveWear();
+    return;
+  }
+
+  if (!wearDirty || !intervalElapsed(wearSavedAt, msToUs(WEAR_SAVE_INTERVAL))) return;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (motors[i].running) return;
+  }
+  saveWear();
+}
+
+void handleWearRequest(AsyncWebServerRequest *request) {
+  WearTable copy;
+  portENTER_CRITICAL(&wearMux);
+  copy = wearTable;
+  portEXIT_CRITICAL(&wearMux);
+
+  JsonArenaScope arena;
+  JsonDocument doc(arena.allocator());
+  JsonArray axes = doc["axes"].to<JsonArray>();
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    const AxisWear &w = copy.axes[i];
+    JsonObject axis = axes.add<JsonObject>();
+    axis["distanceMm"] = w.distanceMm;
+    axis["runSeconds"] = (uint32_t)(w.runUs / 1000000);
+    axis["cycles"] = w.cycles;
+    axis["reversals"] = w.reversals;
+    axis["limitHits"] = w.limitHits;
+  }
+  doc["savedAgoS"] = (uint32_t)((nowUs() - wearSavedAt) / 1000000);
+
+  char output[JSON_MESSAGE_MAX];
+  serializeJson(doc, output, sizeof(output));
+  request->send(200, "application/json", output);
+}
+
+// ==== Power management ====
+// Будить loop() з задачі вебсервера, MQTT чи UDP
+void powerWake() {
+  if (powerState == POWER_ACTIVE) return;
+  if (powerWakeAt == 0) powerWakeAt = nowUs();
+  if (loopTaskHandle && xTaskGetCurrentTaskHandle() != loopTaskHandle) {
+    xTaskNotifyGive(loopTaskHandle);
+  }
+}
+
+void IRAM_ATTR powerWakeFromISR() {
+  if (powerState == POWER_ACTIVE || !loopTaskHandle) return;
+  if (powerWakeAt == 0) powerWakeAt = nowUs();
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// Що тримає loop() у повному темпі
+bool powerBusy() {
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (motors[i].running) return true;
+  }
+  return showIP || encoderRedrawPending || btnPressed || updateInProgress || traceArmed ||
+         sessionMode != SESSION_IDLE || pendingBatchCount > 0 || fleetQueue.count > 0 ||
+         presetOpCount > 0 || networkState == NET_CONNECTING || networkState == NET_PORTAL;
+}
+
+// Light-sleep лише тоді, коли мережі давно немає і до наступної спроби ще далеко
+bool powerMaySleep(TimeUs now) {
+  if (networkState != NET_OFFLINE || reconnectDelay < WIFI_RECONNECT_MAX) return false;
+  TimeUs untilAttempt = nextReconnectAt - now;
+  TimeUs sinceAttempt = msToUs(reconnectDelay) - untilAttempt;
+  return sinceAttempt > msToUs(POWER_CONNECT_GUARD) && untilAttempt > msToUs(POWER_IDLE_POLL);
+}
+
+void powerEnter(PowerState state, TimeUs now) {
+  if (state == powerState) return;
+  PowerState previous = powerState;
+  powerStateUs[previous] += now - powerStateSince;
+  powerStateSince = now;
+
+  if (state == POWER_ACTIVE) {
+    // Спершу частота — від неї залежить затримка реакції
+    setCpuFrequencyMhz(powerActiveMhz);
+    metricsCpuMhz = getCpuFrequencyMhz();
+    powerState = state;
+    WiFi.setSleep(false);
+    if (powerWakeAt != 0) {
+      powerWakeups++;
+      powerWakeLatencyUs = (uint32_t)(nowUs() - powerWakeAt);
+      powerWakeLatencyMaxUs = max(powerWakeLatencyMaxUs, powerWakeLatencyUs);
+      powerWakeAt = 0;
+    }
+  } else {
+    if (previous == POWER_ACTIVE) {
+      WiFi.setSleep(true);
+      setCpuFrequencyMhz(POWER_IDLE_MHZ);
+      metricsCpuMhz = getCpuFrequencyMhz();
+      ulTaskNotifyTake(pdTRUE, 0);   // старі сповіщення не мають будити одразу
+    }
+    powerState = state;
+  }
+  Serial.printf("Power: %s -> %s\n", powerStateNames[previous], powerStateNames[state]);
+}
+
+void powerLightSleep(TimeUs now) {
+  TimeUs duration = min(nextReconnectAt - now, msToUs(POWER_SLEEP_MAX));
+  int wakePins[3 + AXIS_COUNT];
+  for (int i = 0; i < 3; i++) wakePins[i] = encoderPins[i];
+  for (int i = 0; i < AXIS_COUNT; i++) wakePins[3 + i] = axisPins[i].limit;
+
+  // Будить будь-яка зміна рівня. Переривання енкодера вимкнені, бо
+  // рівневий тип пробудження інакше викликав би їх безперервно
+  for (int pin : wakePins) {
+    gpio_intr_disable((gpio_num_t)pin);
+    gpio_wakeup_enable((gpio_num_t)pin, digitalRead(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  }
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(duration);
+  Serial.flush();
+  esp_light_sleep_start();
+  powerSleeps++;
+
+  for (int pin : wakePins) {
+    gpio_wakeup_disable((gpio_num_t)pin);
+  }
+  gpio_set_intr_type((gpio_num_t)encoderPins[0], GPIO_INTR_ANYEDGE);
+  gpio_set_intr_type((gpio_num_t)encoderPins[1], GPIO_INTR_ANYEDGE);
+  gpio_set_intr_type((gpio_num_t)encoderPins[2], GPIO_INTR_NEGEDGE);
+  for (int i = 0; i < 3; i++) {
+    gpio_intr_enable((gpio_num_t)encoderPins[i]);
+  }
+
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+    if (powerWakeAt == 0) powerWakeAt = nowUs();
+    powerLastActivity = nowUs();
+    powerEnter(POWER_ACTIVE, powerLastActivity);
+  }
+}
+
+// Кінець loop() замість delay(10). В idle чекаємо сповіщення не довше
+// POWER_IDLE_POLL, тож опитування мережі й телеметрія не зупиняються
+void powerService() {
+  TimeUs now = nowUs();
+  if (powerBusy()) powerLastActivity = now;
+  if (powerWakeAt != 0) {
+    powerLastActivity = now;
+    if (powerState == POWER_ACTIVE) powerWakeAt = 0;
+  }
+
+  PowerState target = POWER_ACTIVE;
+  if (intervalElapsed(powerLastActivity, msToUs(POWER_IDLE_AFTER), now)) {
+    target = powerMaySleep(now) ? POWER_SLEEP : POWER_IDLE;
+  }
+  powerEnter(target, now);
+
+  switch (powerState) {
+    case POWER_ACTIVE:
+      delay(10);
+      break;
+    case POWER_IDLE:
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_IDLE_POLL)) > 0 || powerWakeAt != 0) {
+        powerLastActivity = nowUs();
+        powerEnter(POWER_ACTIVE, powerLastActivity);
+      }
+      break;
+    case POWER_SLEEP:
+      powerLightSleep(now);
+      break;
+    default:
+      break;
+  }
+}
+
+// ==== Metrics export ====
+// GET /metrics у текстовому форматі Prometheus
+void writeMetrics(Print &out) {
+  CycleMetric snapshot[METRIC_COUNT];
+  portENTER_CRITICAL(&metricsMux);
+  memcpy(snapshot, metrics, sizeof(snapshot));
+  portEXIT_CRITICAL(&metricsMux);
+
+  out.print("# HELP stanok_duration_seconds Time spent per subsystem call.\n");
+  out.print("# TYPE stanok_duration_seconds histogram\n");
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    const CycleMetric &m = snapshot[i];
+    uint32_t cumulative = 0;
+    for (size_t b = 0; b < METRIC_BUCKET_COUNT; b++) {
+      cumulative += m.buckets[b];
+      out.printf("stanok_duration_seconds_bucket{span=\"%s\",le=\"%g\"} %u\n",
+                 metricNames[i], metricBucketsUs[b] / 1e6, (unsigned)cumulative);
+    }
+    out.printf("stanok_duration_seconds_bucket{span=\"%s\",le=\"+Inf\"} %u\n", metricNames[i], (unsigned)m.count);
+    out.printf("stanok_duration_seconds_sum{span=\"%s\"} %.6f\n", metricNames[i], m.micros / 1e6);
+    out.printf("stanok_duration_seconds_count{span=\"%s\"} %u\n", metricNames[i], (unsigned)m.count);
+  }
+
+  out.print("# HELP stanok_cycles_total CPU cycles spent per subsystem.\n");
+  out.print("# TYPE stanok_cycles_total counter\n");
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    out.printf("stanok_cycles_total{span=\"%s\"} %llu\n", metricNames[i], (unsigned long long)snapshot[i].cycles);
+  }
+  out.print("# HELP stanok_cycles_max Longest single call in CPU cycles.\n");
+  out.print("# TYPE stanok_cycles_max gauge\n");
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    out.printf("stanok_cycles_max{span=\"%s\"} %u\n", metricNames[i], (unsigned)snapshot[i].maxCycles);
+  }
+
+  out.print("# TYPE stanok_heap_free_bytes gauge\n");
+  out.printf("stanok_heap_free_bytes %u\n", (unsigned)ESP.getFreeHeap());
+  out.print("# TYPE stanok_heap_min_free_bytes gauge\n");
+  out.printf("stanok_heap_min_free_bytes %u\n", (unsigned)ESP.getMinFreeHeap());
+  out.print("# TYPE stanok_heap_largest_block_bytes gauge\n");
+  out.printf("stanok_heap_largest_block_bytes %u\n", (unsigned)ESP.getMaxAllocHeap());
+  out.print("# HELP stanok_heap_steady_used_max_bytes Most heap taken since steady state began.\n");
+  out.print("# TYPE stanok_heap_steady_used_max_bytes gauge\n");
+  out.printf("stanok_heap_steady_used_max_bytes %u\n", (unsigned)(heapSteadyBaseline - heapSteadyLow));
+  out.print("# TYPE stanok_heap_largest_block_min_bytes gauge\n");
+  out.printf("stanok_heap_largest_block_min_bytes %u\n", (unsigned)heapLargestBlockLow);
+  out.print("# HELP stanok_json_arena_high_water_bytes Peak use of each static JSON arena.\n");
+  out.print("# TYPE stanok_json_arena_high_water_bytes gauge\n");
+  for (int i = 0; i < JSON_ARENA_COUNT; i++) {
+    out.printf("stanok_json_arena_high_water_bytes{arena=\"%d\"} %u\n", i, (unsigned)jsonArenas[i].highWater);
+  }
+  out.print("# HELP stanok_json_arena_overflows_total JSON allocations that fell back to the heap.\n");
+  out.print("# TYPE stanok_json_arena_overflows_total counter\n");
+  out.printf("stanok_json_arena_overflows_total %u\n", (unsigned)jsonArenaOverflows);
+  out.print("# TYPE stanok_uptime_seconds gauge\n");
+  out.printf("stanok_uptime_seconds %.3f\n", nowUs() / 1e6);
+  out.print("# TYPE stanok_cpu_mhz gauge\n");
+  out.printf("stanok_cpu_mhz %u\n", (unsigned)metricsCpuMhz);
+  out.print("# HELP stanok_power_seconds_total Time spent in each power state.\n");
+  out.print("# TYPE stanok_power_seconds_total counter\n");
+  for (int i = 0; i < POWER_STATE_COUNT; i++) {
+    TimeUs spent = powerStateUs[i] + (i == powerState ? nowUs() - powerStateSince : 0);
+    out.printf("stanok_power_seconds_total{state=\"%s\"} %.3f\n", powerStateNames[i], spent / 1e6);
+  }
+  out.print("# TYPE stanok_power_wakeups_total counter\n");
+  out.printf("stanok_power_wakeups_total %u\n", (unsigned)powerWakeups);
+  out.print("# TYPE stanok_power_light_sleeps_total counter\n");
+  out.printf("stanok_power_light_sleeps_total %u\n", (unsigned)powerSleeps);
+  out.print("# HELP stanok_power_wake_latency_seconds Event to full CPU clock, last and worst.\n");
+  out.print("# TYPE stanok_power_wake_latency_seconds gauge\n");
+  out.printf("stanok_power_wake_latency_seconds %.6f\n", powerWakeLatencyUs / 1e6);
+  out.printf("stanok_power_wake_latency_max_seconds %.6f\n", powerWakeLatencyMaxUs / 1e6);
+  out.print("# HELP stanok_motion_stop_lead_seconds Early power cut before the last step to a target.\n");
+  out.print("# TYPE stanok_motion_stop_lead_seconds gauge\n");
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    for (int d = 0; d < MOTION_DIRS; d++) {
+      out.printf("stanok_motion_stop_lead_seconds{axis=\"%d\",dir=\"%s\"} %.6f\n", i, motionDirNames[d],
+                 motionLeadUs(i, d == MOTION_FORWARD ? 1 : -1) / 1e6);
+    }
+  }
+  WearTable wear;
+  portENTER_CRITICAL(&wearMux);
+  wear = wearTable;
+  portEXIT_CRITICAL(&wearMux);
+  out.print("# TYPE stanok_axis_distance_mm_total counter\n");
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    out.printf("stanok_axis_distance_mm_total{axis=\"%d\"} %u\n", i, (unsigned)wear.axes[i].distanceMm);
+  }
+  out.print("# TYPE stanok_axis_run_seconds_total counter\n");
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    out.printf("stanok_axis_run_seconds_total{axis=\"%d\"} %.3f\n", i, wear.axes[i].runUs / 1e6);
+  }
+  out.print("# TYPE stanok_axis_cycles_total counter\n");
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    out.printf("stanok_axis_cycles_total{axis=\"%d\"} %u\n", i, (unsigned)wear.axes[i].cycles);
+  }
+  out.print("# TYPE stanok_ws_clients gauge\n");
+  out.printf("stanok_ws_clients %u\n", (unsigned)ws.count());
+  out.print("# TYPE stanok_ws_broadcasts_total counter\n");
+  out.printf("stanok_ws_broadcasts_total %u\n", (unsigned)wsBroadcasts);
+  out.print("# TYPE stanok_ws_frames_queued_total counter\n");
+  out.printf("stanok_ws_frames_queued_total %u\n", (unsigned)wsFramesQueued);
+  out.print("# HELP stanok_ws_broadcasts_dropped_total Broadcasts sent while some client queue was full.\n");
+  out.print("# TYPE stanok_ws_broadcasts_dropped_total counter\n");
+  out.printf("stanok_ws_broadcasts_dropped_total %u\n", (unsigned)wsBroadcastsDropped);
+  out.print("# TYPE stanok_mqtt_connected gauge\n");
+  out.printf("stanok_mqtt_connected %u\n", mqttConnected ? 1u : 0u);
+  out.print("# TYPE stanok_mqtt_reconnects_total counter\n");
+  out.printf("stanok_mqtt_reconnects_total %u\n", (unsigned)mqttReconnects);
+  out.print("# TYPE stanok_mqtt_published_total counter\n");
+  out.printf("stanok_mqtt_published_total %u\n", (unsigned)mqttPublished);
+  out.print("# HELP stanok_mqtt_events_dropped_total Events pushed out of the offline buffer.\n");
+  out.print("# TYPE stanok_mqtt_events_dropped_total counter\n");
+  out.printf("stanok_mqtt_events_dropped_total %u\n", (unsigned)mqttEventsDropped);
+  out.print("# TYPE stanok_mqtt_commands_rejected_total counter\n");
+  out.printf("stanok_mqtt_commands_rejected_total %u\n", (unsigned)mqttRejected);
+
+  // Вибірка з хука тіку є в кожній збірці; завантаження ядра — частка тактів
+  // поза задачами IDLE0/IDLE1
+  static CpuSampleSlot samples[CPU_SAMPLE_TASKS];
+  uint32_t sampleTotal[portNUM_PROCESSORS];
+  portENTER_CRITICAL(&cpuSampleMux);
+  memcpy(samples, cpuSamples, sizeof(samples));
+  memcpy(sampleTotal, cpuSampleTotal, sizeof(sampleTotal));
+  uint32_t sampleOverflow = cpuSampleOverflow;
+  portEXIT_CRITICAL(&cpuSampleMux);
+
+  out.print("# HELP stanok_task_cpu_ticks_total Tick interrupts (1 ms) that found the task running.\n");
+  out.print("# TYPE stanok_task_cpu_ticks_total counter\n");
+  for (const CpuSampleSlot &s : samples) {
+    if (!s.task) break;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      if (s.ticks[core]) {
+        out.printf("stanok_task_cpu_ticks_total{task=\"%s\",core=\"%d\"} %u\n",
+                   s.name, core, (unsigned)s.ticks[core]);
+      }
+    }
+  }
+  out.print("# TYPE stanok_cpu_ticks_total counter\n");
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    out.printf("stanok_cpu_ticks_total{core=\"%d\"} %u\n", core, (unsigned)sampleTotal[core]);
+  }
+  out.print("# HELP stanok_task_cpu_ticks_untracked_total Ticks of tasks beyond the sample table.\n");
+  out.print("# TYPE stanok_task_cpu_ticks_untracked_total counter\n");
+  out.printf("stanok_task_cpu_ticks_untracked_total %u\n", (unsigned)sampleOverflow);
+
+#if configUSE_TRACE_FACILITY
+  UBaseType_t taskCount = uxTaskGetNumberOfTasks();
+  TaskStatus_t *tasks = (TaskStatus_t*)malloc(taskCount * sizeof(TaskStatus_t));
+  if (tasks) {
+    uint32_t totalRuntime = 0;
+    taskCount = uxTaskGetSystemState(tasks, taskCount, &totalRuntime);
+
+#if configGENERATE_RUN_TIME_STATS
+    // Точний час, лише якщо ядро зібране з run-time stats. Лічильники 32-бітні (мкс)
+    // і переповнюються приблизно раз на 71 хв; для Prometheus це скидання лічильника
+    out.print("# HELP stanok_task_runtime_us_total FreeRTOS run time per task.\n");
+    out.print("# TYPE stanok_task_runtime_us_total counter\n");
+    for (UBaseType_t i = 0; i < taskCount; i++) {
+#if configTASKLIST_INCLUDE_COREID
+      int core = tasks[i].xCoreID == tskNO_AFFINITY ? -1 : (int)tasks[i].xCoreID;
+#else
+      int core = -1;
+#endif
+      out.printf("stanok_task_runtime_us_total{task=\"%s\",core=\"%d\"} %u\n",
+                 tasks[i].pcTaskName, core, (unsigned)tasks[i].ulRunTimeCounter);
+    }
+#endif
+
+    out.print("# TYPE stanok_task_stack_free_bytes gauge\n");
+    for (UBaseType_t i = 0; i < taskCount; i++) {
+      out.printf("stanok_task_stack_free_bytes{task=\"%s\"} %u\n",
+                 tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark);
+    }
+    free(tasks);
+  }
+#endif
+}
+
+// ==== Static asset handler ====
+const char* mimeForPath(const char* path) {
+  const char* ext = strrchr(path, '.');
+  if (!ext) return "application/octet-stream";
+  if (strcmp(ext, ".html") == 0) return "text/html";
+  if (strcmp(ext, ".css") == 0) return "text/css";
+  if (strcmp(ext, ".js") == 0) return "application/javascript";
+  if (strcmp(ext, ".json") == 0) return "application/json";
+  if (strcmp(ext, ".svg") == 0) return "image/svg+xml";
+  if (strcmp(ext, ".png") == 0) return "image/png";
+  if (strcmp(ext, ".ico") == 0) return "image/x-icon";
+  return "application/octet-stream";
+}
+
+// Для .gz беремо CRC32 і розмір з трейлера gzip (вісім останніх байтів),
+// для звичайних файлів рахуємо CRC32 самі
+bool computeAssetEtag(File &file, bool gzipped, char *etag, size_t etagLen) {
+  uint32_t crc = 0;
+  uint32_t size = 0;
+
+  if (gzipped) {
+    uint8_t trailer[8];
+    if (file.size() < 18 || !file.seek(file.size() - 8)) return false;
+    if (file.read(trailer, 8) != 8) return false;
+    crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+    size = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t)trailer[7] << 24);
+  } else {
+    uint8_t buffer[512];
+    size_t read;
+    while ((read = file.read(buffer, sizeof(buffer))) > 0) {
+      crc = crc32_le(crc, buffer, read);
+      size += read;
+    }
+  }
+
+  snprintf(etag, etagLen, "\"%08x%x\"", (unsigned)crc, (unsigned)size);
+  return true;
+}
+
+void scanStaticAssets() {
+  staticAssetCount = 0;
+
+  File root = LittleFS.open("/");
+  if (!root || !root.isDirectory()) {
+    Serial.println("LittleFS root not readable");
+    return;
+  }
+
+  File file = root.openNextFile();
+  while (file && staticAssetCount < STATIC_ASSET_MAX) {
+    if (!file.isDirectory()) {
+      StaticAsset &asset = staticAssets[staticAssetCount];
+      const char* name = file.name();
+      if (name[0] == '/') name++;
+
+      snprintf(asset.url, sizeof(asset.url), "/%s", name);
+      size_t urlLen = strlen(asset.url);
+      bool gzipped = urlLen > 3 && strcmp(asset.url + urlLen - 3, ".gz") == 0;
+      if (gzipped) {
+        asset.url[urlLen - 3] = 0;
+      }
+      asset.mime = mimeForPath(asset.url);
+
+      // Якщо є і стиснений, і звичайний файл — лишаємо один запис
+      bool duplicate = false;
+      for (int i = 0; i < staticAssetCount; i++) {
+        if (strcmp(staticAssets[i].url, asset.url) == 0) duplicate = true;
+      }
+
+      if (!duplicate && computeAssetEtag(file, gzipped, asset.etag, sizeof(asset.etag))) {
+        Serial.printf("Asset %s%s etag %s\n", asset.url, gzipped ? " (gzip)" : "", asset.etag);
+        staticAssetCount++;
+      }
+    }
+    file = root.openNextFile();
+  }
+}
+
+const StaticAsset* findStaticAsset(const String &url) {
+  const char* path = url.c_str();
+  if (strcmp(path, "/") == 0) path = "/index.html";
+  size_t pathLen = strlen(path);
+
+  for (int i = 0; i < staticAssetCount; i++) {
+    const char* assetUrl = staticAssets[i].url;
+    if (strcmp(assetUrl, path) == 0) return &staticAssets[i];
+
+    // "/admin" -> "/admin.html"
+    if (strncmp(assetUrl, path, pathLen) == 0 && strcmp(assetUrl + pathLen, ".html") == 0) {
+      return &staticAssets[i];
+    }
+  }
+  return nullptr;
+}
+
+// Один обробник на всі файли: LittleFS сам підставляє file.gz з
+// Content-Encoding: gzip, а ми додаємо ETag, Cache-Control і відповідаємо 304
+class StaticAssetHandler : public AsyncWebHandler {
+ public:
+  bool canHandle(AsyncWebServerRequest *request) const override {
+    return request->method() == AsyncWebRequestMethod::HTTP_GET && findStaticAsset(request->url()) != nullptr;
+  }
+
+  void handleRequest(AsyncWebServerRequest *request) override {
+    const StaticAsset *asset = findStaticAsset(request->url());
+    if (!asset) {
+      request->send(404);
+      return;
+    }
+
+    // HTML завжди перевіряється заново; CSS/JS з ?v=<crc> (див. scripts/compress_assets.py)
+    // незмінні і кешуються на рік
+    const char* cacheControl = request->hasParam("v")
+      ? "public, max-age=31536000, immutable"
+      : "no-cache";
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") &&
+        request->getHeader("If-None-Match")->value() == asset->etag) {
+      response = request->beginResponse(304);
+    } else {
+      response = request->beginResponse(LittleFS, asset->url, asset->mime);
+    }
+    response->addHeader("ETag", asset->etag);
+    response->addHeader("Cache-Control", cacheControl);
+    request->send(response);
+  }
+};
+
+StaticAssetHandler staticAssetHandler;
+
+void handleWebServer() {
+  ws.onEvent(onWsEvent);
+  server.addHandler(&ws);
+
+  server.on("/api/presets", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonArenaScope arena;
+    JsonDocument doc(arena.allocator());
+    JsonArray list = doc.to<JsonArray>();
+    for (int i = 0; i < PRESET_COUNT; i++) {
+      const Preset &p = presetTable.slots[i];
+      if (!p.used) continue;
+      JsonObject item = list.add<JsonObject>();
+      item["slot"] = i;
+      item["name"] = p.name;
+      item["servo"] = p.servo != 0;
+      JsonArray targets = item["targets"].to<JsonArray>();
+      for (int m = 0; m < AXIS_COUNT; m++) {
+        targets.add(p.target[m]);
+      }
+    }
+    char output[JSON_MESSAGE_MAX];
+    serializeJson(doc, output, sizeof(output));
+    request->send(200, "application/json", output);
+  });
+
+  server.on("/metrics", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+    writeMetrics(*response);
+    request->send(response);
+  });
+
+  server.on("/api/telemetry.bin", AsyncWebRequestMethod::HTTP_GET, handleTelemetryRequest);
+  server.on("/api/log", AsyncWebRequestMethod::HTTP_GET, handleLogRequest);
+  server.on("/api/fleet", AsyncWebRequestMethod::HTTP_GET, handleFleetRequest);
+  server.on("/api/clients", AsyncWebRequestMethod::HTTP_GET, handleClientsRequest);
+
+  server.on("/api/motion-model", AsyncWebRequestMethod::HTTP_GET, handleMotionModel);
+  // GET /api/wear — напрацювання осей; POST ?axis=N — скидання після заміни приводу
+  server.on("/api/wear", AsyncWebRequestMethod::HTTP_GET, handleWearRequest);
+  server.on("/api/wear", AsyncWebRequestMethod::HTTP_POST, [](AsyncWebServerRequest *request) {
+    int axis = request->hasParam("axis") ? request->getParam("axis")->value().toInt() : -1;
+    if (!request->hasParam("axis") || axis < 0 || axis >= AXIS_COUNT) {
+      request->send(400, "application/json", "{\"error\":\"invalid axis\"}");
+      return;
+    }
+    portENTER_CRITICAL(&wearMux);
+    wearResetMask |= 1u << axis;
+    portEXIT_CRITICAL(&wearMux);
+    powerWake();
+    request->send(202, "application/json", "{\"accepted\":true}");
+  });
+
+  // Запис і відтворення сесії: POST /api/session?action=record|stop|replay[&speed=N]
+  server.on("/api/session", AsyncWebRequestMethod::HTTP_GET, handleSessionStatus);
+  server.on("/api/session", AsyncWebRequestMethod::HTTP_POST, [](AsyncWebServerRequest *request) {
+    String action = request->hasParam("action") ? request->getParam("action")->value() : String();
+    if (action == "record") {
+      sessionRequest = SESSION_REQ_RECORD;
+    } else if (action == "stop") {
+      sessionRequest = SESSION_REQ_STOP;
+    } else if (action == "replay") {
+      sessionRequestSpeed = request->hasParam("speed") ? request->getParam("speed")->value().toFloat() : 1.0f;
+      sessionRequest = SESSION_REQ_REPLAY;
+    } else {
+      request->send(400, "application/json", "{\"error\":\"unknown action\"}");
+      return;
+    }
+    powerWake();
+    request->send(202, "application/json", "{\"accepted\":true}");
+  });
+  server.on("/api/session.bin", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (sessionMode != SESSION_IDLE || sessionLength == 0) {
+      request->send(409, "application/json", "{\"error\":\"no finished session\"}");
+      return;
+    }
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/octet-stream", sessionBuffer, sessionLength);
+    response->addHeader("Content-Disposition", "attachment; filename=\"session.bin\"");
+    request->send(response);
+  });
+  // Завантаження сліду одразу в sessionBuffer, без проміжного буфера
+  server.on("/api/session.bin", AsyncWebRequestMethod::HTTP_POST,
+    [](AsyncWebServerRequest *request) {
+      const char *error = nullptr;
+      if (sessionMode != SESSION_IDLE) {
+        request->send(409, "application/json", "{\"error\":\"session busy\"}");
+      } else if (sessionLength == 0) {
+        request->send(413, "application/json", "{\"error\":\"empty or oversized body\"}");
+      } else if (!sessionHeaderValid(&error)) {
+        sessionLength = 0;
+        request->send(400, "application/json", String("{\"error\":\"") + error + "\"}");
+      } else {
+        request->send(200, "application/json", "{\"result\":\"ok\"}");
+      }
+    },
+    nullptr,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      if (sessionMode != SESSION_IDLE) return;
+      if (index == 0) {
+        sessionLength = 0;
+        sessionTruncated = false;
+        sessionResult = SessionResult();
+      }
+      if (total > SESSION_BUFFER_SIZE) return;
+      memcpy(sessionBuffer + index, data, len);
+      if (index + len == total) {
+        sessionLength = total;
+      }
+    });
+
+  // Запис вмикається командою trace_start через WebSocket
+  server.on("/trace.json", AsyncWebRequestMethod::HTTP_GET, handleTraceRequest);
+
+  // Час етапів старту і стан Wi-Fi
+  server.on("/api/boot", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonArenaScope arena;
+    JsonDocument doc(arena.allocator());
+    JsonObject stages = doc["stages"].to<JsonObject>();
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+      if (bootStageMs[i] != 0) {
+        stages[bootStageNames[i]] = bootStageMs[i];
+      } else {
+        stages[bootStageNames[i]] = nullptr;
+      }
+    }
+    doc["network"] = networkStateNames[networkState];
+    doc["reconnects"] = wifiReconnects;
+    doc["resetReason"] = (int)esp_reset_reason();
+    doc["uptime"] = nowUs() / 1000;
+
+    char output[JSON_MESSAGE_MAX];
+    serializeJson(doc, output, sizeof(output));
+    request->send(200, "application/json", output);
+  });
+
+  // Стан віддається з кешу останньої розсилки, без повторної серіалізації
+  server.on("/api/state", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
+    char snapshot[JSON_MESSAGE_MAX];
+    snapshot[0] = '\0';
+    if (xSemaphoreTake(stateSnapshotMutex, portMAX_DELAY) == pdTRUE) {
+      memcpy(snapshot, stateSnapshot, stateSnapshotLen + 1);
+      xSemaphoreGive(stateSnapshotMutex);
+    }
+    if (snapshot[0] == '\0') {
+      request->send(503, "application/json", "{\"error\":\"state not ready\"}");
+      return;
+    }
+    request->send(200, "application/json", snapshot);
+  });
+
+  // POST /api/batch: [{"type": "...", "data": {...}}, ...]
+  server.on("/api/batch", AsyncWebRequestMethod::HTTP_POST,
+    [](AsyncWebServerRequest *request) {
+      if (!request->_tempObject) {
+        request->send(413, "application/json", "{\"error\":\"empty or oversized body\"}");
+        return;
+      }
+      handleBatchRequest(request, (const char*)request->_tempObject);
+    },
+    nullptr,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      if (total > BATCH_MAX_BODY) return;
+      // Буфер звільняє сам AsyncWebServerRequest
+      if (index == 0) {
+        request->_tempObject = malloc(total + 1);
+      }
+      if (!request->_tempObject) return;
+      memcpy((uint8_t*)request->_tempObject + index, data, len);
+      if (index + len == total) {
+        ((char*)request->_tempObject)[total] = 0;
+      }
+    });
+
+  // GET /api/config — значення і схема; POST — часткова зміна {"max_mm": 25, ...}
+  server.on("/api/config", AsyncWebRequestMethod::HTTP_GET, handleConfigRequest);
+  server.on("/api/config", AsyncWebRequestMethod::HTTP_POST,
+    [](AsyncWebServerRequest *request) {
+      if (!request->_tempObject) {
+        request->send(413, "application/json", "{\"error\":\"empty or oversized body\"}");
+        return;
+      }
+      handleConfigUpdate(request, (const char*)request->_tempObject);
+    },
+    nullptr,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      if (total > CONFIG_MAX_BODY) return;
+      if (index == 0) {
+        request->_tempObject = malloc(total + 1);
+      }
+      if (!request->_tempObject) return;
+      memcpy((uint8_t*)request->_tempObject + index, data, len);
+      if (index + len == total) {
+        ((char*)request->_tempObject)[total] = 0;
+      }
+    });
+
+  // POST /api/presets/recall?slot=N
+  server.on("/api/presets/recall", AsyncWebRequestMethod::HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("slot")) {
+      request->send(400, "application/json", "{\"error\":\"missing slot\"}");
+      return;
+    }
+    int slot = request->getParam("slot")->value().toInt();
+    if (sessionMode == SESSION_REPLAYING) {
+      request->send(409, "application/json", "{\"error\":\"session replay\"}");
+    } else if (slot >= 0 && slot < PRESET_COUNT && presetTable.slots[slot].used) {
+      // Рух і серво — лише з loop(): команда йде тим самим шляхом, що й /api/batch
+      Command cmd = {CMD_RECALL_PRESET, -1, (int16_t)slot};
+      if (queuePendingBatch(&cmd, 1)) {
+        request->send(202, "application/json", "{\"accepted\":true}");
+      } else {
+        request->send(409, "application/json", "{\"error\":\"batch queue full\"}");
       }
-      break;
+    } else {
+      request->send(404, "application/json", "{\"error\":\"preset not found\"}");
     }
-      
-    case WS_EVT_ERROR:
-      Serial.printf("WebSocket error\n");
-      break;
-  }
+  });
+
+  // Статичні файли обробляються останніми, після API
+  scanStaticAssets();
+  server.addHandler(&staticAssetHandler);
+
+  server.begin();
+  Serial.println("HTTP server started");
 }
 
-// Send state to all WebSocket clients
-void sendState() {
-  JsonDocument doc;
-  
-  for (int i = 0; i < 4; i++) {
-    char motorKey[10];
-    sprintf(motorKey, "motor%d", i);
-    
-    // Виправлено deprecated createNestedObject
-    JsonObject motorData = doc[motorKey].to<JsonObject>();
-    motorData["position"] = motors[i].real_position;
-    motorData["target"] = motors[i].target;
-    motorData["running"] = motors[i].running;
-    motorData["calibrating"] = motors[i].calibrating;
-    motorData["fullForward"] = motors[i].fullForward;
-    motorData["fullBackward"] = motors[i].fullBackward;
-  }
-  
-  doc["servoState"] = servoState;
-  doc["ip"] = WiFi.localIP().toString();
-  doc["updateInProgress"] = updateInProgress;
-  doc["updateProgress"] = updateProgress;
-  doc["updateStatus"] = updateStatus;
-  doc["latestVersion"] = latestVersion;
-  
-  bool any_running = false;
-  for (int i = 0; i < 4; i++) {
-    if (motors[i].running) {
-      any_running = true;
-      break;
-    }
-  }
-  doc["globalStatus"] = any_running ? "RUNNING" : "STOPPED";
-  
-  String output;
-  serializeJson(doc, output);
-  
-  ws.textAll(output);
+// ==== Network: staged boot ====
+// Wi-Fi, веб-сервер і OTA піднімаються у фоні з loop(), тож меню,
+// енкодер і мотори працюють одразу після старту, навіть без роутера
+void markBootStage(BootStage stage) {
+  if (bootStageMs[stage] != 0) return;
+  bootStageMs[stage] = max(uptimeMs(), (uint32_t)1);
+  Serial.printf("Boot stage %s: %lu ms\n", bootStageNames[stage], (unsigned long)bootStageMs[stage]);
 }
 
-void setMotorTarget(int motor, int target) {
-  if (motor < 0 || motor > 3) return;
-  
-  motors[motor].target = target;
-  Serial.printf("Setting motor %d target to %d, current position: %d\n", 
-                motor, target, motors[motor].real_position);
-  
-  motors[motor].running = true;
-  
-  if (motors[motor].target > motors[motor].real_position) {
-    startMotor(motor, 1);
-  } else if (motors[motor].target < motors[motor].real_position) {
-    startMotor(motor, -1);
-  } else {
-    stopMotor(motor);
-  }
-  
-  drawMenu();
-  sendState();
+void setNetworkState(NetworkState state) {
+  networkState = state;
+  networkStateSince = nowUs();
 }
 
-void setupOTA() {
-  ArduinoOTA.setHostname("stanok");
-  ArduinoOTA.setPassword("ota123");
+void showHostnameOverlay() {
+  showIP = true;
+  displayStartTime = nowUs();
+  drawHostnameDisplay();
+}
 
-  ArduinoOTA
-    .onStart([]() {
-      String type;
-      if (ArduinoOTA.getCommand() == U_FLASH)
-        type = "sketch";
-      else
-        type = "filesystem";
+// Портал неблокуючий: його обслуговує wm.process() з serviceNetwork()
+void startWifiPortal() {
+  Serial.println("Starting WiFi config portal");
+  logEvent(LOG_WIFI_PORTAL);
+  wm.startConfigPortal(WIFI_AP_NAME, WIFI_AP_PASSWORD);
+  setNetworkState(NET_PORTAL);
+  showHostnameOverlay();
+}
 
-      Serial.println("Start updating " + type);
-      stopAllMotors();
-      
-      display.clearDisplay();
-      display.setTextSize(1);
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(0, 0);
-      display.println("OTA UPDATE");
-      display.println("Updating " + type);
-      display.display();
-    })
-    .onEnd([]() {
-      Serial.println("\nEnd");
-      display.clearDisplay();
-      display.setTextSize(1);
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(0, 0);
-      display.println("Update Complete!");
-      display.println("Rebooting...");
-      display.display();
-    })
-    .onProgress([](unsigned int progress, unsigned int total) {
-      Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
-      
-      display.clearDisplay();
-      display.setTextSize(1);
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(0, 0);
-      display.println("OTA UPDATE");
-      display.printf("Progress: %u%%", (progress / (total / 100)));
-      display.display();
-    })
-    .onError([](ota_error_t error) {
-      Serial.printf("Error[%u]: ", error);
-      if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
-      else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
-      else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
-      else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
-      else if (error == OTA_END_ERROR) Serial.println("End Failed");
-      
-      display.clearDisplay();
-      display.setTextSize(1);
-      display.setTextColor(SSD1306_WHITE);
-      display.setCursor(0, 0);
-      display.println("OTA ERROR!");
-      display.printf("Error: %u", error);
-      display.display();
-    });
+void scheduleReconnect() {
+  setNetworkState(NET_OFFLINE);
+  nextReconnectAt = nowUs() + msToUs(reconnectDelay);
+}
 
-  ArduinoOTA.begin();
-  Serial.println("OTA Ready");
+void onNetworkUp() {
+  setNetworkState(NET_ONLINE);
+  reconnectDelay = WIFI_RECONNECT_MIN;
+
+  Serial.println("WiFi connected!");
   Serial.print("IP address: ");
   Serial.println(WiFi.localIP());
+  Serial.print("Hostname: ");
+  Serial.println(WiFi.getHostname());
+  markBootStage(BOOT_WIFI);
+  logEvent(LOG_WIFI_UP, -1, WiFi.RSSI());
+
+  // Сервер і ArduinoOTA стартують один раз; після перепідключення
+  // вони продовжують працювати на новій адресі
+  if (!networkServicesStarted) {
+    setupOTA();
+    handleWebServer();
+    networkServicesStarted = true;
+    markBootStage(BOOT_NETWORK);
+    sampleHeap(true);  // далі купа має лишатися рівною
+    showHostnameOverlay();  // показуємо hostname замість IP
+  }
+  startFleet();
 }
 
-void handleWebServer() {
-  ws.onEvent(onWsEvent);
-  server.addHandler(&ws);
+void beginNetwork() {
+  WiFi.setHostname(config.hostname);
+  WiFi.mode(WIFI_STA);
+  wm.setHostname(config.hostname);
+  wm.setConfigPortalBlocking(false);
+  wm.setConfigPortalTimeout(300); // 5 хвилин
 
-  server.on("/", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/index.html", "text/html");
-  });
-  
-  server.on("/admin", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/admin.html", "text/html");
-  });
-  
-  server.on("/style.css", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/style.css", "text/css");
-  });
-  
-  server.on("/admin-style.css", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/admin-style.css", "text/css");
-  });
-  
-  server.on("/script.js", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/script.js", "application/javascript");
-  });
-  
-  server.on("/admin-script.js", AsyncWebRequestMethod::HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(LittleFS, "/admin-script.js", "application/javascript");
-  });
+  if (wm.getWiFiIsSaved()) {
+    WiFi.begin();
+    setNetworkState(NET_CONNECTING);
+  } else {
+    startWifiPortal();
+  }
+}
 
-  server.begin();
-  Serial.println("HTTP server started");
+void serviceNetwork() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+
+  switch (networkState) {
+    case NET_CONNECTING:
+      if (connected) {
+        onNetworkUp();
+      } else if (intervalElapsed(networkStateSince, msToUs(WIFI_CONNECT_TIMEOUT))) {
+        Serial.println("Failed to connect, starting config portal...");
+        startWifiPortal();
+      }
+      break;
+
+    case NET_PORTAL:
+      if (wm.process() || connected) {
+        if (wm.getConfigPortalActive()) {
+          wm.stopConfigPortal();
+        }
+        onNetworkUp();
+      } else if (!wm.getConfigPortalActive()) {
+        Serial.println("Config portal timed out, retrying saved network");
+        scheduleReconnect();
+      }
+      break;
+
+    case NET_ONLINE:
+      if (!connected) {
+        Serial.println("WiFi connection lost");
+        logEvent(LOG_WIFI_DOWN);
+        reconnectDelay = WIFI_RECONNECT_MIN;
+        scheduleReconnect();
+      }
+      break;
+
+    case NET_OFFLINE:
+      if (connected) {
+        onNetworkUp();
+      } else if (deadlineReached(nextReconnectAt)) {
+        if (!wm.getWiFiIsSaved() && !networkServicesStarted) {
+          startWifiPortal();
+          break;
+        }
+        wifiReconnects++;
+        Serial.printf("WiFi reconnect attempt %lu, next in %lu ms\n",
+                      (unsigned long)wifiReconnects, (unsigned long)reconnectDelay);
+        WiFi.mode(WIFI_STA);
+        WiFi.begin();
+        reconnectDelay = min(reconnectDelay * 2, (uint32_t)WIFI_RECONNECT_MAX);
+        nextReconnectAt = nowUs() + msToUs(reconnectDelay);
+      }
+      break;
+  }
 }
 
 void setup() {
   Serial.begin(115200);
+  stateSnapshotMutex = xSemaphoreCreateMutex();
+  metricsCpuMhz = getCpuFrequencyMhz();
+  powerActiveMhz = metricsCpuMhz;
   Serial.println("\n\nBooting...");
   setupI2C();
 
@@ -989,17 +5995,15 @@ void setup() {
   }
   attachInterrupt(digitalPinToInterrupt(encoderPins[0]), readEncoder, CHANGE);
   attachInterrupt(digitalPinToInterrupt(encoderPins[1]), readEncoder, CHANGE);
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 2; j++) {
-      pinMode(motorPins[i][j], OUTPUT);
-      digitalWrite(motorPins[i][j], LOW);
-    }
-  }
-  
-  for (int i = 0; i < 4; i++) {
-    pinMode(limitPins[i], INPUT_PULLUP);
+  // Кнопка опитується в loop(); переривання лише будить його з idle
+  attachInterrupt(digitalPinToInterrupt(encoderPins[2]), powerWakeFromISR, FALLING);
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    esp_register_freertos_tick_hook_for_cpu(cpuSampleTick, core);
   }
+
+  motors.begin();
+  markBootStage(BOOT_HARDWARE);
   
   if (!LittleFS.begin()) {
     Serial.println("LittleFS mount failed");
@@ -1012,7 +6016,7 @@ void setup() {
   Serial.println("LittleFS mounted successfully");
 
   // Ініціалізація моторів
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < AXIS_COUNT; i++) {
     motors[i].manual_distance = 0;
     motors[i].target = 0;
     motors[i].running = false;
@@ -1023,241 +6027,265 @@ void setup() {
   }
 
   // Завантажуємо збережені позиції
+  loadConfig();
   loadMotorPositions();
-
-  wm.setConfigPortalTimeout(300); // 5 хвилин
-  wm.setHostname("stanok");
-  
-  bool res = wm.autoConnect("ESP32", "12345678");
-  
-  if (!res) {
-    Serial.println("Failed to connect, starting config portal...");
-    // Якщо не підключились, запускаємо портал (буде блокувати)
-    wm.startConfigPortal("ESP32", "12345678");
-  }
-  
-  Serial.println("WiFi connected!");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  Serial.print("Hostname: ");
-  Serial.println(WiFi.getHostname());
-
-  displayStartTime = millis();
-  drawHostnameDisplay();  // показуємо hostname замість IP
-
-  setupOTA();
-  handleWebServer();
+  loadMotionModel();
+  loadWear();
+  loadPresets();
+  loadUpdateSettings();
+  startEventLog();
+  loadFleetSettings();
+  loadMqttSettings();
+  startMqtt();       // задача сама чекає на Wi-Fi
+  markBootStage(BOOT_STORAGE);
 
   setServoState(false);
+  drawMenu();
+  markBootStage(BOOT_UI);
+
+  // Далі Wi-Fi підключається у фоні, див. serviceNetwork()
+  beginNetwork();
   
   Serial.println("Setup complete!");
 }
 
-void loop() {
-  ArduinoOTA.handle();
-  
-  if (updateInProgress) {
-    delay(100);
-    return;
-  }
-  
-  if (millis() - displayStartTime < 10000) {
-    if (showIP) {
-      drawHostnameDisplay();
-    }
-    if (millis() - displayStartTime >= 10000 && showIP) {
+// Один такт керування: енкодер, кнопка, кінцевики й позиції осей.
+// Час — controlNowUs(), тож відтворення сесії проганяє той самий код
+void controlTick(int detents, bool btnState) {
+  TimeUs now = controlNowUs();
+
+  // Підказка з hostname не блокує керування: перший ввід лише закриває її
+  if (showIP) {
+    if (detents != 0 || btnState == LOW || intervalElapsed(displayStartTime, msToUs(HOSTNAME_OVERLAY_TIME), now)) {
+      if (btnState == LOW) {
+        btnPressed = true;
+        lastDebounce = now;
+      }
       showIP = false;
       drawMenu();
     }
-  } else {
-    // Handle encoder scrolling
-    if (encoder_delta != 0) {
-      if (millis() - lastEncoderUpdate > ENCODER_DEBOUNCE) {
-        lastEncoderUpdate = millis();
+    detents = 0;
+  }
+
+  // Handle encoder scrolling: клацання застосовуються одразу,
+  // а перемальовування обмежене encoder_debounce_ms
+  if (detents != 0) {
+    handleEncoderDetents(detents);
+    encoderRedrawPending = true;
+  }
+
+  if (encoderRedrawPending && intervalElapsed(lastEncoderUpdate, msToUs(config.encoderDebounceMs), now)) {
+    lastEncoderUpdate = now;
+    encoderRedrawPending = false;
+    drawMenu();
+    sendState();
+  }
+
+  if (btnState == LOW && !btnPressed && intervalElapsed(lastDebounce, msToUs(BUTTON_DEBOUNCE), now)) {
+    btnPressed = true;
+    lastDebounce = now;
+
+    switch (menu_level) {
+      case 0:
+        if (menu_index[0] == 0) {
+          menu_level = 1;
+          menu_index[1] = 0;
+        } else if (menu_index[0] == 1) {
+          menu_level = 5;
+          menu_index[5] = 0;
+        } else if (menu_index[0] == 2) {
+          menu_level = 6;
+          menu_index[6] = 0;
+        } else if (menu_index[0] == 3) {
+          menu_level = 7;
+          menu_index[7] = 0;
+        }
+        break;
         
-        int8_t delta = (encoder_delta > 0) ? 1 : -1;
+      case 1:
+        if (menu_index[1] == 0) {
+          menu_level = 3;
+          menu_index[3] = 0;
+          selected_motor = -1;
+        } else if (menu_index[1] == 1) {
+          menu_level = 2;
+          menu_index[2] = 0;
+        } else if (menu_index[1] == 2) {
+          menu_level = 0;
+        }
+        break;
         
-        if (menu_level == 4 && edit_value) {
-          motors[selected_motor].target += delta;
-          if (motors[selected_motor].target < min_mm) motors[selected_motor].target = min_mm;
-          if (motors[selected_motor].target > max_mm) motors[selected_motor].target = max_mm;
+      case 2:
+        if (menu_index[2] == AXIS_COUNT) {
+          menu_level = 1;
         } else {
-          menu_index[menu_level] += delta;
-          
-          int max_indices[] = {2, 2, 4, 3, 3, 4, 1};
-          menu_index[menu_level] = constrain(menu_index[menu_level], 0, max_indices[menu_level]);
+          selected_motor = menu_index[2];
+          menu_level = 3;
+          menu_index[3] = 0;
         }
+        break;
         
-        encoder_delta = 0;
-        drawMenu();
-        sendState();
-      }
-    }
-
-    bool btnState = digitalRead(encoderPins[2]);
-    if (btnState == LOW && !btnPressed && millis() - lastDebounce > 300) {
-      btnPressed = true;
-      lastDebounce = millis();
-
-      switch (menu_level) {
-        case 0:
-          if (menu_index[0] == 0) {
-            menu_level = 1;
-            menu_index[1] = 0;
-          } else if (menu_index[0] == 1) {
-            menu_level = 5;
-            menu_index[5] = 0;
-          } else if (menu_index[0] == 2) {
-            menu_level = 6;
-            menu_index[6] = 0;
-          }
-          break;
-          
-        case 1:
-          if (menu_index[1] == 0) {
-            menu_level = 3;
-            menu_index[3] = 0;
-            selected_motor = -1;
-          } else if (menu_index[1] == 1) {
-            menu_level = 2;
-            menu_index[2] = 0;
-          } else if (menu_index[1] == 2) {
-            menu_level = 0;
-          }
-          break;
-          
-        case 2:
-          if (menu_index[2] == 4) {
-            menu_level = 1;
+      case 3:
+        selected_action = menu_index[3];
+        if (selected_action == 4) {
+          menu_level = (selected_motor == -1) ? 1 : 2;
+        } 
+        else if (selected_action == 3) {
+          menu_level = 8;
+        } 
+        else if (selected_action == 0) {
+          menu_level = 4;
+          menu_index[4] = 0;
+          edit_value = false;
+        } 
+        else if (selected_action == 1) {
+          if (selected_motor == -1) {
+            toggleAllFullForward();
           } else {
-            selected_motor = menu_index[2];
-            menu_level = 3;
-            menu_index[3] = 0;
-          }
-          break;
-          
-        case 3:
-          selected_action = menu_index[3];
-          if (selected_action == 3) {
-            menu_level = (selected_motor == -1) ? 1 : 2;
-          } 
-          else if (selected_action == 0) {
-            menu_level = 4;
-            menu_index[4] = 0;
-            edit_value = false;
-          } 
-          else if (selected_action == 1) {
-            if (selected_motor == -1) {
-              toggleAllFullForward();
-            } else {
-              toggleFullForward(selected_motor);
-            }
+            toggleFullForward(selected_motor);
           }
-          else if (selected_action == 2) {
-            if (selected_motor == -1) {
-              toggleAllFullBackward();
-            } else {
-              toggleFullBackward(selected_motor);
-            }
+        }
+        else if (selected_action == 2) {
+          if (selected_motor == -1) {
+            toggleAllFullBackward();
+          } else {
+            toggleFullBackward(selected_motor);
           }
-          break;
-          
-        case 4:
-          if (menu_index[4] == 0) {
-            edit_value = !edit_value;
-          } 
-          else if (menu_index[4] == 2) {
-            if (selected_motor == -1) {
-              for (int i = 0; i < 4; i++) {
-                setMotorTarget(i, motors[i].target);
-              }
-            } else {
-              setMotorTarget(selected_motor, motors[selected_motor].target);
+        }
+        break;
+        
+      case 4:
+        if (menu_index[4] == 0) {
+          edit_value = !edit_value;
+        } 
+        else if (menu_index[4] == 2) {
+          if (selected_motor == -1) {
+            for (int i = 0; i < AXIS_COUNT; i++) {
+              setMotorTarget(i, motors[i].target);
             }
-          } 
-          else if (menu_index[4] == 3) {
-            menu_level = 3;
-            edit_value = false;
-          }
-          break;
-          
-        case 5:
-          if (menu_index[5] == 4) {
-            menu_level = 0;
           } else {
-            toggleCalibration(menu_index[5]);
+            setMotorTarget(selected_motor, motors[selected_motor].target);
           }
-          break;
-          
-        case 6:
-          if (menu_index[6] == 0) {
-            setServoState(!servoState);
-          } 
-          else if (menu_index[6] == 1) {
-            menu_level = 0;
-          }
-          break;
-      }
-      
-      drawMenu();
+        } 
+        else if (menu_index[4] == 3) {
+          menu_level = 3;
+          edit_value = false;
+        }
+        break;
+        
+      case 5:
+        if (menu_index[5] == AXIS_COUNT) {
+          menu_level = 0;
+        } else {
+          toggleCalibration(menu_index[5]);
+        }
+        break;
+        
+      case 6:
+        if (menu_index[6] == 0) {
+          setServoState(!servoState);
+        } 
+        else if (menu_index[6] == 1) {
+          menu_level = 0;
+        }
+        break;
+
+      case 7:
+        if (menu_index[7] == PRESET_COUNT) {
+          menu_level = 0;
+        } else {
+          recallPreset(menu_index[7]);
+        }
+        break;
+
+      case 8:
+        // Вихід з jog; рух до вже заданої цілі завершується сам
+        menu_level = 3;
+        break;
+    }
+    
+    drawMenu();
+    sendState();
+  } else if (btnState == HIGH && btnPressed) {
+    btnPressed = false;
+  }
+
+  // Check limit switches
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (motors[i].calibrating && motors.limitHit(i)) {
+      motionHomed(i, now);
+      wearLimitHit(i);
+      logEvent(LOG_CALIBRATION_DONE, i);
+      stopMotor(i);
+      motors[i].manual_distance = 0;
+      motors[i].real_position = 0;
       sendState();
-    } else if (btnState == HIGH && btnPressed) {
-      btnPressed = false;
-    }
-
-    // Check limit switches
-    for (int i = 0; i < 4; i++) {
-      if (motors[i].calibrating && digitalRead(limitPins[i]) == LOW) {
-        stopMotor(i);
-        motors[i].manual_distance = 0;
-        motors[i].real_position = 0;
-        sendState();
-        drawMenu();
-        saveMotorPositions(); // зберігаємо після калібрування
-      }
+      drawMenu();
+      saveMotorPositions(); // зберігаємо після калібрування
     }
+  }
 
-    // Update motor positions
-    unsigned long current_time = millis();
-    for (int i = 0; i < 4; i++) {
-      if (motors[i].running && !motors[i].fullForward && !motors[i].fullBackward) {
-        if (current_time - motors[i].last_position_update >= ms_per_mm) {
-          motors[i].last_position_update = current_time;
-          
-          if (motors[i].dir > 0) {
-            motors[i].real_position++;
-          } else if (motors[i].dir < 0) {
-            // Не дозволяємо позиції стати від'ємною під час калібрування
-            if (motors[i].real_position > 0) {
-              motors[i].real_position--;
-            }
-          }
+  wearTick();
 
-          if (motors[i].dir > 0) {
-            motors[i].manual_distance++;
-          } else if (motors[i].dir < 0) {
-            motors[i].manual_distance--;
-          }
-          
-          // Перевірка досягнення цілі
-          if (!motors[i].calibrating) {
-            if ((motors[i].dir > 0 && motors[i].manual_distance >= motors[i].target) ||
-                (motors[i].dir < 0 && motors[i].manual_distance <= motors[i].target)) {
-              stopMotor(i);
-            }
-          }
-          
-          // Періодичне збереження (раз на 5 секунд, якщо мотор рухається)
-          if (current_time - lastSaveTime > 5000) {
-            saveMotorPositions();
-          }
-          
-          sendState();
-          drawMenu();
-        }
-      }
+  // Update motor positions
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    TimeUs lead = motionLeadUs(i, motors[i].dir);
+    MotorStep step = advanceMotorPosition(motors[i], now, msToUs(config.msPerMm), lead);
+    if (step == STEP_NONE) continue;
+    if (step == STEP_ARRIVED) {
+      motionArrived(i, motors[i].dir, motors[i].last_position_update - lead);
+      stopMotor(i);
+    }
+
+    // Періодичне збереження (раз на 5 секунд, якщо мотор рухається)
+    if (intervalElapsed(lastSaveTime, msToUs(POSITION_SAVE_INTERVAL), now)) {
+      saveMotorPositions();
     }
+
+    sendState();
+    drawMenu();
+  }
+}
+
+void loop() {
+  uint32_t loopStart = ESP.getCycleCount();
+  serviceNetwork();
+  traceTick();
+  if (networkServicesStarted) {
+    ArduinoOTA.handle();
   }
   
-  delay(10);
+  if (updateInProgress) {
+    delay(100);
+    return;
+  }
+
+  applyPendingBatch();
+  fleetService();
+  mqttService();
+  sessionService();
+  configService();
+  presetService();
+  wearService();
+
+  int detents = takeEncoderDetents();
+  bool btnState = digitalRead(encoderPins[2]);
+  if (detents != 0) powerLastActivity = nowUs();
+  // Під час відтворення такти керування проганяє sessionService(),
+  // а фізичний ввід відкидається
+  if (sessionMode != SESSION_REPLAYING) {
+    sessionRecordInputs(detents, btnState);
+    controlTick(detents, btnState);
+
+    telemetrySample();
+    mqttCapture();
+  }
+
+  if (intervalElapsed(lastHeapSample, msToUs(HEAP_SAMPLE_INTERVAL))) {
+    lastHeapSample = nowUs();
+    sampleHeap();
+  }
+
+  metricRecord(METRIC_LOOP, ESP.getCycleCount() - loopStart);
+  powerService();
 }
\ No newline at end of file
@@ -0,0 +1,182 @@
+// Записані послідовності AB енкодера через декодер квадратури і прискорення:
+// повільне обертання, брязкіт контактів, швидка прокрутка між тактами loop().
+//
+//   pio test -e native
+
+#include <stdint.h>
+#include <unity.h>
+
+static int64_t virtualClockUs = 0;
+#define TIME_SOURCE_US() virtualClockUs
+
+#include "timebase.h"
+#include "encoder.h"
+
+// Один фронт, як його бачить ISR: рівні AB після фронту і момент, мкс
+struct Edge {
+  uint8_t ab;
+  TimeUs at;
+};
+
+// Клацання за годинниковою стрілкою — чотири фронти 00 → 10 → 11 → 01 → 00
+static const uint8_t CW[4] = {0b10, 0b11, 0b01, 0b00};
+static const uint8_t CCW[4] = {0b01, 0b11, 0b10, 0b00};
+
+// Проти годинникової, два клацання; кожен фронт A чи B брязкає
+static const uint8_t bouncyCcw[] = {
+  0b01, 0b00, 0b01, 0b11, 0b01, 0b11, 0b10, 0b11, 0b10, 0b00,
+  0b01, 0b00, 0b01, 0b11, 0b10, 0b11, 0b10, 0b00, 0b10, 0b00,
+};
+
+static uint8_t decoderState;
+static int32_t pendingSteps;
+static int residual;
+
+void setUp() {
+  virtualClockUs = 0;
+  decoderState = 0;
+  pendingSteps = 0;
+  residual = 0;
+}
+void tearDown() {}
+
+// Те, що робить readEncoder() на кожному фронті
+static void isrEdge(uint8_t ab) {
+  pendingSteps += quadratureStep(decoderState, ab);
+}
+
+// Те, що робить takeEncoderDetents() у loop()
+static int takeDetents() {
+  int32_t steps = pendingSteps;
+  pendingSteps = 0;
+  return quadratureDetents(residual, steps);
+}
+
+void test_each_direction_counts_every_edge() {
+  for (int d = 0; d < 3; d++) {
+    for (uint8_t ab : CW) isrEdge(ab);
+  }
+  TEST_ASSERT_EQUAL_INT32(3 * ENCODER_STEPS_PER_DETENT, pendingSteps);
+  TEST_ASSERT_EQUAL(3, takeDetents());
+  TEST_ASSERT_EQUAL(0, residual);
+
+  for (int d = 0; d < 2; d++) {
+    for (uint8_t ab : CCW) isrEdge(ab);
+  }
+  TEST_ASSERT_EQUAL(-2, takeDetents());
+  TEST_ASSERT_EQUAL(0, residual);
+}
+
+// Брязкіт — це пари протилежних переходів, вони взаємно гасяться
+void test_contact_bounce_cancels_out() {
+  for (uint8_t ab : bouncyCcw) isrEdge(ab);
+  TEST_ASSERT_EQUAL(-2, takeDetents());
+  TEST_ASSERT_EQUAL(0, residual);
+  TEST_ASSERT_EQUAL_UINT8(0b00, decoderState);
+}
+
+// Неможливий перехід (обидва біти разом) не рахується і не збиває стан
+void test_invalid_transition_is_ignored() {
+  isrEdge(0b11);
+  TEST_ASSERT_EQUAL_INT32(0, pendingSteps);
+  isrEdge(0b01);
+  isrEdge(0b00);
+  TEST_ASSERT_EQUAL_INT32(2, pendingSteps);
+}
+
+// Швидка прокрутка: loop() забирає переходи посеред клацання,
+// залишок переноситься і сума клацань точна
+void test_fast_spin_split_across_loop_ticks() {
+  const int detents = 40;
+  int total = 0;
+  int edges = 0;
+  for (int d = 0; d < detents; d++) {
+    for (uint8_t ab : CW) {
+      isrEdge(ab);
+      if (++edges % 7 == 0) total += takeDetents();
+    }
+  }
+  total += takeDetents();
+  TEST_ASSERT_EQUAL(detents, total);
+  TEST_ASSERT_EQUAL(0, residual);
+}
+
+// Розворот посеред клацання не дає хибного кроку в жоден бік
+void test_reversal_mid_detent() {
+  isrEdge(CW[0]);
+  isrEdge(CW[1]);
+  TEST_ASSERT_EQUAL(0, takeDetents());
+  isrEdge(CW[0]);
+  isrEdge(0b00);
+  TEST_ASSERT_EQUAL(0, takeDetents());
+  TEST_ASSERT_EQUAL(0, residual);
+}
+
+void test_acceleration_steps() {
+  TimeUs last = 0;
+  TEST_ASSERT_EQUAL(1, encoderAccelerate(1, last, msToUs(1000)));
+  TEST_ASSERT_EQUAL_INT64(msToUs(1000), last);
+  TEST_ASSERT_EQUAL(1, encoderAccelerate(1, last, msToUs(1081)));
+  TEST_ASSERT_EQUAL(2, encoderAccelerate(1, last, msToUs(1161)));
+  TEST_ASSERT_EQUAL(2, encoderAccelerate(1, last, msToUs(1192)));
+  TEST_ASSERT_EQUAL(5, encoderAccelerate(1, last, msToUs(1222)));
+  TEST_ASSERT_EQUAL(-5, encoderAccelerate(-1, last, msToUs(1232)));
+}
+
+// Кілька клацань за такт ділять інтервал між собою
+void test_acceleration_for_batched_detents() {
+  TimeUs last = 0;
+  TEST_ASSERT_EQUAL(6, encoderAccelerate(3, last, msToUs(150)));
+  TEST_ASSERT_EQUAL(-20, encoderAccelerate(-4, last, msToUs(250)));
+  TEST_ASSERT_EQUAL(3, encoderAccelerate(3, last, msToUs(500)));
+}
+
+// Записана прокрутка з мітками часу: ISR на кожному фронті, loop() кожні 10 мс.
+// Повільне клацання, розгін, брязкіт на розвороті і повільний хід назад
+void test_recorded_spin_with_acceleration() {
+  Edge trace[64];
+  int n = 0;
+  TimeUs t = msToUs(500);
+  for (int d = 0; d < 2; d++) {            // 2 клацання по 200 мс
+    for (uint8_t ab : CW) trace[n++] = {ab, t += msToUs(50)};
+  }
+  for (int d = 0; d < 6; d++) {            // 6 клацань по 20 мс
+    for (uint8_t ab : CW) trace[n++] = {ab, t += msToUs(5)};
+  }
+  trace[n++] = {0b01, t += msToUs(300)};   // брязкіт на початку розвороту
+  trace[n++] = {0b00, t += 300};
+  for (int d = 0; d < 2; d++) {            // 2 клацання назад по 400 мс
+    for (uint8_t ab : CCW) trace[n++] = {ab, t += msToUs(100)};
+  }
+
+  TimeUs lastDetent = 0;
+  int position = 0;
+  int detentsSeen = 0;
+  int next = 0;
+  for (virtualClockUs = 0; virtualClockUs <= t + msToUs(10); virtualClockUs += msToUs(10)) {
+    while (next < n && trace[next].at <= virtualClockUs) isrEdge(trace[next++].ab);
+    int detents = takeDetents();
+    if (detents == 0) continue;
+    detentsSeen += detents;
+    position += encoderAccelerate(detents, lastDetent, nowUs());
+  }
+
+  TEST_ASSERT_EQUAL(n, next);
+  TEST_ASSERT_EQUAL(2 + 6 - 2, detentsSeen);
+  TEST_ASSERT_EQUAL(0, residual);
+  // 2 повільних по 1, 6 швидких по 5, 2 назад по 1
+  TEST_ASSERT_EQUAL(2 + 6 * 5 - 2, position);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_each_direction_counts_every_edge);
+  RUN_TEST(test_contact_bounce_cancels_out);
+  RUN_TEST(test_invalid_transition_is_ignored);
+  RUN_TEST(test_fast_spin_split_across_loop_ticks);
+  RUN_TEST(test_reversal_mid_detent);
+  RUN_TEST(test_acceleration_steps);
+  RUN_TEST(test_acceleration_for_batched_detents);
+  RUN_TEST(test_recorded_spin_with_acceleration);
+  return UNITY_END();
+}
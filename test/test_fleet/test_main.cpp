@@ -0,0 +1,271 @@
+// Протокол лінії без мережі: синхронізація годинника веденого за маяками,
+// черга команд за спільним моментом, повтори і ACK координатора.
+//
+//   pio test -e native
+
+#include <stdint.h>
+#include <unity.h>
+
+static int64_t virtualClockUs = 0;
+#define TIME_SOURCE_US() virtualClockUs
+
+#include "timebase.h"
+#include "command.h"
+#include "fleet.h"
+
+static const CommandLimits limits = {4, 0, 300, 8, 0};
+static const uint32_t COORDINATOR = 0xc0de0001;
+
+static FleetSync sync;
+static FleetQueue queue;
+static FleetPeer peers[FLEET_MAX_PEERS];
+static FleetOutgoing outbox[FLEET_OUTBOX];
+
+void setUp() {
+  virtualClockUs = 0;
+  sync = FleetSync();
+  queue = FleetQueue();
+  memset(peers, 0, sizeof(peers));
+  memset(outbox, 0, sizeof(outbox));
+}
+void tearDown() {}
+
+// Годинник веденого: зсув від координатора і хід у ppm
+struct Clock {
+  int64_t offsetUs;
+  int32_t ppm;
+  int64_t at(int64_t coordinatorUs) const {
+    return coordinatorUs - offsetUs + coordinatorUs * ppm / 1000000;
+  }
+};
+
+// Мережева затримка маяка: 300..2300 мкс, детермінована послідовність
+static int64_t delayUs(int i) {
+  return 300 + (i * 7919) % 2000;
+}
+
+void test_header_filtering() {
+  FleetHeader h;
+  uint8_t buf[sizeof(FleetHeader)];
+  fleetFillHeader(h, FLEET_BEACON, 3, COORDINATOR, 42, 1000);
+  memcpy(buf, &h, sizeof(h));
+
+  FleetHeader out;
+  TEST_ASSERT_TRUE(fleetParseHeader(buf, sizeof(buf), 3, 0x1234, out));
+  TEST_ASSERT_EQUAL_UINT32(42, out.seq);
+  TEST_ASSERT_EQUAL_INT64(1000, out.timeUs);
+  TEST_ASSERT_FALSE(fleetParseHeader(buf, sizeof(buf), 4, 0x1234, out));         // інша лінія
+  TEST_ASSERT_FALSE(fleetParseHeader(buf, sizeof(buf), 3, COORDINATOR, out));    // власне відлуння
+  TEST_ASSERT_FALSE(fleetParseHeader(buf, sizeof(buf) - 1, 3, 0x1234, out));
+  buf[4] = FLEET_VERSION + 1;
+  TEST_ASSERT_FALSE(fleetParseHeader(buf, sizeof(buf), 3, 0x1234, out));
+}
+
+void test_command_bounds() {
+  TEST_ASSERT_TRUE(fleetCommandValid({CMD_SET_TARGET, 3, 300}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_SET_TARGET, 4, 10}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_SET_TARGET, 0, 301}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_SET_ALL_TARGETS, -1, -1}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_CALIBRATE, -1, 0}, limits));
+  TEST_ASSERT_TRUE(fleetCommandValid({CMD_RECALL_PRESET, -1, 7}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_RECALL_PRESET, -1, 8}, limits));
+  TEST_ASSERT_FALSE(fleetCommandValid({CMD_COUNT, -1, 0}, limits));
+
+  TEST_ASSERT_EQUAL_INT64(1000, fleetDueTime({CMD_EMERGENCY_STOP, -1, 0}, 1000));
+  TEST_ASSERT_EQUAL_INT64(1000 + msToUs(FLEET_LEAD_TIME), fleetDueTime({CMD_SET_SERVO, -1, 1}, 1000));
+}
+
+// Найбільша вибірка у вікні — з найменшою затримкою; зсув точний до неї
+void test_offset_from_beacons() {
+  Clock follower = {-7300000, 0};
+  int64_t minDelay = INT64_MAX;
+  for (int i = 0; i < FLEET_SYNC_WINDOW; i++) {
+    int64_t sentUs = 10000000 + i * msToUs(FLEET_BEACON_INTERVAL);
+    int64_t rxUs = follower.at(sentUs + delayUs(i));
+    if (delayUs(i) < minDelay) minDelay = delayUs(i);
+    TEST_ASSERT_TRUE(fleetFollow(sync, COORDINATOR, sentUs, rxUs));
+  }
+  TEST_ASSERT_EQUAL_UINT32(COORDINATOR, sync.coordinator);
+  TEST_ASSERT_EQUAL(FLEET_SYNC_WINDOW, sync.count);
+  TEST_ASSERT_EQUAL_INT64(follower.offsetUs - minDelay, sync.offsetUs);
+}
+
+// Годинник веденого спішить на 50 ppm: за FLEET_DRIFT_INTERVAL з'являється оцінка
+void test_drift_estimate() {
+  Clock follower = {0, 50};
+  for (int i = 0; i <= 2 * FLEET_DRIFT_INTERVAL / FLEET_BEACON_INTERVAL; i++) {
+    int64_t sentUs = 1000000 + i * msToUs(FLEET_BEACON_INTERVAL);
+    fleetFollow(sync, COORDINATOR, sentUs, follower.at(sentUs + 500));
+  }
+  TEST_ASSERT_INT_WITHIN(1000, -50000, sync.driftPpb);
+}
+
+// Другий координатор ігнорується, доки перший не замовкне
+void test_follows_first_coordinator() {
+  TEST_ASSERT_TRUE(fleetFollow(sync, COORDINATOR, 5000, 1000));
+  TEST_ASSERT_FALSE(fleetFollow(sync, 0xbeef, 9000, 1000 + msToUs(FLEET_PEER_TIMEOUT) - 1));
+  TEST_ASSERT_EQUAL_UINT32(COORDINATOR, sync.coordinator);
+  TEST_ASSERT_TRUE(fleetFollow(sync, 0xbeef, 9000, 1000 + msToUs(FLEET_PEER_TIMEOUT)));
+  TEST_ASSERT_EQUAL_UINT32(0xbeef, sync.coordinator);
+  TEST_ASSERT_EQUAL(1, sync.count);
+  TEST_ASSERT_EQUAL_INT64(9000 - 1000 - msToUs(FLEET_PEER_TIMEOUT), sync.offsetUs);
+}
+
+void test_duplicate_seq_window() {
+  FleetSeen seen = {};
+  TEST_ASSERT_FALSE(fleetSeenBefore(seen, 100));
+  TEST_ASSERT_TRUE(fleetSeenBefore(seen, 100));
+  for (uint32_t seq = 101; seq < 101 + FLEET_SEEN - 1; seq++) {
+    TEST_ASSERT_FALSE(fleetSeenBefore(seen, seq));
+  }
+  TEST_ASSERT_TRUE(fleetSeenBefore(seen, 100));
+  TEST_ASSERT_FALSE(fleetSeenBefore(seen, 500));   // витісняє найстаріший
+  TEST_ASSERT_FALSE(fleetSeenBefore(seen, 100));
+}
+
+// Команди з однаковим моментом виходять разом, решта чекає в порядку надходження
+void test_queue_due_and_overflow() {
+  fleetEnqueue(queue, 2000, 1, {CMD_SET_TARGET, 0, 10}, true);
+  fleetEnqueue(queue, 1000, 2, {CMD_SET_TARGET, 1, 20}, true);
+  fleetEnqueue(queue, 3000, 3, {CMD_SET_TARGET, 2, 30}, true);
+  fleetEnqueue(queue, 1000, 4, {CMD_SET_TARGET, 3, 40}, true);
+
+  FleetScheduled due[FLEET_QUEUE_LENGTH];
+  TEST_ASSERT_EQUAL(0, fleetTakeDue(queue, 999, due));
+  TEST_ASSERT_EQUAL(2, fleetTakeDue(queue, 1000, due));
+  TEST_ASSERT_EQUAL_UINT32(2, due[0].seq);
+  TEST_ASSERT_EQUAL_UINT32(4, due[1].seq);
+  TEST_ASSERT_EQUAL(2, queue.count);
+  TEST_ASSERT_EQUAL_UINT32(1, queue.items[0].seq);
+  TEST_ASSERT_EQUAL_UINT32(3, queue.items[1].seq);
+  TEST_ASSERT_EQUAL(2, fleetTakeDue(queue, 5000, due));
+  TEST_ASSERT_EQUAL(0, queue.count);
+
+  for (int i = 0; i < FLEET_QUEUE_LENGTH + 3; i++) {
+    fleetEnqueue(queue, 1000, i, {CMD_SET_SERVO, -1, 1}, false);
+  }
+  TEST_ASSERT_EQUAL(FLEET_QUEUE_LENGTH, queue.count);
+  TEST_ASSERT_EQUAL_UINT32(3, queue.dropped);
+}
+
+void test_peer_slots() {
+  TimeUs now = msToUs(10000);
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    int slot = fleetPeerSlot(peers, 0x100 + i, now);
+    TEST_ASSERT_EQUAL(i, slot);
+    peers[slot].lastSeen = now;
+  }
+  TEST_ASSERT_EQUAL(-1, fleetPeerSlot(peers, 0x999, now));
+  TEST_ASSERT_EQUAL(3, fleetPeerSlot(peers, 0x103, now));
+  TEST_ASSERT_EQUAL_UINT8(0xff, fleetAliveMask(peers, now));
+
+  // Учасник 5 замовк — його слот віддається новому
+  now += msToUs(FLEET_PEER_TIMEOUT);
+  for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+    if (i != 5) peers[i].lastSeen = now;
+  }
+  TEST_ASSERT_EQUAL_UINT8(0xdf, fleetAliveMask(peers, now));
+  TEST_ASSERT_EQUAL(5, fleetPeerSlot(peers, 0x999, now));
+  TEST_ASSERT_EQUAL_UINT32(0x999, peers[5].unit);
+}
+
+// Повтори йдуть, поки не всі живі підтвердили, і не більше FLEET_RESEND_COUNT
+void test_resend_until_acked() {
+  TimeUs now = msToUs(1000);
+  for (int i = 0; i < 2; i++) {
+    fleetPeerSlot(peers, 0x100 + i, now);
+    peers[i].lastSeen = now;
+  }
+  FleetCommandPacket p = {};
+  fleetFillHeader(p.header, FLEET_COMMAND, 0, COORDINATOR, 17, now);
+  p.executeAtUs = fleetDueTime({CMD_SET_ALL_TARGETS, -1, 50}, now);
+  fleetPost(outbox, peers, p, now);
+  FleetOutgoing &o = outbox[17 % FLEET_OUTBOX];
+  TEST_ASSERT_EQUAL(1, o.sends);
+
+  TEST_ASSERT_FALSE(fleetResendDue(o, peers, now + msToUs(FLEET_RESEND_INTERVAL) - 1));
+  now += msToUs(FLEET_RESEND_INTERVAL);
+  TEST_ASSERT_TRUE(fleetResendDue(o, peers, now));
+  fleetMarkAcked(outbox, 0, 17);
+  now += msToUs(FLEET_RESEND_INTERVAL);
+  TEST_ASSERT_TRUE(fleetResendDue(o, peers, now));      // ведений 1 ще мовчить
+  TEST_ASSERT_EQUAL(FLEET_RESEND_COUNT, o.sends);
+  now += msToUs(FLEET_RESEND_INTERVAL);
+  TEST_ASSERT_FALSE(fleetResendDue(o, peers, now));     // ліміт повторів
+
+  // Після моменту виконання плюс тайм-аут слот списується, пропуск — лише
+  // живому, але мовчазному (звіти на маяки обидва шлють і далі)
+  now = p.executeAtUs + msToUs(FLEET_PEER_TIMEOUT);
+  peers[0].lastSeen = peers[1].lastSeen = now;
+  TEST_ASSERT_FALSE(fleetResendDue(o, peers, now));
+  TEST_ASSERT_EQUAL(0, o.sends);
+  TEST_ASSERT_EQUAL_UINT32(0, peers[0].missed);
+  TEST_ASSERT_EQUAL_UINT32(1, peers[1].missed);
+}
+
+void test_all_acked_stops_resend() {
+  TimeUs now = msToUs(1000);
+  fleetPeerSlot(peers, 0x100, now);
+  peers[0].lastSeen = now;
+  FleetCommandPacket p = {};
+  fleetFillHeader(p.header, FLEET_COMMAND, 0, COORDINATOR, 3, now);
+  p.executeAtUs = now + msToUs(FLEET_LEAD_TIME);
+  fleetPost(outbox, peers, p, now);
+  fleetMarkAcked(outbox, 0, 3);
+  TEST_ASSERT_FALSE(fleetResendDue(outbox[3], peers, now + msToUs(FLEET_RESEND_INTERVAL)));
+  TEST_ASSERT_EQUAL(1, outbox[3].sends);
+}
+
+// Наскрізно: маяки, команда зі спільним моментом, виконання на веденому.
+// Зсув оцінюється з найменшою затримкою маяка у вікні, тож ведений
+// виконує рівно на неї пізніше спільного моменту
+void test_command_lands_at_shared_moment() {
+  Clock follower = {-123456789, 0};
+  FleetSeen seen = {};
+  int64_t coordUs = 50000000;
+  int64_t minDelay = INT64_MAX;
+  // Останнє місце у вікні займе вибірка з самого пакета команди
+  for (int i = 0; i < FLEET_SYNC_WINDOW - 1; i++) {
+    coordUs += msToUs(FLEET_BEACON_INTERVAL);
+    if (delayUs(i) < minDelay) minDelay = delayUs(i);
+    fleetFollow(sync, COORDINATOR, coordUs, follower.at(coordUs + delayUs(i)));
+  }
+
+  coordUs += 10000;
+  FleetCommandPacket p = {};
+  fleetFillHeader(p.header, FLEET_COMMAND, 0, COORDINATOR, 77, coordUs);
+  p.executeAtUs = fleetDueTime({CMD_SET_ALL_TARGETS, -1, 120}, coordUs);
+  p.cmd = {CMD_SET_ALL_TARGETS, -1, 120};
+
+  for (int copy = 0; copy < 2; copy++) {     // повтор координатора не ставиться вдруге
+    int64_t rx = follower.at(coordUs + 900 + copy * msToUs(FLEET_RESEND_INTERVAL));
+    TEST_ASSERT_TRUE(fleetFollow(sync, COORDINATOR, p.header.timeUs, rx));
+    if (fleetCommandValid(p.cmd, limits) && !fleetSeenBefore(seen, p.header.seq)) {
+      fleetEnqueue(queue, fleetLocalTime(sync, p.executeAtUs), p.header.seq, p.cmd, true);
+    }
+  }
+  TEST_ASSERT_EQUAL(1, queue.count);
+
+  FleetScheduled due[FLEET_QUEUE_LENGTH];
+  int64_t shared = follower.at(p.executeAtUs);
+  TEST_ASSERT_EQUAL(0, fleetTakeDue(queue, shared + minDelay - 1, due));
+  TEST_ASSERT_EQUAL(1, fleetTakeDue(queue, shared + minDelay, due));
+  TEST_ASSERT_EQUAL_INT64(shared + minDelay, due[0].due);
+  TEST_ASSERT_EQUAL(120, due[0].cmd.value);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_filtering);
+  RUN_TEST(test_command_bounds);
+  RUN_TEST(test_offset_from_beacons);
+  RUN_TEST(test_drift_estimate);
+  RUN_TEST(test_follows_first_coordinator);
+  RUN_TEST(test_duplicate_seq_window);
+  RUN_TEST(test_queue_due_and_overflow);
+  RUN_TEST(test_peer_slots);
+  RUN_TEST(test_resend_until_acked);
+  RUN_TEST(test_all_acked_stops_resend);
+  RUN_TEST(test_command_lands_at_shared_moment);
+  return UNITY_END();
+}
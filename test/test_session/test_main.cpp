@@ -0,0 +1,289 @@
+// Слід сесії на віртуальному годиннику: запис живого прогону, відтворення
+// тим самим курсором, що й на платі, і звірка підсумкових позицій.
+//
+//   pio test -e native
+
+#include <stdint.h>
+#include <unity.h>
+
+static int64_t virtualClockUs = 0;
+#define TIME_SOURCE_US() virtualClockUs
+
+#include "timebase.h"
+#include "motion.h"
+#include "command.h"
+#include "session_trace.h"
+
+#define AXES 2
+static const TimeUs STEP_US = 100000;    // 100 мс на мм
+static const TimeUs START_US = 5000000;
+
+// Найменша машина: осі, що крокують за часом, і кілька команд
+struct Machine {
+  Motor axes[AXES];
+  uint8_t limits;
+};
+
+static Machine machine;
+
+static void startAxis(Motor &m, int target) {
+  m.target = target;
+  if (target == m.manual_distance) return;
+  m.dir = target > m.manual_distance ? 1 : -1;
+  if (!m.running) m.last_position_update = nowUs();
+  m.running = true;
+}
+
+static void applyCommand(const Command &cmd) {
+  switch (cmd.op) {
+    case CMD_SET_TARGET:
+      startAxis(machine.axes[cmd.motor], cmd.value);
+      break;
+    case CMD_SET_ALL_TARGETS:
+      for (Motor &m : machine.axes) startAxis(m, cmd.value);
+      break;
+    case CMD_EMERGENCY_STOP:
+      for (Motor &m : machine.axes) m.running = false;
+      break;
+  }
+}
+
+// Енкодер веде вісь 0, кінцевик зупиняє вісь
+static void applyDetents(int detents) {
+  if (detents != 0) startAxis(machine.axes[0], machine.axes[0].target + detents);
+}
+
+static void controlTick() {
+  for (int i = 0; i < AXES; i++) {
+    Motor &m = machine.axes[i];
+    if ((machine.limits >> i) & 1) m.running = false;
+    if (advanceMotorPosition(m, nowUs(), STEP_US) == STEP_ARRIVED) m.running = false;
+  }
+}
+
+// Запис, як sessionAppend(): dt від попередньої події
+static uint8_t trace[1024];
+static size_t traceLength;
+static TimeUs traceLastUs;
+
+static void record(SessionEventType type, const void *data, size_t len) {
+  TimeUs dt = nowUs() > traceLastUs ? nowUs() - traceLastUs : 0;
+  traceLastUs += dt;
+  traceLength += sessionPutEvent(trace + traceLength, dt, type, data, len);
+}
+
+static void recordCommand(const Command &cmd) {
+  uint8_t data[SESSION_COMMAND_SIZE];
+  sessionPackCommand(cmd, data);
+  record(SESSION_COMMAND, data, sizeof(data));
+  applyCommand(cmd);
+}
+
+static void recordEnd() {
+  uint8_t data[AXES * 8];
+  for (int i = 0; i < AXES; i++) {
+    int32_t values[2] = {machine.axes[i].real_position, machine.axes[i].manual_distance};
+    memcpy(data + i * 8, values, 8);
+  }
+  record(SESSION_END, data, sizeof(data));
+}
+
+// Живий прогін: такти loop() кожні 10 мс, команда з вебсервера між тактами,
+// енкодер, кінцевик і аварійна зупинка
+static void recordSession() {
+  virtualClockUs = START_US;
+  traceLastUs = START_US;
+  traceLength = 0;
+
+  for (int tick = 0; tick <= 400; tick++) {
+    virtualClockUs = START_US + tick * SESSION_TICK_US;
+    if (tick == 1) recordCommand({CMD_SET_TARGET, 1, 12});
+    if (tick == 20) {
+      uint8_t data[10];
+      record(SESSION_ENCODER, data, sessionPackDetents(5, data));
+      applyDetents(5);
+    }
+    if (tick == 60) {
+      // Прийшла посеред такту, ще до наступного проходу loop()
+      virtualClockUs += 3200;
+      recordCommand({CMD_SET_TARGET, 0, 2});
+      virtualClockUs -= 3200;
+    }
+    if (tick == 150) recordCommand({CMD_SET_ALL_TARGETS, -1, 20});
+    if (tick == 230) {
+      machine.limits = 0x2;
+      record(SESSION_LIMITS, &machine.limits, 1);
+    }
+    if (tick == 260) {
+      uint8_t data[10];
+      record(SESSION_ENCODER, data, sessionPackDetents(-3, data));
+      applyDetents(-3);
+    }
+    if (tick == 300) recordCommand({CMD_EMERGENCY_STOP, -1, 0});
+    controlTick();
+  }
+  recordEnd();
+}
+
+struct ReplayResult {
+  bool ended;
+  bool corrupt;
+  int events;
+  int ticks;
+  int32_t expected[AXES];
+};
+
+// Відтворення так само, як sessionReplayStep() на платі
+static ReplayResult replay(const uint8_t *buf, size_t len) {
+  ReplayResult result = {};
+  machine = Machine();
+  virtualClockUs = START_US;
+
+  SessionCursor cursor;
+  if (!sessionCursorBegin(cursor, buf, len, 0, AXES, START_US)) {
+    result.corrupt = true;
+    return result;
+  }
+  TimeUs lastTickUs = START_US;
+  while (!result.ended) {
+    TimeUs at = sessionNextTickUs(cursor, lastTickUs);
+    virtualClockUs = at;
+
+    int detents = 0;
+    SessionEvent e;
+    while (!result.ended && sessionTakeEvent(cursor, at, e)) {
+      switch (e.type) {
+        case SESSION_COMMAND: applyCommand(e.cmd); break;
+        case SESSION_ENCODER: detents += e.detents; break;
+        case SESSION_LIMITS: machine.limits = e.level; break;
+        case SESSION_END:
+          for (int i = 0; i < AXES; i++) result.expected[i] = sessionEndPosition(e, i);
+          result.ended = true;
+          continue;
+      }
+      result.events++;
+    }
+    if (cursor.corrupt) {
+      result.corrupt = true;
+      return result;
+    }
+    if (result.ended) break;
+
+    applyDetents(detents);
+    controlTick();
+    lastTickUs = at;
+    result.ticks++;
+  }
+  return result;
+}
+
+void setUp() {
+  virtualClockUs = 0;
+  machine = Machine();
+}
+void tearDown() {}
+
+void test_varint_round_trip() {
+  const uint64_t values[] = {0, 1, 127, 128, 16383, 16384, SESSION_TICK_US, (uint64_t)1 << 40, UINT64_MAX};
+  for (uint64_t value : values) {
+    uint8_t buf[10];
+    size_t n = sessionPutVarint(buf, value);
+    size_t pos = 0;
+    uint64_t v;
+    TEST_ASSERT_TRUE(sessionGetVarint(buf, n, pos, v));
+    TEST_ASSERT_EQUAL_UINT64(value, v);
+    TEST_ASSERT_EQUAL(n, pos);
+  }
+}
+
+// Байти сліду як їх пише прошивка
+void test_decode_recorded_bytes() {
+  const uint8_t bytes[] = {
+    0x90, 0x4e, SESSION_COMMAND, CMD_SET_TARGET, 1, 0x2c, 0x01,   // +10 мс: вісь 1 → 300
+    0x00, SESSION_ENCODER, 0x05,                                  // той самий такт: -3 клацання
+    0xe8, 0x07, SESSION_BUTTON, 0,                                // +1 мс
+    0x00, SESSION_END, 7, 0, 0, 0, 9, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0,
+  };
+  SessionCursor c;
+  TEST_ASSERT_TRUE(sessionCursorBegin(c, bytes, sizeof(bytes), 0, AXES, START_US));
+  TEST_ASSERT_EQUAL_INT64(START_US + 10000, c.nextEventUs);
+  TEST_ASSERT_EQUAL_INT64(START_US + 10000, sessionNextTickUs(c, START_US));
+
+  SessionEvent e;
+  TimeUs at = START_US + 10000;
+  TEST_ASSERT_TRUE(sessionTakeEvent(c, at, e));
+  TEST_ASSERT_EQUAL(SESSION_COMMAND, e.type);
+  TEST_ASSERT_EQUAL(CMD_SET_TARGET, e.cmd.op);
+  TEST_ASSERT_EQUAL(1, e.cmd.motor);
+  TEST_ASSERT_EQUAL(300, e.cmd.value);
+  TEST_ASSERT_TRUE(sessionTakeEvent(c, at, e));
+  TEST_ASSERT_EQUAL(SESSION_ENCODER, e.type);
+  TEST_ASSERT_EQUAL(-3, e.detents);
+  TEST_ASSERT_FALSE(sessionTakeEvent(c, at, e));
+
+  at += 1000;
+  TEST_ASSERT_EQUAL_INT64(at, sessionNextTickUs(c, START_US + 10000));
+  TEST_ASSERT_TRUE(sessionTakeEvent(c, at, e));
+  TEST_ASSERT_EQUAL(SESSION_BUTTON, e.type);
+  TEST_ASSERT_EQUAL(0, e.level);
+  TEST_ASSERT_TRUE(sessionTakeEvent(c, at, e));
+  TEST_ASSERT_EQUAL(SESSION_END, e.type);
+  TEST_ASSERT_EQUAL(7, sessionEndPosition(e, 0));
+  TEST_ASSERT_EQUAL(-1, sessionEndPosition(e, 1));
+  TEST_ASSERT_FALSE(c.corrupt);
+}
+
+// Без подій такти йдуть рівно через SESSION_TICK_US
+void test_ticks_between_events() {
+  const uint8_t bytes[] = {0xb0, 0xea, 0x01, SESSION_BUTTON, 1};   // +30 мс
+  SessionCursor c;
+  TEST_ASSERT_TRUE(sessionCursorBegin(c, bytes, sizeof(bytes), 0, AXES, START_US));
+  TEST_ASSERT_EQUAL_INT64(START_US + SESSION_TICK_US, sessionNextTickUs(c, START_US));
+  TEST_ASSERT_EQUAL_INT64(START_US + 2 * SESSION_TICK_US, sessionNextTickUs(c, START_US + SESSION_TICK_US));
+  TEST_ASSERT_EQUAL_INT64(START_US + 3 * SESSION_TICK_US, sessionNextTickUs(c, START_US + 25000));
+}
+
+void test_replay_matches_recorded_positions() {
+  recordSession();
+  int32_t live[AXES];
+  for (int i = 0; i < AXES; i++) live[i] = machine.axes[i].real_position;
+
+  ReplayResult r = replay(trace, traceLength);
+  TEST_ASSERT_TRUE(r.ended);
+  TEST_ASSERT_FALSE(r.corrupt);
+  TEST_ASSERT_EQUAL(7, r.events);
+  for (int i = 0; i < AXES; i++) {
+    TEST_ASSERT_EQUAL(live[i], r.expected[i]);
+    TEST_ASSERT_EQUAL(live[i], machine.axes[i].real_position);
+  }
+  // Вісь 0: 5 клацань, з 4 мм назад до 2, далі до 20, на 2.6 с енкодер
+  // скорочує ціль до 17, аварійна зупинка на 3.0 с — за крок до неї;
+  // вісь 1: 12, далі до 20, кінцевик на 2.3 с — на останньому кроці
+  TEST_ASSERT_EQUAL(16, machine.axes[0].real_position);
+  TEST_ASSERT_EQUAL(19, machine.axes[1].real_position);
+  TEST_ASSERT_FALSE(machine.axes[0].running);
+  TEST_ASSERT_FALSE(machine.axes[1].running);
+}
+
+// Обрізаний слід зупиняє відтворення як пошкоджений, а не зависає
+void test_truncated_trace_is_corrupt() {
+  recordSession();
+  ReplayResult r = replay(trace, traceLength - AXES * 8);
+  TEST_ASSERT_FALSE(r.ended);
+  TEST_ASSERT_TRUE(r.corrupt);
+
+  const uint8_t badOp[] = {0x00, SESSION_COMMAND, CMD_COUNT, 0, 0, 0, 0x00, SESSION_END};
+  r = replay(badOp, sizeof(badOp));
+  TEST_ASSERT_TRUE(r.corrupt);
+  TEST_ASSERT_EQUAL(0, r.events);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_varint_round_trip);
+  RUN_TEST(test_decode_recorded_bytes);
+  RUN_TEST(test_ticks_between_events);
+  RUN_TEST(test_replay_matches_recorded_positions);
+  RUN_TEST(test_truncated_trace_is_corrupt);
+  return UNITY_END();
+}
@@ -0,0 +1,145 @@
+// Тривалий аптайм на віртуальному годиннику: межі 2^32 мкс (~71.6 хв) і
+// 2^32 мс (~49.7 доби), далі місяці великими стрибками.
+//
+//   pio test -e native
+
+#include <stdint.h>
+#include <unity.h>
+
+static int64_t virtualClockUs = 0;
+#define TIME_SOURCE_US() virtualClockUs
+
+#include "timebase.h"
+#include "motion.h"
+
+static const TimeUs US_2_32 = (TimeUs)1 << 32;
+static const TimeUs MS_2_32_US = ((TimeUs)1 << 32) * 1000;
+static const TimeUs DAY_US = 24LL * 3600 * 1000000;
+static const TimeUs STEP_US = 4350000;   // ms_per_mm за замовчуванням
+
+static const TimeUs startPoints[] = {0, US_2_32 - 5000, MS_2_32_US - 5000, 180 * DAY_US};
+
+void setUp() { virtualClockUs = 0; }
+void tearDown() {}
+
+void test_deadline_across_boundaries() {
+  for (TimeUs start : startPoints) {
+    virtualClockUs = start;
+    TimeUs deadline = nowUs() + 10000;
+    TEST_ASSERT_FALSE(deadlineReached(deadline));
+    virtualClockUs += 9999;
+    TEST_ASSERT_FALSE(deadlineReached(deadline));
+    virtualClockUs += 1;
+    TEST_ASSERT_TRUE(deadlineReached(deadline));
+    virtualClockUs += 30 * DAY_US;
+    TEST_ASSERT_TRUE(deadlineReached(deadline));
+  }
+}
+
+void test_interval_across_boundaries() {
+  for (TimeUs start : startPoints) {
+    virtualClockUs = start;
+    TimeUs since = nowUs();
+    TimeUs interval = msToUs(5000);
+    TEST_ASSERT_FALSE(intervalElapsed(since, interval));
+    virtualClockUs = since + interval - 1;
+    TEST_ASSERT_FALSE(intervalElapsed(since, interval));
+    virtualClockUs = since + interval;
+    TEST_ASSERT_TRUE(intervalElapsed(since, interval));
+  }
+}
+
+// Періодична задача, яку не будили місяцями: один спрацьовує одразу,
+// далі мітка наздоганяє поточний час кроками інтервалу без дрейфу
+void test_periodic_schedule_over_months() {
+  TimeUs interval = msToUs(1000);
+  TimeUs last = 0;
+  uint64_t fired = 0;
+  for (int month = 0; month < 6; month++) {
+    virtualClockUs += 30 * DAY_US;
+    TEST_ASSERT_TRUE(intervalElapsed(last, interval));
+    while (intervalElapsed(last, interval)) {
+      last += interval;
+      fired++;
+    }
+    TEST_ASSERT_FALSE(intervalElapsed(last, interval));
+    TEST_ASSERT_TRUE(virtualClockUs - last < interval);
+  }
+  TEST_ASSERT_EQUAL_UINT64((uint64_t)(180 * DAY_US / interval), fired);
+}
+
+void test_uptime_ms_wraps_as_uint32() {
+  virtualClockUs = MS_2_32_US + msToUs(1234);
+  TEST_ASSERT_EQUAL_UINT32(1234, uptimeMs());
+}
+
+// Кроки позиції від попередньої мітки: після довгої паузи loop() вісь
+// наздоганяє пропущені кроки, а фаза кроку не зсувається
+void test_motor_catch_up_without_drift() {
+  for (TimeUs start : startPoints) {
+    Motor m;
+    m.running = true;
+    m.dir = 1;
+    m.target = 1000;
+    m.move_start_time = start;
+    m.last_position_update = start;
+
+    TEST_ASSERT_EQUAL(STEP_NONE, advanceMotorPosition(m, start + STEP_US - 1, STEP_US));
+
+    TimeUs now = start + 3 * STEP_US + STEP_US / 2;
+    int steps = 0;
+    while (advanceMotorPosition(m, now, STEP_US) != STEP_NONE) steps++;
+    TEST_ASSERT_EQUAL(3, steps);
+    TEST_ASSERT_EQUAL(3, m.real_position);
+    TEST_ASSERT_EQUAL_INT64(start + 3 * STEP_US, m.last_position_update);
+  }
+}
+
+void test_motor_arrives_on_target_after_long_run() {
+  Motor m;
+  TimeUs start = MS_2_32_US - STEP_US;
+  m.running = true;
+  m.dir = -1;
+  m.real_position = m.manual_distance = 20;
+  m.target = 15;
+  m.last_position_update = start;
+
+  MotorStep step = STEP_NONE;
+  int steps = 0;
+  for (TimeUs now = start; step != STEP_ARRIVED; now += 10000) {
+    step = advanceMotorPosition(m, now, STEP_US);
+    if (step != STEP_NONE) steps++;
+    TEST_ASSERT_TRUE(now < start + 10 * STEP_US);
+  }
+  TEST_ASSERT_EQUAL(5, steps);
+  TEST_ASSERT_EQUAL(15, m.real_position);
+}
+
+// Випередження зупинки зсуває лише останній крок до цілі
+void test_motor_stop_lead_only_on_last_step() {
+  Motor m;
+  TimeUs start = US_2_32 - STEP_US;
+  TimeUs lead = 300000;
+  m.running = true;
+  m.dir = 1;
+  m.target = 2;
+  m.last_position_update = start;
+
+  TEST_ASSERT_EQUAL(STEP_NONE, advanceMotorPosition(m, start + STEP_US - lead, STEP_US, lead));
+  TEST_ASSERT_EQUAL(STEP_MOVED, advanceMotorPosition(m, start + STEP_US, STEP_US, lead));
+  TEST_ASSERT_EQUAL(STEP_NONE, advanceMotorPosition(m, start + 2 * STEP_US - lead - 1, STEP_US, lead));
+  TEST_ASSERT_EQUAL(STEP_ARRIVED, advanceMotorPosition(m, start + 2 * STEP_US - lead, STEP_US, lead));
+  TEST_ASSERT_EQUAL_INT64(start + 2 * STEP_US, m.last_position_update);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_deadline_across_boundaries);
+  RUN_TEST(test_interval_across_boundaries);
+  RUN_TEST(test_periodic_schedule_over_months);
+  RUN_TEST(test_uptime_ms_wraps_as_uint32);
+  RUN_TEST(test_motor_catch_up_without_drift);
+  RUN_TEST(test_motor_arrives_on_target_after_long_run);
+  RUN_TEST(test_motor_stop_lead_only_on_last_step);
+  return UNITY_END();
+}
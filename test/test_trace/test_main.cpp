@@ -0,0 +1,179 @@
+// Кільце трасування і експорт у Chrome Trace: форма JSON, розгортання
+// 32-бітного ccount через мітки TRACE_SYNC і часткові буфери chunked-відповіді.
+//
+//   pio test -e native
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "trace.h"
+
+static const uint32_t CPU_MHZ = 240;
+static const uint32_t SYNC_CYCLES = TRACE_SYNC_INTERVAL * 1000 * CPU_MHZ;
+
+static TraceEvent ring[TRACE_CAPACITY];
+static volatile uint32_t head;
+static char output[TRACE_CAPACITY * 160 + 256];
+
+void setUp() {
+  memset(ring, 0, sizeof(ring));
+  head = 0;
+}
+void tearDown() {}
+
+static size_t exportAll(size_t chunk) {
+  TraceExport ex;
+  traceExportBegin(ex, ring, head, CPU_MHZ);
+  size_t length = 0;
+  size_t n;
+  while ((n = traceFill(ex, (uint8_t*)output + length, chunk)) > 0) {
+    length += n;
+    TEST_ASSERT_TRUE(length < sizeof(output));
+  }
+  output[length] = 0;
+  return length;
+}
+
+struct Line {
+  char name[24];
+  char phase;
+  double ts;
+  unsigned tid;
+  unsigned core;
+  unsigned arg;
+};
+
+// Рядки подій після метаданих процесу, по одному на подію
+static int parseEvents(Line *lines, int max) {
+  int count = 0;
+  const char *p = strstr(output, "\"ph\":\"M\"");
+  while (p && (p = strstr(p, ",\n{\"name\":\"")) != nullptr && count < max) {
+    Line &l = lines[count];
+    int fields = sscanf(p, ",\n{\"name\":\"%23[^\"]\",\"cat\":\"%*[^\"]\",\"ph\":\"%c\",\"ts\":%lf,\"pid\":1,\"tid\":%u,",
+                        l.name, &l.phase, &l.ts, &l.tid);
+    TEST_ASSERT_EQUAL(4, fields);
+    const char *args = strstr(p, "\"args\":{");
+    TEST_ASSERT_NOT_NULL(args);
+    TEST_ASSERT_EQUAL(2, sscanf(args, "\"args\":{\"core\":%u,\"arg\":%u}}", &l.core, &l.arg));
+    count++;
+    p++;
+  }
+  return count;
+}
+
+void test_empty_export_is_valid_json() {
+  size_t length = exportAll(4096);
+  TEST_ASSERT_EQUAL_STRING(
+    "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"stanok\"}}"
+    "\n]}\n", output);
+  TEST_ASSERT_EQUAL(strlen(output), length);
+}
+
+void test_events_shape_and_sync_hidden() {
+  traceStore(ring, head, 1000, 0x3ffb0000, TRACE_SYNC, 'i', 0, 0);
+  traceStore(ring, head, 1000 + 240, 0x3ffb0000, TRACE_DRAW_MENU, 'B', 1, 4);
+  traceStore(ring, head, 1000 + 2400, 0x3ffb0000, TRACE_DRAW_MENU, 'E', 1, 4);
+  traceStore(ring, head, 1000 + 4800, 0x3ffc1000, TRACE_WS_EVENT, 'B', 0, 3);
+  exportAll(4096);
+
+  Line lines[8];
+  TEST_ASSERT_EQUAL(3, parseEvents(lines, 8));
+  TEST_ASSERT_EQUAL_STRING("drawMenu", lines[0].name);
+  TEST_ASSERT_EQUAL('B', lines[0].phase);
+  TEST_ASSERT_TRUE(lines[0].ts == 1.0);
+  TEST_ASSERT_EQUAL('E', lines[1].phase);
+  TEST_ASSERT_TRUE(lines[1].ts == 10.0);
+  TEST_ASSERT_EQUAL_STRING("onWsEvent", lines[2].name);
+  TEST_ASSERT_EQUAL_UINT32(0x3ffc1000, lines[2].tid);
+  TEST_ASSERT_EQUAL(4, lines[0].arg);
+  TEST_ASSERT_EQUAL(1, lines[0].core);
+  TEST_ASSERT_NULL(strstr(output, "\"sync\""));
+
+  size_t length = strlen(output);
+  TEST_ASSERT_EQUAL_STRING("\n]}\n", output + length - 4);
+  TEST_ASSERT_EQUAL(0, strncmp(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 40));
+}
+
+// 240 МГц: ccount обертається кожні ~17.9 с. Мітки раз на TRACE_SYNC_INTERVAL
+// тримають різницю сусідніх подій далеко від 2^31, тож час росте монотонно
+void test_ccount_unwrap_across_wraps() {
+  uint32_t cycles = 0xffffffffu - 5 * SYNC_CYCLES;
+  int64_t expected[8];
+  int n = 0;
+  int64_t elapsed = 0;
+  traceStore(ring, head, cycles, 1, TRACE_SYNC, 'i', 0, 0);
+  for (int second = 1; second <= 40; second++) {
+    cycles += SYNC_CYCLES;
+    elapsed += SYNC_CYCLES;
+    traceStore(ring, head, cycles, 1, TRACE_SYNC, 'i', 0, 0);
+    if (second % 6 == 0) {
+      traceStore(ring, head, cycles + 2400, 1, TRACE_START_MOTOR, 'B', 0, 0);
+      expected[n++] = elapsed + 2400;
+    }
+  }
+  exportAll(4096);
+
+  Line lines[8];
+  TEST_ASSERT_EQUAL(n, parseEvents(lines, 8));
+  for (int i = 0; i < n; i++) {
+    TEST_ASSERT_TRUE(lines[i].ts == (double)expected[i] / CPU_MHZ);
+    if (i > 0) TEST_ASSERT_TRUE(lines[i].ts > lines[i - 1].ts);
+  }
+  // 36 с пройшло через два обороти лічильника
+  TEST_ASSERT_TRUE(lines[n - 1].ts > 2.0 * 4294967296.0 / CPU_MHZ);
+}
+
+// Без міток довша за 2^31 тактів пауза розгортається неправильно —
+// саме тому traceTick() пише TRACE_SYNC раз на секунду
+void test_gap_without_sync_is_misread() {
+  traceStore(ring, head, 0, 1, TRACE_STOP_MOTOR, 'B', 0, 0);
+  traceStore(ring, head, 0x90000000u, 1, TRACE_STOP_MOTOR, 'E', 0, 0);
+  exportAll(4096);
+  Line lines[2];
+  TEST_ASSERT_EQUAL(2, parseEvents(lines, 2));
+  TEST_ASSERT_TRUE(lines[1].ts < 0);
+}
+
+// Переповнене кільце віддає лише останні TRACE_CAPACITY подій
+void test_ring_keeps_latest_events() {
+  for (uint32_t i = 0; i < TRACE_CAPACITY + 100; i++) {
+    traceStore(ring, head, i * 240, 7, TRACE_SAVE_POSITIONS, 'i', 0, (uint8_t)i);
+  }
+  exportAll(4096);
+  static Line lines[TRACE_CAPACITY + 1];
+  TEST_ASSERT_EQUAL(TRACE_CAPACITY, parseEvents(lines, TRACE_CAPACITY + 1));
+  TEST_ASSERT_EQUAL(100, lines[0].arg);
+  TEST_ASSERT_TRUE(lines[0].ts == 0.0);
+  TEST_ASSERT_TRUE(lines[TRACE_CAPACITY - 1].ts == (double)(TRACE_CAPACITY - 1));
+  TEST_ASSERT_NOT_NULL(strstr(output, "\"ph\":\"i\",\"ts\":0.000,\"pid\":1,\"tid\":7,\"s\":\"t\","));
+}
+
+// Дрібні буфери chunked-відповіді дають ті самі байти, що й один великий
+void test_small_chunks_match() {
+  for (int i = 0; i < 40; i++) {
+    traceStore(ring, head, i * 1000, 1 + i % 3, (uint8_t)(i % TRACE_SYNC), i % 2 ? 'E' : 'B', i % 2, i);
+  }
+  size_t length = exportAll(4096);
+  char whole[sizeof(output)];
+  memcpy(whole, output, length + 1);
+
+  const size_t chunks[] = {1, 7, 64, 159, 160, 161};
+  for (size_t chunk : chunks) {
+    TEST_ASSERT_EQUAL(length, exportAll(chunk));
+    TEST_ASSERT_EQUAL_STRING(whole, output);
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_export_is_valid_json);
+  RUN_TEST(test_events_shape_and_sync_hidden);
+  RUN_TEST(test_ccount_unwrap_across_wraps);
+  RUN_TEST(test_gap_without_sync_is_misread);
+  RUN_TEST(test_ring_keeps_latest_events);
+  RUN_TEST(test_small_chunks_match);
+  return UNITY_END();
+}